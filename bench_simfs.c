@@ -0,0 +1,654 @@
+#include "simfs.h"
+#include "simfs_crc.h"
+#include "simfs_io.h"
+#include "simfs_lz.h"
+
+#include <unistd.h>
+
+#define SIMFS_BENCH_FILE_NAME "simfsBench.dta"
+
+//////////////////////////////////////////////////////////////////////////
+//
+// helpers
+//
+//////////////////////////////////////////////////////////////////////////
+
+double elapsedSeconds(struct timespec *start)
+{
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/***
+ * Generates content that looks like an application log: mostly repeated structure with a few varying fields.
+ */
+char *generateLogContent(int size)
+{
+    static char *levels[] = {"INFO", "INFO", "INFO", "WARN", "DEBUG"};
+    static char *paths[] = {"/api/v1/items", "/api/v1/users", "/healthz", "/api/v1/orders"};
+
+    char *content = malloc(size + 1);
+    int length = 0;
+    for (int line = 0; length < size; ++line) {
+        char buffer[160];
+        int n = snprintf(buffer, sizeof(buffer),
+                "2026-10-18 12:%02d:%02d %s request id=%d path=%s status=%d duration=%dms\n",
+                (line / 60) % 60, line % 60, levels[rand() % 5], 100000 + line, paths[rand() % 4],
+                rand() % 8 == 0 ? 404 : 200, rand() % 250);
+        if (n > size - length)
+            n = size - length;
+        memcpy(content + length, buffer, n);
+        length += n;
+    }
+    content[size] = '\0';
+    return content;
+}
+
+SIMFS_VOLUME *loadVolume(char *simfsFileName)
+{
+    SIMFS_VOLUME *volume = malloc(sizeof(SIMFS_VOLUME));
+    FILE *file = fopen(simfsFileName, "rb");
+    if (volume == NULL || file == NULL || fread(volume, 1, sizeof(SIMFS_VOLUME), file) != sizeof(SIMFS_VOLUME))
+        exit(EXIT_FAILURE);
+    fclose(file);
+    return volume;
+}
+
+int countUsedBlocks(char *simfsFileName)
+{
+    SIMFS_VOLUME *volume = loadVolume(simfsFileName);
+    int used = 0;
+    for (int i = 0; i < SIMFS_NUMBER_OF_BLOCKS / 8; ++i)
+        used += __builtin_popcount(volume->bitvector[i]);
+    free(volume);
+    return used;
+}
+
+/***
+ * Follows every file in the root folder (which must not hold more than SIMFS_BTREE_THRESHOLD entries) in the
+ * order it is read: the descriptor, then each index block followed by its data blocks. Returns the average number
+ * of blocks read before jumping to a block that is not the next one on the volume.
+ */
+double averageRunLength(char *simfsFileName)
+{
+    SIMFS_VOLUME *volume = loadVolume(simfsFileName);
+    SIMFS_FILE_DESCRIPTOR_TYPE *root =
+        &(volume->block[volume->superblock.attr.rootNodeIndex].content.fileDescriptor);
+    int blocks = 0, runs = 0;
+
+    SIMFS_INDEX_TYPE entries = root->block_ref;
+    for (size_t i = 0; i < root->size; ++i) {
+        if (i > 0 && i % (SIMFS_INDEX_SIZE - 1) == 0)
+            entries = volume->block[entries].content.index[SIMFS_INDEX_SIZE - 1];
+        SIMFS_INDEX_TYPE previous = volume->block[entries].content.index[i % (SIMFS_INDEX_SIZE - 1)];
+        SIMFS_FILE_DESCRIPTOR_TYPE *fd = &(volume->block[previous].content.fileDescriptor);
+        blocks++;
+        runs++;
+
+        size_t dataBlocks = (fd->storedSize + SIMFS_DATA_SIZE - 1) / SIMFS_DATA_SIZE;
+        SIMFS_INDEX_TYPE index = fd->block_ref;
+        for (size_t k = 0; k < dataBlocks; ++k) {
+            int slot = k % (SIMFS_INDEX_SIZE - 1);
+            if (k > 0 && slot == 0)
+                index = volume->block[index].content.index[SIMFS_INDEX_SIZE - 1];
+            SIMFS_INDEX_TYPE next[2] = {index, volume->block[index].content.index[slot]};
+            for (int j = (slot == 0 ? 0 : 1); j < 2; ++j) {
+                blocks++;
+                if (next[j] != previous + 1)
+                    runs++;
+                previous = next[j];
+            }
+        }
+    }
+    free(volume);
+    return runs > 0 ? (double) blocks / runs : 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// benchmarks
+//
+//////////////////////////////////////////////////////////////////////////
+
+/***
+ * Raw codec throughput and ratio on one kind of content.
+ */
+void benchCodec(char *label, char *content, int size)
+{
+    char *compressed = malloc(simfsLzCompressBound(size));
+    char *decompressed = malloc(size);
+    int rounds = (64 << 20) / size + 1;
+
+    struct timespec start;
+    size_t compressedSize = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < rounds; ++i)
+        compressedSize = simfsLzCompress(content, size, compressed, simfsLzCompressBound(size));
+    double compressSeconds = elapsedSeconds(&start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < rounds; ++i)
+        simfsLzDecompress(compressed, compressedSize, decompressed, size);
+    double decompressSeconds = elapsedSeconds(&start);
+
+    if (memcmp(content, decompressed, size) != 0) {
+        printf("%s: round trip mismatch\n", label);
+        exit(EXIT_FAILURE);
+    }
+
+    double megabytes = (double) size * rounds / (1 << 20);
+    printf("  %-10s %8d -> %8zu bytes  ratio %5.2f  compress %8.1f MB/s  decompress %8.1f MB/s\n",
+           label, size, compressedSize, (double) size / compressedSize,
+           megabytes / compressSeconds, megabytes / decompressSeconds);
+
+    free(compressed);
+    free(decompressed);
+}
+
+/***
+ * Writes files that share the given content, each followed by a unique trailer, through the file system and
+ * reports blocks used and write/read throughput.
+ */
+void benchFiles(char *label, char *content, int numberOfFiles, int compressed, unsigned int options)
+{
+    SIMFS_INSTANCE instance;
+    char name[SIMFS_MAX_NAME_LENGTH];
+    SIMFS_FILE_HANDLE_TYPE handle;
+    char *readBack;
+    size_t length = strlen(content);
+    char *fileContent = malloc(length + 32);
+    size_t totalLength = 0;
+
+    simfsCreateFileSystem(SIMFS_BENCH_FILE_NAME);
+    simfsMountFileSystemWithOptions(&instance, SIMFS_BENCH_FILE_NAME, options);
+
+    struct timespec start;
+    int written = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < numberOfFiles; ++i) {
+        snprintf(name, sizeof(name), "file%d.log", i);
+        sprintf(fileContent, "%s# file %d\n", content, i);
+        simfsCreateFile(&instance, name, SIMFS_FILE_CONTENT_TYPE);
+        if (compressed)
+            simfsSetFileCompression(&instance, name, 1);
+        simfsOpenFile(&instance, name, &handle);
+        if (simfsWriteFile(&instance, handle, fileContent) == SIMFS_NO_ERROR) {
+            written++;
+            totalLength += strlen(fileContent);
+        }
+        simfsCloseFile(&instance, handle);
+    }
+    double writeSeconds = elapsedSeconds(&start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < written; ++i) {
+        snprintf(name, sizeof(name), "file%d.log", i);
+        sprintf(fileContent, "%s# file %d\n", content, i);
+        simfsOpenFile(&instance, name, &handle);
+        simfsReadFile(&instance, handle, &readBack);
+        if (strcmp(readBack, fileContent) != 0) {
+            printf("%s: read back mismatch\n", label);
+            exit(EXIT_FAILURE);
+        }
+        free(readBack);
+        simfsCloseFile(&instance, handle);
+    }
+    double readSeconds = elapsedSeconds(&start);
+
+    simfsUmountFileSystem(&instance, SIMFS_BENCH_FILE_NAME);
+    free(fileContent);
+
+    double megabytes = (double) totalLength / (1 << 20);
+    printf("  %-10s %-12s %-6s %3d/%3d files fit  %5d blocks used  write %7.2f MB/s  read %7.2f MB/s\n",
+           label, compressed ? "compressed" : "plain", options & SIMFS_MOUNT_DEDUP ? "dedup" : "", written,
+           numberOfFiles, countUsedBlocks(SIMFS_BENCH_FILE_NAME), megabytes / writeSeconds, megabytes / readSeconds);
+}
+
+/***
+ * Fills the root folder with empty files and reports how fast names are looked up in it after remounting.
+ */
+void benchFolder(int numberOfFiles)
+{
+    SIMFS_INSTANCE instance;
+    char name[SIMFS_MAX_NAME_LENGTH];
+    SIMFS_FILE_DESCRIPTOR_TYPE info;
+
+    simfsCreateFileSystem(SIMFS_BENCH_FILE_NAME);
+    simfsMountFileSystem(&instance, SIMFS_BENCH_FILE_NAME);
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < numberOfFiles; ++i) {
+        snprintf(name, sizeof(name), "entry%d", i);
+        simfsCreateFile(&instance, name, SIMFS_FILE_CONTENT_TYPE);
+    }
+    double createSeconds = elapsedSeconds(&start);
+    simfsUmountFileSystem(&instance, SIMFS_BENCH_FILE_NAME);
+
+    simfsMountFileSystem(&instance, SIMFS_BENCH_FILE_NAME);
+    int rounds = 100000 / numberOfFiles;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int round = 0; round < rounds; ++round)
+        for (int i = 0; i < numberOfFiles; ++i) {
+            snprintf(name, sizeof(name), "entry%d", i);
+            if (simfsGetFileInfo(&instance, name, &info) != SIMFS_NO_ERROR) {
+                printf("%s: lookup failed\n", name);
+                exit(EXIT_FAILURE);
+            }
+        }
+    double lookupSeconds = elapsedSeconds(&start);
+    simfsUmountFileSystem(&instance, SIMFS_BENCH_FILE_NAME);
+
+    printf("  %5d entries  create %9.0f files/s  lookup %9.0f names/s\n", numberOfFiles,
+           numberOfFiles / createSeconds, rounds * numberOfFiles / lookupSeconds);
+}
+
+/***
+ * Rewrites files of varying sizes in random order, as an aging volume would see, and reports how contiguously
+ * the files can be read back afterwards.
+ */
+void benchLocality(int numberOfFiles, int rounds)
+{
+    SIMFS_INSTANCE instance;
+    char name[SIMFS_MAX_NAME_LENGTH];
+    SIMFS_FILE_HANDLE_TYPE handle;
+
+    simfsCreateFileSystem(SIMFS_BENCH_FILE_NAME);
+    simfsMountFileSystem(&instance, SIMFS_BENCH_FILE_NAME);
+    for (int i = 0; i < numberOfFiles; ++i) {
+        snprintf(name, sizeof(name), "aged%d", i);
+        simfsCreateFile(&instance, name, SIMFS_FILE_CONTENT_TYPE);
+    }
+    for (int round = 0; round < rounds * numberOfFiles; ++round) {
+        snprintf(name, sizeof(name), "aged%d", rand() % numberOfFiles);
+        char *content = simfsGenerateContent(200 + rand() % 1800);
+        simfsOpenFile(&instance, name, &handle);
+        simfsWriteFile(&instance, handle, content);
+        simfsCloseFile(&instance, handle);
+        free(content);
+    }
+    simfsUmountFileSystem(&instance, SIMFS_BENCH_FILE_NAME);
+
+    simfsMountFileSystem(&instance, SIMFS_BENCH_FILE_NAME);
+    char *readBack;
+    size_t totalLength = 0;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int round = 0; round < 200; ++round)
+        for (int i = 0; i < numberOfFiles; ++i) {
+            snprintf(name, sizeof(name), "aged%d", i);
+            simfsOpenFile(&instance, name, &handle);
+            simfsReadFile(&instance, handle, &readBack);
+            totalLength += strlen(readBack);
+            free(readBack);
+            simfsCloseFile(&instance, handle);
+        }
+    double readSeconds = elapsedSeconds(&start);
+    simfsUmountFileSystem(&instance, SIMFS_BENCH_FILE_NAME);
+
+    printf("  %d files, %d rewrites  %6.1f blocks read per contiguous run  read %7.2f MB/s\n", numberOfFiles,
+           rounds * numberOfFiles, averageRunLength(SIMFS_BENCH_FILE_NAME), totalLength / readSeconds / (1 << 20));
+}
+
+/***
+ * Fills the root folder with small files and reports how fast all of them are fetched, one by one through
+ * simfsOpenFile(), simfsReadFile() and simfsCloseFile(), and in batches through simfsReadMany().
+ */
+void benchReadMany(int numberOfFiles, int batchSize)
+{
+    SIMFS_INSTANCE instance;
+    char names[numberOfFiles][SIMFS_MAX_NAME_LENGTH];
+    char *nameList[numberOfFiles];
+    SIMFS_FILE_HANDLE_TYPE handle;
+
+    simfsCreateFileSystem(SIMFS_BENCH_FILE_NAME);
+    simfsMountFileSystem(&instance, SIMFS_BENCH_FILE_NAME);
+    for (int i = 0; i < numberOfFiles; ++i) {
+        snprintf(names[i], SIMFS_MAX_NAME_LENGTH, "small%d", i);
+        nameList[i] = names[i];
+        char *content = simfsGenerateContent(20 + rand() % 100);
+        simfsCreateFile(&instance, names[i], SIMFS_FILE_CONTENT_TYPE);
+        simfsOpenFile(&instance, names[i], &handle);
+        simfsWriteFile(&instance, handle, content);
+        simfsCloseFile(&instance, handle);
+        free(content);
+    }
+
+    int rounds = 200000 / numberOfFiles;
+    char *readBack;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int round = 0; round < rounds; ++round)
+        for (int i = 0; i < numberOfFiles; ++i) {
+            simfsOpenFile(&instance, names[i], &handle);
+            simfsReadFile(&instance, handle, &readBack);
+            free(readBack);
+            simfsCloseFile(&instance, handle);
+        }
+    double singleSeconds = elapsedSeconds(&start);
+
+    char *buffers = malloc((size_t) batchSize * 128);
+    struct iovec vectors[batchSize];
+    SIMFS_ERROR results[batchSize];
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int round = 0; round < rounds; ++round)
+        for (int i = 0; i < numberOfFiles; i += batchSize) {
+            int n = numberOfFiles - i < batchSize ? numberOfFiles - i : batchSize;
+            for (int k = 0; k < n; ++k) {
+                vectors[k].iov_base = buffers + k * 128;
+                vectors[k].iov_len = 128;
+            }
+            if (simfsReadMany(&instance, n, nameList + i, vectors, results) != SIMFS_NO_ERROR) {
+                printf("batch read failed\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+    double batchSeconds = elapsedSeconds(&start);
+    simfsUmountFileSystem(&instance, SIMFS_BENCH_FILE_NAME);
+    free(buffers);
+
+    printf("  %5d files  one by one %9.0f files/s  in batches of %d %9.0f files/s\n", numberOfFiles,
+           rounds * numberOfFiles / singleSeconds, batchSize, rounds * numberOfFiles / batchSeconds);
+}
+
+/***
+ * Patches a few bytes at random places in a file, once by rewriting the whole content and once in place, and
+ * then punches holes into half of the file to see how many blocks go back to the volume.
+ */
+void benchUpdates(int size, int numberOfPatches)
+{
+    SIMFS_INSTANCE instance;
+    SIMFS_FILE_HANDLE_TYPE handle;
+    SIMFS_FREE_SPACE_INFO_TYPE before, after;
+    char *content = simfsGenerateContent(size);
+
+    simfsCreateFileSystem(SIMFS_BENCH_FILE_NAME);
+    simfsMountFileSystem(&instance, SIMFS_BENCH_FILE_NAME);
+    simfsCreateFile(&instance, "patched", SIMFS_FILE_CONTENT_TYPE);
+    simfsOpenFile(&instance, "patched", &handle);
+    simfsWriteFile(&instance, handle, content);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < numberOfPatches; ++i) {
+        content[rand() % size] = 'a' + rand() % 26;
+        simfsWriteFile(&instance, handle, content);
+    }
+    double rewriteSeconds = elapsedSeconds(&start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < numberOfPatches; ++i) {
+        char patch = 'a' + rand() % 26;
+        simfsWriteFileAt(&instance, handle, rand() % size, &patch, 1);
+    }
+    double patchSeconds = elapsedSeconds(&start);
+
+    simfsGetFreeSpace(&instance, &before);
+    for (int offset = 0; offset < size; offset += 2 * 1024)
+        simfsPunchHole(&instance, handle, offset, 1024);
+    simfsGetFreeSpace(&instance, &after);
+    simfsCloseFile(&instance, handle);
+    simfsUmountFileSystem(&instance, SIMFS_BENCH_FILE_NAME);
+    free(content);
+
+    printf("  %d bytes  rewrite %9.0f patches/s  in place %9.0f patches/s  holes freed %u blocks\n", size,
+           numberOfPatches / rewriteSeconds, numberOfPatches / patchSeconds, after.freeBlocks - before.freeBlocks);
+}
+
+typedef struct bench_volume_type {
+    SIMFS_INSTANCE instance;
+    char fileName[32];
+    char *content;
+    int numberOfOperations;
+    pthread_barrier_t *ready;
+} BENCH_VOLUME_TYPE;
+
+/*****
+ * Creates, writes, reads, and deletes files on one volume until the given number of operations is done.
+ */
+void *benchVolume(void *argument)
+{
+    BENCH_VOLUME_TYPE *volume = argument;
+    char name[SIMFS_MAX_NAME_LENGTH];
+    SIMFS_FILE_HANDLE_TYPE handle;
+    char *readBack;
+
+    pthread_barrier_wait(volume->ready);
+    for (int i = 0; i < volume->numberOfOperations; i += 5) {
+        snprintf(name, sizeof(name), "file%d", i % 64);
+        simfsCreateFile(&volume->instance, name, SIMFS_FILE_CONTENT_TYPE);
+        simfsOpenFile(&volume->instance, name, &handle);
+        simfsWriteFile(&volume->instance, handle, volume->content);
+        simfsReadFile(&volume->instance, handle, &readBack);
+        free(readBack);
+        simfsCloseFile(&volume->instance, handle);
+        simfsDeleteFile(&volume->instance, name);
+    }
+    return NULL;
+}
+
+/***
+ * Runs the same workload on each of a number of volumes mounted side by side, one thread per volume, and reports
+ * the aggregate throughput. The volumes share no state, so it should grow with the number of volumes up to the
+ * number of processors.
+ */
+void benchInstances(int numberOfVolumes, int numberOfOperations)
+{
+    BENCH_VOLUME_TYPE volumes[numberOfVolumes];
+    pthread_t threads[numberOfVolumes];
+    pthread_barrier_t ready;
+    char *content = simfsGenerateContent(SIMFS_DATA_SIZE * 4);
+
+    pthread_barrier_init(&ready, NULL, numberOfVolumes + 1);
+    for (int i = 0; i < numberOfVolumes; ++i) {
+        snprintf(volumes[i].fileName, sizeof(volumes[i].fileName), "simfsBench%d.dta", i);
+        simfsCreateFileSystem(volumes[i].fileName);
+        simfsMountFileSystem(&volumes[i].instance, volumes[i].fileName);
+        volumes[i].content = content;
+        volumes[i].numberOfOperations = numberOfOperations;
+        volumes[i].ready = &ready;
+        pthread_create(&threads[i], NULL, benchVolume, &volumes[i]);
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pthread_barrier_wait(&ready);
+    for (int i = 0; i < numberOfVolumes; ++i)
+        pthread_join(threads[i], NULL);
+    double seconds = elapsedSeconds(&start);
+
+    for (int i = 0; i < numberOfVolumes; ++i) {
+        simfsUmountFileSystem(&volumes[i].instance, volumes[i].fileName);
+        remove(volumes[i].fileName);
+    }
+    pthread_barrier_destroy(&ready);
+    free(content);
+
+    printf("  %2d volumes  %9.0f operations/s  %9.0f per volume\n", numberOfVolumes,
+           numberOfVolumes * numberOfOperations / seconds, numberOfOperations / seconds);
+}
+
+/***
+ * Checksum throughput over all blocks of a volume, one block at a time and three at a time, next to the speed of
+ * copying them; then the time to mount a volume holding the given number of files with checksums, and to verify
+ * all of its blocks at once.
+ */
+void benchChecksums(int numberOfFiles)
+{
+    size_t size = sizeof(SIMFS_BLOCK_TYPE) * SIMFS_NUMBER_OF_BLOCKS;
+    char *blocks = simfsGenerateContent(size);
+    char *copy = malloc(size);
+    const void **buffers = malloc(SIMFS_NUMBER_OF_BLOCKS * sizeof(void *));
+    unsigned int *crcs = malloc(SIMFS_NUMBER_OF_BLOCKS * sizeof(unsigned int));
+    for (int i = 0; i < SIMFS_NUMBER_OF_BLOCKS; ++i)
+        buffers[i] = blocks + i * sizeof(SIMFS_BLOCK_TYPE);
+    int rounds = (256 << 20) / size + 1;
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int r = 0; r < rounds; ++r)
+        for (int i = 0; i < SIMFS_NUMBER_OF_BLOCKS; ++i)
+            crcs[i] = simfsCrc32c(0, buffers[i], sizeof(SIMFS_BLOCK_TYPE));
+    double singleSeconds = elapsedSeconds(&start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int r = 0; r < rounds; ++r)
+        simfsCrc32cMany(buffers, sizeof(SIMFS_BLOCK_TYPE), SIMFS_NUMBER_OF_BLOCKS, crcs);
+    double manySeconds = elapsedSeconds(&start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int r = 0; r < rounds; ++r) {
+        blocks[r % size]++;
+        memcpy(copy, blocks, size);
+    }
+    double copySeconds = elapsedSeconds(&start);
+
+    double megabytes = (double) size * rounds / (1 << 20);
+    printf("  %d-byte blocks  one at a time %8.1f MB/s  three at a time %8.1f MB/s  copy %8.1f MB/s\n",
+           (int) sizeof(SIMFS_BLOCK_TYPE), megabytes / singleSeconds, megabytes / manySeconds, megabytes / copySeconds);
+    free(blocks);
+    free(copy);
+    free(buffers);
+    free(crcs);
+
+    SIMFS_INSTANCE instance;
+    SIMFS_FILE_HANDLE_TYPE handle;
+    char name[SIMFS_MAX_NAME_LENGTH];
+    char *content = simfsGenerateContent(SIMFS_DATA_SIZE * 40);
+    simfsCreateFileSystem(SIMFS_BENCH_FILE_NAME);
+    simfsMountFileSystemWithOptions(&instance, SIMFS_BENCH_FILE_NAME, SIMFS_MOUNT_CHECKSUMS);
+    for (int i = 0; i < numberOfFiles; ++i) {
+        snprintf(name, sizeof(name), "file%d", i);
+        simfsCreateFile(&instance, name, SIMFS_FILE_CONTENT_TYPE);
+        simfsOpenFile(&instance, name, &handle);
+        simfsWriteFile(&instance, handle, content);
+        simfsCloseFile(&instance, handle);
+    }
+    simfsUmountFileSystem(&instance, SIMFS_BENCH_FILE_NAME);
+    int usedBlocks = countUsedBlocks(SIMFS_BENCH_FILE_NAME);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    simfsMountFileSystem(&instance, SIMFS_BENCH_FILE_NAME);
+    double plainMountSeconds = elapsedSeconds(&start);
+    simfsUmountFileSystem(&instance, SIMFS_BENCH_FILE_NAME);
+
+    // the plain mount dropped the checksums, so they are written once more
+    simfsMountFileSystemWithOptions(&instance, SIMFS_BENCH_FILE_NAME, SIMFS_MOUNT_CHECKSUMS);
+    simfsUmountFileSystem(&instance, SIMFS_BENCH_FILE_NAME);
+
+    int badBlocks = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    simfsMountFileSystemWithOptions(&instance, SIMFS_BENCH_FILE_NAME, SIMFS_MOUNT_CHECKSUMS);
+    double mountSeconds = elapsedSeconds(&start);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    simfsVerifyVolume(&instance, &badBlocks);
+    double verifySeconds = elapsedSeconds(&start);
+    simfsUmountFileSystem(&instance, SIMFS_BENCH_FILE_NAME);
+    free(content);
+
+    printf("  %d blocks used  mount %6.2f ms  with checksums %6.2f ms  verify the rest %6.2f ms  %d bad\n",
+           usedBlocks, plainMountSeconds * 1e3, mountSeconds * 1e3, verifySeconds * 1e3, badBlocks);
+}
+
+/***
+ * Image I/O with one combination of SIMFS_MOUNT_IO_URING and SIMFS_MOUNT_DIRECT_IO: the bandwidth of writing and
+ * reading back a scratch image of the given size, then the time to mount and unmount the benchmark volume. Reads
+ * without O_DIRECT come from the page cache.
+ */
+void benchImageIo(char *label, unsigned int options, size_t size)
+{
+    unsigned int flags = ((options & SIMFS_MOUNT_IO_URING) ? SIMFS_IO_URING : 0) |
+                         ((options & SIMFS_MOUNT_DIRECT_IO) ? SIMFS_IO_DIRECT : 0);
+    char *buffer = simfsIoAllocate(size);
+    memset(buffer, 'x', size);
+
+    SIMFS_IO_FILE_TYPE file;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (simfsIoOpen(&file, SIMFS_BENCH_FILE_NAME, 1, flags) != 0 || simfsIoWrite(&file, buffer, size, 0) != 0 ||
+        simfsIoFlush(&file) != 0)
+        exit(EXIT_FAILURE);
+    unsigned int effective = file.flags;
+    simfsIoClose(&file);
+    double writeSeconds = elapsedSeconds(&start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (simfsIoOpen(&file, SIMFS_BENCH_FILE_NAME, 0, flags) != 0 || simfsIoRead(&file, buffer, size, 0) != 0)
+        exit(EXIT_FAILURE);
+    simfsIoClose(&file);
+    double readSeconds = elapsedSeconds(&start);
+    free(buffer);
+
+    SIMFS_INSTANCE instance;
+    simfsCreateFileSystem(SIMFS_BENCH_FILE_NAME);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int r = 0; r < 16; ++r) {
+        simfsMountFileSystemWithOptions(&instance, SIMFS_BENCH_FILE_NAME, options);
+        simfsUmountFileSystem(&instance, SIMFS_BENCH_FILE_NAME);
+    }
+    double mountSeconds = elapsedSeconds(&start) / 16;
+
+    double megabytes = (double) size / (1 << 20);
+    printf("  %-16s write %8.1f MB/s  read %8.1f MB/s  mount and unmount %6.2f ms%s\n", label,
+           megabytes / writeSeconds, megabytes / readSeconds, mountSeconds * 1e3,
+           effective == flags ? "" : "  (fell back)");
+}
+
+int main()
+{
+    srand(1997);
+
+    int size = 64 * 1024;
+    char *logs = generateLogContent(size);
+    char *random = simfsGenerateContent(size + 1);
+
+    printf("Codec\n");
+    benchCodec("logs", logs, size);
+    benchCodec("random", random, size);
+
+    // a file of a few kilobytes uses a noticeable share of the small simulated volume; the shared part is a
+    // whole number of data blocks, so that deduplication can share all of it
+    int fileSize = SIMFS_DATA_SIZE * 140;
+    logs[fileSize] = '\0';
+    random[fileSize] = '\0';
+
+    printf("File system\n");
+    benchFiles("logs", logs, 32, 0, 0);
+    benchFiles("logs", logs, 32, 1, 0);
+    benchFiles("random", random, 32, 0, 0);
+    benchFiles("random", random, 32, 1, 0);
+    benchFiles("templates", random, 32, 0, SIMFS_MOUNT_DEDUP);
+    benchFiles("templates", random, 32, 1, SIMFS_MOUNT_DEDUP);
+
+    printf("Folders\n");
+    benchFolder(SIMFS_BTREE_THRESHOLD);
+    benchFolder(256);
+    benchFolder(2048);
+
+    printf("Small files\n");
+    benchReadMany(SIMFS_BTREE_THRESHOLD, SIMFS_BTREE_THRESHOLD);
+    benchReadMany(256, 128);
+
+    printf("Locality\n");
+    benchLocality(SIMFS_BTREE_THRESHOLD, 8);
+
+    printf("Updates\n");
+    benchUpdates(16 * 1024, 2000);
+
+    printf("Instances (%ld processors)\n", sysconf(_SC_NPROCESSORS_ONLN));
+    for (int volumes = 1; volumes <= 8; volumes *= 2)
+        benchInstances(volumes, 100000);
+
+    printf("Checksums (%s)\n", simfsCrc32cHardware() ? "crc32 instruction" : "table");
+    benchChecksums(64);
+
+    printf("Image I/O\n");
+    benchImageIo("pread", 0, 256 << 20);
+    benchImageIo("io_uring", SIMFS_MOUNT_IO_URING, 256 << 20);
+    benchImageIo("O_DIRECT", SIMFS_MOUNT_DIRECT_IO, 256 << 20);
+    benchImageIo("io_uring+direct", SIMFS_MOUNT_IO_URING | SIMFS_MOUNT_DIRECT_IO, 256 << 20);
+
+    free(logs);
+    free(random);
+    return EXIT_SUCCESS;
+}
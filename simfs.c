@@ -1,42 +1,71 @@
 
 #include "simfs.h"
+#include "simfs_crc.h"
+#include "simfs_io.h"
+#include "simfs_lz.h"
+
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
 
 //The last valid position for a file descriptor in an index block
 #define LAST_POS (SIMFS_INDEX_SIZE-1)
 
-//////////////////////////////////////////////////////////////////////////
-//
-// allocation of the in-memory data structures
-//
-//////////////////////////////////////////////////////////////////////////
-
-SIMFS_CONTEXT_TYPE *simfsContext; // all in-memory information about the system
-SIMFS_VOLUME *simfsVolume;
-
-
 //////////////////////////////////////////////////////////////////////////
 //
 // simfs function implementations
 //
 //////////////////////////////////////////////////////////////////////////
 
-unsigned long long nextUniqueIdentifier() {
-    return simfsVolume->superblock.attr.nextUniqueIdentifier++;
+unsigned long long nextUniqueIdentifier(SIMFS_INSTANCE *instance) {
+    return instance->volume->superblock.attr.nextUniqueIdentifier++;
 }
 
 /*****
- * Retuns a hash value within the limits of the directory.
+ * Returns the key of a name in the B+tree of a large folder (32-bit FNV-1a).
  */
+unsigned int simfsNameKey(SIMFS_NAME_TYPE name)
+{
+    unsigned int key = 2166136261u;
+    for (unsigned char *c = (unsigned char *) name; *c != '\0'; ++c)
+        key = (key ^ *c) * 16777619u;
+    return key;
+}
 
-inline unsigned long hash(SIMFS_NAME_TYPE str)
+/*****
+ * Stores a name in a descriptor of the given volume. A name longer than SIMFS_NAME_PREFIX_SIZE needs a name block
+ * for the rest of it, which the caller has allocated; it is SIMFS_INVALID_INDEX otherwise.
+ */
+void simfsStoreName(SIMFS_VOLUME *volume, SIMFS_FILE_DESCRIPTOR_TYPE *fd, SIMFS_INDEX_TYPE nameBlock,
+        SIMFS_NAME_TYPE name)
 {
-    register unsigned long hash = 5381;
-    register unsigned char c;
+    size_t length = strlen(name);
+    fd->nameKey = simfsNameKey(name);
+    fd->nameLength = length;
+    memset(fd->namePrefix, 0, SIMFS_NAME_PREFIX_SIZE);
+    memcpy(fd->namePrefix, name, length < SIMFS_NAME_PREFIX_SIZE ? length : SIMFS_NAME_PREFIX_SIZE);
 
-    while ((c = *str++) != '\0')
-        hash = ((hash << 5) + hash) ^ c; /* hash * 33 + c */
+    fd->nameBlock = nameBlock;
+    if (nameBlock != SIMFS_INVALID_INDEX) {
+        SIMFS_BLOCK_TYPE *block = &(volume->block[nameBlock]);
+        block->type = SIMFS_NAME_CONTENT_TYPE;
+        memset(block->content.name, 0, sizeof(block->content.name));
+        strcpy(block->content.name, name + SIMFS_NAME_PREFIX_SIZE);
+    }
+}
 
-    return hash % SIMFS_DIRECTORY_SIZE;
+/*****
+ * Puts the name held in a descriptor of the given volume back together.
+ */
+void simfsLoadName(SIMFS_VOLUME *volume, SIMFS_FILE_DESCRIPTOR_TYPE *fd, SIMFS_NAME_TYPE name)
+{
+    if (fd->nameLength <= SIMFS_NAME_PREFIX_SIZE) {
+        memcpy(name, fd->namePrefix, fd->nameLength);
+        name[fd->nameLength] = '\0';
+        return;
+    }
+    memcpy(name, fd->namePrefix, SIMFS_NAME_PREFIX_SIZE);
+    strcpy(name + SIMFS_NAME_PREFIX_SIZE, volume->block[fd->nameBlock].content.name);
 }
 
 /*****
@@ -45,9 +74,12 @@ inline unsigned long hash(SIMFS_NAME_TYPE str)
 inline unsigned short simfsFindFreeBlock(unsigned char *bitvector)
 {
     unsigned short i = 0;
-    while (bitvector[i] == 0xFF)
+    while (i < SIMFS_NUMBER_OF_BLOCKS / 8 && bitvector[i] == 0xFF)
         i += 1;
 
+    if (i == SIMFS_NUMBER_OF_BLOCKS / 8)
+        return SIMFS_INVALID_INDEX; // the volume is full
+
     register unsigned char mask = 0x80;
     unsigned short j = 0;
     while (bitvector[i] & mask)
@@ -89,371 +121,2172 @@ inline void simfsClearBit(unsigned char *bitvector, unsigned short bitIndex)
     bitvector[blockIndex] &= ~(mask >> bitShift);
 }
 
-void setNewFileDescriptorFields(SIMFS_INDEX_TYPE index, SIMFS_CONTENT_TYPE content, SIMFS_NAME_TYPE name, mode_t rights, uid_t user)
+time_t currentTime()
 {
-    SIMFS_FILE_DESCRIPTOR_TYPE * fd =
-        &(simfsVolume->block[index].content.fileDescriptor);
-
-    fd->identifier = nextUniqueIdentifier();
-    fd->type = content;
-    strcpy(fd->name, name);
-    fd->accessRights = rights;
-    fd->owner = user; // arbitrarily simulated
-    fd->size = 0;
-    fd->block_ref = SIMFS_INVALID_INDEX;
-
     struct timespec time;
     clock_gettime(CLOCK_MONOTONIC, &time);
-    fd->creationTime = time.tv_sec;
-    fd->lastAccessTime = time.tv_sec;
-    fd->lastModificationTime = time.tv_sec;
+    return time.tv_sec;
 }
 
-/***
- * Allocates space for the file system and saves it to disk.
+SIMFS_INDEX_TYPE allocateFreeBlock(SIMFS_INSTANCE *instance, SIMFS_CONTENT_TYPE type);
+
+/*****
+ * Allocates the name block that a name needs, if any. Returns SIMFS_INVALID_INDEX in nameBlock for a name that
+ * fits in a descriptor, and SIMFS_ALLOC_ERROR if the volume is full.
  */
-SIMFS_ERROR simfsCreateFileSystem(char *simfsFileName)
+SIMFS_ERROR allocateNameBlock(SIMFS_INSTANCE *instance, SIMFS_NAME_TYPE name, SIMFS_INDEX_TYPE *nameBlock)
 {
-    printf("Creating File System\n");
-    printf("  Size of SIMFS_VOLUME: %ld\n", sizeof(SIMFS_VOLUME));
-    printf("  Size of SIMFS_CONTEXT_TYPE: %ld\n", sizeof(SIMFS_CONTEXT_TYPE));
-
-    FILE *file = fopen(simfsFileName, "wb");
-    if (file == NULL)
-        return SIMFS_ALLOC_ERROR;
+    *nameBlock = SIMFS_INVALID_INDEX;
+    if (strlen(name) <= SIMFS_NAME_PREFIX_SIZE)
+        return SIMFS_NO_ERROR;
+    *nameBlock = allocateFreeBlock(instance, SIMFS_NAME_CONTENT_TYPE);
+    return (*nameBlock == SIMFS_INVALID_INDEX ? SIMFS_ALLOC_ERROR : SIMFS_NO_ERROR);
+}
 
-    simfsVolume = malloc(sizeof(SIMFS_VOLUME));
-    if (simfsVolume == NULL)
-        return SIMFS_ALLOC_ERROR;
+/*****
+ * Tells whether a descriptor holds the given name, whose key and length are known. Only the descriptors whose key
+ * and length match are compared character by character.
+ */
+int descriptorHasName(SIMFS_INSTANCE *instance, SIMFS_FILE_DESCRIPTOR_TYPE *fd, unsigned int key, size_t length,
+        const char *name)
+{
+    if (fd->nameKey != key || fd->nameLength != length)
+        return 0;
+    if (length <= SIMFS_NAME_PREFIX_SIZE)
+        return memcmp(fd->namePrefix, name, length) == 0;
+    return memcmp(fd->namePrefix, name, SIMFS_NAME_PREFIX_SIZE) == 0 &&
+           strcmp(instance->volume->block[fd->nameBlock].content.name, name + SIMFS_NAME_PREFIX_SIZE) == 0;
+}
 
-    // initialize the superblock
-    simfsVolume->superblock.attr.nextUniqueIdentifier = SIMFS_INITIAL_VALUE_OF_THE_UNIQUE_FILE_IDENTIFIER;
-    simfsVolume->superblock.attr.rootNodeIndex = SIMFS_ROOT_NODE_INDEX;
-    simfsVolume->superblock.attr.blockSize = SIMFS_BLOCK_SIZE;
-    simfsVolume->superblock.attr.numberOfBlocks = SIMFS_NUMBER_OF_BLOCKS;
+/*****
+ * Fills a new descriptor. Returns SIMFS_ALLOC_ERROR if its name needs a name block, but the volume is full; the
+ * descriptor does not refer to any block then.
+ */
+SIMFS_ERROR setNewFileDescriptorFields(SIMFS_INSTANCE *instance, SIMFS_INDEX_TYPE index, SIMFS_CONTENT_TYPE content,
+        SIMFS_NAME_TYPE name, mode_t rights, uid_t user)
+{
+    SIMFS_FILE_DESCRIPTOR_TYPE * fd =
+        &(instance->volume->block[index].content.fileDescriptor);
 
-    // initialize the bitvector
-    memset(simfsVolume->bitvector, 0, SIMFS_NUMBER_OF_BLOCKS / 8);
+    fd->identifier = nextUniqueIdentifier(instance);
+    fd->type = content;
+    fd->accessRights = rights;
+    fd->owner = user; // arbitrarily simulated
+    fd->size = 0;
+    fd->storedSize = 0;
+    fd->flags = 0;
+    fd->block_ref = SIMFS_INVALID_INDEX;
+    fd->allocatedBlocks = 0;
 
-    // initialize the root folder
-    simfsFlipBit(simfsVolume->bitvector, SIMFS_ROOT_NODE_INDEX);
-    setNewFileDescriptorFields(SIMFS_ROOT_NODE_INDEX, SIMFS_FOLDER_CONTENT_TYPE, "/", umask(00000), 0);
-    
-    // using the function to find a free block for testing purposes
-    fwrite(simfsVolume, 1, sizeof(SIMFS_VOLUME), file);
-    fclose(file);
-    free(simfsVolume);
+    fd->creationTime = currentTime();
+    fd->lastAccessTime = fd->creationTime;
+    fd->lastModificationTime = fd->creationTime;
 
-    return SIMFS_NO_ERROR;
+    SIMFS_INDEX_TYPE nameBlock;
+    SIMFS_ERROR error = allocateNameBlock(instance, name, &nameBlock);
+    simfsStoreName(instance->volume, fd, nameBlock, error == SIMFS_NO_ERROR ? name : "");
+    return error;
 }
 
+//////////////////////////////////////////////////////////////////////////
+//
+// block management
+//
+// Blocks can be shared between the live tree and snapshots. A shared block is never modified in place; it is
+// cloned first, and the clone takes over a reference to everything the original block refers to. This way
+// taking a snapshot only has to add a reference to the root, and the cost of copying is paid lazily along the
+// paths that are actually modified afterwards.
+//
+//////////////////////////////////////////////////////////////////////////
 
-SIMFS_ERROR mountVolume(char * simfsFileName) 
+/*****
+ * Returns the 64-bit word of the in-memory bitvector covering blocks [64 * word, 64 * word + 63], with the first
+ * of them in the most significant bit.
+ */
+unsigned long long bitvectorWord(SIMFS_INSTANCE *instance, int word)
 {
-    simfsVolume = malloc(sizeof(SIMFS_VOLUME));
-    if (simfsVolume == NULL)
-        return SIMFS_ALLOC_ERROR;
-
-    FILE *file = fopen(simfsFileName, "rb");
-    if (file == NULL)
-        return SIMFS_ALLOC_ERROR;
-
-    fread(simfsVolume, 1, sizeof(SIMFS_VOLUME), file);
-    fclose(file);
-
-    return SIMFS_NO_ERROR;
+    unsigned long long bits;
+    memcpy(&bits, instance->context->bitvector + word * sizeof(bits), sizeof(bits));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    bits = __builtin_bswap64(bits);
+#endif
+    return bits;
 }
 
-SIMFS_ERROR mountContext() 
+/*****
+ * Brings the summary up to date after the bit of a block changed.
+ */
+void updateFreeSpace(SIMFS_INSTANCE *instance, SIMFS_INDEX_TYPE index, int delta)
 {
-    simfsContext = malloc(sizeof(SIMFS_CONTEXT_TYPE));
-    if (simfsContext == NULL)
-        return SIMFS_ALLOC_ERROR;
-
-    for (int i = 0; i < SIMFS_MAX_NUMBER_OF_OPEN_FILES; i++)
-        simfsContext->globalOpenFileTable[i].type = SIMFS_INVALID_CONTENT_TYPE;  // indicates  empty slot
-
-    for (int i = 0; i < SIMFS_DIRECTORY_SIZE; i++)
-        simfsContext->directory[i] = NULL;
+    SIMFS_FREE_SPACE_TYPE * space = &(instance->context->freeSpace);
+    int word = index / 64;
+    unsigned long long mask = 1ULL << (word % 64);
+    if (~bitvectorWord(instance, word) != 0)
+        space->wordHasFree[word / 64] |= mask;
+    else
+        space->wordHasFree[word / 64] &= ~mask;
 
-    memcpy(simfsContext->bitvector, simfsVolume->bitvector, SIMFS_NUMBER_OF_BLOCKS / 8);
+    int region = index / SIMFS_FREE_SPACE_REGION_SIZE;
+    space->regionFree[region] += delta;
+    space->regionChanged[region] = 1;
+    space->freeBlocks += delta;
+}
 
-    simfsContext->processControlBlocks = NULL;
+/*****
+ * Builds the summary of the in-memory bitvector from scratch.
+ */
+void rebuildFreeSpace(SIMFS_INSTANCE *instance)
+{
+    SIMFS_FREE_SPACE_TYPE * space = &(instance->context->freeSpace);
+    memset(space, 0, sizeof(SIMFS_FREE_SPACE_TYPE));
+    for (int word = 0; word < SIMFS_BITVECTOR_WORDS; ++word) {
+        int free = 64 - __builtin_popcountll(bitvectorWord(instance, word));
+        if (free > 0)
+            space->wordHasFree[word / 64] |= 1ULL << (word % 64);
+        space->regionFree[word * 64 / SIMFS_FREE_SPACE_REGION_SIZE] += free;
+        space->freeBlocks += free;
+    }
+    memset(space->regionChanged, 1, sizeof(space->regionChanged));
+}
 
-    //TODO: Recursively add entries to simfsContext->directory
+/*****
+ * Recomputes the free runs of a region.
+ */
+void summarizeRegion(SIMFS_INSTANCE *instance, int region)
+{
+    SIMFS_FREE_SPACE_TYPE * space = &(instance->context->freeSpace);
+    int first = region * SIMFS_FREE_SPACE_REGION_SIZE;
+    int run = 0, longest = 0, longestStart = 0, leading = -1;
 
+    for (int i = 0; i < SIMFS_FREE_SPACE_REGION_SIZE; i += 64) {
+        unsigned long long bits = bitvectorWord(instance, (first + i) / 64);
+        if (bits == 0) { // a whole word of free blocks
+            run += 64;
+            continue;
+        }
+        for (int bit = 0; bit < 64; ++bit) {
+            if (!(bits & (0x8000000000000000ULL >> bit))) {
+                run++;
+                continue;
+            }
+            if (leading < 0)
+                leading = i + bit;
+            if (run > longest) {
+                longest = run;
+                longestStart = i + bit - run;
+            }
+            run = 0;
+        }
+    }
+    if (run > longest) {
+        longest = run;
+        longestStart = SIMFS_FREE_SPACE_REGION_SIZE - run;
+    }
 
-    return SIMFS_NO_ERROR;
+    space->regionLeadingRun[region] = (leading < 0 ? SIMFS_FREE_SPACE_REGION_SIZE : leading);
+    space->regionTrailingRun[region] = run;
+    space->regionLongestRun[region] = longest;
+    space->regionLongestRunStart[region] = longestStart;
+    space->regionChanged[region] = 0;
 }
-/***
- * Loads the file system from a disk and constructs in-memory directory of all files is the system.
- *
- * Starting with the file system root (pointed to from the superblock) traverses the hierarchy of directories
- * and adds an entry for each folder or file to the directory by hashing the name and adding a directory
- * entry node to the conflict resolution list for that entry. If the entry is NULL, the new node will be
- * the only element of that list. If the list contains more than one element, then multiple files hashed to
- * the same value, so the unique file identifier can be used to determine which entry is applicable. The
- * identifier must be the same as the identifier in the file descriptor pointed to by the node reference.
- *
- * The function sets the current working directory to refer to the block holding the root of the volume. This will
- * be changed as the user navigates the file system hierarchy.
+
+/*****
+ * Finds the longest run of consecutive free blocks, which may span regions. Only the regions that changed since
+ * the last query are scanned.
  *
+ * Returns the length of the run; its first block is returned through the parameter start.
  */
-SIMFS_ERROR simfsMountFileSystem(char *simfsFileName)
+int largestFreeRun(SIMFS_INSTANCE *instance, SIMFS_INDEX_TYPE *start)
 {
-    // TODO: complete
-
-    SIMFS_ERROR error;
+    SIMFS_FREE_SPACE_TYPE * space = &(instance->context->freeSpace);
+    int best = 0, carry = 0;
+    *start = SIMFS_INVALID_INDEX;
 
-    error = mountVolume(simfsFileName);
-    if (error != SIMFS_NO_ERROR)
-        return error;
+    for (int region = 0; region < SIMFS_NUMBER_OF_REGIONS; ++region) {
+        if (space->regionChanged[region])
+            summarizeRegion(instance, region);
 
-    error = mountContext();
-    if (error != SIMFS_NO_ERROR)
-        return error;
+        int first = region * SIMFS_FREE_SPACE_REGION_SIZE;
+        if (carry + space->regionLeadingRun[region] > best) {
+            best = carry + space->regionLeadingRun[region];
+            *start = first - carry;
+        }
+        if (space->regionLongestRun[region] > best) {
+            best = space->regionLongestRun[region];
+            *start = first + space->regionLongestRunStart[region];
+        }
 
-    return SIMFS_NO_ERROR;
+        if (space->regionFree[region] == SIMFS_FREE_SPACE_REGION_SIZE)
+            carry += SIMFS_FREE_SPACE_REGION_SIZE;
+        else
+            carry = space->regionTrailingRun[region];
+    }
+    return best;
 }
 
-/***
- * Saves the file system to a disk and de-allocates the memory.
- *
- * Assumes that all synchronization has been done.
+/*****
+ * Finds the lowest free block in [first, last] through the summary bits, looking at no more than two bitvector
+ * words.
  *
+ * Returns SIMFS_INVALID_INDEX if all blocks in the range are used.
  */
-SIMFS_ERROR simfsUmountFileSystem(char *simfsFileName)
+SIMFS_INDEX_TYPE findFreeBlockInRange(SIMFS_INSTANCE *instance, int first, int last)
 {
-    FILE *file = fopen(simfsFileName, "wb");
-    if (file == NULL)
-        return SIMFS_ALLOC_ERROR;
+    if (first > last)
+        return SIMFS_INVALID_INDEX;
 
-    fwrite(simfsVolume, 1, sizeof(SIMFS_VOLUME), file);
-    fclose(file);
+    SIMFS_FREE_SPACE_TYPE * space = &(instance->context->freeSpace);
+    int word = first / 64;
+    unsigned long long free = ~bitvectorWord(instance, word) & (~0ULL >> (first % 64));
 
-    free(simfsVolume);
-    free(simfsContext);
+    while (free == 0) {
+        if (++word > last / 64)
+            return SIMFS_INVALID_INDEX;
+        unsigned long long hasFree = space->wordHasFree[word / 64] >> (word % 64);
+        if (hasFree == 0) {
+            word = (word / 64 + 1) * 64 - 1; // none in the rest of this summary entry
+            continue;
+        }
+        word += __builtin_ctzll(hasFree);
+        if (word > last / 64)
+            return SIMFS_INVALID_INDEX;
+        free = ~bitvectorWord(instance, word);
+    }
 
-    return SIMFS_NO_ERROR;
+    int index = word * 64 + __builtin_clzll(free);
+    return index <= last ? index : SIMFS_INVALID_INDEX;
 }
 
+//////////////////////////////////////////////////////////////////////////
+//
+// allocation groups
+//
+// The volume is divided into groups of SIMFS_ALLOCATION_GROUP_SIZE blocks. Every allocation starts at a goal
+// block and takes the first free block after it in the goal's group, so that the blocks of a file follow its
+// descriptor, and the descriptors of the files of a folder stay in the group of the folder. Only a full group
+// sends the allocation on to the next one. New folders are spread over the groups by giving each thread a group
+// of its own, so that the folders of different threads, and the files in them, are laid out apart.
+//
+// Groups are about where blocks go, not about locking: every allocation runs under the volume lock like the rest
+// of the operation, so threads do not allocate in different groups at the same time.
+//
 //////////////////////////////////////////////////////////////////////////
 
-SIMFS_PROCESS_CONTROL_BLOCK_TYPE * findPCBByPID(pid_t pid)
+int groupFreeBlocks(SIMFS_INSTANCE *instance, int group)
 {
-    SIMFS_PROCESS_CONTROL_BLOCK_TYPE * pcb = simfsContext->processControlBlocks;
-    while ( pcb != NULL ) {
-        if (pcb->pid == pid)
-            return pcb;
-        pcb = pcb->next;
-    }
-    return NULL;
+    int regionsPerGroup = SIMFS_ALLOCATION_GROUP_SIZE / SIMFS_FREE_SPACE_REGION_SIZE;
+    int free = 0;
+    for (int i = 0; i < regionsPerGroup; ++i)
+        free += instance->context->freeSpace.regionFree[group * regionsPerGroup + i];
+    return free;
 }
 
-SIMFS_INDEX_TYPE getCurrentWorkingDirectory(struct fuse_context * context)
+/*****
+ * Sets the block that the following allocations should be placed after.
+ */
+void setAllocationGoal(SIMFS_INSTANCE *instance, SIMFS_INDEX_TYPE goal)
 {
-    
-    SIMFS_PROCESS_CONTROL_BLOCK_TYPE * pcb = findPCBByPID(context->pid);
-    SIMFS_INDEX_TYPE cwd = SIMFS_INVALID_INDEX;
-    if ( pcb == NULL )
-        cwd = SIMFS_ROOT_NODE_INDEX;
-    else
-        cwd = pcb->currentWorkingDirectory;
-    return cwd;
+    instance->context->allocationGoal = goal;
 }
 
-SIMFS_INDEX_TYPE findFileInIndexBlock(SIMFS_NAME_TYPE name, SIMFS_INDEX_TYPE index, unsigned short size, int * pos)
+/*****
+ * Returns what the volume remembers about the calling thread, starting afresh for a thread that it does not know.
+ * The caller holds the volume lock.
+ */
+SIMFS_THREAD_TYPE * callingThread(SIMFS_INSTANCE *instance)
 {
-    SIMFS_INDEX_TYPE test;
-    for (int i=0; i<size; ++i) {
-        test = simfsVolume->block[index].content.index[i];
-        if ( strcmp(simfsVolume->block[test].content.fileDescriptor.name, name) == 0 ) {
-            if (pos != NULL)
-                *pos = i;
-            return test;
-        }
-    }
-    if (pos != NULL)
-        *pos = 0;
-    return SIMFS_INVALID_INDEX;
+    pthread_t self = pthread_self();
+    unsigned int known = instance->context->numberOfThreads;
+    if (known > SIMFS_MAX_NUMBER_OF_THREADS)
+        known = SIMFS_MAX_NUMBER_OF_THREADS;
+    for (unsigned int i = 0; i < known; i++)
+        if (pthread_equal(instance->context->threads[i].thread, self))
+            return &(instance->context->threads[i]);
+
+    // the earliest thread is forgotten once the table is full
+    unsigned int slot = instance->context->numberOfThreads++ % SIMFS_MAX_NUMBER_OF_THREADS;
+    SIMFS_THREAD_TYPE * thread = &(instance->context->threads[slot]);
+    thread->thread = self;
+    thread->affinityGroup = -1;
+    thread->traceGeneration = 0;
+    return thread;
 }
 
-SIMFS_INDEX_TYPE findFileInFolder(SIMFS_FILE_DESCRIPTOR_TYPE * folder, SIMFS_NAME_TYPE name, 
-        SIMFS_INDEX_TYPE * block, int *pos, int *size)
+/*****
+ * Returns the first block of the allocation group of the calling thread. Every volume assigns groups to threads
+ * round-robin when they first create a folder on it.
+ */
+SIMFS_INDEX_TYPE threadGroupStart(SIMFS_INSTANCE *instance)
 {
-    SIMFS_INDEX_TYPE index_block = folder->block_ref;
-    int remaining = folder->size;
-    for (; remaining > LAST_POS; remaining -= LAST_POS) {
+    SIMFS_THREAD_TYPE * thread = callingThread(instance);
+    if (thread->affinityGroup < 0)
+        thread->affinityGroup = instance->context->nextAffinityGroup++ % SIMFS_NUMBER_OF_ALLOCATION_GROUPS;
+    return thread->affinityGroup * SIMFS_ALLOCATION_GROUP_SIZE;
+}
 
-        SIMFS_INDEX_TYPE test = findFileInIndexBlock(name, index_block, LAST_POS, pos);
-        if (test != SIMFS_INVALID_INDEX) {
-            if (block != NULL && size != NULL) {
-                *block = index_block;
-                *size = LAST_POS;
-            }
-            return test;
-        }
+/*****
+ * Finds the lowest used block in [first, last], or SIMFS_INVALID_INDEX if all blocks in the range are free.
+ */
+SIMFS_INDEX_TYPE findUsedBlockInRange(SIMFS_INSTANCE *instance, int first, int last)
+{
+    if (first > last)
+        return SIMFS_INVALID_INDEX;
 
-        index_block = simfsVolume->block[index_block].content.index[LAST_POS];
+    int word = first / 64;
+    unsigned long long used = bitvectorWord(instance, word) & (~0ULL >> (first % 64));
+    while (used == 0) {
+        if (++word > last / 64)
+            return SIMFS_INVALID_INDEX;
+        used = bitvectorWord(instance, word);
     }
 
-    SIMFS_INDEX_TYPE test = findFileInIndexBlock(name, index_block, remaining, pos);
-    if (test != SIMFS_INVALID_INDEX) {
-        if (block != NULL && size != NULL) {
-            *block = index_block;
-            *size = remaining;
-        }
-        return test;
-    }
+    int index = word * 64 + __builtin_clzll(used);
+    return index <= last ? index : SIMFS_INVALID_INDEX;
+}
 
+/*****
+ * Finds the first run of at least length free blocks in [first, last].
+ */
+SIMFS_INDEX_TYPE findFreeRunInRange(SIMFS_INSTANCE *instance, int first, int last, int length)
+{
+    while (first <= last) {
+        SIMFS_INDEX_TYPE start = findFreeBlockInRange(instance, first, last);
+        if (start == SIMFS_INVALID_INDEX)
+            break;
+        SIMFS_INDEX_TYPE end = findUsedBlockInRange(instance, start, last);
+        if ((end == SIMFS_INVALID_INDEX ? last + 1 : end) - start >= length)
+            return start;
+        first = end + 1;
+    }
     return SIMFS_INVALID_INDEX;
 }
 
-SIMFS_INDEX_TYPE allocateFreeBlock(SIMFS_CONTENT_TYPE type)
+/*****
+ * Moves the allocation goal to the start of the first run of free blocks that can take the given number of
+ * blocks in one piece: after the goal in its group, before it, or in the following groups. The goal stays
+ * where it is if there is no such run.
+ */
+void reserveFreeRun(SIMFS_INSTANCE *instance, int length)
 {
-    SIMFS_INDEX_TYPE index = simfsFindFreeBlock(simfsContext->bitvector);
-    simfsSetBit(simfsContext->bitvector, index);
-    simfsSetBit(simfsVolume->bitvector, index);
-    simfsVolume->block[index].type = type;
-    fprintf(stderr, "Allocate Block: %d\n", index);
-    return index;
+    SIMFS_INDEX_TYPE goal = instance->context->allocationGoal;
+    if (goal >= SIMFS_NUMBER_OF_BLOCKS)
+        goal = 0;
+    int group = goal / SIMFS_ALLOCATION_GROUP_SIZE;
+
+    for (int i = 0; i < SIMFS_NUMBER_OF_ALLOCATION_GROUPS; ++i) {
+        int g = (group + i) % SIMFS_NUMBER_OF_ALLOCATION_GROUPS;
+        if (groupFreeBlocks(instance, g) < length)
+            continue;
+
+        int first = g * SIMFS_ALLOCATION_GROUP_SIZE;
+        int last = first + SIMFS_ALLOCATION_GROUP_SIZE - 1;
+        SIMFS_INDEX_TYPE start = findFreeRunInRange(instance, i == 0 ? goal : first, last, length);
+        if (start == SIMFS_INVALID_INDEX && i == 0)
+            start = findFreeRunInRange(instance, first, goal - 1, length);
+        if (start != SIMFS_INVALID_INDEX) {
+            instance->context->allocationGoal = start;
+            return;
+        }
+    }
 }
 
-void addFileToFolder(SIMFS_FILE_DESCRIPTOR_TYPE * folder, SIMFS_INDEX_TYPE file)
+/*****
+ * Finds a free block close to the allocation goal: the first one after the goal in its group, then the first
+ * one before it, then the first one in the following groups.
+ */
+SIMFS_INDEX_TYPE findFreeBlockNearGoal(SIMFS_INSTANCE *instance)
 {
-    SIMFS_INDEX_TYPE index_block = folder->block_ref; //which block the file should go into
-    int pos = folder->size % LAST_POS; //which position in the index_block file should go into
-    //The folder is empty, make a new index block
-    if (folder->size == 0) {
-        index_block = allocateFreeBlock(SIMFS_INDEX_CONTENT_TYPE);
-        folder->block_ref = index_block;
+    SIMFS_INDEX_TYPE goal = instance->context->allocationGoal;
+    if (goal >= SIMFS_NUMBER_OF_BLOCKS)
+        goal = 0;
+    int group = goal / SIMFS_ALLOCATION_GROUP_SIZE;
+
+    for (int i = 0; i < SIMFS_NUMBER_OF_ALLOCATION_GROUPS; ++i) {
+        int g = (group + i) % SIMFS_NUMBER_OF_ALLOCATION_GROUPS;
+        if (groupFreeBlocks(instance, g) == 0)
+            continue;
+
+        int first = g * SIMFS_ALLOCATION_GROUP_SIZE;
+        int last = first + SIMFS_ALLOCATION_GROUP_SIZE - 1;
+        SIMFS_INDEX_TYPE index = findFreeBlockInRange(instance, i == 0 ? goal : first, last);
+        if (index == SIMFS_INVALID_INDEX)
+            index = findFreeBlockInRange(instance, first, goal - 1);
+        if (index != SIMFS_INVALID_INDEX)
+            return index;
     }
-    //The folder is not empty
-    else {
-        //go to the last index block in the block chain
-        int remaining = folder->size;
-        for (; remaining > LAST_POS; remaining -= LAST_POS)
-            index_block = simfsVolume->block[index_block].content.index[LAST_POS];
-        //if the last index block int the chain is full get a new block
-        if (pos == 0) {
-            SIMFS_INDEX_TYPE temp = allocateFreeBlock(SIMFS_INDEX_CONTENT_TYPE);
-            simfsVolume->block[index_block].content.index[LAST_POS] = temp;
-            index_block = temp;
-        }
-    }
-    simfsVolume->block[index_block].content.index[pos] = file;
-    folder->size++;
+    return SIMFS_INVALID_INDEX; // the volume is full
 }
 
-void addFileToDirectory(SIMFS_INDEX_TYPE file, SIMFS_NAME_TYPE fileName)
+void markBlockUsed(SIMFS_INSTANCE *instance, SIMFS_INDEX_TYPE index)
 {
-    //Create a new entry
-    SIMFS_DIR_ENT * newEnt = malloc(sizeof(SIMFS_DIR_ENT));
-    newEnt->nodeReference = file;
-    newEnt->uniqueFileIdentifier = simfsVolume->block[file].content.fileDescriptor.identifier;
-    newEnt->globalOpenFileTableIndex = SIMFS_INVALID_OPEN_FILE_TABLE_INDEX;
+    simfsSetBit(instance->context->bitvector, index);
+    simfsSetBit(instance->volume->bitvector, index);
+    updateFreeSpace(instance, index, -1);
+}
 
-    //Add entry to front of the list
-    SIMFS_DIR_ENT ** ent = &(simfsContext->directory[hash(fileName)]);
-    newEnt->next = *ent;
-    *ent = newEnt;
+void markBlockFree(SIMFS_INSTANCE *instance, SIMFS_INDEX_TYPE index)
+{
+    simfsClearBit(instance->context->bitvector, index);
+    simfsClearBit(instance->volume->bitvector, index);
+    updateFreeSpace(instance, index, +1);
 }
 
+int countFreeBlocks(SIMFS_INSTANCE *instance)
+{
+    return instance->context->freeSpace.freeBlocks;
+}
 
-/***
- * Depending on the type parameter the function creates a file or a folder in the current directory
- * of the process. If the process does not have an entry in the processControlBlock, then the root directory
- * is assumed to be its current working directory.
- *
- * If a file with the same name already exists in the current directory, it returns SIMFS_DUPLICATE_ERROR.
- *
- * Otherwise:
- *    - sets the folder/file's identifier to the current value of the next unique identifier from the superblock;
- *      then it increments the next available value in the superblock (to prepare it for the next created file)
- *    - finds an available block in the storage using the in-memory bitvector and flips the bit to indicate
- *      that the block is taken
- *    - initializes a local buffer for the file descriptor block with the block type depending on the parameter type
- *      (i.e., folder or file)
- *    - creates an entry in the conflict resolution list for the corresponding in-memory directory entry
- *    - copies the local buffer to the disk block that was found to be free
- *    - copies the in-memory bitvector to the bitevector blocks on the simulated disk
- *
- *  The access rights and the the owner are taken from the context (umask and uid correspondingly).
+/*****
+ * Takes the free block closest to the allocation goal, and moves the goal past it, so that consecutive
+ * allocations are laid out one after another. Index blocks start out with all slots invalid, so the references
+ * held by any block can be found without knowing the size of the file or folder it belongs to; B+tree nodes
+ * start out empty.
  *
+ * Returns SIMFS_INVALID_INDEX if the volume is full.
  */
-SIMFS_ERROR simfsCreateFile(SIMFS_NAME_TYPE fileName, SIMFS_CONTENT_TYPE type)
+SIMFS_INDEX_TYPE allocateFreeBlock(SIMFS_INSTANCE *instance, SIMFS_CONTENT_TYPE type)
 {
-    // TODO: implement - DONE
-    struct fuse_context * context = simfs_debug_get_context();
-    SIMFS_INDEX_TYPE cwd = getCurrentWorkingDirectory(context);
-    SIMFS_FILE_DESCRIPTOR_TYPE * cwdfd = &(simfsVolume->block[cwd].content.fileDescriptor);
-    
-    SIMFS_INDEX_TYPE file = findFileInFolder(cwdfd, fileName, NULL, NULL, NULL);
-    if (file != SIMFS_INVALID_INDEX)
-        return SIMFS_DUPLICATE_ERROR;
-    
-    file = allocateFreeBlock(type);
-    setNewFileDescriptorFields(file, type, fileName, context->umask, context->uid);
-    addFileToFolder(cwdfd, file);
-    addFileToDirectory(file, fileName);
+    SIMFS_INDEX_TYPE index = findFreeBlockNearGoal(instance);
+    if (index == SIMFS_INVALID_INDEX)
+        return SIMFS_INVALID_INDEX;
 
-    return SIMFS_NO_ERROR;
+    instance->context->allocationGoal = index + 1;
+    markBlockUsed(instance, index);
+    simfsSetBit(instance->context->verified, index);
+    instance->volume->sharedCount[index] = 0;
+    instance->volume->block[index].type = type;
+    if (type == SIMFS_INDEX_CONTENT_TYPE)
+        for (int i = 0; i < SIMFS_INDEX_SIZE; ++i)
+            instance->volume->block[index].content.index[i] = SIMFS_INVALID_INDEX;
+    if (type == SIMFS_BTREE_CONTENT_TYPE)
+        memset(&(instance->volume->block[index].content.btree), 0, sizeof(SIMFS_BTREE_NODE_TYPE));
+#ifdef _DEBUG
+    fprintf(stderr, "Allocate Block: %d\n", index);
+#endif
+    return index;
 }
 
+//////////////////////////////////////////////////////////////////////////
+//
+// deduplication of data blocks
+//
+// Data blocks are never modified in place, so a block with the same content as a new one can be shared through
+// its shared count just like blocks shared with snapshots.
+//
 //////////////////////////////////////////////////////////////////////////
 
-SIMFS_DIR_ENT ** findFileInDirectory(SIMFS_INDEX_TYPE file, SIMFS_NAME_TYPE fileName)
+#define FINGERPRINT_MASK (SIMFS_FINGERPRINT_TABLE_SIZE - 1)
+
+unsigned long long fingerprintData(char *data)
 {
-    unsigned long long id = simfsVolume->block[file].content.fileDescriptor.identifier;
-    SIMFS_DIR_ENT ** ent = &(simfsContext->directory[hash(fileName)]);
-    while(*ent != NULL) {
-        if ( (*ent)->nodeReference == file && (*ent)->uniqueFileIdentifier == id )
-            return ent;
-        ent = &((*ent)->next);
+    unsigned long long hash = 0x9E3779B97F4A7C15ULL ^ SIMFS_DATA_SIZE;
+    unsigned long long word;
+    int i = 0;
+    for (; i + (int) sizeof(word) <= SIMFS_DATA_SIZE; i += sizeof(word)) {
+        memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word) * 0xFF51AFD7ED558CCDULL;
+        hash ^= hash >> 32;
     }
-    return NULL;
+    for (; i < SIMFS_DATA_SIZE; ++i)
+        hash = (hash ^ (unsigned char) data[i]) * 0x100000001B3ULL;
+
+    hash ^= hash >> 33;
+    hash *= 0xC4CEB9FE1A85EC53ULL;
+    hash ^= hash >> 33;
+    return hash;
 }
 
-void deleteFileIndices(SIMFS_FILE_DESCRIPTOR_TYPE * filefd)
+void addFingerprint(SIMFS_INSTANCE *instance, SIMFS_INDEX_TYPE block, unsigned long long hash)
 {
-    //Nothing to delete
-    if (filefd->size == 0)
-        return;
+    size_t slot = hash & FINGERPRINT_MASK;
+    while (instance->context->fingerprint[slot].block != SIMFS_INVALID_INDEX)
+        slot = (slot + 1) & FINGERPRINT_MASK;
+    instance->context->fingerprint[slot].hash = hash;
+    instance->context->fingerprint[slot].block = block;
+}
 
-    if (filefd->size > SIMFS_DATA_SIZE) {
-        simfsClearBit(simfsContext->bitvector, filefd->block_ref);
-        simfsClearBit(simfsVolume->bitvector, filefd->block_ref);
-        return;
+/*****
+ * Removes the fingerprint of a block that is about to be freed. The entries after it are shifted back, so
+ * that lookups never need tombstones.
+ */
+void removeFingerprint(SIMFS_INSTANCE *instance, SIMFS_INDEX_TYPE block)
+{
+    SIMFS_FINGERPRINT_TYPE *table = instance->context->fingerprint;
+    size_t slot = fingerprintData(instance->volume->block[block].content.data) & FINGERPRINT_MASK;
+    while (table[slot].block != block) {
+        if (table[slot].block == SIMFS_INVALID_INDEX)
+            return; // a duplicate that was never indexed
+        slot = (slot + 1) & FINGERPRINT_MASK;
     }
 
-    //If 
-    int CONTEXT_DATA_SIZE = (SIMFS_INDEX_SIZE-1) * (SIMFS_DATA_SIZE-1);
-    int size = filefd->size;
-    SIMFS_INDEX_TYPE indexBlock = filefd->block_ref;
-    for (; size > CONTEXT_DATA_SIZE; size -= CONTEXT_DATA_SIZE) {
-        for (int i=0; i < SIMFS_INDEX_SIZE; ++i) {
-            simfsClearBit(simfsContext->bitvector, simfsVolume->block[indexBlock].content.index[i]);
-            simfsClearBit(simfsVolume->bitvector, simfsVolume->block[indexBlock].content.index[i]);
+    for (size_t next = (slot + 1) & FINGERPRINT_MASK; ; next = (next + 1) & FINGERPRINT_MASK) {
+        if (table[next].block == SIMFS_INVALID_INDEX)
+            break;
+        size_t home = table[next].hash & FINGERPRINT_MASK;
+        // the entry may fill the hole unless its home slot lies cyclically in (slot, next]
+        int stays = slot <= next ? (slot < home && home <= next) : (slot < home || home <= next);
+        if (!stays) {
+            table[slot] = table[next];
+            slot = next;
         }
-        SIMFS_INDEX_TYPE temp = indexBlock;
-        indexBlock = simfsVolume->block[indexBlock].content.index[SIMFS_INDEX_SIZE-1];
-        simfsClearBit(simfsContext->bitvector, temp);
-        simfsClearBit(simfsVolume->bitvector, temp);
-    }
-    for (int i=0; i< (size / SIMFS_DATA_SIZE); ++i) {
-        simfsClearBit(simfsContext->bitvector, simfsVolume->block[indexBlock].content.index[i]);
-        simfsClearBit(simfsVolume->bitvector, simfsVolume->block[indexBlock].content.index[i]);    
-        size -= SIMFS_DATA_SIZE;
-    }
-    if (size > 0) {
-        simfsClearBit(simfsContext->bitvector, indexBlock);
-        simfsClearBit(simfsVolume->bitvector, indexBlock);
     }
+    table[slot].block = SIMFS_INVALID_INDEX;
 }
 
-/***
- * Deletes a file from the file system.
- *
+/*****
+ * Returns a data block with exactly the given content that can take one more reference, if there is one.
+ */
+SIMFS_INDEX_TYPE findDuplicateBlock(SIMFS_INSTANCE *instance, char *data, unsigned long long hash)
+{
+    for (size_t slot = hash & FINGERPRINT_MASK; instance->context->fingerprint[slot].block != SIMFS_INVALID_INDEX;
+         slot = (slot + 1) & FINGERPRINT_MASK) {
+        SIMFS_INDEX_TYPE block = instance->context->fingerprint[slot].block;
+        if (instance->context->fingerprint[slot].hash == hash &&
+            instance->volume->sharedCount[block] < SIMFS_MAX_SHARED_COUNT &&
+            memcmp(instance->volume->block[block].content.data, data, SIMFS_DATA_SIZE) == 0)
+            return block;
+    }
+    return SIMFS_INVALID_INDEX;
+}
+
+/*****
+ * Indexes every allocated data block. Blocks whose content is already indexed stay separate copies.
+ */
+void rebuildFingerprints(SIMFS_INSTANCE *instance)
+{
+    for (int i = 0; i < SIMFS_NUMBER_OF_BLOCKS; ++i) {
+        if (!(instance->context->bitvector[i / 8] & (0x80 >> (i % 8))) ||
+            instance->volume->block[i].type != SIMFS_DATA_CONTENT_TYPE)
+            continue;
+
+        unsigned long long hash = fingerprintData(instance->volume->block[i].content.data);
+        if (findDuplicateBlock(instance, instance->volume->block[i].content.data, hash) == SIMFS_INVALID_INDEX)
+            addFingerprint(instance, i, hash);
+    }
+}
+
+/*****
+ * Stores up to SIMFS_DATA_SIZE bytes of content in a data block. With deduplication, an existing block with
+ * the same content is shared instead of acquiring a new one.
+ *
+ * Returns SIMFS_INVALID_INDEX if the volume is full.
+ */
+SIMFS_INDEX_TYPE storeDataBlock(SIMFS_INSTANCE *instance, char *content, size_t length)
+{
+    SIMFS_DATA_TYPE data;
+    memset(data, 0, SIMFS_DATA_SIZE);
+    memcpy(data, content, length);
+
+    unsigned long long hash = 0;
+    if (instance->context->options & SIMFS_MOUNT_DEDUP) {
+        hash = fingerprintData(data);
+        SIMFS_INDEX_TYPE duplicate = findDuplicateBlock(instance, data, hash);
+        if (duplicate != SIMFS_INVALID_INDEX) {
+            instance->volume->sharedCount[duplicate]++;
+            return duplicate;
+        }
+    }
+
+    SIMFS_INDEX_TYPE block = allocateFreeBlock(instance, SIMFS_DATA_CONTENT_TYPE);
+    if (block == SIMFS_INVALID_INDEX)
+        return SIMFS_INVALID_INDEX;
+
+    memcpy(instance->volume->block[block].content.data, data, SIMFS_DATA_SIZE);
+    if (instance->context->options & SIMFS_MOUNT_DEDUP)
+        addFingerprint(instance, block, hash);
+    return block;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// block checksums
+//
+// With SIMFS_MOUNT_CHECKSUMS, the image holds a CRC32C of every block and one of the metadata in front of the
+// blocks. They are computed whenever an image is written, which is also when the whole volume is written, so the
+// operations themselves never compute a checksum; with writeback, the thread computes them on the checkpoint.
+// After mounting, the metadata and every block other than a data block are verified right away, as they are read
+// on mounting anyway; a data block is verified on its first read. A block that is allocated or modified after
+// mounting needs no verification any more, as its checksum in the image is out of date until the next write.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#define CHECKSUM_BATCH 48 // blocks handed to simfsCrc32cMany() at a time; a multiple of three
+
+int isBlockVerified(SIMFS_INSTANCE *instance, SIMFS_INDEX_TYPE block)
+{
+    return instance->context->verified[block / 8] & (0x80 >> (block % 8));
+}
+
+/*****
+ * Returns the checksum of the superblock, with the checksum field taken as 0, followed by the bitvector, the
+ * snapshots, and the shared counts.
+ */
+unsigned int metadataChecksum(SIMFS_VOLUME *volume)
+{
+    SIMFS_SUPERBLOCK_TYPE superblock = volume->superblock;
+    superblock.attr.metadataChecksum = 0;
+    unsigned int crc = simfsCrc32c(0, &superblock, sizeof(SIMFS_SUPERBLOCK_TYPE));
+    return simfsCrc32c(crc, volume->bitvector, offsetof(SIMFS_VOLUME, checksum) - offsetof(SIMFS_VOLUME, bitvector));
+}
+
+/*****
+ * Brings the checksums of a volume that is about to be written up to date if it is mounted with
+ * SIMFS_MOUNT_CHECKSUMS, and marks them out of date otherwise. The volume is the live volume or a checkpoint of it.
+ */
+void sealVolume(SIMFS_INSTANCE *instance, SIMFS_VOLUME *volume)
+{
+    if (!(instance->context->options & SIMFS_MOUNT_CHECKSUMS)) {
+        volume->superblock.attr.flags &= ~SIMFS_SUPERBLOCK_CHECKSUMS;
+        return;
+    }
+
+    const void *buffers[CHECKSUM_BATCH];
+    for (int i = 0; i < SIMFS_NUMBER_OF_BLOCKS; i += CHECKSUM_BATCH) {
+        int count = SIMFS_NUMBER_OF_BLOCKS - i < CHECKSUM_BATCH ? SIMFS_NUMBER_OF_BLOCKS - i : CHECKSUM_BATCH;
+        for (int k = 0; k < count; ++k)
+            buffers[k] = &(volume->block[i + k]);
+        simfsCrc32cMany(buffers, sizeof(SIMFS_BLOCK_TYPE), count, volume->checksum + i);
+    }
+    volume->superblock.attr.flags |= SIMFS_SUPERBLOCK_CHECKSUMS;
+    volume->superblock.attr.metadataChecksum = metadataChecksum(volume);
+}
+
+/*****
+ * Verifies the checksum of a block that is about to be read, unless it is verified already. Returns
+ * SIMFS_READ_ERROR if it does not match; the block then stays unverified, so that every later read fails as well.
+ */
+SIMFS_ERROR verifyBlock(SIMFS_INSTANCE *instance, SIMFS_INDEX_TYPE block)
+{
+    if (isBlockVerified(instance, block))
+        return SIMFS_NO_ERROR;
+    if (simfsCrc32c(0, &(instance->volume->block[block]), sizeof(SIMFS_BLOCK_TYPE)) !=
+        instance->volume->checksum[block])
+        return SIMFS_READ_ERROR;
+    simfsSetBit(instance->context->verified, block);
+    return SIMFS_NO_ERROR;
+}
+
+/*****
+ * Verifies the checksums of all allocated blocks that are not verified yet, or only of those that are not data
+ * blocks, a batch at a time. Returns the number of blocks whose checksum does not match.
+ */
+int verifyBlocks(SIMFS_INSTANCE *instance, int metadataOnly)
+{
+    const void *buffers[CHECKSUM_BATCH];
+    SIMFS_INDEX_TYPE blocks[CHECKSUM_BATCH];
+    unsigned int crcs[CHECKSUM_BATCH];
+    int bad = 0;
+
+    for (int i = 0; i < SIMFS_NUMBER_OF_BLOCKS; ) {
+        int count = 0;
+        for (; i < SIMFS_NUMBER_OF_BLOCKS && count < CHECKSUM_BATCH; ++i) {
+            if (!(instance->context->bitvector[i / 8] & (0x80 >> (i % 8))) || isBlockVerified(instance, i) ||
+                (metadataOnly && instance->volume->block[i].type == SIMFS_DATA_CONTENT_TYPE))
+                continue;
+            blocks[count] = i;
+            buffers[count++] = &(instance->volume->block[i]);
+        }
+
+        simfsCrc32cMany(buffers, sizeof(SIMFS_BLOCK_TYPE), count, crcs);
+        for (int k = 0; k < count; ++k) {
+            if (crcs[k] == instance->volume->checksum[blocks[k]])
+                simfsSetBit(instance->context->verified, blocks[k]);
+            else
+                bad++;
+        }
+    }
+    return bad;
+}
+
+/*****
+ * Sets up the verification of a volume that was just read and verifies its metadata. Without
+ * SIMFS_MOUNT_CHECKSUMS, or if the image was written without checksums, every block counts as verified.
+ *
+ * Returns SIMFS_READ_ERROR if a checksum does not match.
+ */
+SIMFS_ERROR startVerification(SIMFS_INSTANCE *instance, unsigned int options)
+{
+    if (!(options & SIMFS_MOUNT_CHECKSUMS) || !(instance->volume->superblock.attr.flags & SIMFS_SUPERBLOCK_CHECKSUMS)) {
+        memset(instance->context->verified, 0xFF, SIMFS_NUMBER_OF_BLOCKS / 8);
+        return SIMFS_NO_ERROR;
+    }
+
+    memset(instance->context->verified, 0, SIMFS_NUMBER_OF_BLOCKS / 8);
+    if (metadataChecksum(instance->volume) != instance->volume->superblock.attr.metadataChecksum ||
+        verifyBlocks(instance, 1) != 0)
+        return SIMFS_READ_ERROR;
+    return SIMFS_NO_ERROR;
+}
+
+/***
+ * Verifies every allocated block that was not verified since mounting in one pass over the volume, instead of
+ * on its first read. The number of blocks whose checksum does not match is stored in numberOfBadBlocks unless it
+ * is NULL; they stay unverified, so reading them keeps failing.
+ *
+ * Returns SIMFS_READ_ERROR if there is such a block. Without checksums, there is nothing to verify.
+ */
+SIMFS_ERROR verifyVolume(SIMFS_INSTANCE *instance, int *numberOfBadBlocks)
+{
+    int bad = verifyBlocks(instance, 0);
+    if (numberOfBadBlocks != NULL)
+        *numberOfBadBlocks = bad;
+    return bad == 0 ? SIMFS_NO_ERROR : SIMFS_READ_ERROR;
+}
+
+SIMFS_ERROR shareChildren(SIMFS_INSTANCE *instance, SIMFS_INDEX_TYPE index);
+void releaseBlock(SIMFS_INSTANCE *instance, SIMFS_INDEX_TYPE index);
+
+/*****
+ * Adds a reference to the block that the given reference refers to. A block that already has
+ * SIMFS_MAX_SHARED_COUNT references (a deduplicated data block, typically) is copied instead, with its own
+ * children shared, and the reference is moved to the copy.
+ *
+ * Returns SIMFS_ALLOC_ERROR if a copy is needed, but the volume is full; the reference is left alone then.
+ */
+SIMFS_ERROR shareBlock(SIMFS_INSTANCE *instance, SIMFS_INDEX_TYPE *reference)
+{
+    if (instance->volume->sharedCount[*reference] < SIMFS_MAX_SHARED_COUNT) {
+        instance->volume->sharedCount[*reference]++;
+        return SIMFS_NO_ERROR;
+    }
+
+    SIMFS_INDEX_TYPE copy = allocateFreeBlock(instance, instance->volume->block[*reference].type);
+    if (copy == SIMFS_INVALID_INDEX)
+        return SIMFS_ALLOC_ERROR;
+
+    memcpy(&(instance->volume->block[copy]), &(instance->volume->block[*reference]), sizeof(SIMFS_BLOCK_TYPE));
+    if (shareChildren(instance, copy) != SIMFS_NO_ERROR) {
+        markBlockFree(instance, copy);
+        return SIMFS_ALLOC_ERROR;
+    }
+    *reference = copy;
+    return SIMFS_NO_ERROR;
+}
+
+/*****
+ * Adds a reference to every block that the given block refers to.
+ *
+ * Returns SIMFS_ALLOC_ERROR if a block has to be copied by shareBlock(), but the volume is full. The references
+ * added so far are dropped again then.
+ */
+SIMFS_ERROR shareChildren(SIMFS_INSTANCE *instance, SIMFS_INDEX_TYPE index)
+{
+    SIMFS_BLOCK_TYPE *block = &(instance->volume->block[index]);
+    switch (block->type) {
+    case SIMFS_FOLDER_CONTENT_TYPE:
+    case SIMFS_FILE_CONTENT_TYPE: {
+        SIMFS_FILE_DESCRIPTOR_TYPE *fd = &(block->content.fileDescriptor);
+        if (fd->block_ref != SIMFS_INVALID_INDEX && shareBlock(instance, &(fd->block_ref)) != SIMFS_NO_ERROR)
+            return SIMFS_ALLOC_ERROR;
+        if (fd->nameBlock != SIMFS_INVALID_INDEX && shareBlock(instance, &(fd->nameBlock)) != SIMFS_NO_ERROR) {
+            if (fd->block_ref != SIMFS_INVALID_INDEX)
+                releaseBlock(instance, fd->block_ref);
+            return SIMFS_ALLOC_ERROR;
+        }
+        break;
+    }
+    case SIMFS_INDEX_CONTENT_TYPE:
+        for (int i = 0; i < SIMFS_INDEX_SIZE; ++i) {
+            if (block->content.index[i] != SIMFS_INVALID_INDEX &&
+                shareBlock(instance, &(block->content.index[i])) != SIMFS_NO_ERROR) {
+                while (--i >= 0)
+                    if (block->content.index[i] != SIMFS_INVALID_INDEX)
+                        releaseBlock(instance, block->content.index[i]);
+                return SIMFS_ALLOC_ERROR;
+            }
+        }
+        break;
+    case SIMFS_BTREE_CONTENT_TYPE:
+        for (int i = 0; i < block->content.btree.numberOfEntries; ++i) {
+            if (shareBlock(instance, &(block->content.btree.child[i])) != SIMFS_NO_ERROR) {
+                while (--i >= 0)
+                    releaseBlock(instance, block->content.btree.child[i]);
+                return SIMFS_ALLOC_ERROR;
+            }
+        }
+        break;
+    default:
+        break;
+    }
+    return SIMFS_NO_ERROR;
+}
+
+/*****
+ * Drops one reference to a block. The last reference frees the block and drops the references it holds.
+ */
+void releaseBlock(SIMFS_INSTANCE *instance, SIMFS_INDEX_TYPE index)
+{
+    if (instance->volume->sharedCount[index] > 0) {
+        instance->volume->sharedCount[index]--;
+        return;
+    }
+
+    SIMFS_BLOCK_TYPE *block = &(instance->volume->block[index]);
+    switch (block->type) {
+    case SIMFS_FOLDER_CONTENT_TYPE:
+    case SIMFS_FILE_CONTENT_TYPE:
+        if (block->content.fileDescriptor.block_ref != SIMFS_INVALID_INDEX)
+            releaseBlock(instance, block->content.fileDescriptor.block_ref);
+        if (block->content.fileDescriptor.nameBlock != SIMFS_INVALID_INDEX)
+            releaseBlock(instance, block->content.fileDescriptor.nameBlock);
+        break;
+    case SIMFS_INDEX_CONTENT_TYPE:
+        for (int i = 0; i < SIMFS_INDEX_SIZE; ++i)
+            if (block->content.index[i] != SIMFS_INVALID_INDEX)
+                releaseBlock(instance, block->content.index[i]);
+        break;
+    case SIMFS_BTREE_CONTENT_TYPE:
+        for (int i = 0; i < block->content.btree.numberOfEntries; ++i)
+            releaseBlock(instance, block->content.btree.child[i]);
+        break;
+    case SIMFS_DATA_CONTENT_TYPE:
+        if (instance->context->options & SIMFS_MOUNT_DEDUP)
+            removeFingerprint(instance, index);
+        break;
+    default:
+        break;
+    }
+    markBlockFree(instance, index);
+}
+
+/*****
+ * Returns a block that can be modified in place: the block itself if it is not shared, or a fresh clone of it.
+ * The caller must replace its reference to the old block with the returned one.
+ *
+ * Returns SIMFS_INVALID_INDEX if a clone is needed, but the volume is full, including when a block that the clone
+ * refers to already has SIMFS_MAX_SHARED_COUNT references and there is no room to copy it.
+ */
+SIMFS_INDEX_TYPE writableBlock(SIMFS_INSTANCE *instance, SIMFS_INDEX_TYPE index)
+{
+    if (instance->volume->sharedCount[index] == 0)
+        return index;
+
+    SIMFS_INDEX_TYPE clone = allocateFreeBlock(instance, instance->volume->block[index].type);
+    if (clone == SIMFS_INVALID_INDEX)
+        return SIMFS_INVALID_INDEX;
+
+    memcpy(&(instance->volume->block[clone]), &(instance->volume->block[index]), sizeof(SIMFS_BLOCK_TYPE));
+    if (shareChildren(instance, clone) != SIMFS_NO_ERROR) {
+        markBlockFree(instance, clone);
+        return SIMFS_INVALID_INDEX;
+    }
+    instance->volume->sharedCount[index]--;
+    return clone;
+}
+
+/*****
+ * Makes the k-th index block in the chain of a writable descriptor writable, cloning every shared index block
+ * on the way and relinking the chain to the clones.
+ */
+SIMFS_INDEX_TYPE writableChainBlock(SIMFS_INSTANCE *instance, SIMFS_FILE_DESCRIPTOR_TYPE *owner, int k)
+{
+    SIMFS_INDEX_TYPE *ref = &(owner->block_ref);
+    for (int i = 0; ; ++i) {
+        SIMFS_INDEX_TYPE block = writableBlock(instance, *ref);
+        if (block == SIMFS_INVALID_INDEX)
+            return SIMFS_INVALID_INDEX;
+        *ref = block;
+        if (i == k)
+            return block;
+        ref = &(instance->volume->block[block].content.index[LAST_POS]);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// readahead
+//
+// Content and folder entries are reached through chains of index blocks, and each hop to the next index block
+// or to a referenced block is a dependent load. Traversals of a chain are sequential, so the blocks they are
+// about to use are prefetched into the cache while the traversal works on the current ones.
+//
+//////////////////////////////////////////////////////////////////////////
+
+/*****
+ * Moves the readahead cursor to the next entry of the chain and prefetches the block it refers to.
+ */
+void moveReadaheadCursor(SIMFS_INSTANCE *instance, SIMFS_READAHEAD_TYPE *readahead)
+{
+    if (readahead->pos == LAST_POS) {
+        readahead->index_block = instance->volume->block[readahead->index_block].content.index[LAST_POS];
+        readahead->pos = 0;
+    }
+
+    SIMFS_INDEX_TYPE *index = instance->volume->block[readahead->index_block].content.index;
+    if (readahead->pos == 0 && readahead->remaining > LAST_POS)
+        __builtin_prefetch(&(instance->volume->block[index[LAST_POS]]));
+    if (index[readahead->pos] != SIMFS_INVALID_INDEX) // a hole in a sparse file
+        __builtin_prefetch(&(instance->volume->block[index[readahead->pos]].content));
+
+    readahead->pos++;
+    readahead->remaining--;
+    readahead->distance++;
+}
+
+/*****
+ * Starts readahead for a traversal of a chain of index blocks holding the given number of entries.
+ */
+void startReadahead(SIMFS_INSTANCE *instance, SIMFS_READAHEAD_TYPE *readahead, SIMFS_INDEX_TYPE index_block,
+        int entries)
+{
+    readahead->index_block = index_block;
+    readahead->pos = 0;
+    readahead->remaining = entries;
+    readahead->distance = 0;
+    readahead->window = instance->context->readaheadWindow;
+    readahead->consumed = 0;
+    readahead->consumedInWindow = 0;
+
+    if (entries > 0) {
+        __builtin_prefetch(&(instance->volume->block[index_block]));
+        if (entries > LAST_POS)
+            __builtin_prefetch(
+                &(instance->volume->block[instance->volume->block[index_block].content.index[LAST_POS]]));
+    }
+    while (readahead->distance < readahead->window && readahead->remaining > 0)
+        moveReadaheadCursor(instance, readahead);
+}
+
+/*****
+ * Tells the readahead that the traversal is about to use the next entry of the chain.
+ */
+void advanceReadahead(SIMFS_INSTANCE *instance, SIMFS_READAHEAD_TYPE *readahead)
+{
+    readahead->distance--;
+    readahead->consumed++;
+    if (++readahead->consumedInWindow == readahead->window) {
+        readahead->consumedInWindow = 0;
+        if (readahead->window < SIMFS_READAHEAD_MAX_WINDOW)
+            readahead->window *= 2;
+    }
+
+    while (readahead->distance < readahead->window && readahead->remaining > 0)
+        moveReadaheadCursor(instance, readahead);
+}
+
+/*****
+ * Ends the traversal. The window it reached carries over to the next traversal unless it prefetched more entries
+ * than it used, in which case the next traversal starts with half the window this one started with.
+ */
+void stopReadahead(SIMFS_INSTANCE *instance, SIMFS_READAHEAD_TYPE *readahead)
+{
+    int window = readahead->window;
+    if (readahead->distance > readahead->consumed)
+        window = instance->context->readaheadWindow / 2;
+    instance->context->readaheadWindow = (window < SIMFS_READAHEAD_MIN_WINDOW ? SIMFS_READAHEAD_MIN_WINDOW : window);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// B+tree folders
+//
+// Nodes are copied on write like every other block, so leaves are not linked to their siblings; entries with
+// equal keys are found by descending into every child whose range includes the key. Removal does not
+// rebalance: a node left empty is freed, and a root with a single child is replaced by that child.
+//
+//////////////////////////////////////////////////////////////////////////
+
+_Static_assert(sizeof(SIMFS_BTREE_NODE_TYPE) <= sizeof(SIMFS_FILE_DESCRIPTOR_TYPE),
+               "B+tree nodes must not make the blocks larger");
+
+SIMFS_BTREE_NODE_TYPE * btreeNode(SIMFS_INSTANCE *instance, SIMFS_INDEX_TYPE node)
+{
+    return &(instance->volume->block[node].content.btree);
+}
+
+/*****
+ * Finds the leaf entry with the given key that refers to the given file or, if file is SIMFS_INVALID_INDEX, to
+ * a file with the given name of the given length. The nodes and slots on the way are recorded in path and slot
+ * from depth on.
+ *
+ * Returns the depth of the leaf, or -1 if there is no such entry.
+ */
+int btreeFind(SIMFS_INSTANCE *instance, SIMFS_INDEX_TYPE node, unsigned int key, char *name, size_t length,
+              SIMFS_INDEX_TYPE file, int depth, SIMFS_INDEX_TYPE *path, int *slot)
+{
+    SIMFS_BTREE_NODE_TYPE * n = btreeNode(instance, node);
+    path[depth] = node;
+
+    if (n->level == 0) {
+        for (int i = 0; i < n->numberOfEntries && n->key[i] <= key; ++i) {
+            SIMFS_INDEX_TYPE child = n->child[i];
+            if (n->key[i] == key && (file != SIMFS_INVALID_INDEX ? child == file :
+                    descriptorHasName(instance, &(instance->volume->block[child].content.fileDescriptor), key, length,
+                                      name))) {
+                slot[depth] = i;
+                return depth;
+            }
+        }
+        return -1;
+    }
+
+    for (int i = 0; i < n->numberOfEntries && (i == 0 || n->key[i] <= key); ++i) {
+        if (i + 1 < n->numberOfEntries && n->key[i + 1] < key)
+            continue;
+        slot[depth] = i;
+        int leaf = btreeFind(instance, n->child[i], key, name, length, file, depth + 1, path, slot);
+        if (leaf >= 0)
+            return leaf;
+    }
+    return -1;
+}
+
+/*****
+ * Makes the nodes on a path found by btreeFind() writable, relinking the path to the clones.
+ */
+int btreeWritablePath(SIMFS_INSTANCE *instance, SIMFS_FILE_DESCRIPTOR_TYPE * folder, int leaf, SIMFS_INDEX_TYPE *path,
+        int *slot)
+{
+    SIMFS_INDEX_TYPE *ref = &(folder->block_ref);
+    for (int depth = 0; depth <= leaf; ++depth) {
+        SIMFS_INDEX_TYPE node = writableBlock(instance, *ref);
+        if (node == SIMFS_INVALID_INDEX)
+            return 0;
+        *ref = path[depth] = node;
+        ref = &(btreeNode(instance, node)->child[slot[depth]]);
+    }
+    return 1;
+}
+
+/*****
+ * Inserts an entry at the given position of a writable node. A full node is split in half; the new half goes to
+ * the spare block, which the caller has allocated.
+ *
+ * Returns the new right half, or SIMFS_INVALID_INDEX if the node did not split.
+ */
+SIMFS_INDEX_TYPE btreeInsertEntry(SIMFS_INSTANCE *instance, SIMFS_INDEX_TYPE node, int position, unsigned int key,
+                                  SIMFS_INDEX_TYPE child, SIMFS_INDEX_TYPE spare)
+{
+    SIMFS_BTREE_NODE_TYPE * n = btreeNode(instance, node);
+    int count = n->numberOfEntries;
+
+    if (count < SIMFS_BTREE_ORDER) {
+        memmove(&(n->key[position + 1]), &(n->key[position]), (count - position) * sizeof(n->key[0]));
+        memmove(&(n->child[position + 1]), &(n->child[position]), (count - position) * sizeof(n->child[0]));
+        n->key[position] = key;
+        n->child[position] = child;
+        n->numberOfEntries++;
+        return SIMFS_INVALID_INDEX;
+    }
+
+    unsigned int keys[SIMFS_BTREE_ORDER + 1];
+    SIMFS_INDEX_TYPE children[SIMFS_BTREE_ORDER + 1];
+    for (int i = 0, j = 0; i <= count; ++i) {
+        if (i == position) {
+            keys[i] = key;
+            children[i] = child;
+        } else {
+            keys[i] = n->key[j];
+            children[i] = n->child[j++];
+        }
+    }
+
+    SIMFS_INDEX_TYPE sibling = spare;
+    SIMFS_BTREE_NODE_TYPE * s = btreeNode(instance, sibling);
+    int left = (count + 1) / 2;
+    n->numberOfEntries = left;
+    memcpy(n->key, keys, left * sizeof(keys[0]));
+    memcpy(n->child, children, left * sizeof(children[0]));
+    s->numberOfEntries = count + 1 - left;
+    s->level = n->level;
+    memcpy(s->key, keys + left, s->numberOfEntries * sizeof(keys[0]));
+    memcpy(s->child, children + left, s->numberOfEntries * sizeof(children[0]));
+    return sibling;
+}
+
+/*****
+ * Adds an entry to the B+tree of a writable folder, cloning the shared nodes on the way to the leaf and
+ * splitting the full ones on the way back. The blocks for the splits are allocated before any node is split, so
+ * that running out of space never leaves a half-split tree behind.
+ *
+ * Returns SIMFS_ALLOC_ERROR if the volume is full; the tree is left without the entry then, possibly with some
+ * of the nodes on the way cloned.
+ */
+SIMFS_ERROR btreeInsert(SIMFS_INSTANCE *instance, SIMFS_FILE_DESCRIPTOR_TYPE * folder, unsigned int key,
+        SIMFS_INDEX_TYPE file)
+{
+    SIMFS_INDEX_TYPE path[SIMFS_BTREE_MAX_HEIGHT];
+    int slot[SIMFS_BTREE_MAX_HEIGHT];
+    SIMFS_INDEX_TYPE spare[SIMFS_BTREE_MAX_HEIGHT];
+
+    if (folder->block_ref == SIMFS_INVALID_INDEX) {
+        folder->block_ref = allocateFreeBlock(instance, SIMFS_BTREE_CONTENT_TYPE);
+        if (folder->block_ref == SIMFS_INVALID_INDEX)
+            return SIMFS_ALLOC_ERROR;
+    }
+
+    int height = btreeNode(instance, folder->block_ref)->level + 1;
+    if (height == SIMFS_BTREE_MAX_HEIGHT)
+        return SIMFS_ALLOC_ERROR;
+
+    SIMFS_INDEX_TYPE *ref = &(folder->block_ref);
+    int leaf = 0;
+    for (;; ++leaf) {
+        SIMFS_INDEX_TYPE node = writableBlock(instance, *ref);
+        if (node == SIMFS_INVALID_INDEX)
+            return SIMFS_ALLOC_ERROR;
+        *ref = path[leaf] = node;
+
+        SIMFS_BTREE_NODE_TYPE * n = btreeNode(instance, node);
+        int i = 0;
+        if (n->level == 0) {
+            while (i < n->numberOfEntries && n->key[i] <= key)
+                ++i;
+            slot[leaf] = i;
+            break;
+        }
+
+        while (i + 1 < n->numberOfEntries && n->key[i + 1] <= key)
+            ++i;
+        if (key < n->key[i])
+            n->key[i] = key; // keeps the key a lower bound of the child
+        slot[leaf] = i;
+        ref = &(n->child[i]);
+    }
+
+    // the full nodes from the leaf up split, and a new root is needed if the old one does
+    int splits = 0;
+    while (splits <= leaf && btreeNode(instance, path[leaf - splits])->numberOfEntries == SIMFS_BTREE_ORDER)
+        ++splits;
+    int spares = splits + (splits > leaf);
+    for (int i = 0; i < spares; ++i) {
+        spare[i] = allocateFreeBlock(instance, SIMFS_BTREE_CONTENT_TYPE);
+        if (spare[i] == SIMFS_INVALID_INDEX) {
+            while (--i >= 0)
+                releaseBlock(instance, spare[i]);
+            return SIMFS_ALLOC_ERROR;
+        }
+    }
+
+    // a split hands the new right half up to the parent, to be placed after the half that was split
+    for (int depth = leaf; depth >= 0; --depth) {
+        int position = (depth == leaf ? slot[depth] : slot[depth] + 1);
+        SIMFS_INDEX_TYPE sibling = btreeInsertEntry(instance, path[depth], position, key, file, spare[leaf - depth]);
+        if (sibling == SIMFS_INVALID_INDEX)
+            return SIMFS_NO_ERROR;
+        key = btreeNode(instance, sibling)->key[0];
+        file = sibling;
+    }
+
+    SIMFS_INDEX_TYPE root = spare[leaf + 1];
+    SIMFS_BTREE_NODE_TYPE * n = btreeNode(instance, root);
+    n->level = btreeNode(instance, folder->block_ref)->level + 1;
+    n->numberOfEntries = 2;
+    n->key[0] = btreeNode(instance, folder->block_ref)->key[0];
+    n->child[0] = folder->block_ref;
+    n->key[1] = key;
+    n->child[1] = file;
+    folder->block_ref = root;
+    return SIMFS_NO_ERROR;
+}
+
+/*****
+ * Removes the entry for a file from the B+tree of a writable folder.
+ */
+SIMFS_ERROR btreeRemove(SIMFS_INSTANCE *instance, SIMFS_FILE_DESCRIPTOR_TYPE * folder, SIMFS_INDEX_TYPE file)
+{
+    SIMFS_INDEX_TYPE path[SIMFS_BTREE_MAX_HEIGHT];
+    int slot[SIMFS_BTREE_MAX_HEIGHT];
+
+    unsigned int key = instance->volume->block[file].content.fileDescriptor.nameKey;
+    int leaf = btreeFind(instance, folder->block_ref, key, NULL, 0, file, 0, path, slot);
+    if (leaf < 0)
+        return SIMFS_NOT_FOUND_ERROR;
+    if (!btreeWritablePath(instance, folder, leaf, path, slot))
+        return SIMFS_ALLOC_ERROR;
+
+    for (int depth = leaf; depth >= 0; --depth) {
+        SIMFS_BTREE_NODE_TYPE * n = btreeNode(instance, path[depth]);
+        int i = slot[depth];
+        memmove(&(n->key[i]), &(n->key[i + 1]), (n->numberOfEntries - i - 1) * sizeof(n->key[0]));
+        memmove(&(n->child[i]), &(n->child[i + 1]), (n->numberOfEntries - i - 1) * sizeof(n->child[0]));
+        if (--n->numberOfEntries > 0)
+            break;
+
+        releaseBlock(instance, path[depth]);
+        if (depth == 0)
+            folder->block_ref = SIMFS_INVALID_INDEX;
+    }
+
+    // the root is on the path, so it is writable and its only child simply moves up
+    while (folder->block_ref != SIMFS_INVALID_INDEX && btreeNode(instance, folder->block_ref)->level > 0 &&
+           btreeNode(instance, folder->block_ref)->numberOfEntries == 1) {
+        SIMFS_INDEX_TYPE root = folder->block_ref;
+        folder->block_ref = btreeNode(instance, root)->child[0];
+        btreeNode(instance, root)->numberOfEntries = 0;
+        releaseBlock(instance, root);
+    }
+    return SIMFS_NO_ERROR;
+}
+
+/*****
+ * Moves the entries of a writable folder from its index block chain to a new B+tree. The tree takes its own
+ * reference to every entry before the chain is released, which leaves the entries in place if the chain is
+ * still shared with a snapshot.
+ *
+ * Returns SIMFS_ALLOC_ERROR if the volume has no room for the tree, or an entry already has
+ * SIMFS_MAX_SHARED_COUNT references; the partial tree is released then, and the folder keeps its chain.
+ */
+SIMFS_ERROR convertFolderToBtree(SIMFS_INSTANCE *instance, SIMFS_FILE_DESCRIPTOR_TYPE * folder)
+{
+    // split leaves are at least half full, and there are no more inner nodes than leaves
+    int needed = 4 * folder->size / SIMFS_BTREE_ORDER + 2 * SIMFS_BTREE_MAX_HEIGHT;
+    if (countFreeBlocks(instance) < needed)
+        return SIMFS_ALLOC_ERROR;
+
+    SIMFS_FILE_DESCRIPTOR_TYPE tree;
+    tree.block_ref = SIMFS_INVALID_INDEX;
+
+    SIMFS_INDEX_TYPE index_block = folder->block_ref;
+    for (size_t i = 0; i < folder->size; ++i) {
+        if (i > 0 && i % LAST_POS == 0)
+            index_block = instance->volume->block[index_block].content.index[LAST_POS];
+
+        SIMFS_INDEX_TYPE child = instance->volume->block[index_block].content.index[i % LAST_POS];
+        unsigned int key = instance->volume->block[child].content.fileDescriptor.nameKey;
+        if (instance->volume->sharedCount[child] == SIMFS_MAX_SHARED_COUNT ||
+            btreeInsert(instance, &tree, key, child) != SIMFS_NO_ERROR) {
+            // drops the references taken by the tree so far along with its nodes
+            if (tree.block_ref != SIMFS_INVALID_INDEX)
+                releaseBlock(instance, tree.block_ref);
+            return SIMFS_ALLOC_ERROR;
+        }
+        instance->volume->sharedCount[child]++;
+    }
+
+    if (folder->block_ref != SIMFS_INVALID_INDEX)
+        releaseBlock(instance, folder->block_ref);
+    folder->block_ref = tree.block_ref;
+    folder->flags |= SIMFS_BTREE_FLAG;
+    return SIMFS_NO_ERROR;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// in-memory directory
+//
+//////////////////////////////////////////////////////////////////////////
+
+/*****
+ * Returns the list of the directory that holds the entries of files with the given name key.
+ */
+SIMFS_DIR_ENT ** directoryList(SIMFS_INSTANCE *instance, unsigned int key)
+{
+    return &(instance->context->directory[key % SIMFS_DIRECTORY_SIZE]);
+}
+
+void addFileToDirectory(SIMFS_INSTANCE *instance, SIMFS_INDEX_TYPE file)
+{
+    //Create a new entry
+    SIMFS_DIR_ENT * newEnt = malloc(sizeof(SIMFS_DIR_ENT));
+    newEnt->nodeReference = file;
+    newEnt->uniqueFileIdentifier = instance->volume->block[file].content.fileDescriptor.identifier;
+    newEnt->globalOpenFileTableIndex = SIMFS_INVALID_OPEN_FILE_TABLE_INDEX;
+
+    //Add entry to front of the list
+    SIMFS_DIR_ENT ** ent = directoryList(instance, instance->volume->block[file].content.fileDescriptor.nameKey);
+    newEnt->next = *ent;
+    *ent = newEnt;
+}
+
+SIMFS_DIR_ENT ** findFileInDirectory(SIMFS_INSTANCE *instance, SIMFS_INDEX_TYPE file)
+{
+    unsigned long long id = instance->volume->block[file].content.fileDescriptor.identifier;
+    SIMFS_DIR_ENT ** ent = directoryList(instance, instance->volume->block[file].content.fileDescriptor.nameKey);
+    while(*ent != NULL) {
+        if ( (*ent)->nodeReference == file && (*ent)->uniqueFileIdentifier == id )
+            return ent;
+        ent = &((*ent)->next);
+    }
+    return NULL;
+}
+
+void addFolderToDirectory(SIMFS_INSTANCE *instance, SIMFS_INDEX_TYPE folder);
+
+void addEntryToDirectory(SIMFS_INSTANCE *instance, SIMFS_INDEX_TYPE child)
+{
+    addFileToDirectory(instance, child);
+    if (instance->volume->block[child].type == SIMFS_FOLDER_CONTENT_TYPE)
+        addFolderToDirectory(instance, child);
+}
+
+void addBtreeToDirectory(SIMFS_INSTANCE *instance, SIMFS_INDEX_TYPE node)
+{
+    SIMFS_BTREE_NODE_TYPE * n = btreeNode(instance, node);
+    for (int i = 0; i < n->numberOfEntries; ++i) {
+        if (n->level > 0)
+            addBtreeToDirectory(instance, n->child[i]);
+        else
+            addEntryToDirectory(instance, n->child[i]);
+    }
+}
+
+/*****
+ * Recursively adds all files and folders in a folder to the directory.
+ */
+void addFolderToDirectory(SIMFS_INSTANCE *instance, SIMFS_INDEX_TYPE folder)
+{
+    SIMFS_FILE_DESCRIPTOR_TYPE * fd = &(instance->volume->block[folder].content.fileDescriptor);
+    if (fd->flags & SIMFS_BTREE_FLAG) {
+        if (fd->block_ref != SIMFS_INVALID_INDEX)
+            addBtreeToDirectory(instance, fd->block_ref);
+        return;
+    }
+
+    SIMFS_INDEX_TYPE index_block = fd->block_ref;
+    for (size_t i = 0; i < fd->size; ++i) {
+        if (i > 0 && i % LAST_POS == 0)
+            index_block = instance->volume->block[index_block].content.index[LAST_POS];
+        addEntryToDirectory(instance, instance->volume->block[index_block].content.index[i % LAST_POS]);
+    }
+}
+
+void freeDirectory(SIMFS_INSTANCE *instance)
+{
+    for (int i = 0; i < SIMFS_DIRECTORY_SIZE; i++) {
+        while (instance->context->directory[i] != NULL) {
+            SIMFS_DIR_ENT * trash_ent = instance->context->directory[i];
+            instance->context->directory[i] = trash_ent->next;
+            free(trash_ent);
+        }
+    }
+}
+
+void freeProcessControlBlocks(SIMFS_INSTANCE *instance)
+{
+    while (instance->context->processControlBlocks != NULL) {
+        SIMFS_PROCESS_CONTROL_BLOCK_TYPE * pcb = instance->context->processControlBlocks;
+        instance->context->processControlBlocks = pcb->next;
+        free(pcb);
+    }
+}
+
+/*****
+ * A descriptor has been cloned; points the directory and the open file tables to the clone.
+ */
+void relocateDescriptor(SIMFS_INSTANCE *instance, SIMFS_INDEX_TYPE from, SIMFS_INDEX_TYPE to)
+{
+    SIMFS_DIR_ENT ** ent = findFileInDirectory(instance, from);
+    if (ent != NULL)
+        (*ent)->nodeReference = to;
+
+    for (int i = 0; i < SIMFS_MAX_NUMBER_OF_OPEN_FILES; i++)
+        if (instance->context->globalOpenFileTable[i].type != SIMFS_INVALID_CONTENT_TYPE &&
+            instance->context->globalOpenFileTable[i].fileDescriptor == from)
+            instance->context->globalOpenFileTable[i].fileDescriptor = to;
+}
+
+/*****
+ * The root folder has been cloned; moves the superblock and every process that works in the root along with it.
+ */
+void relocateRoot(SIMFS_INSTANCE *instance, SIMFS_INDEX_TYPE to)
+{
+    SIMFS_PROCESS_CONTROL_BLOCK_TYPE * pcb = instance->context->processControlBlocks;
+    for (; pcb != NULL; pcb = pcb->next)
+        if (pcb->currentWorkingDirectory == instance->context->rootNodeIndex)
+            pcb->currentWorkingDirectory = to;
+
+    instance->context->rootNodeIndex = to;
+    instance->volume->superblock.attr.rootNodeIndex = to;
+}
+
+/***
+ * Allocates space for the file system and saves it to disk.
+ */
+SIMFS_ERROR simfsCreateFileSystem(char *simfsFileName)
+{
+    printf("Creating File System\n");
+    printf("  Size of SIMFS_VOLUME: %ld\n", sizeof(SIMFS_VOLUME));
+    printf("  Size of SIMFS_CONTEXT_TYPE: %ld\n", sizeof(SIMFS_CONTEXT_TYPE));
+
+    SIMFS_IO_FILE_TYPE file;
+    if (simfsIoOpen(&file, simfsFileName, 1, 0) != 0)
+        return SIMFS_ALLOC_ERROR;
+
+    // the new volume is built in an instance of its own, which has no context since it is never mounted
+    SIMFS_INSTANCE created = { malloc(sizeof(SIMFS_VOLUME)), NULL };
+    if (created.volume == NULL) {
+        simfsIoClose(&file);
+        return SIMFS_ALLOC_ERROR;
+    }
+
+    // no snapshots, no shared blocks
+    memset(created.volume, 0, sizeof(SIMFS_VOLUME));
+
+    // initialize the superblock
+    created.volume->superblock.attr.nextUniqueIdentifier = SIMFS_INITIAL_VALUE_OF_THE_UNIQUE_FILE_IDENTIFIER;
+    created.volume->superblock.attr.rootNodeIndex = SIMFS_ROOT_NODE_INDEX;
+    created.volume->superblock.attr.blockSize = SIMFS_BLOCK_SIZE;
+    created.volume->superblock.attr.numberOfBlocks = SIMFS_NUMBER_OF_BLOCKS;
+
+    // initialize the bitvector
+    memset(created.volume->bitvector, 0, SIMFS_NUMBER_OF_BLOCKS / 8);
+
+    // initialize the root folder
+    simfsFlipBit(created.volume->bitvector, SIMFS_ROOT_NODE_INDEX);
+    setNewFileDescriptorFields(&created, SIMFS_ROOT_NODE_INDEX, SIMFS_FOLDER_CONTENT_TYPE, "/", umask(00000), 0);
+    
+    // using the function to find a free block for testing purposes
+    int written = (simfsIoWrite(&file, created.volume, sizeof(SIMFS_VOLUME), 0) == 0);
+    if (simfsIoClose(&file) != 0)
+        written = 0;
+    free(created.volume);
+
+    return written ? SIMFS_NO_ERROR : SIMFS_WRITE_ERROR;
+}
+
+/*****
+ * Returns the SIMFS_IO_* flags for loading and saving the image with the given SIMFS_MOUNT_* options.
+ */
+unsigned int imageIoFlags(unsigned int options)
+{
+    return ((options & SIMFS_MOUNT_IO_URING) ? SIMFS_IO_URING : 0) |
+           ((options & SIMFS_MOUNT_DIRECT_IO) ? SIMFS_IO_DIRECT : 0);
+}
+
+/*****
+ * Loads a volume image from a disk into a new volume. Returns SIMFS_ALLOC_ERROR if the volume cannot be allocated
+ * or the image cannot be opened, and SIMFS_READ_ERROR if the image is shorter than a volume.
+ */
+SIMFS_ERROR mountVolume(SIMFS_INSTANCE *instance, char * simfsFileName, unsigned int options)
+{
+    instance->volume = simfsIoAllocate(sizeof(SIMFS_VOLUME));
+    if (instance->volume == NULL)
+        return SIMFS_ALLOC_ERROR;
+
+    SIMFS_IO_FILE_TYPE file;
+    if (simfsIoOpen(&file, simfsFileName, 0, imageIoFlags(options)) != 0) {
+        free(instance->volume);
+        return SIMFS_ALLOC_ERROR;
+    }
+
+    // the image is read from start to end, so the kernel can read ahead as far as it likes
+    posix_fadvise(file.descriptor, 0, 0, POSIX_FADV_SEQUENTIAL);
+    int read = (simfsIoRead(&file, instance->volume, sizeof(SIMFS_VOLUME), 0) == 0);
+    simfsIoClose(&file);
+    if (!read) {
+        free(instance->volume);
+        return SIMFS_READ_ERROR;
+    }
+
+    return SIMFS_NO_ERROR;
+}
+
+unsigned long long elapsedNanoseconds(struct timespec *from, struct timespec *to)
+{
+    return (unsigned long long) (to->tv_sec - from->tv_sec) * 1000000000ULL + to->tv_nsec - from->tv_nsec;
+}
+
+/*****
+ * Writes a volume image to a disk. The image is written to a temporary file that replaces the old image only after
+ * it is complete, so that the image on the disk is always a consistent checkpoint. The checksums in the image are
+ * computed first. The image is written with the backend chosen by the mount options.
+ */
+SIMFS_ERROR saveVolume(SIMFS_INSTANCE *instance, char *simfsFileName, SIMFS_VOLUME *volume)
+{
+    char *temporaryFileName = malloc(strlen(simfsFileName) + sizeof(".tmp"));
+    if (temporaryFileName == NULL)
+        return SIMFS_ALLOC_ERROR;
+    sprintf(temporaryFileName, "%s.tmp", simfsFileName);
+
+    sealVolume(instance, volume);
+
+    SIMFS_ERROR error = SIMFS_WRITE_ERROR;
+    SIMFS_IO_FILE_TYPE file;
+    if (simfsIoOpen(&file, temporaryFileName, 1, imageIoFlags(instance->context->options)) == 0) {
+        int written = simfsIoWrite(&file, volume, sizeof(SIMFS_VOLUME), 0) == 0;
+        int flushed = written && simfsIoFlush(&file) == 0;
+        if (simfsIoClose(&file) == 0 && flushed && rename(temporaryFileName, simfsFileName) == 0)
+            error = SIMFS_NO_ERROR;
+    }
+
+    if (error != SIMFS_NO_ERROR)
+        remove(temporaryFileName);
+    free(temporaryFileName);
+    return error;
+}
+
+SIMFS_ERROR mountContext(SIMFS_INSTANCE *instance, SIMFS_INDEX_TYPE rootNodeIndex, unsigned int options)
+{
+    instance->context = malloc(sizeof(SIMFS_CONTEXT_TYPE));
+    if (instance->context == NULL)
+        return SIMFS_ALLOC_ERROR;
+
+    for (int i = 0; i < SIMFS_MAX_NUMBER_OF_OPEN_FILES; i++)
+        instance->context->globalOpenFileTable[i].type = SIMFS_INVALID_CONTENT_TYPE;  // indicates  empty slot
+
+    for (int i = 0; i < SIMFS_DIRECTORY_SIZE; i++)
+        instance->context->directory[i] = NULL;
+
+    memcpy(instance->context->bitvector, instance->volume->bitvector, SIMFS_NUMBER_OF_BLOCKS / 8);
+    rebuildFreeSpace(instance);
+    instance->context->allocationGoal = 0;
+    instance->context->nextAffinityGroup = 0;
+    instance->context->numberOfThreads = 0;
+    instance->context->readaheadWindow = SIMFS_READAHEAD_MIN_WINDOW;
+
+    instance->context->processControlBlocks = NULL;
+    instance->context->rootNodeIndex = rootNodeIndex;
+    instance->context->readOnly = 0;
+    instance->context->options = options;
+
+    // nothing is taken from the volume before its metadata is known to be intact
+    if (startVerification(instance, options) != SIMFS_NO_ERROR) {
+        free(instance->context);
+        return SIMFS_READ_ERROR;
+    }
+
+    pthread_mutex_init(&(instance->context->lock), NULL);
+    memset(&(instance->context->writeback), 0, sizeof(SIMFS_WRITEBACK_TYPE));
+    pthread_mutex_init(&(instance->context->writeback.lock), NULL);
+    pthread_cond_init(&(instance->context->writeback.wakeup), NULL);
+    pthread_cond_init(&(instance->context->writeback.flushed), NULL);
+    memset(&(instance->context->trace), 0, sizeof(SIMFS_TRACE_TYPE));
+
+    addFolderToDirectory(instance, rootNodeIndex);
+
+    for (int i = 0; i < SIMFS_FINGERPRINT_TABLE_SIZE; i++)
+        instance->context->fingerprint[i].block = SIMFS_INVALID_INDEX;
+    if (options & SIMFS_MOUNT_DEDUP)
+        rebuildFingerprints(instance);
+
+    return SIMFS_NO_ERROR;
+}
+
+/***
+ * Loads the file system from a disk and constructs in-memory directory of all files is the system.
+ *
+ * Starting with the file system root (pointed to from the superblock) traverses the hierarchy of directories
+ * and adds an entry for each folder or file to the directory by hashing the name and adding a directory
+ * entry node to the conflict resolution list for that entry. If the entry is NULL, the new node will be
+ * the only element of that list. If the list contains more than one element, then multiple files hashed to
+ * the same value, so the unique file identifier can be used to determine which entry is applicable. The
+ * identifier must be the same as the identifier in the file descriptor pointed to by the node reference.
+ *
+ * The function sets the current working directory to refer to the block holding the root of the volume. This will
+ * be changed as the user navigates the file system hierarchy.
+ *
+ * The mounted volume is kept in the instance, which is passed to every operation on it and on down to the helpers
+ * that carry it out. Any number of instances can be mounted at the same time. What the library remembers about a
+ * calling thread (its allocation group and its number in a trace) is kept in the context of each instance, so
+ * instances share no state, and operations on different instances run in parallel.
+ */
+SIMFS_ERROR simfsMountFileSystem(SIMFS_INSTANCE *instance, char *simfsFileName)
+{
+    return simfsMountFileSystemWithOptions(instance, simfsFileName, 0);
+}
+
+/***
+ * Mounts the file system like simfsMountFileSystem() with a combination of SIMFS_MOUNT_* options:
+ *
+ *    - SIMFS_MOUNT_DEDUP: data blocks are fingerprinted, and a write that produces a data block with the same
+ *      content as an existing one shares that block instead of acquiring a new one. The fingerprint index is
+ *      built from the allocated data blocks on mounting.
+ *    - SIMFS_MOUNT_RELATIME: a read moves the access time of a file only if it is not later than the modification
+ *      time, or is older than SIMFS_RELATIME_INTERVAL.
+ *    - SIMFS_MOUNT_NOATIME: reads never move the access time. It takes precedence over SIMFS_MOUNT_RELATIME.
+ *    - SIMFS_MOUNT_CHECKSUMS: every block is verified against the checksum it had when the image was written; the
+ *      metadata on mounting, and a data block on its first read. A mismatch makes the mount, or the read,
+ *      fail with SIMFS_READ_ERROR; simfsVerifyVolume() verifies all blocks at once. The checksums are written with
+ *      the image. An image written without this option has no checksums, and every block counts as verified.
+ *    - SIMFS_MOUNT_IO_URING: the image is loaded, and saved on unmounting and by the writeback thread, with up to
+ *      SIMFS_IO_QUEUE_DEPTH requests in flight on an io_uring instead of one pread()/pwrite() at a time. A kernel
+ *      without io_uring falls back to pread()/pwrite().
+ *    - SIMFS_MOUNT_DIRECT_IO: the image is loaded and saved with O_DIRECT, bypassing the page cache. A file system
+ *      without O_DIRECT falls back to buffered I/O.
+ *
+ * Without SIMFS_MOUNT_RELATIME or SIMFS_MOUNT_NOATIME, every read moves the access time. Either way, the access
+ * time is only cached in the open file table and written back to the descriptor on closing, simfsSync(), or
+ * unmounting.
+ */
+SIMFS_ERROR simfsMountFileSystemWithOptions(SIMFS_INSTANCE *instance, char *simfsFileName, unsigned int options)
+{
+    // TODO: complete
+
+    SIMFS_ERROR error;
+
+    error = mountVolume(instance, simfsFileName, options);
+    if (error != SIMFS_NO_ERROR)
+        return error;
+
+    error = mountContext(instance, instance->volume->superblock.attr.rootNodeIndex, options);
+    if (error != SIMFS_NO_ERROR) {
+        free(instance->volume);
+        return error;
+    }
+
+    return SIMFS_NO_ERROR;
+}
+
+void writeBackAllAttributes(SIMFS_INSTANCE *instance, struct fuse_context * context);
+
+/***
+ * Saves the file system to a disk and de-allocates the memory.
+ *
+ * Assumes that all synchronization has been done. The cached attributes of open files are written back to their
+ * descriptors first. A running writeback thread is stopped then; if it has
+ * already written every change to the same image, the image is not written again. A trace being captured is
+ * closed.
+ *
+ */
+SIMFS_ERROR simfsUmountFileSystem(SIMFS_INSTANCE *instance, char *simfsFileName)
+{
+    SIMFS_WRITEBACK_TYPE * writeback = &(instance->context->writeback);
+    int saved = 0;
+
+    // under the volume lock, so that the writeback thread does not capture a checkpoint halfway through
+    pthread_mutex_lock(&(instance->context->lock));
+    writeBackAllAttributes(instance, simfs_debug_get_context());
+    pthread_mutex_unlock(&(instance->context->lock));
+
+    if (writeback->running) {
+        saved = (strcmp(writeback->fileName, simfsFileName) == 0);
+        if (simfsStopWriteback(instance) != SIMFS_NO_ERROR)
+            saved = 0;
+    }
+
+    if (instance->context->trace.file != NULL)
+        simfsStopTrace(instance);
+
+    // a mounted snapshot is read-only, so there is nothing to save
+    if (!instance->context->readOnly && !saved) {
+        SIMFS_ERROR error = saveVolume(instance, simfsFileName, instance->volume);
+        if (error != SIMFS_NO_ERROR)
+            return error;
+    }
+
+    pthread_cond_destroy(&(writeback->flushed));
+    pthread_cond_destroy(&(writeback->wakeup));
+    pthread_mutex_destroy(&(writeback->lock));
+    pthread_mutex_destroy(&(instance->context->lock));
+
+    freeDirectory(instance);
+    freeProcessControlBlocks(instance);
+    free(instance->volume);
+    free(instance->context);
+    instance->volume = NULL;
+    instance->context = NULL;
+
+    return SIMFS_NO_ERROR;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+SIMFS_PROCESS_CONTROL_BLOCK_TYPE * findPCBByPID(SIMFS_INSTANCE *instance, pid_t pid)
+{
+    SIMFS_PROCESS_CONTROL_BLOCK_TYPE * pcb = instance->context->processControlBlocks;
+    while ( pcb != NULL ) {
+        if (pcb->pid == pid)
+            return pcb;
+        pcb = pcb->next;
+    }
+    return NULL;
+}
+
+SIMFS_INDEX_TYPE getCurrentWorkingDirectory(SIMFS_INSTANCE *instance, struct fuse_context * context)
+{
+    
+    SIMFS_PROCESS_CONTROL_BLOCK_TYPE * pcb = findPCBByPID(instance, context->pid);
+    SIMFS_INDEX_TYPE cwd = SIMFS_INVALID_INDEX;
+    if ( pcb == NULL )
+        cwd = instance->context->rootNodeIndex;
+    else
+        cwd = pcb->currentWorkingDirectory;
+    return cwd;
+}
+
+/*****
+ * Makes the current working directory writable. Processes cannot leave the root yet, and the root is the only
+ * folder that can be cloned without a reference to its parent, so that is the only one that may move here.
+ */
+SIMFS_INDEX_TYPE writableWorkingDirectory(SIMFS_INSTANCE *instance, struct fuse_context * context)
+{
+    SIMFS_INDEX_TYPE cwd = getCurrentWorkingDirectory(instance, context);
+    if (cwd != instance->context->rootNodeIndex)
+        return cwd;
+
+    SIMFS_INDEX_TYPE root = writableBlock(instance, cwd);
+    if (root != SIMFS_INVALID_INDEX && root != cwd)
+        relocateRoot(instance, root);
+    return root;
+}
+
+/*****
+ * Looks a name with the given key and length up among the first size entries of an index block. The keys of the
+ * entries are gathered and compared with the key all at once, and only the entries whose key matches are compared
+ * by name.
+ */
+SIMFS_INDEX_TYPE findFileInIndexBlock(SIMFS_INSTANCE *instance, SIMFS_NAME_TYPE name, unsigned int key, size_t length,
+        SIMFS_INDEX_TYPE index, unsigned short size, int * pos, SIMFS_READAHEAD_TYPE * readahead)
+{
+    SIMFS_INDEX_TYPE *entries = instance->volume->block[index].content.index;
+    unsigned int keys[LAST_POS];
+    for (int i=0; i<size; ++i) {
+        advanceReadahead(instance, readahead);
+        keys[i] = instance->volume->block[entries[i]].content.fileDescriptor.nameKey;
+    }
+
+    unsigned char matches[LAST_POS];
+    for (int i=0; i<size; ++i)
+        matches[i] = (keys[i] == key);
+
+    for (int i=0; i<size; ++i) {
+        if (matches[i] &&
+            descriptorHasName(instance, &(instance->volume->block[entries[i]].content.fileDescriptor), key, length,
+                              name)) {
+            if (pos != NULL)
+                *pos = i;
+            return entries[i];
+        }
+    }
+    if (pos != NULL)
+        *pos = 0;
+    return SIMFS_INVALID_INDEX;
+}
+
+/*****
+ * Looks a name up in a folder. The position of the entry in the folder's index block chain is returned
+ * through the parameter position; it is 0 for folders held in a B+tree.
+ */
+SIMFS_INDEX_TYPE findFileInFolder(SIMFS_INSTANCE *instance, SIMFS_FILE_DESCRIPTOR_TYPE * folder, SIMFS_NAME_TYPE name,
+        int *position)
+{
+    if (folder->flags & SIMFS_BTREE_FLAG) {
+        SIMFS_INDEX_TYPE path[SIMFS_BTREE_MAX_HEIGHT];
+        int slot[SIMFS_BTREE_MAX_HEIGHT];
+        if (position != NULL)
+            *position = 0;
+        if (folder->block_ref == SIMFS_INVALID_INDEX)
+            return SIMFS_INVALID_INDEX;
+
+        int leaf = btreeFind(instance, folder->block_ref, simfsNameKey(name), name, strlen(name), SIMFS_INVALID_INDEX,
+                             0, path, slot);
+        return (leaf < 0 ? SIMFS_INVALID_INDEX : btreeNode(instance, path[leaf])->child[slot[leaf]]);
+    }
+
+    unsigned int key = simfsNameKey(name);
+    size_t length = strlen(name);
+    SIMFS_INDEX_TYPE index_block = folder->block_ref;
+    int remaining = folder->size;
+    SIMFS_READAHEAD_TYPE readahead;
+    startReadahead(instance, &readahead, index_block, remaining);
+    for (int first = 0; remaining > 0; first += LAST_POS, remaining -= LAST_POS) {
+        int pos;
+        SIMFS_INDEX_TYPE test = findFileInIndexBlock(instance, name, key, length, index_block,
+                remaining < LAST_POS ? remaining : LAST_POS, &pos, &readahead);
+        if (test != SIMFS_INVALID_INDEX) {
+            if (position != NULL)
+                *position = first + pos;
+            stopReadahead(instance, &readahead);
+            return test;
+        }
+
+        index_block = instance->volume->block[index_block].content.index[LAST_POS];
+    }
+
+    stopReadahead(instance, &readahead);
+    return SIMFS_INVALID_INDEX;
+}
+
+/*****
+ * Looks several names up in a folder at once. The descriptor of each name is returned in files, or
+ * SIMFS_INVALID_INDEX if the folder has no entry with that name.
+ *
+ * A B+tree folder is searched for each name. A folder held in a chain of index blocks is scanned only once, and
+ * every entry is compared with all names; the keys stored in the descriptors are compared before the names
+ * themselves.
+ */
+SIMFS_ERROR findFilesInFolder(SIMFS_INSTANCE *instance, SIMFS_FILE_DESCRIPTOR_TYPE * folder, int numberOfNames,
+        char **names, SIMFS_INDEX_TYPE *files)
+{
+    for (int i = 0; i < numberOfNames; ++i)
+        files[i] = SIMFS_INVALID_INDEX;
+
+    if (folder->flags & SIMFS_BTREE_FLAG) {
+        for (int i = 0; i < numberOfNames; ++i)
+            files[i] = findFileInFolder(instance, folder, names[i], NULL);
+        return SIMFS_NO_ERROR;
+    }
+
+    unsigned int *keys = malloc(numberOfNames * sizeof(unsigned int));
+    if (keys == NULL)
+        return SIMFS_ALLOC_ERROR;
+    for (int i = 0; i < numberOfNames; ++i)
+        keys[i] = simfsNameKey(names[i]);
+
+    SIMFS_INDEX_TYPE index_block = folder->block_ref;
+    SIMFS_READAHEAD_TYPE readahead;
+    startReadahead(instance, &readahead, index_block, folder->size);
+    for (size_t k = 0; k < folder->size; ++k) {
+        if (k > 0 && k % LAST_POS == 0)
+            index_block = instance->volume->block[index_block].content.index[LAST_POS];
+        advanceReadahead(instance, &readahead);
+
+        SIMFS_INDEX_TYPE entry = instance->volume->block[index_block].content.index[k % LAST_POS];
+        SIMFS_FILE_DESCRIPTOR_TYPE * fd = &(instance->volume->block[entry].content.fileDescriptor);
+        for (int i = 0; i < numberOfNames; ++i)
+            if (keys[i] == fd->nameKey && files[i] == SIMFS_INVALID_INDEX &&
+                descriptorHasName(instance, fd, keys[i], strlen(names[i]), names[i]))
+                files[i] = entry;
+    }
+    stopReadahead(instance, &readahead);
+
+    free(keys);
+    return SIMFS_NO_ERROR;
+}
+
+/*****
+ * Returns the position of a block in a folder's index block chain, or -1 if the folder does not refer to it.
+ */
+int findSlotInFolder(SIMFS_INSTANCE *instance, SIMFS_FILE_DESCRIPTOR_TYPE * folder, SIMFS_INDEX_TYPE file)
+{
+    SIMFS_INDEX_TYPE index_block = folder->block_ref;
+    for (size_t i = 0; i < folder->size; ++i) {
+        if (i > 0 && i % LAST_POS == 0)
+            index_block = instance->volume->block[index_block].content.index[LAST_POS];
+        if (instance->volume->block[index_block].content.index[i % LAST_POS] == file)
+            return i;
+    }
+    return -1;
+}
+
+/*****
+ * Appends a file to a writable folder. Shared index blocks on the way to the end of the chain are cloned.
+ * A folder that reaches SIMFS_BTREE_THRESHOLD entries is converted to a B+tree first.
+ */
+SIMFS_ERROR addFileToFolder(SIMFS_INSTANCE *instance, SIMFS_FILE_DESCRIPTOR_TYPE * folder, SIMFS_INDEX_TYPE file)
+{
+    if (!(folder->flags & SIMFS_BTREE_FLAG) && folder->size >= SIMFS_BTREE_THRESHOLD) {
+        SIMFS_ERROR error = convertFolderToBtree(instance, folder);
+        if (error != SIMFS_NO_ERROR)
+            return error;
+    }
+
+    if (folder->flags & SIMFS_BTREE_FLAG) {
+        unsigned int key = instance->volume->block[file].content.fileDescriptor.nameKey;
+        SIMFS_ERROR error = btreeInsert(instance, folder, key, file);
+        if (error == SIMFS_NO_ERROR)
+            folder->size++;
+        return error;
+    }
+
+    int k = folder->size / LAST_POS; //which block in the chain the file should go into
+    int pos = folder->size % LAST_POS; //which position in the index_block file should go into
+    SIMFS_INDEX_TYPE index_block;
+    //The last index block in the chain is full or there is none, make a new index block
+    if (pos == 0) {
+        index_block = allocateFreeBlock(instance, SIMFS_INDEX_CONTENT_TYPE);
+        if (index_block == SIMFS_INVALID_INDEX)
+            return SIMFS_ALLOC_ERROR;
+
+        if (k == 0)
+            folder->block_ref = index_block;
+        else {
+            SIMFS_INDEX_TYPE previous = writableChainBlock(instance, folder, k - 1);
+            if (previous == SIMFS_INVALID_INDEX) {
+                releaseBlock(instance, index_block);
+                return SIMFS_ALLOC_ERROR;
+            }
+            instance->volume->block[previous].content.index[LAST_POS] = index_block;
+        }
+    }
+    //go to the last index block in the block chain
+    else {
+        index_block = writableChainBlock(instance, folder, k);
+        if (index_block == SIMFS_INVALID_INDEX)
+            return SIMFS_ALLOC_ERROR;
+    }
+    instance->volume->block[index_block].content.index[pos] = file;
+    folder->size++;
+    return SIMFS_NO_ERROR;
+}
+
+/*****
+ * Removes a file found at the given position from a writable folder by moving the last entry into its place.
+ * An index block left empty at the end of the chain is freed.
+ */
+SIMFS_ERROR removeFileFromFolder(SIMFS_INSTANCE *instance, SIMFS_FILE_DESCRIPTOR_TYPE * folder, SIMFS_INDEX_TYPE file,
+        int position)
+{
+    if (folder->flags & SIMFS_BTREE_FLAG) {
+        SIMFS_ERROR error = btreeRemove(instance, folder, file);
+        if (error == SIMFS_NO_ERROR)
+            folder->size--;
+        return error;
+    }
+
+    int last = folder->size - 1;
+    SIMFS_INDEX_TYPE hole = writableChainBlock(instance, folder, position / LAST_POS);
+    SIMFS_INDEX_TYPE tail = writableChainBlock(instance, folder, last / LAST_POS);
+    if (hole == SIMFS_INVALID_INDEX || tail == SIMFS_INVALID_INDEX)
+        return SIMFS_ALLOC_ERROR;
+
+    instance->volume->block[hole].content.index[position % LAST_POS] =
+        instance->volume->block[tail].content.index[last % LAST_POS];
+    instance->volume->block[tail].content.index[last % LAST_POS] = SIMFS_INVALID_INDEX;
+
+    if (last % LAST_POS == 0) {
+        releaseBlock(instance, tail);
+        if (last == 0)
+            folder->block_ref = SIMFS_INVALID_INDEX;
+        else
+            instance->volume->block[writableChainBlock(instance, folder, last / LAST_POS - 1)].content.index[LAST_POS] =
+                SIMFS_INVALID_INDEX;
+    }
+    folder->size--;
+    return SIMFS_NO_ERROR;
+}
+
+/*****
+ * Makes the descriptor of a file held right in a writable folder writable, cloning it if it is shared with a
+ * snapshot and relinking the folder to the clone. Returns SIMFS_INVALID_INDEX if the folder does not hold the file
+ * or the volume has no room for the clone.
+ */
+SIMFS_INDEX_TYPE writableEntry(SIMFS_INSTANCE *instance, SIMFS_INDEX_TYPE folder, SIMFS_INDEX_TYPE file)
+{
+    SIMFS_FILE_DESCRIPTOR_TYPE * folderfd = &(instance->volume->block[folder].content.fileDescriptor);
+    SIMFS_INDEX_TYPE *entry;
+    if (folderfd->flags & SIMFS_BTREE_FLAG) {
+        SIMFS_INDEX_TYPE path[SIMFS_BTREE_MAX_HEIGHT];
+        int slot[SIMFS_BTREE_MAX_HEIGHT];
+        unsigned int key = instance->volume->block[file].content.fileDescriptor.nameKey;
+        int leaf = btreeFind(instance, folderfd->block_ref, key, NULL, 0, file, 0, path, slot);
+        if (leaf < 0 || !btreeWritablePath(instance, folderfd, leaf, path, slot))
+            return SIMFS_INVALID_INDEX;
+        entry = &(btreeNode(instance, path[leaf])->child[slot[leaf]]);
+    } else {
+        int position = findSlotInFolder(instance, folderfd, file);
+        if (position < 0)
+            return SIMFS_INVALID_INDEX;
+
+        SIMFS_INDEX_TYPE index_block = writableChainBlock(instance, folderfd, position / LAST_POS);
+        if (index_block == SIMFS_INVALID_INDEX)
+            return SIMFS_INVALID_INDEX;
+        entry = &(instance->volume->block[index_block].content.index[position % LAST_POS]);
+    }
+
+    SIMFS_INDEX_TYPE clone = writableBlock(instance, file);
+    if (clone == SIMFS_INVALID_INDEX)
+        return SIMFS_INVALID_INDEX;
+
+    *entry = clone;
+    if (clone != file)
+        relocateDescriptor(instance, file, clone);
+    return clone;
+}
+
+SIMFS_INDEX_TYPE entryHolding(SIMFS_INSTANCE *instance, SIMFS_INDEX_TYPE folder, SIMFS_INDEX_TYPE file);
+
+/*****
+ * Returns the entry below a B+tree node that is the file or a folder holding it, or SIMFS_INVALID_INDEX.
+ */
+SIMFS_INDEX_TYPE btreeEntryHolding(SIMFS_INSTANCE *instance, SIMFS_INDEX_TYPE node, SIMFS_INDEX_TYPE file)
+{
+    SIMFS_BTREE_NODE_TYPE * n = btreeNode(instance, node);
+    for (int i = 0; i < n->numberOfEntries; ++i) {
+        SIMFS_INDEX_TYPE entry = n->child[i];
+        if (n->level > 0)
+            entry = btreeEntryHolding(instance, entry, file);
+        else if (entry != file && entryHolding(instance, entry, file) == SIMFS_INVALID_INDEX)
+            entry = SIMFS_INVALID_INDEX;
+        if (entry != SIMFS_INVALID_INDEX)
+            return entry;
+    }
+    return SIMFS_INVALID_INDEX;
+}
+
+/*****
+ * Returns the entry of a folder that is the file or a folder holding it at any depth, or SIMFS_INVALID_INDEX.
+ * Anything but a folder holds nothing.
+ */
+SIMFS_INDEX_TYPE entryHolding(SIMFS_INSTANCE *instance, SIMFS_INDEX_TYPE folder, SIMFS_INDEX_TYPE file)
+{
+    if (instance->volume->block[folder].type != SIMFS_FOLDER_CONTENT_TYPE)
+        return SIMFS_INVALID_INDEX;
+
+    SIMFS_FILE_DESCRIPTOR_TYPE * fd = &(instance->volume->block[folder].content.fileDescriptor);
+    if (fd->flags & SIMFS_BTREE_FLAG)
+        return (fd->block_ref == SIMFS_INVALID_INDEX) ? SIMFS_INVALID_INDEX :
+               btreeEntryHolding(instance, fd->block_ref, file);
+
+    SIMFS_INDEX_TYPE index_block = fd->block_ref;
+    for (size_t i = 0; i < fd->size; ++i) {
+        if (i > 0 && i % LAST_POS == 0)
+            index_block = instance->volume->block[index_block].content.index[LAST_POS];
+        SIMFS_INDEX_TYPE entry = instance->volume->block[index_block].content.index[i % LAST_POS];
+        if (entry == file || entryHolding(instance, entry, file) != SIMFS_INVALID_INDEX)
+            return entry;
+    }
+    return SIMFS_INVALID_INDEX;
+}
+
+/*****
+ * Makes the descriptor of a file below a writable folder writable, together with the folders on the way to it.
+ */
+SIMFS_INDEX_TYPE writableFileBelow(SIMFS_INSTANCE *instance, SIMFS_INDEX_TYPE folder, SIMFS_INDEX_TYPE file)
+{
+    SIMFS_INDEX_TYPE clone = writableEntry(instance, folder, file);
+    if (clone != SIMFS_INVALID_INDEX)
+        return clone;
+
+    // either the file is below a folder in this one, or it is right here and there was no room for the clone
+    SIMFS_INDEX_TYPE holder = entryHolding(instance, folder, file);
+    if (holder == SIMFS_INVALID_INDEX || holder == file)
+        return SIMFS_INVALID_INDEX;
+
+    holder = writableEntry(instance, folder, holder);
+    if (holder == SIMFS_INVALID_INDEX)
+        return SIMFS_INVALID_INDEX;
+    return writableFileBelow(instance, holder, file);
+}
+
+/*****
+ * Makes the descriptor of a file writable, cloning it together with the path from the root if it is shared with
+ * a snapshot. A block's own shared count is not enough to tell, since the references of a shared parent are only
+ * handed down to its children when the parent is cloned.
+ *
+ * The file is looked for in the current working directory first. A file that was moved to another folder while
+ * it was open is looked for in the folders below it.
+ */
+SIMFS_INDEX_TYPE writableFile(SIMFS_INSTANCE *instance, struct fuse_context * context, SIMFS_INDEX_TYPE file)
+{
+    SIMFS_INDEX_TYPE cwd = writableWorkingDirectory(instance, context);
+    if (cwd == SIMFS_INVALID_INDEX)
+        return SIMFS_INVALID_INDEX;
+
+    return writableFileBelow(instance, cwd, file);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// attribute cache
+//
+// While a file is open, reads move its access time in the open file table only, so that a read-heavy workload
+// does not change a descriptor block (and clone it along with the path to it, if it is shared with a snapshot) on
+// every read. The access time goes to the descriptor when the file is closed, synced, or unmounted.
+//
+//////////////////////////////////////////////////////////////////////////
+
+void volumeChanged(SIMFS_INSTANCE *instance);
+
+/*****
+ * Moves the cached access time of an open file to now, unless the mount options say otherwise:
+ *    - with SIMFS_MOUNT_NOATIME, never,
+ *    - with SIMFS_MOUNT_RELATIME, only if the access time is not later than the modification time, or is older
+ *      than SIMFS_RELATIME_INTERVAL.
+ */
+void touchAccessTime(SIMFS_INSTANCE *instance, SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE * openFile)
+{
+    if (instance->context->options & SIMFS_MOUNT_NOATIME)
+        return;
+
+    time_t now = currentTime();
+    if ((instance->context->options & SIMFS_MOUNT_RELATIME) &&
+        openFile->lastAccessTime > openFile->lastModificationTime &&
+        now - openFile->lastAccessTime < SIMFS_RELATIME_INTERVAL)
+        return;
+
+    if (openFile->lastAccessTime != now) {
+        openFile->lastAccessTime = now;
+        openFile->attributesDirty = 1;
+    }
+}
+
+/*****
+ * Writes the cached access time of an open file back to its descriptor if it has changed, and counts that as
+ * a change of the volume. Nothing is written on a read-only mount. If the descriptor is shared with a snapshot
+ * and the volume has no room for the clone, the access time is dropped, as it would be with noatime.
+ *
+ * The caller holds the volume lock.
+ */
+void writeBackAttributes(SIMFS_INSTANCE *instance, struct fuse_context * context,
+        SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE * openFile)
+{
+    if (!openFile->attributesDirty || instance->context->readOnly)
+        return;
+    openFile->attributesDirty = 0;
+
+    SIMFS_INDEX_TYPE file = writableFile(instance, context, openFile->fileDescriptor);
+    if (file == SIMFS_INVALID_INDEX)
+        return;
+
+    instance->volume->block[file].content.fileDescriptor.lastAccessTime = openFile->lastAccessTime;
+    volumeChanged(instance);
+}
+
+/*****
+ * Writes the cached access times of all open files back to their descriptors.
+ */
+void writeBackAllAttributes(SIMFS_INSTANCE *instance, struct fuse_context * context)
+{
+    for (int i = 0; i < SIMFS_MAX_NUMBER_OF_OPEN_FILES; i++)
+        if (instance->context->globalOpenFileTable[i].type != SIMFS_INVALID_CONTENT_TYPE)
+            writeBackAttributes(instance, context, &(instance->context->globalOpenFileTable[i]));
+}
+
+/***
+ * Depending on the type parameter the function creates a file or a folder in the current directory
+ * of the process. If the process does not have an entry in the processControlBlock, then the root directory
+ * is assumed to be its current working directory.
+ *
+ * If a file with the same name already exists in the current directory, it returns SIMFS_DUPLICATE_ERROR.
+ *
+ * Otherwise:
+ *    - sets the folder/file's identifier to the current value of the next unique identifier from the superblock;
+ *      then it increments the next available value in the superblock (to prepare it for the next created file)
+ *    - finds an available block in the storage using the in-memory bitvector and flips the bit to indicate
+ *      that the block is taken
+ *    - initializes a local buffer for the file descriptor block with the block type depending on the parameter type
+ *      (i.e., folder or file)
+ *    - creates an entry in the conflict resolution list for the corresponding in-memory directory entry
+ *    - copies the local buffer to the disk block that was found to be free
+ *    - copies the in-memory bitvector to the bitevector blocks on the simulated disk
+ *
+ *  The access rights and the the owner are taken from the context (umask and uid correspondingly).
+ *
+ *  If a snapshot is mounted, the function returns SIMFS_ACCESS_ERROR.
+ *
+ */
+SIMFS_ERROR createFile(SIMFS_INSTANCE *instance, SIMFS_NAME_TYPE fileName, SIMFS_CONTENT_TYPE type)
+{
+    // TODO: implement - DONE
+    if (instance->context->readOnly)
+        return SIMFS_ACCESS_ERROR;
+
+    struct fuse_context * context = simfs_debug_get_context();
+    SIMFS_INDEX_TYPE cwd = getCurrentWorkingDirectory(instance, context);
+    SIMFS_FILE_DESCRIPTOR_TYPE * cwdfd = &(instance->volume->block[cwd].content.fileDescriptor);
+    
+    SIMFS_INDEX_TYPE file = findFileInFolder(instance, cwdfd, fileName, NULL);
+    if (file != SIMFS_INVALID_INDEX)
+        return SIMFS_DUPLICATE_ERROR;
+
+    cwd = writableWorkingDirectory(instance, context);
+    if (cwd == SIMFS_INVALID_INDEX)
+        return SIMFS_ALLOC_ERROR;
+    cwdfd = &(instance->volume->block[cwd].content.fileDescriptor);
+
+    // files go to the group of their folder, new folders to the group of the thread
+    setAllocationGoal(instance, type == SIMFS_FOLDER_CONTENT_TYPE ? threadGroupStart(instance) : cwd);
+    file = allocateFreeBlock(instance, type);
+    if (file == SIMFS_INVALID_INDEX)
+        return SIMFS_ALLOC_ERROR;
+
+    if (setNewFileDescriptorFields(instance, file, type, fileName, context->umask, context->uid) != SIMFS_NO_ERROR ||
+        addFileToFolder(instance, cwdfd, file) != SIMFS_NO_ERROR) {
+        releaseBlock(instance, file);
+        return SIMFS_ALLOC_ERROR;
+    }
+    addFileToDirectory(instance, file);
+
+    return SIMFS_NO_ERROR;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+/***
+ * Deletes a file from the file system.
+ *
  * Hashes the file name and check if the file is in the directory. If not, then it returns SIMFS_NOT_FOUND_ERROR.
  * If the file is found, but the reference count is not zero, then it returns SIMS_WRITE_ERROR.
  * Otherwise:
@@ -467,229 +2300,2094 @@ void deleteFileIndices(SIMFS_FILE_DESCRIPTOR_TYPE * filefd)
  *          - clears the entry in the folder by removing the corresponding node in the list associated with
  *            the slot for this file
  *          - copies the in-memory bitvector to the bitvector blocks on the simulated disk
+ *
+ * Blocks that are shared with a snapshot are not freed; they only lose the reference from the live volume.
+ */
+
+SIMFS_ERROR deleteFile(SIMFS_INSTANCE *instance, SIMFS_NAME_TYPE fileName)
+{
+    // TODO: implement
+    if (instance->context->readOnly)
+        return SIMFS_ACCESS_ERROR;
+    
+    //Get the current context
+    struct fuse_context * context = simfs_debug_get_context();
+    SIMFS_INDEX_TYPE cwd = getCurrentWorkingDirectory(instance, context);
+    SIMFS_FILE_DESCRIPTOR_TYPE * cwdfd = &(instance->volume->block[cwd].content.fileDescriptor);
+
+    //Find the file in the current working directory
+    int positionInFolder = 0;
+    SIMFS_INDEX_TYPE file = findFileInFolder(instance, cwdfd, fileName, &positionInFolder);
+    if (file == SIMFS_INVALID_INDEX)
+        return SIMFS_NOT_FOUND_ERROR;
+
+    //Find the file in the context's directory
+    SIMFS_DIR_ENT ** ent = findFileInDirectory(instance, file);
+    if (ent == NULL)
+        return SIMFS_NOT_FOUND_ERROR;
+
+    unsigned int actuallyFunny = (*ent)->globalOpenFileTableIndex;
+    if (actuallyFunny != (unsigned int) SIMFS_INVALID_OPEN_FILE_TABLE_INDEX)
+        if (instance->context->globalOpenFileTable[actuallyFunny].referenceCount != 0)
+            return SIMFS_WRITE_ERROR;
+
+    //Check to see that file (if a directory) is empty
+    SIMFS_FILE_DESCRIPTOR_TYPE * filefd = &(instance->volume->block[file].content.fileDescriptor);
+    if ( (filefd->type == SIMFS_FOLDER_CONTENT_TYPE) && (filefd->size != 0) )
+        return SIMFS_NOT_EMPTY_ERROR;
+    
+    //TODO do you have permissions?
+    //  If user use pcb->permisions & I_SWUSR
+    //  else use pcb->permissions & I_SWOTH
+
+    cwd = writableWorkingDirectory(instance, context);
+    if (cwd == SIMFS_INVALID_INDEX)
+        return SIMFS_ALLOC_ERROR;
+    cwdfd = &(instance->volume->block[cwd].content.fileDescriptor);
+
+    SIMFS_ERROR error = removeFileFromFolder(instance, cwdfd, file, positionInFolder);
+    if (error != SIMFS_NO_ERROR)
+        return error;
+
+    SIMFS_DIR_ENT * trash_ent = *ent;
+    *ent = (*ent)->next;
+    free(trash_ent);
+
+    releaseBlock(instance, file);
+    return SIMFS_NO_ERROR;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+/***
+ * Renames a file or folder in the current working directory, and optionally moves it into one of the folders
+ * in the current working directory at the same time.
+ *
+ * If there is no file with the old name, or newFolder is neither NULL, nor an empty string, nor the name of
+ * a folder in the current working directory, the function returns SIMFS_NOT_FOUND_ERROR. If the target folder
+ * already holds a file with the new name, it returns SIMFS_DUPLICATE_ERROR. A folder cannot be moved into itself,
+ * and nothing can be renamed while a snapshot is mounted; for these, it returns SIMFS_ACCESS_ERROR.
+ *
+ * Otherwise:
+ *    - the descriptor is made writable (cloning it with the path to it if it is shared with a snapshot) and
+ *      gets the new name in place; the rest of a long new name goes to a new name block,
+ *    - the reference to the descriptor is added to the target folder under the new name, and then removed from
+ *      the current working directory; within one folder held in an index block chain, the reference stays in its
+ *      slot,
+ *    - the entry for the file in the in-memory directory is moved to the list for the new name.
+ *
+ * The content of the file is not touched, and an open file stays open, also when it has moved to another folder.
+ * Like every operation, a rename runs under the volume lock, so a concurrent lookup finds the file under either
+ * its old name or its new one.
+ *
+ * If the target folder needs a new block for the entry, or the new name needs a name block, but the volume is
+ * full, the function returns SIMFS_ALLOC_ERROR and the file keeps its old name.
+ */
+SIMFS_ERROR renameFile(SIMFS_INSTANCE *instance, SIMFS_NAME_TYPE oldName, SIMFS_NAME_TYPE newFolder,
+        SIMFS_NAME_TYPE newName)
+{
+    if (instance->context->readOnly)
+        return SIMFS_ACCESS_ERROR;
+
+    struct fuse_context * context = simfs_debug_get_context();
+    SIMFS_INDEX_TYPE cwd = getCurrentWorkingDirectory(instance, context);
+    SIMFS_FILE_DESCRIPTOR_TYPE * cwdfd = &(instance->volume->block[cwd].content.fileDescriptor);
+
+    SIMFS_INDEX_TYPE file = findFileInFolder(instance, cwdfd, oldName, NULL);
+    if (file == SIMFS_INVALID_INDEX)
+        return SIMFS_NOT_FOUND_ERROR;
+
+    SIMFS_INDEX_TYPE folder = cwd;
+    if (newFolder != NULL && newFolder[0] != '\0') {
+        folder = findFileInFolder(instance, cwdfd, newFolder, NULL);
+        if (folder == SIMFS_INVALID_INDEX || instance->volume->block[folder].type != SIMFS_FOLDER_CONTENT_TYPE)
+            return SIMFS_NOT_FOUND_ERROR;
+        if (folder == file)
+            return SIMFS_ACCESS_ERROR;
+    }
+
+    SIMFS_INDEX_TYPE existing =
+        findFileInFolder(instance, &(instance->volume->block[folder].content.fileDescriptor), newName, NULL);
+    if (existing == file)
+        return SIMFS_NO_ERROR;
+    if (existing != SIMFS_INVALID_INDEX)
+        return SIMFS_DUPLICATE_ERROR;
+
+    int sameFolder = (folder == cwd);
+    file = writableFile(instance, context, file);
+    if (file == SIMFS_INVALID_INDEX)
+        return SIMFS_ALLOC_ERROR;
+    cwd = writableWorkingDirectory(instance, context);
+    if (sameFolder)
+        folder = cwd;
+    else if ((folder = writableFile(instance, context, folder)) == SIMFS_INVALID_INDEX)
+        return SIMFS_ALLOC_ERROR;
+    cwdfd = &(instance->volume->block[cwd].content.fileDescriptor);
+    SIMFS_FILE_DESCRIPTOR_TYPE * folderfd = &(instance->volume->block[folder].content.fileDescriptor);
+
+    SIMFS_FILE_DESCRIPTOR_TYPE * filefd = &(instance->volume->block[file].content.fileDescriptor);
+    SIMFS_DIR_ENT ** ent = findFileInDirectory(instance, file);
+    if (ent == NULL)
+        return SIMFS_NOT_FOUND_ERROR;
+
+    // the name block of the old name may be shared with a snapshot, so a long new name always gets a new one
+    SIMFS_INDEX_TYPE nameBlock;
+    if (allocateNameBlock(instance, newName, &nameBlock) != SIMFS_NO_ERROR)
+        return SIMFS_ALLOC_ERROR;
+    unsigned int oldKey = filefd->nameKey;
+    unsigned int newKey = simfsNameKey(newName);
+
+    // a B+tree is keyed by the name, so the reference has to move even within one folder
+    if (!sameFolder || (cwdfd->flags & SIMFS_BTREE_FLAG)) {
+        filefd->nameKey = newKey;
+        SIMFS_ERROR error = addFileToFolder(instance, folderfd, file);
+        // the old entry is found by the old key
+        filefd->nameKey = oldKey;
+        if (error == SIMFS_NO_ERROR) {
+            int position = (cwdfd->flags & SIMFS_BTREE_FLAG) ? 0 : findSlotInFolder(instance, cwdfd, file);
+            error = removeFileFromFolder(instance, cwdfd, file, position);
+            if (error != SIMFS_NO_ERROR) {
+                // take the new entry back out, so that the file stays under its old name only
+                filefd->nameKey = newKey;
+                position = (folderfd->flags & SIMFS_BTREE_FLAG) ? 0 : findSlotInFolder(instance, folderfd, file);
+                removeFileFromFolder(instance, folderfd, file, position);
+                filefd->nameKey = oldKey;
+            }
+        }
+        if (error != SIMFS_NO_ERROR) {
+            if (nameBlock != SIMFS_INVALID_INDEX)
+                releaseBlock(instance, nameBlock);
+            return error;
+        }
+    }
+
+    SIMFS_INDEX_TYPE oldNameBlock = filefd->nameBlock;
+    simfsStoreName(instance->volume, filefd, nameBlock, newName);
+    if (oldNameBlock != SIMFS_INVALID_INDEX)
+        releaseBlock(instance, oldNameBlock);
+
+    SIMFS_DIR_ENT * moved = *ent;
+    *ent = moved->next;
+    SIMFS_DIR_ENT ** head = directoryList(instance, newKey);
+    moved->next = *head;
+    *head = moved;
+
+    return SIMFS_NO_ERROR;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+/***
+ * Finds the file in the in-memory directory and obtains the information about the file from the file descriptor
+ * block referenced from the directory. For an open file, the access time is taken from the open file table, since
+ * it is only written back to the descriptor on closing. The name is left as it is held in the descriptor: the caller
+ * has the whole of it already.
+ *
+ * If the file is not found, then it returns SIMFS_NOT_FOUND_ERROR
+ */
+SIMFS_ERROR getFileInfo(SIMFS_INSTANCE *instance, SIMFS_NAME_TYPE fileName, SIMFS_FILE_DESCRIPTOR_TYPE *infoBuffer)
+{
+    //TODO: implement - DONE
+
+    //Get the current working directory
+    struct fuse_context * context = simfs_debug_get_context();
+    SIMFS_INDEX_TYPE cwd = getCurrentWorkingDirectory(instance, context);
+    SIMFS_FILE_DESCRIPTOR_TYPE * cwdfd = &(instance->volume->block[cwd].content.fileDescriptor);
+
+    //Make sure the file exists
+    SIMFS_INDEX_TYPE file = findFileInFolder(instance, cwdfd, fileName, NULL);
+    if (file == SIMFS_INVALID_INDEX)
+        return SIMFS_NOT_FOUND_ERROR;
+    
+    //Copy the info into the buffer
+    SIMFS_FILE_DESCRIPTOR_TYPE * filefd = &(instance->volume->block[file].content.fileDescriptor);
+    memcpy(infoBuffer, filefd, sizeof(SIMFS_FILE_DESCRIPTOR_TYPE));
+
+    //An open file has the latest attributes in the open file table
+    SIMFS_DIR_ENT ** ent = findFileInDirectory(instance, file);
+    if (ent != NULL && (*ent)->globalOpenFileTableIndex != (unsigned int) SIMFS_INVALID_OPEN_FILE_TABLE_INDEX)
+        infoBuffer->lastAccessTime =
+            instance->context->globalOpenFileTable[(*ent)->globalOpenFileTableIndex].lastAccessTime;
+
+    return SIMFS_NO_ERROR;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+/***
+ * Creates an in-memory description of the file for fast access.
+ *
+ * - hashes the name and searches for it in the in-memory directory resolving potential conflicts using the
+ *   unique identifier.
+ *
+ *   If the file does not exist (i.e., the slot obtained by hashing is NULL), the SIMFS_NOT_FOUND_ERROR is returned.
+ *
+ * Otherwise:
+ *
+ *    - if there is a global entry for the file (as indicated by the index to the global open file table in the
+ *      directory entry), then:
+ *
+ *       - it increases the reference count for this file
+ *
+ *       - otherwise
+ *          - finds an empty slot in the global open file table and adds an entry for the file
+ *          - copies the information from the file descriptor block referenced from the directory entry for
+ *            this file to the new entry in the global open file table
+ *          - sets the reference count of the file to 1
+ *          - adds the index of the entry in the global open file table to the directory entry for this file
+ *
+ *   - checks if the process has its process control block in the processControlBlocks list
+ *      - if not, then a file control block for the process is created and added to the list; the current
+ *        working directory is initialized to the root of the volume and the number of the open files is
+ *        initialized to 1; the process id should be simulated for testing; it will be possible to obtain
+ *        the actual pid after integration with FUSE
+ *
+ *     - scans the per-process open file table of the process checking if an entry for the file already
+ *      exists in the table (i.e., the file has already been opened)
+ *
+ *       - if the entry indeed does exists, the function returns the index of the entry through the parameter
+ *         fileHandle, and then returns SIMFS_DUPLICATE_ERROR as the return value. This is not a fatal error.
+ *
+ *       - otherwise:
+ *          - the function finds an empty slot in the table and fills it with the information including
+ *            the index to the entry for this file in the global open file table
+ *
+ *          - returns the index to the new element of the per-process open file table through the parameter
+ *            fileHandle and SIMFS_NO_ERROR as the return value.
+ *
+ * If there is no free slot for the file in either the global file table or in the per-process
+ * file table, or if there is any other allocation problem, then the function returns SIMFS_ALLOC_ERROR.
+ *
+ */
+SIMFS_ERROR openFileHandle(SIMFS_INSTANCE *instance, SIMFS_NAME_TYPE fileName, SIMFS_FILE_HANDLE_TYPE *fileHandle)
+{
+    struct fuse_context * context = simfs_debug_get_context();
+    SIMFS_INDEX_TYPE cwd = getCurrentWorkingDirectory(instance, context);
+    SIMFS_FILE_DESCRIPTOR_TYPE * cwdfd = &(instance->volume->block[cwd].content.fileDescriptor);
+
+    SIMFS_INDEX_TYPE file = findFileInFolder(instance, cwdfd, fileName, NULL);
+    if (file == SIMFS_INVALID_INDEX)
+        return SIMFS_NOT_FOUND_ERROR;
+
+    SIMFS_DIR_ENT ** ent = findFileInDirectory(instance, file);
+    if (ent == NULL)
+        return SIMFS_NOT_FOUND_ERROR;
+
+    //Already open in this process?
+    unsigned int global = (*ent)->globalOpenFileTableIndex;
+    SIMFS_PROCESS_CONTROL_BLOCK_TYPE * pcb = findPCBByPID(instance, context->pid);
+    if (pcb != NULL && global != (unsigned int) SIMFS_INVALID_OPEN_FILE_TABLE_INDEX) {
+        for (int i = 0; i < SIMFS_MAX_NUMBER_OF_OPEN_FILES_PER_PROCESS; i++) {
+            if (pcb->openFileTable[i].globalOpenFileTableIndex == global) {
+                *fileHandle = i;
+                return SIMFS_DUPLICATE_ERROR;
+            }
+        }
+    }
+
+    //Find a slot in the global open file table if the file is not open yet
+    if (global == (unsigned int) SIMFS_INVALID_OPEN_FILE_TABLE_INDEX) {
+        for (int i = 0; i < SIMFS_MAX_NUMBER_OF_OPEN_FILES; i++) {
+            if (instance->context->globalOpenFileTable[i].type == SIMFS_INVALID_CONTENT_TYPE) {
+                global = i;
+                break;
+            }
+        }
+        if (global == (unsigned int) SIMFS_INVALID_OPEN_FILE_TABLE_INDEX)
+            return SIMFS_ALLOC_ERROR;
+    }
+
+    //Find or create the process control block and a slot in its open file table
+    if (pcb == NULL) {
+        pcb = malloc(sizeof(SIMFS_PROCESS_CONTROL_BLOCK_TYPE));
+        if (pcb == NULL)
+            return SIMFS_ALLOC_ERROR;
+
+        pcb->pid = context->pid;
+        pcb->numberOfOpenFiles = 0;
+        pcb->currentWorkingDirectory = instance->context->rootNodeIndex;
+        for (int i = 0; i < SIMFS_MAX_NUMBER_OF_OPEN_FILES_PER_PROCESS; i++)
+            pcb->openFileTable[i].globalOpenFileTableIndex = SIMFS_INVALID_OPEN_FILE_TABLE_INDEX;
+        pcb->next = instance->context->processControlBlocks;
+        instance->context->processControlBlocks = pcb;
+    }
+
+    int handle = -1;
+    for (int i = 0; i < SIMFS_MAX_NUMBER_OF_OPEN_FILES_PER_PROCESS && handle < 0; i++)
+        if (pcb->openFileTable[i].globalOpenFileTableIndex == (unsigned int) SIMFS_INVALID_OPEN_FILE_TABLE_INDEX)
+            handle = i;
+    if (handle < 0)
+        return SIMFS_ALLOC_ERROR;
+
+    //Fill in the tables
+    SIMFS_FILE_DESCRIPTOR_TYPE * filefd = &(instance->volume->block[file].content.fileDescriptor);
+    SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE * openFile = &(instance->context->globalOpenFileTable[global]);
+    if (openFile->type == SIMFS_INVALID_CONTENT_TYPE) {
+        openFile->type = filefd->type;
+        openFile->fileDescriptor = file;
+        openFile->referenceCount = 0;
+        openFile->creationTime = filefd->creationTime;
+        openFile->lastAccessTime = filefd->lastAccessTime;
+        openFile->lastModificationTime = filefd->lastModificationTime;
+        openFile->accessRights = filefd->accessRights;
+        openFile->owner = filefd->owner;
+        openFile->size = filefd->size;
+        openFile->attributesDirty = 0;
+        (*ent)->globalOpenFileTableIndex = global;
+    }
+    openFile->referenceCount++;
+
+    pcb->openFileTable[handle].accessRights = filefd->accessRights;
+    pcb->openFileTable[handle].globalOpenFileTableIndex = global;
+    pcb->numberOfOpenFiles++;
+
+    *fileHandle = handle;
+    return SIMFS_NO_ERROR;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+/*****
+ * Resolves a file handle of the calling process to its entry in the global open file table.
+ * Returns NULL if the handle does not refer to an open file.
+ */
+SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE * findOpenFile(SIMFS_INSTANCE *instance, struct fuse_context * context,
+        SIMFS_FILE_HANDLE_TYPE fileHandle, SIMFS_PROCESS_CONTROL_BLOCK_TYPE ** process)
+{
+    SIMFS_PROCESS_CONTROL_BLOCK_TYPE * pcb = findPCBByPID(instance, context->pid);
+    if (pcb == NULL || fileHandle < 0 || fileHandle >= SIMFS_MAX_NUMBER_OF_OPEN_FILES_PER_PROCESS)
+        return NULL;
+
+    unsigned int global = pcb->openFileTable[fileHandle].globalOpenFileTableIndex;
+    if (global >= SIMFS_MAX_NUMBER_OF_OPEN_FILES)
+        return NULL;
+
+    SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE * openFile = &(instance->context->globalOpenFileTable[global]);
+    if (openFile->type == SIMFS_INVALID_CONTENT_TYPE)
+        return NULL;
+
+    if (process != NULL)
+        *process = pcb;
+    return openFile;
+}
+
+/*****
+ * Checks the owner's right if the caller owns the file, and the right of others otherwise.
+ */
+int hasAccessRight(struct fuse_context * context, mode_t accessRights, uid_t owner,
+        mode_t ownerRight, mode_t otherRight)
+{
+    if (context->uid == owner)
+        return (accessRights & ownerRight) != 0;
+    return (accessRights & otherRight) != 0;
+}
+
+/*****
+ * Number of index blocks in the chain of content of the given length.
+ */
+size_t indexBlocksForContent(size_t length)
+{
+    size_t data = (length + SIMFS_DATA_SIZE - 1) / SIMFS_DATA_SIZE;
+    return (data + LAST_POS - 1) / LAST_POS;
+}
+
+/*****
+ * Number of data and index blocks needed to hold content of the given length.
+ */
+size_t blocksNeededForContent(size_t length)
+{
+    return (length + SIMFS_DATA_SIZE - 1) / SIMFS_DATA_SIZE + indexBlocksForContent(length);
+}
+
+/*****
+ * Copies content to newly acquired data blocks referenced from a new chain of index blocks and returns the
+ * first index block of the chain.
+ *
+ * Returns SIMFS_INVALID_INDEX if the volume runs out of blocks; nothing stays allocated in that case.
+ */
+SIMFS_INDEX_TYPE writeContent(SIMFS_INSTANCE *instance, char *content, size_t length)
+{
+    SIMFS_INDEX_TYPE head = SIMFS_INVALID_INDEX;
+    SIMFS_INDEX_TYPE *link = &head;
+    SIMFS_INDEX_TYPE index_block = SIMFS_INVALID_INDEX;
+    int pos = LAST_POS;
+
+    for (size_t offset = 0; offset < length; offset += SIMFS_DATA_SIZE) {
+        if (pos == LAST_POS) {
+            index_block = allocateFreeBlock(instance, SIMFS_INDEX_CONTENT_TYPE);
+            if (index_block == SIMFS_INVALID_INDEX)
+                break;
+            *link = index_block;
+            link = &(instance->volume->block[index_block].content.index[LAST_POS]);
+            pos = 0;
+        }
+
+        size_t chunk = length - offset < SIMFS_DATA_SIZE ? length - offset : SIMFS_DATA_SIZE;
+        SIMFS_INDEX_TYPE data = storeDataBlock(instance, content + offset, chunk);
+        if (data == SIMFS_INVALID_INDEX) {
+            index_block = SIMFS_INVALID_INDEX;
+            break;
+        }
+        instance->volume->block[index_block].content.index[pos++] = data;
+    }
+
+    if (index_block == SIMFS_INVALID_INDEX && head != SIMFS_INVALID_INDEX) {
+        releaseBlock(instance, head);
+        return SIMFS_INVALID_INDEX;
+    }
+    return head;
+}
+
+/*****
+ * Concatenates the data blocks of a chain of index blocks into the buffer. Holes are read as zeros.
+ *
+ * Returns SIMFS_READ_ERROR if the checksum of a data block does not match.
+ */
+SIMFS_ERROR readContent(SIMFS_INSTANCE *instance, SIMFS_INDEX_TYPE index_block, size_t length, char *buffer)
+{
+    SIMFS_READAHEAD_TYPE readahead;
+    startReadahead(instance, &readahead, index_block, (length + SIMFS_DATA_SIZE - 1) / SIMFS_DATA_SIZE);
+
+    int pos = 0;
+    for (size_t offset = 0; offset < length; offset += SIMFS_DATA_SIZE) {
+        advanceReadahead(instance, &readahead);
+        if (pos == LAST_POS) {
+            index_block = instance->volume->block[index_block].content.index[LAST_POS];
+            pos = 0;
+        }
+
+        SIMFS_INDEX_TYPE data = instance->volume->block[index_block].content.index[pos++];
+        size_t chunk = length - offset < SIMFS_DATA_SIZE ? length - offset : SIMFS_DATA_SIZE;
+        if (data == SIMFS_INVALID_INDEX)
+            memset(buffer + offset, 0, chunk);
+        else if (verifyBlock(instance, data) == SIMFS_NO_ERROR)
+            memcpy(buffer + offset, instance->volume->block[data].content.data, chunk);
+        else {
+            stopReadahead(instance, &readahead);
+            return SIMFS_READ_ERROR;
+        }
+    }
+    stopReadahead(instance, &readahead);
+    return SIMFS_NO_ERROR;
+}
+
+/*****
+ * Encodes content chunk by chunk. Returns a new buffer holding the encoded content, or NULL if out of memory.
+ */
+char *compressContent(char *content, size_t length, size_t *storedLength)
+{
+    size_t numberOfChunks = (length + SIMFS_COMPRESSION_CHUNK_SIZE - 1) / SIMFS_COMPRESSION_CHUNK_SIZE;
+    char *stored = malloc(numberOfChunks * (SIMFS_CHUNK_HEADER_SIZE + SIMFS_COMPRESSION_CHUNK_SIZE));
+    if (stored == NULL)
+        return NULL;
+
+    char *out = stored;
+    for (size_t offset = 0; offset < length; offset += SIMFS_COMPRESSION_CHUNK_SIZE) {
+        size_t chunk = length - offset < SIMFS_COMPRESSION_CHUNK_SIZE ? length - offset : SIMFS_COMPRESSION_CHUNK_SIZE;
+
+        // a chunk that does not get smaller is stored as it is
+        size_t header;
+        size_t encoded = simfsLzCompress(content + offset, chunk, out + SIMFS_CHUNK_HEADER_SIZE, chunk - 1);
+        if (encoded == SIMFS_LZ_ERROR) {
+            memcpy(out + SIMFS_CHUNK_HEADER_SIZE, content + offset, chunk);
+            encoded = chunk;
+            header = chunk | SIMFS_STORED_CHUNK_FLAG;
+        }
+        else
+            header = encoded;
+
+        out[0] = (char) (header & 0xFF);
+        out[1] = (char) (header >> 8);
+        out += SIMFS_CHUNK_HEADER_SIZE + encoded;
+    }
+
+    *storedLength = out - stored;
+    return stored;
+}
+
+/*****
+ * Decodes content encoded by compressContent(). Returns 0 if the encoded content is corrupted.
+ */
+int decompressContent(char *stored, size_t storedLength, char *content, size_t length)
+{
+    unsigned char *in = (unsigned char *) stored;
+    unsigned char *inEnd = in + storedLength;
+    for (size_t offset = 0; offset < length; offset += SIMFS_COMPRESSION_CHUNK_SIZE) {
+        size_t chunk = length - offset < SIMFS_COMPRESSION_CHUNK_SIZE ? length - offset : SIMFS_COMPRESSION_CHUNK_SIZE;
+        if (inEnd - in < SIMFS_CHUNK_HEADER_SIZE)
+            return 0;
+
+        size_t header = in[0] | (in[1] << 8);
+        size_t encoded = header & ~SIMFS_STORED_CHUNK_FLAG;
+        in += SIMFS_CHUNK_HEADER_SIZE;
+        if ((size_t) (inEnd - in) < encoded)
+            return 0;
+
+        if (header & SIMFS_STORED_CHUNK_FLAG) {
+            if (encoded != chunk)
+                return 0;
+            memcpy(content + offset, in, chunk);
+        }
+        else if (simfsLzDecompress((char *) in, encoded, content + offset, chunk) != chunk)
+            return 0;
+        in += encoded;
+    }
+    return 1;
+}
+
+/*****
+ * Copies the complete content of a file into the buffer, decoding it if the file is compressed.
+ */
+SIMFS_ERROR loadContent(SIMFS_INSTANCE *instance, SIMFS_FILE_DESCRIPTOR_TYPE * filefd, char *buffer)
+{
+    if (!(filefd->flags & SIMFS_COMPRESSED_FLAG)) {
+        memset(buffer + filefd->storedSize, 0, filefd->size - filefd->storedSize);
+        return readContent(instance, filefd->block_ref, filefd->storedSize, buffer);
+    }
+
+    char *stored = malloc(filefd->storedSize);
+    if (stored == NULL)
+        return SIMFS_READ_ERROR;
+
+    int decoded = readContent(instance, filefd->block_ref, filefd->storedSize, stored) == SIMFS_NO_ERROR &&
+                  decompressContent(stored, filefd->storedSize, buffer, filefd->size);
+    free(stored);
+
+    return decoded ? SIMFS_NO_ERROR : SIMFS_READ_ERROR;
+}
+
+/*****
+ * Records a change of the content of a file in its descriptor and in any open file table entry for it.
+ */
+void contentChanged(SIMFS_INSTANCE *instance, SIMFS_INDEX_TYPE file)
+{
+    SIMFS_FILE_DESCRIPTOR_TYPE * filefd = &(instance->volume->block[file].content.fileDescriptor);
+    filefd->lastModificationTime = currentTime();
+    filefd->lastAccessTime = filefd->lastModificationTime;
+
+    for (int i = 0; i < SIMFS_MAX_NUMBER_OF_OPEN_FILES; i++) {
+        SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE * openFile = &(instance->context->globalOpenFileTable[i]);
+        if (openFile->type != SIMFS_INVALID_CONTENT_TYPE && openFile->fileDescriptor == file) {
+            openFile->size = filefd->size;
+            openFile->lastModificationTime = filefd->lastModificationTime;
+            openFile->lastAccessTime = filefd->lastAccessTime;
+            openFile->attributesDirty = 0;
+        }
+    }
+}
+
+/*****
+ * Replaces the content of a file and its flags. The new content goes to newly acquired blocks, and the old
+ * blocks are released only after the descriptor refers to the new ones. Any open file table entry for the
+ * file is updated as well.
+ */
+SIMFS_ERROR replaceContent(SIMFS_INSTANCE *instance, struct fuse_context * context, SIMFS_INDEX_TYPE file,
+        char *content, size_t length, unsigned short flags)
+{
+    char *stored = content;
+    size_t storedLength = length;
+    if (flags & SIMFS_COMPRESSED_FLAG) {
+        stored = compressContent(content, length, &storedLength);
+        if (stored == NULL)
+            return SIMFS_ALLOC_ERROR;
+    }
+
+    SIMFS_INDEX_TYPE newContent = SIMFS_INVALID_INDEX;
+    int fits = blocksNeededForContent(storedLength) <= (size_t) countFreeBlocks(instance);
+    if (fits && storedLength > 0) {
+        // lay the content out in one piece as close after the descriptor as possible
+        setAllocationGoal(instance, file);
+        reserveFreeRun(instance, blocksNeededForContent(storedLength));
+        newContent = writeContent(instance, stored, storedLength);
+    }
+    if (stored != content)
+        free(stored);
+    if (!fits || (storedLength > 0 && newContent == SIMFS_INVALID_INDEX))
+        return SIMFS_ALLOC_ERROR;
+
+    file = writableFile(instance, context, file);
+    if (file == SIMFS_INVALID_INDEX) {
+        if (newContent != SIMFS_INVALID_INDEX)
+            releaseBlock(instance, newContent);
+        return SIMFS_ALLOC_ERROR;
+    }
+
+    SIMFS_FILE_DESCRIPTOR_TYPE * filefd = &(instance->volume->block[file].content.fileDescriptor);
+    SIMFS_INDEX_TYPE oldContent = filefd->block_ref;
+    filefd->block_ref = newContent;
+    filefd->size = length;
+    filefd->storedSize = storedLength;
+    filefd->allocatedBlocks = (storedLength + SIMFS_DATA_SIZE - 1) / SIMFS_DATA_SIZE;
+    filefd->flags = flags;
+    if (oldContent != SIMFS_INVALID_INDEX)
+        releaseBlock(instance, oldContent);
+    contentChanged(instance, file);
+
+    return SIMFS_NO_ERROR;
+}
+
+/*****
+ * Finds the open file that a handle refers to, and checks that the process may write to it.
+ */
+SIMFS_ERROR checkWriteAccess(SIMFS_INSTANCE *instance, struct fuse_context * context, SIMFS_FILE_HANDLE_TYPE fileHandle,
+        SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE **openFile)
+{
+    *openFile = findOpenFile(instance, context, fileHandle, NULL);
+    if (*openFile == NULL || (*openFile)->type != SIMFS_FILE_CONTENT_TYPE)
+        return SIMFS_SYSTEM_ERROR;
+
+    if (instance->context->readOnly ||
+        !hasAccessRight(context, (*openFile)->accessRights, (*openFile)->owner, S_IWUSR, S_IWOTH))
+        return SIMFS_ACCESS_ERROR;
+
+    return SIMFS_NO_ERROR;
+}
+
+/***
+ * The function replaces content of a file with new one pointed to by the parameter writeBuffer.
+ *
+ * Checks if the file handle points to a valid file descriptor of an open file. Any issues should be reported by
+ * returning SIMFS_SYSTEM_ERROR. In this case, further code debugging is needed.
+ *
+ * Otherwise, it checks the access rights for writing. If the process owner is not allowed to write to the file,
+ * then the function returns SIMFS_ACCESS_ERROR.
+ *
+ * Then, the function calculates the space needed for the new content and checks if the write buffer can fit into
+ * the remaining free space in the file system. If not, then the SIMFS_ALLOC_ERROR is returned.
+ *
+ * Otherwise, the function:
+ *    - acquires as many new blocks as needed to hold the new content modifying corresponding bits in
+ *      the in-memory bitvector,
+ *    - copies the characters pointed to by the parameter writeBuffer (until '\0' but excluding it) to the
+ *      new just acquired blocks,
+ *    - copies any modified block of the in-memory bitvector to the corresponding bitvector block on the disk.
+ *
+ * If the new content has been written successfully, the function then removes all blocks currently held by
+ * this file and modifies the file descriptor to reflect the new location, the new size of the file, and the new
+ * times of last modification and access.
+ *
+ * This order of actions prevents file corruption, since in case of any error with writing new content, the file's
+ * old version is intact. This technique is called copy-on-write and is an alternative to journalling.
+ *
+ * A descriptor that is shared with a snapshot is cloned (along with the path to it) before it is modified, and
+ * the old content is only freed if no snapshot refers to it.
+ *
+ * Content of a compressed file is compressed before it is written; the space check applies to the compressed size.
+ *
+ * The function returns SIMFS_WRITE_ERROR in response to exception not specified earlier.
+ *
+ */
+SIMFS_ERROR writeFile(SIMFS_INSTANCE *instance, SIMFS_FILE_HANDLE_TYPE fileHandle, char *writeBuffer)
+{
+    struct fuse_context * context = simfs_debug_get_context();
+    SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE * openFile;
+    SIMFS_ERROR error = checkWriteAccess(instance, context, fileHandle, &openFile);
+    if (error != SIMFS_NO_ERROR)
+        return error;
+
+    SIMFS_FILE_DESCRIPTOR_TYPE * filefd = &(instance->volume->block[openFile->fileDescriptor].content.fileDescriptor);
+    return replaceContent(instance, context, openFile->fileDescriptor, writeBuffer, strlen(writeBuffer), filefd->flags);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// sparse files
+//
+// Content can also be changed in place at any offset. A slot of an index block that holds SIMFS_INVALID_INDEX
+// is a hole: it takes no data block and reads as zeros. Only the data blocks in the changed range and the index
+// blocks leading to them are made writable, so the rest of the content stays shared with snapshots.
+//
+// The chain of a file always has the index blocks for storedSize bytes, the bytes of the last data block past
+// storedSize are zeros, and anything from storedSize to size reads as zeros without being stored at all.
+//
+//////////////////////////////////////////////////////////////////////////
+
+/*****
+ * Returns 1 if a data block holds nothing but zeros.
+ */
+int isZeroData(SIMFS_DATA_TYPE data)
+{
+    for (int i = 0; i < SIMFS_DATA_SIZE; ++i)
+        if (data[i] != 0)
+            return 0;
+    return 1;
+}
+
+/*****
+ * Counts the data blocks referred to by a chain of index blocks, not counting holes.
+ */
+size_t countDataBlocks(SIMFS_INSTANCE *instance, SIMFS_INDEX_TYPE index_block)
+{
+    size_t count = 0;
+    for (; index_block != SIMFS_INVALID_INDEX;
+         index_block = instance->volume->block[index_block].content.index[LAST_POS])
+        for (int pos = 0; pos < LAST_POS; ++pos)
+            if (instance->volume->block[index_block].content.index[pos] != SIMFS_INVALID_INDEX)
+                count++;
+    return count;
+}
+
+/*****
+ * Appends index blocks holding only holes to the chain of a writable descriptor, until it is long enough for
+ * content of the given length.
+ *
+ * Returns 0 if the volume is full.
+ */
+int extendChain(SIMFS_INSTANCE *instance, SIMFS_FILE_DESCRIPTOR_TYPE *filefd, size_t storedSize)
+{
+    size_t have = indexBlocksForContent(filefd->storedSize);
+    size_t need = indexBlocksForContent(storedSize);
+    if (need <= have)
+        return 1;
+
+    SIMFS_INDEX_TYPE *link = &(filefd->block_ref);
+    if (have > 0) {
+        SIMFS_INDEX_TYPE last = writableChainBlock(instance, filefd, have - 1);
+        if (last == SIMFS_INVALID_INDEX)
+            return 0;
+        link = &(instance->volume->block[last].content.index[LAST_POS]);
+    }
+    for (; have < need; ++have) {
+        SIMFS_INDEX_TYPE block = allocateFreeBlock(instance, SIMFS_INDEX_CONTENT_TYPE);
+        if (block == SIMFS_INVALID_INDEX)
+            return 0;
+        *link = block;
+        link = &(instance->volume->block[block].content.index[LAST_POS]);
+    }
+    return 1;
+}
+
+/*****
+ * Replaces length bytes of the data block in a slot of a writable index block, starting at the given offset
+ * within the block, with the given data, or with zeros if data is NULL. A block that ends up holding only zeros
+ * is released and leaves a hole behind. A block that is neither shared nor deduplicated is modified in place;
+ * otherwise the new content goes to a new block.
+ *
+ * Returns 0 if a new block is needed, but the volume is full.
+ */
+int updateDataBlock(SIMFS_INSTANCE *instance, SIMFS_FILE_DESCRIPTOR_TYPE *filefd, SIMFS_INDEX_TYPE index_block, int pos,
+        size_t from, char *data, size_t length)
+{
+    SIMFS_INDEX_TYPE *slot = &(instance->volume->block[index_block].content.index[pos]);
+    SIMFS_DATA_TYPE merged;
+    if (*slot == SIMFS_INVALID_INDEX)
+        memset(merged, 0, SIMFS_DATA_SIZE);
+    else
+        memcpy(merged, instance->volume->block[*slot].content.data, SIMFS_DATA_SIZE);
+    if (data == NULL)
+        memset(merged + from, 0, length);
+    else
+        memcpy(merged + from, data, length);
+
+    if (isZeroData(merged)) {
+        if (*slot != SIMFS_INVALID_INDEX) {
+            releaseBlock(instance, *slot);
+            *slot = SIMFS_INVALID_INDEX;
+            filefd->allocatedBlocks--;
+        }
+        return 1;
+    }
+
+    if (*slot != SIMFS_INVALID_INDEX && instance->volume->sharedCount[*slot] == 0 &&
+        !(instance->context->options & SIMFS_MOUNT_DEDUP)) {
+        memcpy(instance->volume->block[*slot].content.data, merged, SIMFS_DATA_SIZE);
+        simfsSetBit(instance->context->verified, *slot);
+        return 1;
+    }
+
+    SIMFS_INDEX_TYPE block = storeDataBlock(instance, merged, SIMFS_DATA_SIZE);
+    if (block == SIMFS_INVALID_INDEX)
+        return 0;
+    if (*slot != SIMFS_INVALID_INDEX)
+        releaseBlock(instance, *slot);
+    else
+        filefd->allocatedBlocks++;
+    *slot = block;
+    return 1;
+}
+
+/*****
+ * Replaces length bytes of the content of a writable descriptor at the offset with the given data, or with zeros
+ * if data is NULL. The chain must already be long enough. The chain is walked once, making each index block
+ * on the way writable.
+ *
+ * Returns 0 if the volume is full.
+ */
+int updateRange(SIMFS_INSTANCE *instance, SIMFS_FILE_DESCRIPTOR_TYPE *filefd, size_t offset, char *data, size_t length)
+{
+    if (length == 0)
+        return 1;
+
+    size_t first = offset / SIMFS_DATA_SIZE;
+    SIMFS_INDEX_TYPE index_block = writableChainBlock(instance, filefd, first / LAST_POS);
+    if (index_block == SIMFS_INVALID_INDEX)
+        return 0;
+
+    int pos = first % LAST_POS;
+    for (size_t done = 0; done < length; ) {
+        if (pos == LAST_POS) {
+            SIMFS_INDEX_TYPE *link = &(instance->volume->block[index_block].content.index[LAST_POS]);
+            index_block = writableBlock(instance, *link);
+            if (index_block == SIMFS_INVALID_INDEX)
+                return 0;
+            *link = index_block;
+            pos = 0;
+        }
+
+        size_t from = (offset + done) % SIMFS_DATA_SIZE;
+        size_t chunk = SIMFS_DATA_SIZE - from < length - done ? SIMFS_DATA_SIZE - from : length - done;
+        if (!updateDataBlock(instance, filefd, index_block, pos++, from, (data != NULL) ? data + done : NULL, chunk))
+            return 0;
+        done += chunk;
+    }
+    return 1;
+}
+
+/*****
+ * Cuts the content of a writable descriptor down to the given length: zeros the tail of the last data block
+ * that is kept, and releases every data and index block past it.
+ *
+ * Returns 0 if the volume is full.
+ */
+int truncateContent(SIMFS_INSTANCE *instance, SIMFS_FILE_DESCRIPTOR_TYPE *filefd, size_t storedSize)
+{
+    size_t keep = (storedSize + SIMFS_DATA_SIZE - 1) / SIMFS_DATA_SIZE;
+    if (!updateRange(instance, filefd, storedSize, NULL, keep * SIMFS_DATA_SIZE - storedSize))
+        return 0;
+
+    size_t indexBlocks = indexBlocksForContent(storedSize);
+    if (indexBlocks == 0) {
+        if (filefd->block_ref != SIMFS_INVALID_INDEX)
+            releaseBlock(instance, filefd->block_ref);
+        filefd->block_ref = SIMFS_INVALID_INDEX;
+        filefd->allocatedBlocks = 0;
+        return 1;
+    }
+
+    SIMFS_INDEX_TYPE last = writableChainBlock(instance, filefd, indexBlocks - 1);
+    if (last == SIMFS_INVALID_INDEX)
+        return 0;
+
+    SIMFS_INDEX_TYPE *slots = instance->volume->block[last].content.index;
+    for (size_t pos = keep - (indexBlocks - 1) * LAST_POS; pos < LAST_POS; ++pos)
+        if (slots[pos] != SIMFS_INVALID_INDEX) {
+            releaseBlock(instance, slots[pos]);
+            slots[pos] = SIMFS_INVALID_INDEX;
+            filefd->allocatedBlocks--;
+        }
+    if (slots[LAST_POS] != SIMFS_INVALID_INDEX) {
+        filefd->allocatedBlocks -= countDataBlocks(instance, slots[LAST_POS]);
+        releaseBlock(instance, slots[LAST_POS]);
+        slots[LAST_POS] = SIMFS_INVALID_INDEX;
+    }
+    return 1;
+}
+
+/*****
+ * Changes the content of a compressed file by decompressing it, changing it, and writing it back as a whole.
+ * Compressed content is stored in one piece, so it never has holes.
+ */
+SIMFS_ERROR rewriteCompressedContent(SIMFS_INSTANCE *instance, struct fuse_context * context, SIMFS_INDEX_TYPE file,
+        size_t offset, char *data, size_t length, size_t size)
+{
+    SIMFS_FILE_DESCRIPTOR_TYPE * filefd = &(instance->volume->block[file].content.fileDescriptor);
+    size_t oldSize = filefd->size;
+    char *content = malloc((size > oldSize ? size : oldSize) + 1);
+    if (content == NULL)
+        return SIMFS_ALLOC_ERROR;
+
+    if (loadContent(instance, filefd, content) != SIMFS_NO_ERROR) {
+        free(content);
+        return SIMFS_READ_ERROR;
+    }
+    if (size > oldSize)
+        memset(content + oldSize, 0, size - oldSize);
+    if (data == NULL)
+        memset(content + offset, 0, length);
+    else
+        memcpy(content + offset, data, length);
+
+    SIMFS_ERROR error = replaceContent(instance, context, file, content, size, filefd->flags);
+    free(content);
+    return error;
+}
+
+/*****
+ * Verifies the data block that holds the byte at the given position of the stored content of a file, if there is
+ * such a block.
+ */
+SIMFS_ERROR verifyDataBlockAt(SIMFS_INSTANCE *instance, SIMFS_FILE_DESCRIPTOR_TYPE *filefd, size_t position)
+{
+    if (position >= filefd->storedSize)
+        return SIMFS_NO_ERROR;
+
+    size_t k = position / SIMFS_DATA_SIZE;
+    SIMFS_INDEX_TYPE index_block = filefd->block_ref;
+    for (size_t i = 0; i < k / LAST_POS; ++i)
+        index_block = instance->volume->block[index_block].content.index[LAST_POS];
+
+    SIMFS_INDEX_TYPE data = instance->volume->block[index_block].content.index[k % LAST_POS];
+    return (data == SIMFS_INVALID_INDEX) ? SIMFS_NO_ERROR : verifyBlock(instance, data);
+}
+
+/*****
+ * Replaces length bytes of the content of a file at the offset with the given data, or with zeros if data is
+ * NULL, and then sets the size of the file. Zeros in place of a whole data block leave a hole, and a size past
+ * the stored content does not take any blocks. Once the descriptor and the path to it are writable, and before
+ * the content is changed, the volume is checked to have room for every data block in the range and every index
+ * block of the chain, in case they all need to be cloned.
+ *
+ * Returns SIMFS_ALLOC_ERROR without changing anything if the range or the size reaches past SIMFS_MAX_FILE_SIZE.
+ */
+SIMFS_ERROR changeContent(SIMFS_INSTANCE *instance, struct fuse_context * context, SIMFS_INDEX_TYPE file, size_t offset,
+        char *data, size_t length, size_t size)
+{
+    if (offset > SIMFS_MAX_FILE_SIZE || length > SIMFS_MAX_FILE_SIZE - offset || size > SIMFS_MAX_FILE_SIZE)
+        return SIMFS_ALLOC_ERROR;
+
+    SIMFS_FILE_DESCRIPTOR_TYPE * filefd = &(instance->volume->block[file].content.fileDescriptor);
+    if (filefd->flags & SIMFS_COMPRESSED_FLAG)
+        return rewriteCompressedContent(instance, context, file, offset, data, length, size);
+
+    size_t end = offset + length;
+    size_t storedSize = (data != NULL && end > filefd->storedSize) ? end : filefd->storedSize;
+    if (size < storedSize)
+        storedSize = size;
+
+    // a data block that is changed only in part keeps the rest of its old content, which must be intact
+    if ((length > 0 && offset % SIMFS_DATA_SIZE != 0 &&
+         verifyDataBlockAt(instance, filefd, offset) != SIMFS_NO_ERROR) ||
+        (length > 0 && end % SIMFS_DATA_SIZE != 0 && verifyDataBlockAt(instance, filefd, end) != SIMFS_NO_ERROR) ||
+        (storedSize % SIMFS_DATA_SIZE != 0 && verifyDataBlockAt(instance, filefd, storedSize) != SIMFS_NO_ERROR))
+        return SIMFS_READ_ERROR;
+
+    // the path to the descriptor is cloned first, so that the blocks it takes are not counted on for the content;
+    // a path that is cloned in vain is just an unshared copy of the old one
+    setAllocationGoal(instance, file);
+    file = writableFile(instance, context, file);
+    if (file == SIMFS_INVALID_INDEX)
+        return SIMFS_ALLOC_ERROR;
+    filefd = &(instance->volume->block[file].content.fileDescriptor);
+
+    size_t needed = (length == 0) ? 0 : (end - 1) / SIMFS_DATA_SIZE - offset / SIMFS_DATA_SIZE + 1;
+    if (storedSize < filefd->storedSize)
+        needed++; // the zeroed tail of the last data block that is kept
+    needed += indexBlocksForContent(storedSize > filefd->storedSize ? storedSize : filefd->storedSize);
+    if (needed > (size_t) countFreeBlocks(instance))
+        return SIMFS_ALLOC_ERROR;
+
+    if (!extendChain(instance, filefd, storedSize) || !updateRange(instance, filefd, offset, data, length) ||
+        (storedSize < filefd->storedSize && !truncateContent(instance, filefd, storedSize)))
+        return SIMFS_WRITE_ERROR;
+
+    filefd->storedSize = storedSize;
+    filefd->size = size;
+    contentChanged(instance, file);
+
+    return SIMFS_NO_ERROR;
+}
+
+/***
+ * The function writes length bytes from writeBuffer to the file at the given offset, leaving the rest of the
+ * content as it is. Unlike writeFile(), the buffer may hold any bytes, including '\0'.
+ *
+ * The handle and the access rights are checked just like in writeFile(). Writing past the end of the file extends
+ * it; the gap between the old end and the offset is a hole that reads as zeros and takes no data blocks.
+ *
+ * Only the data blocks that the range overlaps are written to. A data block shared with a snapshot or another
+ * file is never modified in place, so the change is invisible everywhere else.
+ *
+ * The function returns SIMFS_ALLOC_ERROR if the volume might not have enough free blocks for the change, or if the
+ * range ends past SIMFS_MAX_FILE_SIZE; the file is then left intact.
+ */
+SIMFS_ERROR writeFileAt(SIMFS_INSTANCE *instance, SIMFS_FILE_HANDLE_TYPE fileHandle, size_t offset, char *writeBuffer,
+        size_t length)
+{
+    struct fuse_context * context = simfs_debug_get_context();
+    SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE * openFile;
+    SIMFS_ERROR error = checkWriteAccess(instance, context, fileHandle, &openFile);
+    if (error != SIMFS_NO_ERROR || length == 0)
+        return error;
+
+    if (offset > SIMFS_MAX_FILE_SIZE || length > SIMFS_MAX_FILE_SIZE - offset)
+        return SIMFS_ALLOC_ERROR;
+
+    SIMFS_FILE_DESCRIPTOR_TYPE * filefd = &(instance->volume->block[openFile->fileDescriptor].content.fileDescriptor);
+    size_t size = (offset + length > filefd->size) ? offset + length : filefd->size;
+    return changeContent(instance, context, openFile->fileDescriptor, offset, writeBuffer, length, size);
+}
+
+/***
+ * The function sets the size of the file. Growing a file only changes its size, and the new part reads as zeros
+ * without taking any blocks. Shrinking a file releases every block past the new size.
+ *
+ * The handle and the access rights are checked just like in writeFile().
+ *
+ * The function returns SIMFS_ALLOC_ERROR if the size is larger than SIMFS_MAX_FILE_SIZE, or if blocks shared with
+ * a snapshot have to be cloned, but the volume might not have enough free blocks; the file is then left intact.
+ */
+SIMFS_ERROR setFileSize(SIMFS_INSTANCE *instance, SIMFS_FILE_HANDLE_TYPE fileHandle, size_t size)
+{
+    struct fuse_context * context = simfs_debug_get_context();
+    SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE * openFile;
+    SIMFS_ERROR error = checkWriteAccess(instance, context, fileHandle, &openFile);
+    if (error != SIMFS_NO_ERROR)
+        return error;
+
+    return changeContent(instance, context, openFile->fileDescriptor, 0, NULL, 0, size);
+}
+
+/***
+ * The function replaces length bytes of the file at the given offset with zeros without changing its size. Every
+ * data block that the range covers completely is released to the bitvector and becomes a hole; the blocks at the
+ * edges of the range are zeroed in part. The part of the range past the end of the file is ignored.
+ *
+ * The handle and the access rights are checked just like in writeFile().
+ *
+ * The function returns SIMFS_ALLOC_ERROR if blocks shared with a snapshot have to be cloned, but the volume might
+ * not have enough free blocks; the file is then left intact.
+ */
+SIMFS_ERROR punchHole(SIMFS_INSTANCE *instance, SIMFS_FILE_HANDLE_TYPE fileHandle, size_t offset, size_t length)
+{
+    struct fuse_context * context = simfs_debug_get_context();
+    SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE * openFile;
+    SIMFS_ERROR error = checkWriteAccess(instance, context, fileHandle, &openFile);
+    if (error != SIMFS_NO_ERROR)
+        return error;
+
+    SIMFS_FILE_DESCRIPTOR_TYPE * filefd = &(instance->volume->block[openFile->fileDescriptor].content.fileDescriptor);
+    // zeros past the stored content are already there
+    size_t end = (filefd->flags & SIMFS_COMPRESSED_FLAG) ? filefd->size : filefd->storedSize;
+    if (offset >= end)
+        return SIMFS_NO_ERROR;
+    if (length > end - offset)
+        length = end - offset;
+
+    return changeContent(instance, context, openFile->fileDescriptor, offset, NULL, length, filefd->size);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+/***
+ * The function returns the complete content of the file to the caller through the parameter readBuffer.
+ *
+ * Checks if the file handle (i.e., an index to an entry in the per-process open files table) points to
+ * a valid file descriptor of an open file. Any issues should be reported by returning SIMFS_SYSTEM_ERROR.
+ * In this case, further code debugging is needed.
+ *
+ * Otherwise, it checks the user's access right to read the file. If the process owner is not allowed to read the file,
+ * then the function returns SIMFS_ACCESS_ERROR.
+ *
+ * Otherwise, the function allocates memory sufficient to hold the read content with an appended end of string
+ * character; the pointer to newly allocated memory is passed back through the readBuffer parameter. All the content
+ * of the blocks is concatenated using the allocated space, and an end of string character is appended at the end of
+ * the concatenated content.
+ *
+ * The access time of the file is moved in the open file table only, as the mount options allow.
+ *
+ * The function returns SIMFS_READ_ERROR in response to exception not specified earlier.
+ *
+ */
+SIMFS_ERROR readFile(SIMFS_INSTANCE *instance, SIMFS_FILE_HANDLE_TYPE fileHandle, char **readBuffer)
+{
+    struct fuse_context * context = simfs_debug_get_context();
+    SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE * openFile = findOpenFile(instance, context, fileHandle, NULL);
+    if (openFile == NULL || openFile->type != SIMFS_FILE_CONTENT_TYPE)
+        return SIMFS_SYSTEM_ERROR;
+
+    if (!hasAccessRight(context, openFile->accessRights, openFile->owner, S_IRUSR, S_IROTH))
+        return SIMFS_ACCESS_ERROR;
+
+    SIMFS_FILE_DESCRIPTOR_TYPE * filefd = &(instance->volume->block[openFile->fileDescriptor].content.fileDescriptor);
+    *readBuffer = malloc(filefd->size + 1);
+    if (*readBuffer == NULL)
+        return SIMFS_READ_ERROR;
+
+    if (loadContent(instance, filefd, *readBuffer) != SIMFS_NO_ERROR) {
+        free(*readBuffer);
+        *readBuffer = NULL;
+        return SIMFS_READ_ERROR;
+    }
+    (*readBuffer)[filefd->size] = '\0';
+
+    touchAccessTime(instance, openFile);
+
+    return SIMFS_NO_ERROR;
+}
+
+/*****
+ * Adds the data blocks of a chain of index blocks holding content of the given length to a gather list, with
+ * the places in the buffer the blocks are to be copied to and the position of the file they belong to. The places
+ * of holes are filled with zeros right away.
+ */
+void gatherContent(SIMFS_INSTANCE *instance, SIMFS_INDEX_TYPE index_block, size_t length, char *buffer, int file,
+        SIMFS_GATHER_TYPE *gather, size_t *numberOfEntries)
+{
+    int pos = 0;
+    for (size_t offset = 0; offset < length; offset += SIMFS_DATA_SIZE) {
+        if (pos == LAST_POS) {
+            index_block = instance->volume->block[index_block].content.index[LAST_POS];
+            pos = 0;
+        }
+
+        SIMFS_INDEX_TYPE data = instance->volume->block[index_block].content.index[pos++];
+        size_t chunk = length - offset < SIMFS_DATA_SIZE ? length - offset : SIMFS_DATA_SIZE;
+        if (data == SIMFS_INVALID_INDEX) {
+            memset(buffer + offset, 0, chunk);
+            continue;
+        }
+
+        SIMFS_GATHER_TYPE * entry = &gather[(*numberOfEntries)++];
+        entry->block = data;
+        entry->length = chunk;
+        entry->file = file;
+        entry->destination = buffer + offset;
+    }
+}
+
+int compareGatherEntries(const void *a, const void *b)
+{
+    const SIMFS_GATHER_TYPE * x = a;
+    const SIMFS_GATHER_TYPE * y = b;
+    return (x->block > y->block) - (x->block < y->block);
+}
+
+/***
+ * Reads the complete content of several files in the current working directory in one operation.
+ *
+ * The files are not opened, so no entries are made in the open file tables. All names are resolved in one pass
+ * over the folder. The data blocks of all files are then copied in the order of their block indices, so that the
+ * volume is read from start to end once, no matter how the files are laid out.
+ *
+ * The content of the i-th file is copied to buffers[i], without an end of string character; on return,
+ * buffers[i].iov_len holds the size of the file. The outcome for the file is returned in results[i]:
+ *
+ *    - SIMFS_NOT_FOUND_ERROR if there is no such file, and SIMFS_READ_ERROR if the name refers to a folder, or if
+ *      the checksum of one of its data blocks does not match
+ *
+ *    - SIMFS_ACCESS_ERROR if the user is not allowed to read the file
+ *
+ *    - SIMFS_ALLOC_ERROR if the buffer is smaller than the file; nothing is copied, and iov_len tells how large the
+ *      buffer must be
+ *
+ * The function returns the first of these errors, or SIMFS_NO_ERROR if all files were read. If it runs out of
+ * memory, nothing is read, and SIMFS_ALLOC_ERROR is returned for every file.
+ */
+SIMFS_ERROR readMany(SIMFS_INSTANCE *instance, int numberOfFiles, char **fileNames, struct iovec *buffers,
+        SIMFS_ERROR *results)
+{
+    struct fuse_context * context = simfs_debug_get_context();
+    SIMFS_INDEX_TYPE cwd = getCurrentWorkingDirectory(instance, context);
+    SIMFS_FILE_DESCRIPTOR_TYPE * cwdfd = &(instance->volume->block[cwd].content.fileDescriptor);
+
+    SIMFS_INDEX_TYPE *files = malloc(numberOfFiles * sizeof(SIMFS_INDEX_TYPE));
+    char **stored = calloc(numberOfFiles, sizeof(char *));
+    if (files == NULL || stored == NULL ||
+        findFilesInFolder(instance, cwdfd, numberOfFiles, fileNames, files) != SIMFS_NO_ERROR) {
+        for (int i = 0; i < numberOfFiles; ++i)
+            results[i] = SIMFS_ALLOC_ERROR;
+        free(files);
+        free(stored);
+        return SIMFS_ALLOC_ERROR;
+    }
+
+    size_t numberOfBlocks = 0;
+    for (int i = 0; i < numberOfFiles; ++i) {
+        if (files[i] == SIMFS_INVALID_INDEX) {
+            results[i] = SIMFS_NOT_FOUND_ERROR;
+            continue;
+        }
+
+        SIMFS_FILE_DESCRIPTOR_TYPE * filefd = &(instance->volume->block[files[i]].content.fileDescriptor);
+        if (filefd->type != SIMFS_FILE_CONTENT_TYPE)
+            results[i] = SIMFS_READ_ERROR;
+        else if (!hasAccessRight(context, filefd->accessRights, filefd->owner, S_IRUSR, S_IROTH))
+            results[i] = SIMFS_ACCESS_ERROR;
+        else if (filefd->size > buffers[i].iov_len) {
+            results[i] = SIMFS_ALLOC_ERROR;
+            buffers[i].iov_len = filefd->size;
+        }
+        else {
+            results[i] = SIMFS_NO_ERROR;
+            numberOfBlocks += (filefd->storedSize + SIMFS_DATA_SIZE - 1) / SIMFS_DATA_SIZE;
+        }
+    }
+
+    // compressed content is gathered into temporary buffers and decoded afterwards
+    SIMFS_ERROR error = SIMFS_NO_ERROR;
+    size_t numberOfEntries = 0;
+    SIMFS_GATHER_TYPE *gather = malloc(numberOfBlocks * sizeof(SIMFS_GATHER_TYPE) + 1);
+    if (gather == NULL)
+        error = SIMFS_ALLOC_ERROR;
+    for (int i = 0; i < numberOfFiles && error == SIMFS_NO_ERROR; ++i) {
+        if (results[i] != SIMFS_NO_ERROR)
+            continue;
+        SIMFS_FILE_DESCRIPTOR_TYPE * filefd = &(instance->volume->block[files[i]].content.fileDescriptor);
+        char *destination = buffers[i].iov_base;
+        if (filefd->flags & SIMFS_COMPRESSED_FLAG) {
+            destination = stored[i] = malloc(filefd->storedSize + 1);
+            if (destination == NULL)
+                error = SIMFS_ALLOC_ERROR;
+        }
+        if (destination != NULL)
+            gatherContent(instance, filefd->block_ref, filefd->storedSize, destination, i, gather, &numberOfEntries);
+    }
+
+    if (error != SIMFS_NO_ERROR) {
+        for (int i = 0; i < numberOfFiles; ++i)
+            results[i] = SIMFS_ALLOC_ERROR;
+    }
+    else {
+        qsort(gather, numberOfEntries, sizeof(SIMFS_GATHER_TYPE), compareGatherEntries);
+        for (size_t k = 0; k < numberOfEntries; ++k) {
+            if (verifyBlock(instance, gather[k].block) != SIMFS_NO_ERROR)
+                results[gather[k].file] = SIMFS_READ_ERROR;
+            else
+                memcpy(gather[k].destination, instance->volume->block[gather[k].block].content.data, gather[k].length);
+        }
+
+        for (int i = 0; i < numberOfFiles; ++i) {
+            if (results[i] != SIMFS_NO_ERROR)
+                continue;
+            SIMFS_FILE_DESCRIPTOR_TYPE * filefd = &(instance->volume->block[files[i]].content.fileDescriptor);
+            if (stored[i] != NULL &&
+                !decompressContent(stored[i], filefd->storedSize, buffers[i].iov_base, filefd->size))
+                results[i] = SIMFS_READ_ERROR;
+            if (stored[i] == NULL)
+                memset((char *) buffers[i].iov_base + filefd->storedSize, 0, filefd->size - filefd->storedSize);
+            buffers[i].iov_len = filefd->size;
+        }
+
+        for (int i = 0; i < numberOfFiles && error == SIMFS_NO_ERROR; ++i)
+            error = results[i];
+    }
+
+    for (int i = 0; i < numberOfFiles; ++i)
+        free(stored[i]);
+    free(stored);
+    free(gather);
+    free(files);
+    return error;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+/***
+ * Removes the entry for the file with the file handle provided as the parameter from the open file table
+ * for this process. It decreases the number of open files for the file in the process control block of
+ * this process, and if it becomes zero, then the process control block for this process is removed from
+ * the processControlBlocks list.
+ *
+ * Decreases the reference count in the global open file table, and if that number is 0, it also removes the entry
+ * for this file from the global open file table. In this case, it also removes the index to the global open file
+ * table from the directory entry for the file by overwriting it with SIMFS_INVALID_OPEN_FILE_TABLE_INDEX, after
+ * writing the cached access time back to the descriptor.
+ *
+ */
+
+SIMFS_ERROR closeFileHandle(SIMFS_INSTANCE *instance, SIMFS_FILE_HANDLE_TYPE fileHandle)
+{
+    struct fuse_context * context = simfs_debug_get_context();
+    SIMFS_PROCESS_CONTROL_BLOCK_TYPE * pcb = NULL;
+    SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE * openFile = findOpenFile(instance, context, fileHandle, &pcb);
+    if (openFile == NULL)
+        return SIMFS_SYSTEM_ERROR;
+
+    pcb->openFileTable[fileHandle].globalOpenFileTableIndex = SIMFS_INVALID_OPEN_FILE_TABLE_INDEX;
+    if (--pcb->numberOfOpenFiles == 0) {
+        SIMFS_PROCESS_CONTROL_BLOCK_TYPE ** link = &(instance->context->processControlBlocks);
+        while (*link != pcb)
+            link = &((*link)->next);
+        *link = pcb->next;
+        free(pcb);
+    }
+
+    if (--openFile->referenceCount == 0) {
+        writeBackAttributes(instance, context, openFile);
+        SIMFS_INDEX_TYPE file = openFile->fileDescriptor;
+        SIMFS_DIR_ENT ** ent = findFileInDirectory(instance, file);
+        if (ent != NULL)
+            (*ent)->globalOpenFileTableIndex = SIMFS_INVALID_OPEN_FILE_TABLE_INDEX;
+        openFile->type = SIMFS_INVALID_CONTENT_TYPE;
+    }
+
+    return SIMFS_NO_ERROR;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+/***
+ * Turns compression of a file in the current working directory on or off. Existing content is re-encoded
+ * (copy-on-write, like simfsWriteFile()); from then on, simfsWriteFile() compresses the file's content and
+ * simfsReadFile() decompresses it transparently.
+ *
+ * Returns SIMFS_NOT_FOUND_ERROR if there is no such file, SIMFS_ACCESS_ERROR for folders, read-only mounts,
+ * and callers that may not write to the file, and SIMFS_ALLOC_ERROR if the re-encoded content does not fit.
+ */
+SIMFS_ERROR setFileCompression(SIMFS_INSTANCE *instance, SIMFS_NAME_TYPE fileName, int compressed)
+{
+    if (instance->context->readOnly)
+        return SIMFS_ACCESS_ERROR;
+
+    struct fuse_context * context = simfs_debug_get_context();
+    SIMFS_INDEX_TYPE cwd = getCurrentWorkingDirectory(instance, context);
+    SIMFS_FILE_DESCRIPTOR_TYPE * cwdfd = &(instance->volume->block[cwd].content.fileDescriptor);
+
+    SIMFS_INDEX_TYPE file = findFileInFolder(instance, cwdfd, fileName, NULL);
+    if (file == SIMFS_INVALID_INDEX)
+        return SIMFS_NOT_FOUND_ERROR;
+
+    SIMFS_FILE_DESCRIPTOR_TYPE * filefd = &(instance->volume->block[file].content.fileDescriptor);
+    if (filefd->type != SIMFS_FILE_CONTENT_TYPE ||
+        !hasAccessRight(context, filefd->accessRights, filefd->owner, S_IWUSR, S_IWOTH))
+        return SIMFS_ACCESS_ERROR;
+
+    unsigned short flags = compressed ? filefd->flags | SIMFS_COMPRESSED_FLAG : filefd->flags & ~SIMFS_COMPRESSED_FLAG;
+    if (flags == filefd->flags)
+        return SIMFS_NO_ERROR;
+
+    char *content = malloc(filefd->size + 1);
+    if (content == NULL)
+        return SIMFS_ALLOC_ERROR;
+
+    SIMFS_ERROR error = loadContent(instance, filefd, content);
+    if (error == SIMFS_NO_ERROR)
+        error = replaceContent(instance, context, file, content, filefd->size, flags);
+    free(content);
+
+    return error;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+SIMFS_SNAPSHOT_TYPE * findSnapshot(SIMFS_INSTANCE *instance, SIMFS_NAME_TYPE snapshotName)
+{
+    for (int i = 0; i < SIMFS_MAX_NUMBER_OF_SNAPSHOTS; i++)
+        if (instance->volume->snapshot[i].name[0] != '\0' &&
+            strcmp(instance->volume->snapshot[i].name, snapshotName) == 0)
+            return &(instance->volume->snapshot[i]);
+    return NULL;
+}
+
+/***
+ * Takes a named snapshot of the live volume.
+ *
+ * The superblock (and with it the root node index) is recorded in a free snapshot slot and the root gets one more
+ * reference. Nothing else is copied; blocks are cloned when the live volume modifies them later, so taking a
+ * snapshot costs O(1).
+ *
+ * Returns SIMFS_ACCESS_ERROR if a snapshot is mounted, SIMFS_DUPLICATE_ERROR if a snapshot with the same name
+ * already exists, and SIMFS_ALLOC_ERROR if there is no free snapshot slot.
+ */
+SIMFS_ERROR createSnapshot(SIMFS_INSTANCE *instance, SIMFS_NAME_TYPE snapshotName)
+{
+    if (instance->context->readOnly)
+        return SIMFS_ACCESS_ERROR;
+
+    if (findSnapshot(instance, snapshotName) != NULL)
+        return SIMFS_DUPLICATE_ERROR;
+
+    SIMFS_INDEX_TYPE root = instance->context->rootNodeIndex;
+    if (instance->volume->sharedCount[root] == SIMFS_MAX_SHARED_COUNT)
+        return SIMFS_ALLOC_ERROR;
+
+    for (int i = 0; i < SIMFS_MAX_NUMBER_OF_SNAPSHOTS; i++) {
+        SIMFS_SNAPSHOT_TYPE * snapshot = &(instance->volume->snapshot[i]);
+        if (snapshot->name[0] != '\0')
+            continue;
+
+        strcpy(snapshot->name, snapshotName);
+        memcpy(&(snapshot->superblock), &(instance->volume->superblock), sizeof(SIMFS_SUPERBLOCK_TYPE));
+        snapshot->creationTime = currentTime();
+        instance->volume->sharedCount[root]++;
+        return SIMFS_NO_ERROR;
+    }
+
+    return SIMFS_ALLOC_ERROR;
+}
+
+/***
+ * Deletes a named snapshot. Blocks that only the snapshot still refers to are freed.
+ *
+ * Returns SIMFS_ACCESS_ERROR if a snapshot is mounted and SIMFS_NOT_FOUND_ERROR if there is no such snapshot.
+ */
+SIMFS_ERROR deleteSnapshot(SIMFS_INSTANCE *instance, SIMFS_NAME_TYPE snapshotName)
+{
+    if (instance->context->readOnly)
+        return SIMFS_ACCESS_ERROR;
+
+    SIMFS_SNAPSHOT_TYPE * snapshot = findSnapshot(instance, snapshotName);
+    if (snapshot == NULL)
+        return SIMFS_NOT_FOUND_ERROR;
+
+    releaseBlock(instance, snapshot->superblock.attr.rootNodeIndex);
+    memset(snapshot, 0, sizeof(SIMFS_SNAPSHOT_TYPE));
+
+    return SIMFS_NO_ERROR;
+}
+
+/***
+ * Loads the file system from a disk like simfsMountFileSystem(), but with the root of a named snapshot as the
+ * root of the mounted tree. The snapshot is mounted read-only: creating, deleting, and writing files returns
+ * SIMFS_ACCESS_ERROR, and unmounting does not save anything.
+ *
+ * Returns SIMFS_NOT_FOUND_ERROR if there is no such snapshot.
+ */
+SIMFS_ERROR simfsMountSnapshot(SIMFS_INSTANCE *instance, char *simfsFileName, SIMFS_NAME_TYPE snapshotName)
+{
+    SIMFS_ERROR error;
+
+    error = mountVolume(instance, simfsFileName, 0);
+    if (error != SIMFS_NO_ERROR)
+        return error;
+
+    SIMFS_SNAPSHOT_TYPE * snapshot = findSnapshot(instance, snapshotName);
+    if (snapshot == NULL) {
+        free(instance->volume);
+        return SIMFS_NOT_FOUND_ERROR;
+    }
+
+    error = mountContext(instance, snapshot->superblock.attr.rootNodeIndex, 0);
+    if (error != SIMFS_NO_ERROR) {
+        free(instance->volume);
+        return error;
+    }
+
+    instance->context->readOnly = 1;
+    return SIMFS_NO_ERROR;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// background writeback
+//
+//////////////////////////////////////////////////////////////////////////
+
+/*****
+ * Copies the live volume into a shadow buffer and hands it to the writeback thread.
+ *
+ * The caller holds both the volume lock and the writeback lock. A checkpoint that is still waiting to be written is
+ * overwritten with the newer one; the buffer that the thread is writing is never touched.
+ */
+void captureCheckpoint(SIMFS_INSTANCE *instance, SIMFS_WRITEBACK_TYPE *writeback)
+{
+    int shadow = writeback->pendingShadow;
+    if (shadow < 0)
+        shadow = (writeback->writingShadow == 0) ? 1 : 0;
+
+    memcpy(writeback->shadow[shadow], instance->volume, sizeof(SIMFS_VOLUME));
+    writeback->shadowChanges[shadow] = writeback->changes;
+    clock_gettime(CLOCK_MONOTONIC, &(writeback->shadowTime[shadow]));
+    writeback->capturedChanges = writeback->changes;
+    writeback->pendingShadow = shadow;
+    writeback->stats.numberOfCaptures++;
+
+    pthread_cond_signal(&(writeback->wakeup));
+}
+
+/*****
+ * Counts a change of the volume. Once the changes since the latest checkpoint reach the dirty threshold, a new
+ * checkpoint is taken right away; taking it is a memory copy, so the caller never waits for the disk.
+ *
+ * The caller holds the volume lock.
+ */
+void volumeChanged(SIMFS_INSTANCE *instance)
+{
+    SIMFS_WRITEBACK_TYPE * writeback = &(instance->context->writeback);
+
+    pthread_mutex_lock(&(writeback->lock));
+    if (writeback->changes == writeback->flushedChanges)
+        clock_gettime(CLOCK_MONOTONIC, &(writeback->firstUnflushedChange));
+    writeback->changes++;
+
+    if (writeback->running && writeback->changes - writeback->capturedChanges >= writeback->dirtyThreshold)
+        captureCheckpoint(instance, writeback);
+    pthread_mutex_unlock(&(writeback->lock));
+}
+
+/*****
+ * The writeback thread.
+ *
+ * Waits for a checkpoint or for the interval to pass. When the interval passes with changes that did not reach the
+ * threshold, it takes the checkpoint itself. Checkpoints are written without holding any lock, so the file system
+ * operations proceed against the live volume meanwhile. When stopped, the thread writes the remaining changes
+ * before exiting. The thread works on the instance that it was started for.
+ */
+void *writebackThread(void *argument)
+{
+    SIMFS_INSTANCE * instance = argument;
+    SIMFS_CONTEXT_TYPE * context = instance->context;
+    SIMFS_WRITEBACK_TYPE * writeback = &(context->writeback);
+
+    pthread_mutex_lock(&(writeback->lock));
+    while (1) {
+        if (writeback->pendingShadow < 0 && writeback->running) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += writeback->interval / 1000;
+            deadline.tv_nsec += (long) (writeback->interval % 1000) * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+
+            int status = 0;
+            while (writeback->pendingShadow < 0 && writeback->running && status != ETIMEDOUT)
+                status = pthread_cond_timedwait(&(writeback->wakeup), &(writeback->lock), &deadline);
+        }
+
+        if (writeback->pendingShadow < 0 && writeback->changes != writeback->capturedChanges) {
+            // the volume lock is always taken first
+            pthread_mutex_unlock(&(writeback->lock));
+            pthread_mutex_lock(&(context->lock));
+            pthread_mutex_lock(&(writeback->lock));
+            if (writeback->pendingShadow < 0 && writeback->changes != writeback->capturedChanges)
+                captureCheckpoint(instance, writeback);
+            pthread_mutex_unlock(&(context->lock));
+        }
+
+        if (writeback->pendingShadow >= 0) {
+            int shadow = writeback->pendingShadow;
+            writeback->pendingShadow = -1;
+            writeback->writingShadow = shadow;
+            pthread_mutex_unlock(&(writeback->lock));
+
+            struct timespec start, end;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            SIMFS_ERROR error = saveVolume(instance, writeback->fileName, writeback->shadow[shadow]);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+
+            pthread_mutex_lock(&(writeback->lock));
+            writeback->writingShadow = -1;
+            writeback->error = error;
+            if (error == SIMFS_NO_ERROR) {
+                SIMFS_WRITEBACK_STATS_TYPE * stats = &(writeback->stats);
+                unsigned long long duration = elapsedNanoseconds(&start, &end);
+                unsigned long long lag = elapsedNanoseconds(&(writeback->firstUnflushedChange), &end);
+
+                stats->numberOfFlushes++;
+                stats->lastFlushDuration = duration;
+                stats->totalFlushDuration += duration;
+                if (duration > stats->maxFlushDuration)
+                    stats->maxFlushDuration = duration;
+                if (lag > stats->maxLag)
+                    stats->maxLag = lag;
+
+                // changes made after the checkpoint was taken are at most as old as the checkpoint
+                writeback->flushedChanges = writeback->shadowChanges[shadow];
+                if (writeback->changes != writeback->flushedChanges)
+                    writeback->firstUnflushedChange = writeback->shadowTime[shadow];
+            }
+            pthread_cond_broadcast(&(writeback->flushed));
+            continue;
+        }
+
+        if (!writeback->running)
+            break;
+    }
+    pthread_mutex_unlock(&(writeback->lock));
+
+    return NULL;
+}
+
+/*****
+ * Sets up the writeback state and starts the thread for simfsStartWriteback(). The caller holds the volume lock and
+ * the writeback lock, so no operation counts a change and the thread does not start working until it is all set.
+ */
+SIMFS_ERROR startWriteback(SIMFS_INSTANCE *instance, char *simfsFileName, unsigned int interval,
+                           unsigned int dirtyThreshold)
+{
+    SIMFS_WRITEBACK_TYPE * writeback = &(instance->context->writeback);
+
+    if (instance->context->readOnly)
+        return SIMFS_ACCESS_ERROR;
+
+    if (writeback->running || writeback->stopping)
+        return SIMFS_DUPLICATE_ERROR;
+
+    writeback->fileName = malloc(strlen(simfsFileName) + 1);
+    writeback->shadow[0] = simfsIoAllocate(sizeof(SIMFS_VOLUME));
+    writeback->shadow[1] = simfsIoAllocate(sizeof(SIMFS_VOLUME));
+    if (writeback->fileName == NULL || writeback->shadow[0] == NULL || writeback->shadow[1] == NULL) {
+        free(writeback->fileName);
+        free(writeback->shadow[0]);
+        free(writeback->shadow[1]);
+        return SIMFS_ALLOC_ERROR;
+    }
+    strcpy(writeback->fileName, simfsFileName);
+
+    writeback->interval = (interval > 0 ? interval : 1);
+    writeback->dirtyThreshold = (dirtyThreshold > 0 ? dirtyThreshold : 1);
+    writeback->pendingShadow = -1;
+    writeback->writingShadow = -1;
+    writeback->error = SIMFS_NO_ERROR;
+    writeback->running = 1;
+
+    if (pthread_create(&(writeback->thread), NULL, writebackThread, instance) != 0) {
+        writeback->running = 0;
+        free(writeback->fileName);
+        free(writeback->shadow[0]);
+        free(writeback->shadow[1]);
+        return SIMFS_SYSTEM_ERROR;
+    }
+
+    return SIMFS_NO_ERROR;
+}
+
+/***
+ * Starts a background thread that keeps the image of the mounted file system on a disk up to date.
+ *
+ * The thread checkpoints the volume every interval milliseconds if anything has changed, or as soon as
+ * dirtyThreshold modifying operations have accumulated since the latest checkpoint. A checkpoint is a copy of
+ * the volume in one of two shadow buffers; the thread writes it to the image while the file system operations
+ * proceed against the live volume, so they never wait for the disk. Use simfsSync() to wait until all changes
+ * are on the disk.
+ *
+ * Returns SIMFS_ACCESS_ERROR if a snapshot is mounted, SIMFS_DUPLICATE_ERROR if the thread is running or stopping,
+ * and SIMFS_ALLOC_ERROR or SIMFS_SYSTEM_ERROR if the buffers or the thread cannot be created.
  */
+SIMFS_ERROR simfsStartWriteback(SIMFS_INSTANCE *instance, char *simfsFileName, unsigned int interval,
+                                unsigned int dirtyThreshold)
+{
+    SIMFS_WRITEBACK_TYPE * writeback = &(instance->context->writeback);
+
+    pthread_mutex_lock(&(instance->context->lock));
+    pthread_mutex_lock(&(writeback->lock));
+    SIMFS_ERROR error = startWriteback(instance, simfsFileName, interval, dirtyThreshold);
+    pthread_mutex_unlock(&(writeback->lock));
+    pthread_mutex_unlock(&(instance->context->lock));
+    return error;
+}
 
-SIMFS_ERROR simfsDeleteFile(SIMFS_NAME_TYPE fileName)
+/***
+ * Stops the writeback thread after it has written all changes to the disk.
+ *
+ * Returns the result of the last write, or SIMFS_NOT_FOUND_ERROR if the thread is not running.
+ */
+SIMFS_ERROR simfsStopWriteback(SIMFS_INSTANCE *instance)
 {
-    // TODO: implement
-    
-    //Get the current context
-    struct fuse_context * context = simfs_debug_get_context();
-    SIMFS_INDEX_TYPE cwd = getCurrentWorkingDirectory(context);
-    SIMFS_FILE_DESCRIPTOR_TYPE * cwdfd = &(simfsVolume->block[cwd].content.fileDescriptor);
+    SIMFS_WRITEBACK_TYPE * writeback = &(instance->context->writeback);
 
-    //Find the file in the current working directory
-    SIMFS_INDEX_TYPE containingIndexBlock = SIMFS_INVALID_INDEX;
-    int positionInIndexBlock = LAST_POS;
-    int sizeOfIndexBlock = 0;
-    SIMFS_INDEX_TYPE file = findFileInFolder(cwdfd, fileName,
-        &containingIndexBlock, &positionInIndexBlock, &sizeOfIndexBlock);
-    if (file == SIMFS_INVALID_INDEX)
+    pthread_mutex_lock(&(writeback->lock));
+    if (!writeback->running) {
+        pthread_mutex_unlock(&(writeback->lock));
         return SIMFS_NOT_FOUND_ERROR;
+    }
+    writeback->running = 0;
+    writeback->stopping = 1;
+    pthread_cond_signal(&(writeback->wakeup));
+    pthread_mutex_unlock(&(writeback->lock));
 
-    //Find the file in the simfsContext->directory
-    SIMFS_DIR_ENT ** ent = findFileInDirectory(file, fileName);
-    if (ent == NULL)
-        return SIMFS_NOT_FOUND_ERROR;
+    pthread_join(writeback->thread, NULL);
 
-    unsigned int actuallyFunny = (*ent)->globalOpenFileTableIndex;
-    if (actuallyFunny != SIMFS_INVALID_OPEN_FILE_TABLE_INDEX)
-        if (simfsContext->globalOpenFileTable[actuallyFunny].referenceCount != 0)
-            return SIMFS_WRITE_ERROR;
+    pthread_mutex_lock(&(writeback->lock));
+    free(writeback->fileName);
+    free(writeback->shadow[0]);
+    free(writeback->shadow[1]);
+    writeback->fileName = NULL;
+    writeback->shadow[0] = writeback->shadow[1] = NULL;
+    writeback->stopping = 0;
+    SIMFS_ERROR error = writeback->error;
+    pthread_mutex_unlock(&(writeback->lock));
 
-    //Check to see that file (if a directory) is empty
-    SIMFS_FILE_DESCRIPTOR_TYPE * filefd = &(simfsVolume->block[file].content.fileDescriptor);
-    if ( (filefd->type == SIMFS_FOLDER_CONTENT_TYPE) && (filefd->size != 0) )
-        return SIMFS_NOT_EMPTY_ERROR;
-    
-    //TODO do you have permissions?
-    //  If user use pcb->permisions & I_SWUSR
-    //  else use pcb->permissions & I_SWOTH
+    return error;
+}
 
-    simfsVolume->block[containingIndexBlock].content.index[positionInIndexBlock] =
-        simfsVolume->block[containingIndexBlock].content.index[sizeOfIndexBlock-1];
+/***
+ * Waits until every change made before the call is on the disk (the equivalent of fsync(2) for the whole volume).
+ * The cached attributes of open files are written back to their descriptors first.
+ *
+ * Returns SIMFS_NOT_FOUND_ERROR if the writeback thread is not running, and SIMFS_WRITE_ERROR if the image
+ * could not be written.
+ */
+SIMFS_ERROR simfsSync(SIMFS_INSTANCE *instance)
+{
+    SIMFS_WRITEBACK_TYPE * writeback = &(instance->context->writeback);
 
-    SIMFS_DIR_ENT * trash_ent = *ent;
-    *ent = (*ent)->next;
-    free(trash_ent);
+    pthread_mutex_lock(&(instance->context->lock));
+    writeBackAllAttributes(instance, simfs_debug_get_context());
+    pthread_mutex_lock(&(writeback->lock));
+    pthread_mutex_unlock(&(instance->context->lock));
 
-    if (cwdfd->type == SIMFS_FILE_CONTENT_TYPE) {
-        deleteFileIndices(filefd);
+    if (!writeback->running) {
+        pthread_mutex_unlock(&(writeback->lock));
+        return SIMFS_NOT_FOUND_ERROR;
     }
 
-    simfsClearBit(simfsContext->bitvector, file);
-    simfsClearBit(simfsVolume->bitvector, file);
-    cwdfd->size--;
-    return SIMFS_NO_ERROR;
-}
+    if (writeback->changes != writeback->capturedChanges) {
+        pthread_mutex_unlock(&(writeback->lock));
+        pthread_mutex_lock(&(instance->context->lock));
+        pthread_mutex_lock(&(writeback->lock));
+        if (writeback->changes != writeback->capturedChanges)
+            captureCheckpoint(instance, writeback);
+        pthread_mutex_unlock(&(instance->context->lock));
+    }
 
-//////////////////////////////////////////////////////////////////////////
+    SIMFS_ERROR error = SIMFS_NO_ERROR;
+    unsigned long long target = writeback->capturedChanges;
+    while (writeback->flushedChanges < target && error == SIMFS_NO_ERROR) {
+        pthread_cond_wait(&(writeback->flushed), &(writeback->lock));
+        error = writeback->error;
+    }
+    pthread_mutex_unlock(&(writeback->lock));
+
+    return error;
+}
 
 /***
- * Finds the file in the in-memory directory and obtains the information about the file from the file descriptor
- * block referenced from the directory.
- *
- * If the file is not found, then it returns SIMFS_NOT_FOUND_ERROR
+ * Reports the metrics of the writeback thread.
  */
-SIMFS_ERROR simfsGetFileInfo(SIMFS_NAME_TYPE fileName, SIMFS_FILE_DESCRIPTOR_TYPE *infoBuffer)
+void simfsGetWritebackStats(SIMFS_INSTANCE *instance, SIMFS_WRITEBACK_STATS_TYPE *stats)
 {
-    //TODO: implement - DONE
+    SIMFS_WRITEBACK_TYPE * writeback = &(instance->context->writeback);
 
-    //Get the current working directory
-    struct fuse_context * context = simfs_debug_get_context();
-    SIMFS_INDEX_TYPE cwd = getCurrentWorkingDirectory(context);
-    SIMFS_FILE_DESCRIPTOR_TYPE * cwdfd = &(simfsVolume->block[cwd].content.fileDescriptor);
-
-    //Make sure the file exists
-    SIMFS_INDEX_TYPE file = findFileInFolder(cwdfd, fileName, NULL, NULL, NULL);
-    if (file == SIMFS_INVALID_INDEX)
-        return SIMFS_NOT_FOUND_ERROR;
-    
-    //Copy the info into the buffer
-    SIMFS_FILE_DESCRIPTOR_TYPE * filefd = &(simfsVolume->block[cwd].content.fileDescriptor);
-    memcpy(infoBuffer, filefd, sizeof(SIMFS_FILE_DESCRIPTOR_TYPE));
-    
-    return SIMFS_NO_ERROR;
+    pthread_mutex_lock(&(writeback->lock));
+    memcpy(stats, &(writeback->stats), sizeof(SIMFS_WRITEBACK_STATS_TYPE));
+    stats->pendingChanges = writeback->changes - writeback->flushedChanges;
+    stats->lag = 0;
+    if (stats->pendingChanges > 0) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        stats->lag = elapsedNanoseconds(&(writeback->firstUnflushedChange), &now);
+    }
+    pthread_mutex_unlock(&(writeback->lock));
 }
 
+//////////////////////////////////////////////////////////////////////////
+//
+// workload traces
+//
+// Every public operation on the mounted volume can be recorded in a compact binary trace that simfs_replay
+// replays against another image. The records are written under the volume lock, so they appear in the trace in
+// the order in which the operations took effect.
+//
 //////////////////////////////////////////////////////////////////////////
 
-/***
- * Creates an in-memory description of the file for fast access.
- *
- * - hashes the name and searches for it in the in-memory directory resolving potential conflicts using the
- *   unique identifier.
- *
- *   If the file does not exist (i.e., the slot obtained by hashing is NULL), the SIMFS_NOT_FOUND_ERROR is returned.
- *
- * Otherwise:
- *
- *    - if there is a global entry for the file (as indicated by the index to the global open file table in the
- *      directory entry), then:
- *
- *       - it increases the reference count for this file
- *
- *       - otherwise
- *          - finds an empty slot in the global open file table and adds an entry for the file
- *          - copies the information from the file descriptor block referenced from the directory entry for
- *            this file to the new entry in the global open file table
- *          - sets the reference count of the file to 1
- *          - adds the index of the entry in the global open file table to the directory entry for this file
- *
- *   - checks if the process has its process control block in the processControlBlocks list
- *      - if not, then a file control block for the process is created and added to the list; the current
- *        working directory is initialized to the root of the volume and the number of the open files is
- *        initialized to 1; the process id should be simulated for testing; it will be possible to obtain
- *        the actual pid after integration with FUSE
- *
- *     - scans the per-process open file table of the process checking if an entry for the file already
- *      exists in the table (i.e., the file has already been opened)
- *
- *       - if the entry indeed does exists, the function returns the index of the entry through the parameter
- *         fileHandle, and then returns SIMFS_DUPLICATE_ERROR as the return value. This is not a fatal error.
- *
- *       - otherwise:
- *          - the function finds an empty slot in the table and fills it with the information including
- *            the index to the entry for this file in the global open file table
- *
- *          - returns the index to the new element of the per-process open file table through the parameter
- *            fileHandle and SIMFS_NO_ERROR as the return value.
+/*****
+ * Returns the number of the calling thread in the current trace. Threads are numbered when they first ask. The
+ * number is kept with the volume, so a thread that alternates between traced volumes keeps its number in each.
  *
- * If there is no free slot for the file in either the global file table or in the per-process
- * file table, or if there is any other allocation problem, then the function returns SIMFS_ALLOC_ERROR.
+ * The caller holds the volume lock.
+ */
+unsigned short traceThread(SIMFS_INSTANCE *instance)
+{
+    SIMFS_TRACE_TYPE * trace = &(instance->context->trace);
+    SIMFS_THREAD_TYPE * thread = callingThread(instance);
+    if (thread->traceGeneration != trace->generation) {
+        thread->traceGeneration = trace->generation;
+        thread->traceNumber = trace->numberOfThreads++;
+    }
+    return thread->traceNumber;
+}
+
+/*****
+ * Appends a record of an operation to the trace if one is being captured. The name is recorded if it is not
+ * NULL; the offset only matters to operations on part of a file.
  *
+ * The caller holds the volume lock.
  */
-SIMFS_ERROR simfsOpenFile(SIMFS_NAME_TYPE fileName, SIMFS_FILE_HANDLE_TYPE *fileHandle)
+void appendTraceRecord(SIMFS_INSTANCE *instance, struct timespec *start, SIMFS_TRACE_OPERATION_TYPE operation,
+                       char *name, int argument, size_t offset, size_t length, SIMFS_ERROR error)
 {
-    // TODO: implement
+    SIMFS_TRACE_TYPE * trace = &(instance->context->trace);
+    if (trace->file == NULL)
+        return;
 
-    return SIMFS_NO_ERROR;
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    SIMFS_TRACE_RECORD_TYPE record;
+    memset(&record, 0, sizeof(SIMFS_TRACE_RECORD_TYPE));
+    // an operation that waited for the lock while the trace was started counts from the start
+    record.time = (start->tv_sec > trace->start.tv_sec ||
+                   (start->tv_sec == trace->start.tv_sec && start->tv_nsec >= trace->start.tv_nsec))
+                  ? elapsedNanoseconds(&(trace->start), start) : 0;
+    record.duration = (unsigned int) elapsedNanoseconds(start, &end);
+    record.offset = offset;
+    record.length = length;
+    record.argument = argument;
+    record.thread = traceThread(instance);
+    record.operation = operation | (name != NULL ? SIMFS_TRACE_NAME_FLAG : 0);
+    record.result = error;
+
+    size_t nameSize = (name != NULL) ? strnlen(name, SIMFS_MAX_NAME_LENGTH - 1) : 0;
+    if (fwrite(&record, sizeof(SIMFS_TRACE_RECORD_TYPE), 1, trace->file) != 1 ||
+        (name != NULL && (fwrite(name, 1, nameSize, trace->file) != nameSize || fputc('\0', trace->file) == EOF))) {
+        if (trace->error == SIMFS_NO_ERROR)
+            trace->error = SIMFS_WRITE_ERROR;
+    }
 }
 
-//////////////////////////////////////////////////////////////////////////
+/*****
+ * Appends a record of an operation like appendTraceRecord(), with the length of the content if it is not NULL.
+ */
+void traceOperation(SIMFS_INSTANCE *instance, struct timespec *start, SIMFS_TRACE_OPERATION_TYPE operation, char *name,
+                    int argument, char *content, SIMFS_ERROR error)
+{
+    if (instance->context->trace.file != NULL)
+        appendTraceRecord(instance, start, operation, name, argument, 0, (content != NULL) ? strlen(content) : 0,
+                          error);
+}
 
 /***
- * The function replaces content of a file with new one pointed to by the parameter writeBuffer.
- *
- * Checks if the file handle points to a valid file descriptor of an open file. Any issues should be reported by
- * returning SIMFS_SYSTEM_ERROR. In this case, further code debugging is needed.
- *
- * Otherwise, it checks the access rights for writing. If the process owner is not allowed to write to the file,
- * then the function returns SIMFS_ACCESS_ERROR.
- *
- * Then, the function calculates the space needed for the new content and checks if the write buffer can fit into
- * the remaining free space in the file system. If not, then the SIMFS_ALLOC_ERROR is returned.
- *
- * Otherwise, the function:
- *    - acquires as many new blocks as needed to hold the new content modifying corresponding bits in
- *      the in-memory bitvector,
- *    - copies the characters pointed to by the parameter writeBuffer (until '\0' but excluding it) to the
- *      new just acquired blocks,
- *    - copies any modified block of the in-memory bitvector to the corresponding bitvector block on the disk.
- *
- * If the new content has been written successfully, the function then removes all blocks currently held by
- * this file and modifies the file descriptor to reflect the new location, the new size of the file, and the new
- * times of last modification and access.
- *
- * This order of actions prevents file corruption, since in case of any error with writing new content, the file's
- * old version is intact. This technique is called copy-on-write and is an alternative to journalling.
+ * Starts recording every operation on the mounted volume in a trace with the given file name.
  *
- * The function returns SIMFS_WRITE_ERROR in response to exception not specified earlier.
+ * The operations recorded are those that act on the mounted volume: simfsCreateFile(), simfsDeleteFile(),
+ * simfsRename(), simfsGetFileInfo(), simfsOpenFile(), simfsWriteFile(), simfsReadFile(), simfsCloseFile(),
+ * simfsReadMany(), simfsWriteFileAt(), simfsSetFileSize(), simfsPunchHole(), simfsSetFileCompression(),
+ * simfsCreateSnapshot(), simfsDeleteSnapshot(), simfsGetFreeSpace(), and simfsVerifyVolume(). For each, the trace
+ * holds the time of the call, its duration, the calling thread, the arguments, and the result; written and read
+ * content is represented by its length only. The trace is closed by simfsStopTrace() or on unmounting.
  *
+ * Returns SIMFS_DUPLICATE_ERROR if a trace is already being captured, and SIMFS_WRITE_ERROR if the trace cannot
+ * be created.
  */
-SIMFS_ERROR simfsWriteFile(SIMFS_FILE_HANDLE_TYPE fileHandle, char *writeBuffer)
+SIMFS_ERROR simfsStartTrace(SIMFS_INSTANCE *instance, char *traceFileName)
 {
-    // TODO: implement
+    SIMFS_TRACE_TYPE * trace = &(instance->context->trace);
+    SIMFS_ERROR error = SIMFS_NO_ERROR;
 
-    return SIMFS_NO_ERROR;
-}
+    pthread_mutex_lock(&(instance->context->lock));
+    if (trace->file != NULL)
+        error = SIMFS_DUPLICATE_ERROR;
+    else {
+        trace->file = fopen(traceFileName, "wb");
+        if (trace->file == NULL)
+            error = SIMFS_WRITE_ERROR;
+    }
 
-//////////////////////////////////////////////////////////////////////////
+    if (error == SIMFS_NO_ERROR) {
+        setvbuf(trace->file, NULL, _IOFBF, SIMFS_TRACE_BUFFER_SIZE);
+
+        SIMFS_TRACE_HEADER_TYPE header;
+        memset(&header, 0, sizeof(SIMFS_TRACE_HEADER_TYPE));
+        memcpy(header.magic, SIMFS_TRACE_MAGIC, sizeof(header.magic));
+        header.version = SIMFS_TRACE_VERSION;
+        header.recordSize = sizeof(SIMFS_TRACE_RECORD_TYPE);
+        header.startTime = time(NULL);
+
+        if (fwrite(&header, sizeof(SIMFS_TRACE_HEADER_TYPE), 1, trace->file) != 1) {
+            fclose(trace->file);
+            trace->file = NULL;
+            error = SIMFS_WRITE_ERROR;
+        } else {
+            clock_gettime(CLOCK_MONOTONIC, &(trace->start));
+            trace->generation++;
+            trace->numberOfThreads = 0;
+            trace->error = SIMFS_NO_ERROR;
+        }
+    }
+    pthread_mutex_unlock(&(instance->context->lock));
+
+    return error;
+}
 
 /***
- * The function returns the complete content of the file to the caller through the parameter readBuffer.
- *
- * Checks if the file handle (i.e., an index to an entry in the per-process open files table) points to
- * a valid file descriptor of an open file. Any issues should be reported by returning SIMFS_SYSTEM_ERROR.
- * In this case, further code debugging is needed.
- *
- * Otherwise, it checks the user's access right to read the file. If the process owner is not allowed to read the file,
- * then the function returns SIMFS_ACCESS_ERROR.
- *
- * Otherwise, the function allocates memory sufficient to hold the read content with an appended end of string
- * character; the pointer to newly allocated memory is passed back through the readBuffer parameter. All the content
- * of the blocks is concatenated using the allocated space, and an end of string character is appended at the end of
- * the concatenated content.
- *
- * The function returns SIMFS_READ_ERROR in response to exception not specified earlier.
+ * Stops recording operations and closes the trace.
  *
+ * Returns SIMFS_NOT_FOUND_ERROR if no trace is being captured, and SIMFS_WRITE_ERROR if any part of the trace could
+ * not be written.
  */
-SIMFS_ERROR simfsReadFile(SIMFS_FILE_HANDLE_TYPE fileHandle, char **readBuffer)
+SIMFS_ERROR simfsStopTrace(SIMFS_INSTANCE *instance)
 {
-    // TODO: implement
+    SIMFS_TRACE_TYPE * trace = &(instance->context->trace);
+    SIMFS_ERROR error;
 
-    return SIMFS_NO_ERROR;
+    pthread_mutex_lock(&(instance->context->lock));
+    if (trace->file == NULL)
+        error = SIMFS_NOT_FOUND_ERROR;
+    else {
+        error = trace->error;
+        if (fclose(trace->file) != 0)
+            error = SIMFS_WRITE_ERROR;
+        trace->file = NULL;
+    }
+    pthread_mutex_unlock(&(instance->context->lock));
+
+    return error;
 }
 
 //////////////////////////////////////////////////////////////////////////
+//
+// public entry points
+//
+// Every operation runs under the volume lock, so that the writeback thread always checkpoints a consistent
+// volume. The operations are documented at their implementations above.
+//
+//////////////////////////////////////////////////////////////////////////
+
+/*****
+ * Begins an operation on an instance and returns the time of the call for the trace.
+ */
+struct timespec beginOperation(SIMFS_INSTANCE *instance)
+{
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pthread_mutex_lock(&(instance->context->lock));
+    return start;
+}
+
+/*****
+ * Ends an operation. A successful operation that modifies the volume counts as a change for the writeback thread.
+ */
+SIMFS_ERROR endOperation(SIMFS_INSTANCE *instance, SIMFS_ERROR error, int modifies)
+{
+    if (error == SIMFS_NO_ERROR && modifies)
+        volumeChanged(instance);
+    pthread_mutex_unlock(&(instance->context->lock));
+    return error;
+}
+
+SIMFS_ERROR simfsCreateFile(SIMFS_INSTANCE *instance, SIMFS_NAME_TYPE fileName, SIMFS_CONTENT_TYPE type)
+{
+    struct timespec start = beginOperation(instance);
+    SIMFS_ERROR error = createFile(instance, fileName, type);
+    traceOperation(instance, &start, SIMFS_TRACE_CREATE_FILE, fileName, type, NULL, error);
+    return endOperation(instance, error, 1);
+}
+
+SIMFS_ERROR simfsDeleteFile(SIMFS_INSTANCE *instance, SIMFS_NAME_TYPE fileName)
+{
+    struct timespec start = beginOperation(instance);
+    SIMFS_ERROR error = deleteFile(instance, fileName);
+    traceOperation(instance, &start, SIMFS_TRACE_DELETE_FILE, fileName, 0, NULL, error);
+    return endOperation(instance, error, 1);
+}
+
+SIMFS_ERROR simfsRename(SIMFS_INSTANCE *instance, SIMFS_NAME_TYPE oldName, SIMFS_NAME_TYPE newFolder,
+                        SIMFS_NAME_TYPE newName)
+{
+    struct timespec start = beginOperation(instance);
+    SIMFS_ERROR error = renameFile(instance, oldName, newFolder, newName);
+    traceOperation(instance, &start, SIMFS_TRACE_RENAME_FILE, oldName, 0, NULL, error);
+    traceOperation(instance, &start, SIMFS_TRACE_RENAME_FILE, (newFolder != NULL) ? newFolder : "", 1, NULL, error);
+    traceOperation(instance, &start, SIMFS_TRACE_RENAME_FILE, newName, 2, NULL, error);
+    return endOperation(instance, error, 1);
+}
+
+SIMFS_ERROR simfsGetFileInfo(SIMFS_INSTANCE *instance, SIMFS_NAME_TYPE fileName, SIMFS_FILE_DESCRIPTOR_TYPE *infoBuffer)
+{
+    struct timespec start = beginOperation(instance);
+    SIMFS_ERROR error = getFileInfo(instance, fileName, infoBuffer);
+    traceOperation(instance, &start, SIMFS_TRACE_GET_FILE_INFO, fileName, 0, NULL, error);
+    return endOperation(instance, error, 0);
+}
+
+SIMFS_ERROR simfsOpenFile(SIMFS_INSTANCE *instance, SIMFS_NAME_TYPE fileName, SIMFS_FILE_HANDLE_TYPE *fileHandle)
+{
+    struct timespec start = beginOperation(instance);
+    SIMFS_ERROR error = openFileHandle(instance, fileName, fileHandle);
+    int handle = (error == SIMFS_NO_ERROR || error == SIMFS_DUPLICATE_ERROR) ? *fileHandle : -1;
+    traceOperation(instance, &start, SIMFS_TRACE_OPEN_FILE, fileName, handle, NULL, error);
+    return endOperation(instance, error, 0);
+}
+
+SIMFS_ERROR simfsWriteFile(SIMFS_INSTANCE *instance, SIMFS_FILE_HANDLE_TYPE fileHandle, char *writeBuffer)
+{
+    struct timespec start = beginOperation(instance);
+    SIMFS_ERROR error = writeFile(instance, fileHandle, writeBuffer);
+    traceOperation(instance, &start, SIMFS_TRACE_WRITE_FILE, NULL, fileHandle, writeBuffer, error);
+    return endOperation(instance, error, 1);
+}
+
+SIMFS_ERROR simfsWriteFileAt(SIMFS_INSTANCE *instance, SIMFS_FILE_HANDLE_TYPE fileHandle, size_t offset,
+                             char *writeBuffer, size_t length)
+{
+    struct timespec start = beginOperation(instance);
+    SIMFS_ERROR error = writeFileAt(instance, fileHandle, offset, writeBuffer, length);
+    appendTraceRecord(instance, &start, SIMFS_TRACE_WRITE_FILE_AT, NULL, fileHandle, offset, length, error);
+    return endOperation(instance, error, 1);
+}
+
+SIMFS_ERROR simfsSetFileSize(SIMFS_INSTANCE *instance, SIMFS_FILE_HANDLE_TYPE fileHandle, size_t size)
+{
+    struct timespec start = beginOperation(instance);
+    SIMFS_ERROR error = setFileSize(instance, fileHandle, size);
+    appendTraceRecord(instance, &start, SIMFS_TRACE_SET_FILE_SIZE, NULL, fileHandle, size, 0, error);
+    return endOperation(instance, error, 1);
+}
+
+SIMFS_ERROR simfsPunchHole(SIMFS_INSTANCE *instance, SIMFS_FILE_HANDLE_TYPE fileHandle, size_t offset, size_t length)
+{
+    struct timespec start = beginOperation(instance);
+    SIMFS_ERROR error = punchHole(instance, fileHandle, offset, length);
+    appendTraceRecord(instance, &start, SIMFS_TRACE_PUNCH_HOLE, NULL, fileHandle, offset, length, error);
+    return endOperation(instance, error, 1);
+}
+
+SIMFS_ERROR simfsReadFile(SIMFS_INSTANCE *instance, SIMFS_FILE_HANDLE_TYPE fileHandle, char **readBuffer)
+{
+    struct timespec start = beginOperation(instance);
+    SIMFS_ERROR error = readFile(instance, fileHandle, readBuffer);
+    traceOperation(instance, &start, SIMFS_TRACE_READ_FILE, NULL, fileHandle,
+                   error == SIMFS_NO_ERROR ? *readBuffer : NULL, error);
+    return endOperation(instance, error, 0);
+}
+
+SIMFS_ERROR simfsCloseFile(SIMFS_INSTANCE *instance, SIMFS_FILE_HANDLE_TYPE fileHandle)
+{
+    struct timespec start = beginOperation(instance);
+    SIMFS_ERROR error = closeFileHandle(instance, fileHandle);
+    traceOperation(instance, &start, SIMFS_TRACE_CLOSE_FILE, NULL, fileHandle, NULL, error);
+    return endOperation(instance, error, 0);
+}
+
+SIMFS_ERROR simfsReadMany(SIMFS_INSTANCE *instance, int numberOfFiles, char **fileNames, struct iovec *buffers,
+                          SIMFS_ERROR *results)
+{
+    struct timespec start = beginOperation(instance);
+    SIMFS_ERROR error = readMany(instance, numberOfFiles, fileNames, buffers, results);
+    for (int i = 0; i < numberOfFiles; ++i)
+        appendTraceRecord(instance, &start, SIMFS_TRACE_READ_MANY, fileNames[i], numberOfFiles, 0,
+                          results[i] == SIMFS_NO_ERROR ? buffers[i].iov_len : 0, results[i]);
+    return endOperation(instance, error, 0);
+}
+
+SIMFS_ERROR simfsSetFileCompression(SIMFS_INSTANCE *instance, SIMFS_NAME_TYPE fileName, int compressed)
+{
+    struct timespec start = beginOperation(instance);
+    SIMFS_ERROR error = setFileCompression(instance, fileName, compressed);
+    traceOperation(instance, &start, SIMFS_TRACE_SET_FILE_COMPRESSION, fileName, compressed, NULL, error);
+    return endOperation(instance, error, 1);
+}
 
 /***
- * Removes the entry for the file with the file handle provided as the parameter from the open file table
- * for this process. It decreases the number of open files for the file in the process control block of
- * this process, and if it becomes zero, then the process control block for this process is removed from
- * the processControlBlocks list.
- *
- * Decreases the reference count in the global open file table, and if that number is 0, it also removes the entry
- * for this file from the global open file table. In this case, it also removes the index to the global open file
- * table from the directory entry for the file by overwriting it with SIMFS_INVALID_OPEN_FILE_TABLE_INDEX.
- *
+ * Reports the number of free blocks and the longest run of consecutive free blocks on the volume.
  */
+SIMFS_ERROR simfsGetFreeSpace(SIMFS_INSTANCE *instance, SIMFS_FREE_SPACE_INFO_TYPE *info)
+{
+    struct timespec start = beginOperation(instance);
+    info->freeBlocks = countFreeBlocks(instance);
+    info->largestFreeRun = largestFreeRun(instance, &(info->largestFreeRunStart));
+    traceOperation(instance, &start, SIMFS_TRACE_GET_FREE_SPACE, NULL, 0, NULL, SIMFS_NO_ERROR);
+    return endOperation(instance, SIMFS_NO_ERROR, 0);
+}
 
-SIMFS_ERROR simfsCloseFile(SIMFS_FILE_HANDLE_TYPE fileHandle)
+SIMFS_ERROR simfsVerifyVolume(SIMFS_INSTANCE *instance, int *numberOfBadBlocks)
 {
-    // TODO: implement
+    struct timespec start = beginOperation(instance);
+    int bad = 0;
+    SIMFS_ERROR error = verifyVolume(instance, &bad);
+    if (numberOfBadBlocks != NULL)
+        *numberOfBadBlocks = bad;
+    traceOperation(instance, &start, SIMFS_TRACE_VERIFY_VOLUME, NULL, bad, NULL, error);
+    return endOperation(instance, error, 0);
+}
 
-    return SIMFS_NO_ERROR;
+SIMFS_ERROR simfsCreateSnapshot(SIMFS_INSTANCE *instance, SIMFS_NAME_TYPE snapshotName)
+{
+    struct timespec start = beginOperation(instance);
+    SIMFS_ERROR error = createSnapshot(instance, snapshotName);
+    traceOperation(instance, &start, SIMFS_TRACE_CREATE_SNAPSHOT, snapshotName, 0, NULL, error);
+    return endOperation(instance, error, 1);
+}
+
+SIMFS_ERROR simfsDeleteSnapshot(SIMFS_INSTANCE *instance, SIMFS_NAME_TYPE snapshotName)
+{
+    struct timespec start = beginOperation(instance);
+    SIMFS_ERROR error = deleteSnapshot(instance, snapshotName);
+    traceOperation(instance, &start, SIMFS_TRACE_DELETE_SNAPSHOT, snapshotName, 0, NULL, error);
+    return endOperation(instance, error, 1);
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -710,16 +4408,18 @@ struct fuse_context *simfs_debug_get_context()
 
     // TODO: replace its use with FUSE's fuse_get_context()
 
-    struct fuse_context *context = malloc(sizeof(struct fuse_context));
+    // like fuse_get_context(), the context is per thread and describes the calling process, so that handles
+    // from simfsOpenFile() stay valid across calls
+    static __thread struct fuse_context context;
 
-    context->fuse = NULL;
-    context->uid = (uid_t) rand() % 10 + 1;
-    context->pid = (pid_t) rand() % 10 + 1;
-    context->gid = (gid_t) rand() % 10 + 1;
-    context->private_data = NULL;
-    context->umask = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH; // can be changed as needed
+    context.fuse = NULL;
+    context.uid = getuid();
+    context.pid = getpid();
+    context.gid = getgid();
+    context.private_data = NULL;
+    context.umask = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH; // can be changed as needed
 
-    return context;
+    return &context;
 }
 
 /***
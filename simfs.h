@@ -6,6 +6,8 @@
 #include <string.h>
 #include <fuse.h>
 #include <stdio.h>
+#include <pthread.h>
+#include <sys/uio.h>
 
 //////////////////////////////////////////////////////////////////////////
 //
@@ -16,8 +18,10 @@
 #define SIMFS_BLOCK_SIZE 16 // 256
 #define SIMFS_NUMBER_OF_BLOCKS 4096 // 65536 // 2^16
 #define SIMFS_MAX_NAME_LENGTH 64 // 128
+#define SIMFS_NAME_PREFIX_SIZE 31 // 63 // characters of a name held in its descriptor; the rest goes to a name block
 #define SIMFS_DATA_SIZE 14 // 254 // SIMFS_BLOCK_SIZE - sizeof(SIMFS_NODE_TYPE)
 #define SIMFS_INDEX_SIZE 7 // 127 // two bytes => x0000 - xFFFF => 2^16 range
+#define SIMFS_MAX_FILE_SIZE ((size_t) 0x7FFFFFFF) // bytes; with holes, a file can be larger than the volume
 #define SIMFS_ROOT_NODE_INDEX 0
 
 //////////////////////////////////////////////////////////////////////////
@@ -39,6 +43,77 @@
 #define SIMFS_MAX_NUMBER_OF_OPEN_FILES 64 // 1024
 #define SIMFS_MAX_NUMBER_OF_PROCESSES 64 // 1024
 #define SIMFS_MAX_NUMBER_OF_OPEN_FILES_PER_PROCESS 16 // 64
+#define SIMFS_MAX_NUMBER_OF_THREADS 16 // 256 // threads that a mounted volume remembers
+#define SIMFS_FINGERPRINT_TABLE_SIZE 8192 // 131072 // power of two, at least twice the number of blocks
+#define SIMFS_FREE_SPACE_REGION_SIZE 512 // 4096 // blocks per region of the free space summary; a multiple of 64
+#define SIMFS_ALLOCATION_GROUP_SIZE 1024 // 16384 // blocks per allocation group; a multiple of the region size
+#define SIMFS_READAHEAD_MIN_WINDOW 2 // blocks prefetched ahead of a traversal of an index block chain at first
+#define SIMFS_READAHEAD_MAX_WINDOW 32 // 64
+
+//////////////////////////////////////////////////////////////////////////
+//
+// mount options
+//
+//////////////////////////////////////////////////////////////////////////
+
+#define SIMFS_MOUNT_DEDUP 0x0001 // share data blocks with identical content
+#define SIMFS_MOUNT_RELATIME 0x0002 // update the access time only if it is not later than the modification time
+#define SIMFS_MOUNT_NOATIME 0x0004 // never update the access time on reads
+#define SIMFS_MOUNT_CHECKSUMS 0x0008 // keep a checksum of every block in the image and verify it after mounting
+#define SIMFS_MOUNT_IO_URING 0x0010 // load and save the image with io_uring
+#define SIMFS_MOUNT_DIRECT_IO 0x0020 // load and save the image with O_DIRECT, bypassing the page cache
+#define SIMFS_RELATIME_INTERVAL (24 * 60 * 60) // with relatime, an access time older than this is updated anyway
+
+//////////////////////////////////////////////////////////////////////////
+//
+// defines for snapshots
+//
+//////////////////////////////////////////////////////////////////////////
+
+#define SIMFS_MAX_NUMBER_OF_SNAPSHOTS 8
+#define SIMFS_MAX_SHARED_COUNT 0xFF // limit of SIMFS_SHARED_COUNT_TYPE
+
+//////////////////////////////////////////////////////////////////////////
+//
+// defines for large folders
+//
+// a folder that grows beyond SIMFS_BTREE_THRESHOLD entries keeps them in a B+tree keyed by the hashes of
+// their names instead of a chain of index blocks, so that a lookup reads O(log n) blocks
+//
+//////////////////////////////////////////////////////////////////////////
+
+#define SIMFS_BTREE_THRESHOLD 32 // 1024
+#define SIMFS_BTREE_ORDER 16 // 40 // entries per node; a node takes no more space than a file descriptor
+#define SIMFS_BTREE_MAX_HEIGHT 8
+
+//////////////////////////////////////////////////////////////////////////
+//
+// defines for compressed files
+//
+// content of a compressed file is stored as a sequence of chunks, each with a two-byte little-endian header
+// holding the size of the encoded chunk; chunks that do not compress are stored as they are, which is
+// indicated by SIMFS_STORED_CHUNK_FLAG in the header
+//
+//////////////////////////////////////////////////////////////////////////
+
+#define SIMFS_COMPRESSION_CHUNK_SIZE 4096
+#define SIMFS_CHUNK_HEADER_SIZE 2
+#define SIMFS_STORED_CHUNK_FLAG 0x8000
+
+//////////////////////////////////////////////////////////////////////////
+//
+// defines for workload traces
+//
+// a trace starts with a SIMFS_TRACE_HEADER_TYPE followed by a SIMFS_TRACE_RECORD_TYPE for every operation; when
+// SIMFS_TRACE_NAME_FLAG is set in the operation of a record, the record is followed by the name argument of the
+// operation with its terminating null character
+//
+//////////////////////////////////////////////////////////////////////////
+
+#define SIMFS_TRACE_MAGIC "SIMFSTRC"
+#define SIMFS_TRACE_VERSION 2
+#define SIMFS_TRACE_NAME_FLAG 0x80
+#define SIMFS_TRACE_BUFFER_SIZE 65536
 
 //////////////////////////////////////////////////////////////////////////
 //
@@ -51,11 +126,13 @@ typedef enum {
     SIMFS_FILE_CONTENT_TYPE,
     SIMFS_INDEX_CONTENT_TYPE,
     SIMFS_DATA_CONTENT_TYPE,
+    SIMFS_BTREE_CONTENT_TYPE,
+    SIMFS_NAME_CONTENT_TYPE,
     SIMFS_INVALID_CONTENT_TYPE
 } SIMFS_CONTENT_TYPE;
 
 typedef unsigned short SIMFS_INDEX_TYPE; // is used to index blocks in the file system
-#define SIMFS_INVALID_INDEX 0xFF
+#define SIMFS_INVALID_INDEX 0xFFFF // outside of [0, SIMFS_NUMBER_OF_BLOCKS), so it never collides with a real block
 
 //
 // superblock starting block in the whole file system
@@ -67,14 +144,21 @@ typedef unsigned short SIMFS_INDEX_TYPE; // is used to index blocks in the file
 // rootNodeIndex points to the block which is the root folder of the files system
 // numberOfBlock determines the size of the file system
 // blockSize is the size of a single block of the file system
+// flags tell whether the checksums in the image are up to date
+// metadataChecksum covers the superblock (with this field taken as 0), the bitvector, the snapshots, and the shared
+//        counts
 //
+#define SIMFS_SUPERBLOCK_CHECKSUMS 0x0001 // the checksums were computed when the image was written
+
 typedef union simfs_superblock_type { // size of the block with some unused part
     char spacer_dummy[SIMFS_BLOCK_SIZE]; // this makes the struct exactly one block
     struct attr {
         unsigned long long nextUniqueIdentifier; // unique identifier generator for files and folders
         SIMFS_INDEX_TYPE rootNodeIndex; // should point to the first block after the last bitvector block
+        unsigned short flags; // SIMFS_SUPERBLOCK_* flags
         int numberOfBlocks;
         int blockSize;
+        unsigned int metadataChecksum;
     } attr;
 } SIMFS_SUPERBLOCK_TYPE;
 
@@ -83,26 +167,41 @@ typedef union simfs_superblock_type { // size of the block with some unused part
 //
 //   for files:
 //       te size indicates the size of the file
+//       the stored size is the number of bytes held in the data blocks; it differs from the size for
+//           compressed files, and for sparse files
 //       the block reference is initialized to SIMFS_INVALID_INDEX
 //           - it will point to an index block when the file has content
+//       a file that is not compressed may be sparse: an index block entry of SIMFS_INVALID_INDEX is a hole of
+//           a data block of zeros, and everything after the stored size up to the size reads as zeros as well;
+//           only the data blocks that are not holes are allocated, and their number is kept in the descriptor
 //
 //   for directories:
 //       the size indicates the number of files or directories in this folder
-//       the block reference points to an index block that holds references to the file and folder blocks
+//       the block reference points to an index block that holds references to the file and folder blocks,
+//           or to the root of a B+tree if SIMFS_BTREE_FLAG is set
 //
 typedef char SIMFS_NAME_TYPE[SIMFS_MAX_NAME_LENGTH]; // for folder and file names
 
+#define SIMFS_COMPRESSED_FLAG 0x0001 // content is stored compressed
+#define SIMFS_BTREE_FLAG 0x0002 // folder entries are held in a B+tree
+
 typedef struct simfs_file_descriptor_type {
     unsigned long long identifier; // unique folder/file identifier
     SIMFS_CONTENT_TYPE type; // folder or file
-    SIMFS_NAME_TYPE name;
+    unsigned int nameKey; // key of the name in the directory and in B+tree folders
     time_t creationTime; // creation time
     time_t lastAccessTime; // last access
     time_t lastModificationTime; // last modification
     mode_t accessRights; // access rights for the file
     uid_t owner; // owner ID
     size_t size; // capacity limited for this project to 2s^16
+    size_t storedSize; // bytes held in the data blocks
+    unsigned short flags; // SIMFS_*_FLAG
     SIMFS_INDEX_TYPE block_ref; // reference to the data or index block
+    unsigned short allocatedBlocks; // data blocks held by a file; holes are not counted
+    SIMFS_INDEX_TYPE nameBlock; // rest of a long name
+    unsigned char nameLength;
+    char namePrefix[SIMFS_NAME_PREFIX_SIZE];
 } SIMFS_FILE_DESCRIPTOR_TYPE;
 
 //
@@ -110,6 +209,20 @@ typedef struct simfs_file_descriptor_type {
 //
 typedef char SIMFS_DATA_TYPE[SIMFS_DATA_SIZE];
 
+//
+// node of the B+tree of a large folder
+//
+// leaves (level 0) hold the hashes of the names of the entries together with references to their descriptors;
+// inner nodes hold references to their children together with a lower bound of the hashes in each child;
+// entries are sorted by hash, and entries with equal hashes may continue in the next child
+//
+typedef struct simfs_btree_node_type {
+    unsigned short numberOfEntries;
+    unsigned short level; // 0 for leaves
+    unsigned int key[SIMFS_BTREE_ORDER];
+    SIMFS_INDEX_TYPE child[SIMFS_BTREE_ORDER];
+} SIMFS_BTREE_NODE_TYPE;
+
 //
 // various interpretations of a file system block
 //
@@ -120,9 +233,39 @@ typedef struct simfs_node_type {
         SIMFS_DATA_TYPE data; // for data
         SIMFS_INDEX_TYPE index[SIMFS_INDEX_SIZE];  // for indices; all indices but the last point to data blocks
         // the last points to another index block
+        SIMFS_BTREE_NODE_TYPE btree; // for the folder B+tree nodes
+        char name[SIMFS_MAX_NAME_LENGTH - SIMFS_NAME_PREFIX_SIZE]; // for the rest of a long name, terminated
     } content;
 } SIMFS_BLOCK_TYPE;
 
+//
+// named read-only snapshot of the volume
+//
+// the superblock (and with it the root node index) is captured at the time of the snapshot; a slot with
+// an empty name is unused
+//
+typedef struct simfs_snapshot_type {
+    SIMFS_NAME_TYPE name;
+    SIMFS_SUPERBLOCK_TYPE superblock;
+    time_t creationTime;
+} SIMFS_SNAPSHOT_TYPE;
+
+//
+// number of additional references to a block
+//
+// a block with a non-zero shared count is reachable from more than one tree (the live volume and one or more
+// snapshots); it must be cloned before it is modified and is freed only when the count drops back to zero
+//
+typedef unsigned char SIMFS_SHARED_COUNT_TYPE;
+
+//
+// CRC32C of a block as it was when the image was written
+//
+// the checksums are only meaningful if SIMFS_SUPERBLOCK_CHECKSUMS is set in the superblock; they are computed for
+// every block, allocated or not, so that the whole table is written in one pass
+//
+typedef unsigned int SIMFS_CHECKSUM_TYPE;
+
 //
 // "physical" file system structure
 //
@@ -130,12 +273,21 @@ typedef struct simfs_node_type {
 //
 // bitvector - one bit per block ( (SIMFS_NUMBER_OF_BLOCKS/8 / SIMFS_BLOCK_SIZE) blocks )
 //
+// snapshots - SIMFS_MAX_NUMBER_OF_SNAPSHOTS
+//
+// shared counts - one byte per block
+//
+// checksums - one per block
+//
 // blocks (folder, file, data, or index) - SIMFS_NUMBER_OF_BLOCKS
 //
 //
 typedef struct simfs_volume {
     SIMFS_SUPERBLOCK_TYPE superblock;
     unsigned char bitvector[SIMFS_NUMBER_OF_BLOCKS / 8];
+    SIMFS_SNAPSHOT_TYPE snapshot[SIMFS_MAX_NUMBER_OF_SNAPSHOTS];
+    SIMFS_SHARED_COUNT_TYPE sharedCount[SIMFS_NUMBER_OF_BLOCKS];
+    SIMFS_CHECKSUM_TYPE checksum[SIMFS_NUMBER_OF_BLOCKS];
     SIMFS_BLOCK_TYPE block[SIMFS_NUMBER_OF_BLOCKS];
 } SIMFS_VOLUME;
 
@@ -148,6 +300,10 @@ typedef struct simfs_volume {
 //
 // global open file table
 //
+// While a file is open, its entry is the authoritative copy of the attributes of the file. Reads only update the
+// entry; the access time goes back to the descriptor when the last handle is closed, on simfsSync(), and on
+// unmounting. A change of the content writes all the times to the descriptor right away.
+//
 #define SIMFS_INVALID_OPEN_FILE_TABLE_INDEX -1
 typedef struct simfs_open_file_global_type {
     SIMFS_CONTENT_TYPE type; // folder or file
@@ -159,6 +315,7 @@ typedef struct simfs_open_file_global_type {
     mode_t accessRights; // access rights for the file
     uid_t owner; // owner ID
     size_t size;
+    unsigned char attributesDirty; // the access time has changed since it was last written to the descriptor
 } SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE;
 
 //
@@ -206,16 +363,242 @@ typedef struct simfs_process_control_block_type {
     struct simfs_process_control_block_type *next;
 } SIMFS_PROCESS_CONTROL_BLOCK_TYPE;
 
+//
+// fingerprint of a data block for deduplication
+//
+// the fingerprint index is an open addressing hash table with linear probing that maps the hash of the content
+// of every data block to the block; it lives in memory only and is rebuilt on mounting
+//
+typedef struct simfs_fingerprint_type {
+    unsigned long long hash;
+    SIMFS_INDEX_TYPE block; // SIMFS_INVALID_INDEX for an empty slot
+} SIMFS_FINGERPRINT_TYPE;
+
+//
+// summary of the in-memory bitvector
+//
+// the bitvector is viewed as 64-bit words, each covering 64 blocks (the block with the lowest index in the most
+// significant bit); a summary bit per word tells whether the word has a free block, so the lowest free block
+// is found without looking at full words; the volume is also divided into regions with a count of the free
+// blocks in each, and with the free runs of each region that are recomputed lazily when they are queried
+//
+#define SIMFS_BITVECTOR_WORDS (SIMFS_NUMBER_OF_BLOCKS / 64)
+#define SIMFS_NUMBER_OF_REGIONS (SIMFS_NUMBER_OF_BLOCKS / SIMFS_FREE_SPACE_REGION_SIZE)
+#define SIMFS_NUMBER_OF_ALLOCATION_GROUPS (SIMFS_NUMBER_OF_BLOCKS / SIMFS_ALLOCATION_GROUP_SIZE)
+
+typedef struct simfs_free_space_type {
+    unsigned long long wordHasFree[(SIMFS_BITVECTOR_WORDS + 63) / 64]; // bit w % 64 of entry w / 64 for word w
+    int freeBlocks;
+    unsigned short regionFree[SIMFS_NUMBER_OF_REGIONS];
+    unsigned char regionChanged[SIMFS_NUMBER_OF_REGIONS]; // the runs below are out of date
+    unsigned short regionLeadingRun[SIMFS_NUMBER_OF_REGIONS]; // free blocks at the start of the region
+    unsigned short regionTrailingRun[SIMFS_NUMBER_OF_REGIONS]; // free blocks at the end of the region
+    unsigned short regionLongestRun[SIMFS_NUMBER_OF_REGIONS];
+    unsigned short regionLongestRunStart[SIMFS_NUMBER_OF_REGIONS]; // offset within the region
+} SIMFS_FREE_SPACE_TYPE;
+
+//
+// readahead over a chain of index blocks
+//
+// a cursor runs ahead of a traversal of the chain and prefetches every block referenced from the entries it passes,
+// as well as every index block it enters; the cursor keeps up to a window of entries ahead, and the window doubles
+// every time the traversal consumes a window's worth of entries; a traversal starts with the window the previous
+// one had reached, unless most of the entries prefetched by the previous one were not used
+//
+typedef struct simfs_readahead_type {
+    SIMFS_INDEX_TYPE index_block; // index block of the cursor
+    int pos; // position of the cursor in its index block
+    int remaining; // entries of the chain after the cursor
+    int distance; // entries between the traversal and the cursor
+    int window;
+    int consumed; // entries consumed by the traversal
+    int consumedInWindow; // entries consumed since the window last grew
+} SIMFS_READAHEAD_TYPE;
+
+//
+// a data block to be copied by simfsReadMany()
+//
+typedef struct simfs_gather_type {
+    SIMFS_INDEX_TYPE block;
+    unsigned short length;
+    int file; // position of the file in the call
+    char *destination;
+} SIMFS_GATHER_TYPE;
+
+//
+// free space information reported by simfsGetFreeSpace()
+//
+typedef struct simfs_free_space_info_type {
+    unsigned int freeBlocks;
+    unsigned int largestFreeRun; // number of blocks in the longest run of consecutive free blocks
+    SIMFS_INDEX_TYPE largestFreeRunStart; // first block of that run; SIMFS_INVALID_INDEX if the volume is full
+} SIMFS_FREE_SPACE_INFO_TYPE;
+
+//
+// metrics of the background writeback thread
+//
+// durations are in nanoseconds; the lag is the age of the oldest change that is not on disk yet
+//
+typedef struct simfs_writeback_stats_type {
+    unsigned long numberOfFlushes; // checkpoints written to disk
+    unsigned long numberOfCaptures; // checkpoints taken from the live volume
+    unsigned long long lastFlushDuration;
+    unsigned long long maxFlushDuration;
+    unsigned long long totalFlushDuration;
+    unsigned long long lag; // current lag; 0 when everything is on disk
+    unsigned long long maxLag; // largest lag at the moment a checkpoint reached the disk
+    unsigned long pendingChanges; // changes since the last checkpoint on disk
+} SIMFS_WRITEBACK_STATS_TYPE;
+
+//
+// state of the background writeback thread
+//
+// the volume is checkpointed into one of two shadow buffers, so that the next checkpoint can be taken while the
+// thread writes the previous one; every modifying operation increments the change counter, and a checkpoint
+// records the value of the counter at the moment it was taken
+//
+typedef struct simfs_writeback_type {
+    pthread_t thread;
+    int running;
+    int stopping; // set while simfsStopWriteback() waits for the thread, which cannot be started again meanwhile
+    char *fileName; // the image the checkpoints are written to
+    unsigned int interval; // milliseconds between checks for changes
+    unsigned int dirtyThreshold; // number of changes that triggers a checkpoint without waiting for the interval
+    pthread_mutex_t lock; // guards the fields below; taken after the volume lock
+    pthread_cond_t wakeup; // signals the thread
+    pthread_cond_t flushed; // signals the callers of simfsSync()
+    SIMFS_VOLUME *shadow[2];
+    int pendingShadow; // checkpoint waiting to be written; -1 if none
+    int writingShadow; // checkpoint being written; -1 if none
+    unsigned long long shadowChanges[2]; // value of the change counter when the checkpoint was taken
+    struct timespec shadowTime[2]; // time when the checkpoint was taken
+    unsigned long long changes; // change counter
+    unsigned long long capturedChanges; // change counter of the latest checkpoint
+    unsigned long long flushedChanges; // change counter of the latest checkpoint on disk
+    struct timespec firstUnflushedChange; // time of the oldest change not on disk
+    int error; // SIMFS_ERROR of the latest flush
+    SIMFS_WRITEBACK_STATS_TYPE stats;
+} SIMFS_WRITEBACK_TYPE;
+
+//
+// operations recorded in a trace
+//
+typedef enum {
+    SIMFS_TRACE_CREATE_FILE,
+    SIMFS_TRACE_DELETE_FILE,
+    SIMFS_TRACE_GET_FILE_INFO,
+    SIMFS_TRACE_OPEN_FILE,
+    SIMFS_TRACE_WRITE_FILE,
+    SIMFS_TRACE_READ_FILE,
+    SIMFS_TRACE_CLOSE_FILE,
+    SIMFS_TRACE_SET_FILE_COMPRESSION,
+    SIMFS_TRACE_CREATE_SNAPSHOT,
+    SIMFS_TRACE_DELETE_SNAPSHOT,
+    SIMFS_TRACE_GET_FREE_SPACE,
+    SIMFS_TRACE_READ_MANY,
+    SIMFS_TRACE_WRITE_FILE_AT,
+    SIMFS_TRACE_SET_FILE_SIZE,
+    SIMFS_TRACE_PUNCH_HOLE,
+    SIMFS_TRACE_RENAME_FILE,
+    SIMFS_TRACE_VERIFY_VOLUME,
+    SIMFS_NUMBER_OF_TRACE_OPERATIONS
+} SIMFS_TRACE_OPERATION_TYPE;
+
+typedef struct simfs_trace_header_type {
+    char magic[8]; // SIMFS_TRACE_MAGIC without the terminating null character
+    unsigned int version;
+    unsigned int recordSize; // sizeof(SIMFS_TRACE_RECORD_TYPE)
+    long long startTime; // wall clock time of the start of the trace in seconds
+} SIMFS_TRACE_HEADER_TYPE;
+
+//
+// a traced operation
+//
+// times are in nanoseconds; the duration includes waiting for the volume lock; the argument is the file handle
+// for operations on open files (the handle obtained for simfsOpenFile(), or -1 if none), the content type for
+// simfsCreateFile(), the flag for simfsSetFileCompression(), and the number of bad blocks found by
+// simfsVerifyVolume(); the length is the number of bytes written or read, or the length of the hole punched; the
+// offset is the position of a write or of a hole, or the new size of a file
+//
+// simfsReadMany() is recorded as a record for every file it reads, in the order of the files; the argument of each
+// is the number of files read by the call, and all of them have the time and the duration of the call
+//
+// simfsRename() is recorded as three records with the old name, the target folder (empty for NULL), and the new
+// name; their arguments are 0, 1, and 2, and all of them have the time, the duration, and the result of the call
+//
+typedef struct simfs_trace_record_type {
+    unsigned long long time; // since the start of the trace
+    unsigned long long offset;
+    unsigned int duration;
+    unsigned int length;
+    int argument;
+    unsigned short thread; // threads are numbered in the order of their first traced operation
+    unsigned char operation; // SIMFS_TRACE_OPERATION_TYPE, possibly with SIMFS_TRACE_NAME_FLAG
+    unsigned char result; // SIMFS_ERROR
+} SIMFS_TRACE_RECORD_TYPE;
+
+//
+// state of a trace being captured
+//
+typedef struct simfs_trace_type {
+    FILE *file; // NULL when no trace is captured
+    struct timespec start;
+    unsigned int generation; // number of traces started on the volume; threads are numbered anew for every trace
+    unsigned short numberOfThreads;
+    int error; // SIMFS_ERROR of the first failed write
+} SIMFS_TRACE_TYPE;
+
+//
+// a thread that works on a mounted volume
+//
+// A volume remembers the allocation group of every thread and its number in the trace being captured. Once more
+// than SIMFS_MAX_NUMBER_OF_THREADS threads have worked on it, the earliest one is forgotten, and it is taken for a
+// new thread if it comes back.
+//
+typedef struct simfs_thread_type {
+    pthread_t thread;
+    int affinityGroup; // allocation group for the folders that the thread creates; -1 until it creates one
+    unsigned int traceGeneration; // the trace that the thread has its number in; 0 for none
+    unsigned short traceNumber;
+} SIMFS_THREAD_TYPE;
+
 /*
  * file system context
  */
 typedef struct simfs_context_type {
     SIMFS_DIRECTORY directory; // the hashtable-based in-memory directory
     unsigned char bitvector[SIMFS_NUMBER_OF_BLOCKS / 8]; // an in-memory copy of the bitvector of the simulated volume
+    SIMFS_FREE_SPACE_TYPE freeSpace; // summary of the in-memory bitvector
+    SIMFS_INDEX_TYPE allocationGoal; // blocks are allocated at or after this block in its allocation group
+    unsigned int nextAffinityGroup; // allocation group for the next thread that creates a folder
+    SIMFS_THREAD_TYPE threads[SIMFS_MAX_NUMBER_OF_THREADS];
+    unsigned int numberOfThreads; // threads that have worked on the volume, including the forgotten ones
+    int readaheadWindow; // initial window of the next traversal of an index block chain
     SIMFS_OPEN_FILE_GLOBAL_TABLE_TYPE globalOpenFileTable[SIMFS_MAX_NUMBER_OF_OPEN_FILES]; // in-memory
     SIMFS_PROCESS_CONTROL_BLOCK_TYPE *processControlBlocks;
+    SIMFS_INDEX_TYPE rootNodeIndex; // root of the mounted tree; the live root or the root of a snapshot
+    int readOnly; // set when a snapshot is mounted
+    unsigned int options; // SIMFS_MOUNT_* options
+    SIMFS_FINGERPRINT_TYPE fingerprint[SIMFS_FINGERPRINT_TABLE_SIZE]; // used with SIMFS_MOUNT_DEDUP
+    unsigned char verified[SIMFS_NUMBER_OF_BLOCKS / 8]; // blocks that need no checksum verification any more
+    pthread_mutex_t lock; // serializes the file system operations
+    SIMFS_WRITEBACK_TYPE writeback;
+    SIMFS_TRACE_TYPE trace;
 } SIMFS_CONTEXT_TYPE;
 
+/*
+ * a mounted volume
+ *
+ * Every instance has a volume and a context of its own, including the allocator state, the locks and what is
+ * remembered about the threads that call it, so that independent volumes can be mounted and used side by side in
+ * one process. The instance is passed explicitly down to every internal function; nothing is bound to a thread.
+ * The storage for the instance belongs to the caller and must stay in place while the volume is mounted.
+ */
+typedef struct simfs_instance_type {
+    SIMFS_VOLUME *volume; // NULL when nothing is mounted
+    SIMFS_CONTEXT_TYPE *context;
+} SIMFS_INSTANCE;
+
 //////////////////////////////////////////////////////////////////////////
 //
 // file system function declarations
@@ -234,25 +617,68 @@ typedef enum simfs_error {
     SIMFS_SYSTEM_ERROR
 } SIMFS_ERROR;
 
+// every function that works on a mounted volume takes the instance that the volume is mounted in
 SIMFS_ERROR simfsCreateFileSystem(char *simfsFileSystemName);
 
-SIMFS_ERROR simfsUmountFileSystem(char *simfsFileSystemName);
+SIMFS_ERROR simfsUmountFileSystem(SIMFS_INSTANCE *instance, char *simfsFileSystemName);
+
+SIMFS_ERROR simfsMountFileSystem(SIMFS_INSTANCE *instance, char *simfsFileSystemName);
+
+SIMFS_ERROR simfsMountFileSystemWithOptions(SIMFS_INSTANCE *instance, char *simfsFileSystemName,
+        unsigned int options);
+
+SIMFS_ERROR simfsCreateFile(SIMFS_INSTANCE *instance, SIMFS_NAME_TYPE fileName, SIMFS_CONTENT_TYPE type);
+
+SIMFS_ERROR simfsDeleteFile(SIMFS_INSTANCE *instance, SIMFS_NAME_TYPE fileName);
+
+SIMFS_ERROR simfsRename(SIMFS_INSTANCE *instance, SIMFS_NAME_TYPE oldName, SIMFS_NAME_TYPE newFolder,
+        SIMFS_NAME_TYPE newName);
+
+SIMFS_ERROR simfsGetFileInfo(SIMFS_INSTANCE *instance, SIMFS_NAME_TYPE fileName,
+        SIMFS_FILE_DESCRIPTOR_TYPE *infoBuffer);
+
+SIMFS_ERROR simfsOpenFile(SIMFS_INSTANCE *instance, SIMFS_NAME_TYPE fileName, SIMFS_FILE_HANDLE_TYPE *fileHandle);
+
+SIMFS_ERROR simfsWriteFile(SIMFS_INSTANCE *instance, SIMFS_FILE_HANDLE_TYPE fileHandle, char *writeBuffer);
+
+SIMFS_ERROR simfsReadFile(SIMFS_INSTANCE *instance, SIMFS_FILE_HANDLE_TYPE fileHandle, char **readBuffer);
+
+SIMFS_ERROR simfsWriteFileAt(SIMFS_INSTANCE *instance, SIMFS_FILE_HANDLE_TYPE fileHandle, size_t offset,
+        char *writeBuffer, size_t length);
+
+SIMFS_ERROR simfsSetFileSize(SIMFS_INSTANCE *instance, SIMFS_FILE_HANDLE_TYPE fileHandle, size_t size);
+
+SIMFS_ERROR simfsPunchHole(SIMFS_INSTANCE *instance, SIMFS_FILE_HANDLE_TYPE fileHandle, size_t offset, size_t length);
+
+SIMFS_ERROR simfsCloseFile(SIMFS_INSTANCE *instance, SIMFS_FILE_HANDLE_TYPE fileHandle);
+
+SIMFS_ERROR simfsReadMany(SIMFS_INSTANCE *instance, int numberOfFiles, char **fileNames, struct iovec *buffers,
+        SIMFS_ERROR *results);
+
+SIMFS_ERROR simfsSetFileCompression(SIMFS_INSTANCE *instance, SIMFS_NAME_TYPE fileName, int compressed);
+
+SIMFS_ERROR simfsCreateSnapshot(SIMFS_INSTANCE *instance, SIMFS_NAME_TYPE snapshotName);
+
+SIMFS_ERROR simfsDeleteSnapshot(SIMFS_INSTANCE *instance, SIMFS_NAME_TYPE snapshotName);
+
+SIMFS_ERROR simfsMountSnapshot(SIMFS_INSTANCE *instance, char *simfsFileSystemName, SIMFS_NAME_TYPE snapshotName);
 
-SIMFS_ERROR simfsMountFileSystem(char *simfsFileSystemName);
+SIMFS_ERROR simfsStartWriteback(SIMFS_INSTANCE *instance, char *simfsFileSystemName, unsigned int interval,
+        unsigned int dirtyThreshold);
 
-SIMFS_ERROR simfsCreateFile(SIMFS_NAME_TYPE fileName, SIMFS_CONTENT_TYPE type);
+SIMFS_ERROR simfsStopWriteback(SIMFS_INSTANCE *instance);
 
-SIMFS_ERROR simfsDeleteFile(SIMFS_NAME_TYPE fileName);
+SIMFS_ERROR simfsSync(SIMFS_INSTANCE *instance);
 
-SIMFS_ERROR simfsGetFileInfo(SIMFS_NAME_TYPE fileName, SIMFS_FILE_DESCRIPTOR_TYPE *infoBuffer);
+void simfsGetWritebackStats(SIMFS_INSTANCE *instance, SIMFS_WRITEBACK_STATS_TYPE *stats);
 
-SIMFS_ERROR simfsOpenFile(SIMFS_NAME_TYPE fileName, SIMFS_FILE_HANDLE_TYPE *fileHandle);
+SIMFS_ERROR simfsGetFreeSpace(SIMFS_INSTANCE *instance, SIMFS_FREE_SPACE_INFO_TYPE *info);
 
-SIMFS_ERROR simfsWriteFile(SIMFS_FILE_HANDLE_TYPE fileHandle, char *writeBuffer);
+SIMFS_ERROR simfsVerifyVolume(SIMFS_INSTANCE *instance, int *numberOfBadBlocks);
 
-SIMFS_ERROR simfsReadFile(SIMFS_FILE_HANDLE_TYPE fileHandle, char **readBuffer);
+SIMFS_ERROR simfsStartTrace(SIMFS_INSTANCE *instance, char *traceFileName);
 
-SIMFS_ERROR simfsCloseFile(SIMFS_FILE_HANDLE_TYPE fileHandle);
+SIMFS_ERROR simfsStopTrace(SIMFS_INSTANCE *instance);
 
 /*
  * The following functions can be used to simulate FUSE context's user and process identifiers for testing.
@@ -262,7 +688,10 @@ SIMFS_ERROR simfsCloseFile(SIMFS_FILE_HANDLE_TYPE fileHandle);
 
 struct fuse_context *simfs_debug_get_context(); // follows FUSE naming convention
 char *simfsGenerateContent(int size);
-unsigned long hash(SIMFS_NAME_TYPE str);
+unsigned int simfsNameKey(SIMFS_NAME_TYPE name);
+void simfsStoreName(SIMFS_VOLUME *volume, SIMFS_FILE_DESCRIPTOR_TYPE *fd, SIMFS_INDEX_TYPE nameBlock,
+        SIMFS_NAME_TYPE name);
+void simfsLoadName(SIMFS_VOLUME *volume, SIMFS_FILE_DESCRIPTOR_TYPE *fd, SIMFS_NAME_TYPE name);
 void simfsFlipBit(unsigned char *bitvector, unsigned short bitIndex);
 void simfsSetBit(unsigned char *bitvector, unsigned short bitIndex);
 void simfsClearBit(unsigned char *bitvector, unsigned short bitIndex);
@@ -0,0 +1,138 @@
+#include "simfs_crc.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <nmmintrin.h>
+#define CRC_SSE42 1
+#endif
+
+// the Castagnoli polynomial, bit-reflected
+#define CRC_POLYNOMIAL 0x82F63B78u
+
+// crcTable[k][b] is the checksum of byte b followed by k zero bytes
+static uint32_t crcTable[8][256];
+static int crcHardware;
+static pthread_once_t crcOnce = PTHREAD_ONCE_INIT;
+
+static void crcInitialize(void)
+{
+    for (uint32_t b = 0; b < 256; ++b) {
+        uint32_t crc = b;
+        for (int bit = 0; bit < 8; ++bit)
+            crc = (crc >> 1) ^ (CRC_POLYNOMIAL & (0u - (crc & 1)));
+        crcTable[0][b] = crc;
+    }
+    for (int k = 1; k < 8; ++k)
+        for (int b = 0; b < 256; ++b)
+            crcTable[k][b] = (crcTable[k - 1][b] >> 8) ^ crcTable[0][crcTable[k - 1][b] & 0xFF];
+
+#ifdef CRC_SSE42
+    __builtin_cpu_init();
+    crcHardware = __builtin_cpu_supports("sse4.2") != 0;
+#endif
+}
+
+static uint64_t loadWord(const unsigned char *p)
+{
+    // assembled byte by byte, so that it is little-endian everywhere; compilers turn it into a single load
+    return (uint64_t) p[0] | (uint64_t) p[1] << 8 | (uint64_t) p[2] << 16 | (uint64_t) p[3] << 24 |
+           (uint64_t) p[4] << 32 | (uint64_t) p[5] << 40 | (uint64_t) p[6] << 48 | (uint64_t) p[7] << 56;
+}
+
+/*****
+ * Updates a raw (not inverted) checksum with the table, eight bytes at a time.
+ */
+static uint32_t crcSoftware(uint32_t crc, const unsigned char *p, size_t length)
+{
+    for (; length >= 8; p += 8, length -= 8) {
+        uint64_t word = loadWord(p) ^ crc;
+        crc = crcTable[7][word & 0xFF] ^ crcTable[6][(word >> 8) & 0xFF] ^
+              crcTable[5][(word >> 16) & 0xFF] ^ crcTable[4][(word >> 24) & 0xFF] ^
+              crcTable[3][(word >> 32) & 0xFF] ^ crcTable[2][(word >> 40) & 0xFF] ^
+              crcTable[1][(word >> 48) & 0xFF] ^ crcTable[0][word >> 56];
+    }
+    for (; length > 0; ++p, --length)
+        crc = (crc >> 8) ^ crcTable[0][(crc ^ *p) & 0xFF];
+    return crc;
+}
+
+#ifdef CRC_SSE42
+
+__attribute__((target("sse4.2")))
+static uint32_t crcSse42(uint32_t crc, const unsigned char *p, size_t length)
+{
+    uint64_t crc64 = crc;
+    for (; length >= 8; p += 8, length -= 8) {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = (uint32_t) crc64;
+    for (; length > 0; ++p, --length)
+        crc = _mm_crc32_u8(crc, *p);
+    return crc;
+}
+
+/*****
+ * Computes the checksums of three buffers in one pass. The crc32 instruction takes three cycles, but a new one can
+ * start every cycle, so three independent streams keep it busy.
+ */
+__attribute__((target("sse4.2")))
+static void crcSse42Three(const unsigned char *a, const unsigned char *b, const unsigned char *c, size_t length,
+        unsigned int *crcs)
+{
+    uint64_t x = 0xFFFFFFFFu, y = 0xFFFFFFFFu, z = 0xFFFFFFFFu;
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t wa, wb, wc;
+        memcpy(&wa, a + i, sizeof(wa));
+        memcpy(&wb, b + i, sizeof(wb));
+        memcpy(&wc, c + i, sizeof(wc));
+        x = _mm_crc32_u64(x, wa);
+        y = _mm_crc32_u64(y, wb);
+        z = _mm_crc32_u64(z, wc);
+    }
+    crcs[0] = ~crcSse42((uint32_t) x, a + i, length - i);
+    crcs[1] = ~crcSse42((uint32_t) y, b + i, length - i);
+    crcs[2] = ~crcSse42((uint32_t) z, c + i, length - i);
+}
+
+#endif
+
+static uint32_t crcUpdate(uint32_t crc, const unsigned char *p, size_t length)
+{
+#ifdef CRC_SSE42
+    if (crcHardware)
+        return crcSse42(crc, p, length);
+#endif
+    return crcSoftware(crc, p, length);
+}
+
+int simfsCrc32cHardware(void)
+{
+    pthread_once(&crcOnce, crcInitialize);
+    return crcHardware;
+}
+
+unsigned int simfsCrc32c(unsigned int crc, const void *data, size_t length)
+{
+    pthread_once(&crcOnce, crcInitialize);
+    return ~crcUpdate(~crc, data, length);
+}
+
+void simfsCrc32cMany(const void **buffers, size_t length, size_t count, unsigned int *crcs)
+{
+    pthread_once(&crcOnce, crcInitialize);
+
+    size_t i = 0;
+#ifdef CRC_SSE42
+    if (crcHardware)
+        for (; i + 3 <= count; i += 3)
+            crcSse42Three(buffers[i], buffers[i + 1], buffers[i + 2], length, crcs + i);
+#endif
+    for (; i < count; ++i)
+        crcs[i] = ~crcUpdate(0xFFFFFFFFu, buffers[i], length);
+}
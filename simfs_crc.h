@@ -0,0 +1,26 @@
+#ifndef __SIMFS_CRC_H_
+#define __SIMFS_CRC_H_
+
+#include <stddef.h>
+
+//////////////////////////////////////////////////////////////////////////
+//
+// CRC32C (Castagnoli) checksums of volume blocks
+//
+// The checksums are computed with the SSE4.2 crc32 instruction where the processor has it, and with a table
+// that consumes eight bytes at a time otherwise; both give the same result. A checksum is continued from the
+// value returned for the data before it, starting with 0.
+//
+//////////////////////////////////////////////////////////////////////////
+
+// returns 1 if the checksums are computed by the processor
+int simfsCrc32cHardware(void);
+
+// returns the checksum of length bytes following data whose checksum is crc
+unsigned int simfsCrc32c(unsigned int crc, const void *data, size_t length);
+
+// stores the checksum of each of count buffers of the same length in crcs; with the crc32 instruction, three
+// buffers are processed at a time, so that the latency of each instruction is hidden behind the other two
+void simfsCrc32cMany(const void **buffers, size_t length, size_t count, unsigned int *crcs);
+
+#endif
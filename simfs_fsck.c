@@ -0,0 +1,473 @@
+#include "simfs.h"
+#include "simfs_crc.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <unistd.h>
+
+//The last valid position for a file descriptor in an index block
+#define LAST_POS (SIMFS_INDEX_SIZE-1)
+
+//////////////////////////////////////////////////////////////////////////
+//
+// exit codes follow the usual fsck conventions
+//
+//////////////////////////////////////////////////////////////////////////
+
+#define FSCK_OK 0
+#define FSCK_CORRECTED 1
+#define FSCK_UNCORRECTED 4
+#define FSCK_OPERATIONAL_ERROR 8
+
+#define FSCK_WORD_BYTES sizeof(uint64_t)
+#define FSCK_NUMBER_OF_WORDS (SIMFS_NUMBER_OF_BLOCKS / 8 / FSCK_WORD_BYTES)
+#define FSCK_CHECKSUM_BATCH 48 // blocks whose checksums are computed at a time
+
+//////////////////////////////////////////////////////////////////////////
+//
+// checker state shared by all worker threads
+//
+//////////////////////////////////////////////////////////////////////////
+
+typedef struct fsck_state_type {
+    SIMFS_VOLUME *volume;
+
+    // number of references to each block found while traversing from the root
+    _Atomic unsigned short references[SIMFS_NUMBER_OF_BLOCKS];
+    // the type each block is expected to have according to its first referrer
+    SIMFS_CONTENT_TYPE expected[SIMFS_NUMBER_OF_BLOCKS];
+
+    // folders waiting to be scanned; every folder is pushed at most once
+    SIMFS_INDEX_TYPE pending[SIMFS_NUMBER_OF_BLOCKS];
+    int numberOfPending;
+    int numberOfBusyWorkers;
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+
+    _Atomic int badReferences;
+    _Atomic int badTypes;
+} FSCK_STATE_TYPE;
+
+static FSCK_STATE_TYPE fsck;
+
+void pushFolder(SIMFS_INDEX_TYPE folder)
+{
+    pthread_mutex_lock(&fsck.lock);
+    fsck.pending[fsck.numberOfPending++] = folder;
+    pthread_cond_signal(&fsck.wakeup);
+    pthread_mutex_unlock(&fsck.lock);
+}
+
+/*****
+ * Records a reference to a block. Returns 1 if this is the first reference, so the caller owns the descent into it.
+ *
+ * Blocks shared with snapshots are legitimately referenced more than once; the number of references is checked
+ * against the shared counts once the traversal is done.
+ */
+int markBlock(SIMFS_INDEX_TYPE referrer, SIMFS_INDEX_TYPE block, SIMFS_CONTENT_TYPE expected)
+{
+    if (block >= SIMFS_NUMBER_OF_BLOCKS) {
+        printf("  block %d: reference to out-of-range block %d\n", referrer, block);
+        atomic_fetch_add(&fsck.badReferences, 1);
+        return 0;
+    }
+
+    if (atomic_fetch_add(&fsck.references[block], 1) != 0)
+        return 0;
+
+    fsck.expected[block] = expected;
+    if (fsck.volume->block[block].type != expected) {
+        printf("  block %d: type %d, expected %d\n", block, fsck.volume->block[block].type, expected);
+        atomic_fetch_add(&fsck.badTypes, 1);
+    }
+    return 1;
+}
+
+/*****
+ * Walks an index block chain holding the given number of entries and hands every entry to the visitor.
+ */
+void walkIndexChain(SIMFS_INDEX_TYPE owner, SIMFS_INDEX_TYPE indexBlock, size_t entries,
+        void (*visit)(SIMFS_INDEX_TYPE, SIMFS_INDEX_TYPE))
+{
+    SIMFS_INDEX_TYPE referrer = owner;
+    while (entries > 0) {
+        if (!markBlock(referrer, indexBlock, SIMFS_INDEX_CONTENT_TYPE))
+            return; // do not follow broken chains, or shared ones twice
+
+        SIMFS_INDEX_TYPE *index = fsck.volume->block[indexBlock].content.index;
+        size_t inThisBlock = entries < LAST_POS ? entries : LAST_POS;
+        for (size_t i = 0; i < inThisBlock; ++i)
+            visit(indexBlock, index[i]);
+
+        entries -= inThisBlock;
+        referrer = indexBlock;
+        indexBlock = index[LAST_POS];
+    }
+}
+
+/*****
+ * Walks the B+tree of a large folder, checks that the keys are in order and match the names, and hands every
+ * entry to the visitor.
+ *
+ * Returns the number of entries, or -1 if part of the tree was not followed because it had already been
+ * walked from another folder or is broken.
+ */
+long walkBtree(SIMFS_INDEX_TYPE referrer, SIMFS_INDEX_TYPE node, void (*visit)(SIMFS_INDEX_TYPE, SIMFS_INDEX_TYPE))
+{
+    if (!markBlock(referrer, node, SIMFS_BTREE_CONTENT_TYPE))
+        return -1;
+
+    SIMFS_BTREE_NODE_TYPE *n = &(fsck.volume->block[node].content.btree);
+    if (n->numberOfEntries > SIMFS_BTREE_ORDER || n->level >= SIMFS_BTREE_MAX_HEIGHT) {
+        printf("  block %d: malformed B+tree node\n", node);
+        atomic_fetch_add(&fsck.badReferences, 1);
+        return -1;
+    }
+
+    long entries = 0;
+    for (int i = 0; i < n->numberOfEntries; ++i) {
+        if (i > 0 && n->key[i] < n->key[i - 1]) {
+            printf("  block %d: B+tree keys out of order\n", node);
+            atomic_fetch_add(&fsck.badReferences, 1);
+        }
+
+        SIMFS_INDEX_TYPE child = n->child[i];
+        if (n->level > 0) {
+            long below = walkBtree(node, child, visit);
+            entries = (entries < 0 || below < 0) ? -1 : entries + below;
+            continue;
+        }
+
+        if (child < SIMFS_NUMBER_OF_BLOCKS &&
+            n->key[i] != fsck.volume->block[child].content.fileDescriptor.nameKey) {
+            printf("  block %d: B+tree key of block %d does not match its name\n", node, child);
+            atomic_fetch_add(&fsck.badReferences, 1);
+        }
+        visit(node, child);
+        if (entries >= 0)
+            entries++;
+    }
+    return entries;
+}
+
+void visitDataBlock(SIMFS_INDEX_TYPE indexBlock, SIMFS_INDEX_TYPE data)
+{
+    if (data == SIMFS_INVALID_INDEX)
+        return; // a hole in a sparse file
+    markBlock(indexBlock, data, SIMFS_DATA_CONTENT_TYPE);
+}
+
+/*****
+ * Checks that a name block is where the length of a name calls for one, and that the key matches the name.
+ */
+void checkName(SIMFS_INDEX_TYPE descriptor, SIMFS_FILE_DESCRIPTOR_TYPE *fd)
+{
+    int longName = fd->nameLength > SIMFS_NAME_PREFIX_SIZE;
+    if (fd->nameLength >= SIMFS_MAX_NAME_LENGTH || longName != (fd->nameBlock != SIMFS_INVALID_INDEX)) {
+        printf("  block %d: malformed name\n", descriptor);
+        atomic_fetch_add(&fsck.badReferences, 1);
+        return;
+    }
+    if (longName) {
+        markBlock(descriptor, fd->nameBlock, SIMFS_NAME_CONTENT_TYPE); // clones of a descriptor share it
+        if (fd->nameBlock >= SIMFS_NUMBER_OF_BLOCKS)
+            return;
+    }
+
+    SIMFS_NAME_TYPE name;
+    if (longName && memchr(fsck.volume->block[fd->nameBlock].content.name, '\0',
+                            SIMFS_MAX_NAME_LENGTH - SIMFS_NAME_PREFIX_SIZE) == NULL)
+        name[0] = '\0'; // not terminated
+    else
+        simfsLoadName(fsck.volume, fd, name);
+    if (strlen(name) != fd->nameLength || simfsNameKey(name) != fd->nameKey) {
+        printf("  block %d: name key does not match the name\n", descriptor);
+        atomic_fetch_add(&fsck.badReferences, 1);
+    }
+}
+
+void visitFolderEntry(SIMFS_INDEX_TYPE indexBlock, SIMFS_INDEX_TYPE child)
+{
+    if (child >= SIMFS_NUMBER_OF_BLOCKS) {
+        markBlock(indexBlock, child, SIMFS_INVALID_CONTENT_TYPE);
+        return;
+    }
+
+    // a folder entry must be a descriptor; which kind is told by the block itself
+    SIMFS_CONTENT_TYPE type = fsck.volume->block[child].type;
+    if (type != SIMFS_FOLDER_CONTENT_TYPE && type != SIMFS_FILE_CONTENT_TYPE)
+        type = SIMFS_FILE_CONTENT_TYPE;
+
+    if (!markBlock(indexBlock, child, type))
+        return;
+
+    SIMFS_FILE_DESCRIPTOR_TYPE *fd = &(fsck.volume->block[child].content.fileDescriptor);
+    if (fd->type != fsck.volume->block[child].type) {
+        printf("  block %d: descriptor type %d does not match block type %d\n",
+               child, fd->type, fsck.volume->block[child].type);
+        atomic_fetch_add(&fsck.badTypes, 1);
+    }
+
+    checkName(child, fd);
+    if (type == SIMFS_FOLDER_CONTENT_TYPE)
+        pushFolder(child);
+    else if (fd->storedSize > 0)
+        walkIndexChain(child, fd->block_ref, (fd->storedSize + SIMFS_DATA_SIZE - 1) / SIMFS_DATA_SIZE, visitDataBlock);
+}
+
+void *fsckWorker(void *unused)
+{
+    pthread_mutex_lock(&fsck.lock);
+    for (;;) {
+        while (fsck.numberOfPending == 0 && fsck.numberOfBusyWorkers > 0)
+            pthread_cond_wait(&fsck.wakeup, &fsck.lock);
+        if (fsck.numberOfPending == 0)
+            break; // nothing queued and nobody left who could queue more
+
+        SIMFS_INDEX_TYPE folder = fsck.pending[--fsck.numberOfPending];
+        fsck.numberOfBusyWorkers++;
+        pthread_mutex_unlock(&fsck.lock);
+
+        SIMFS_FILE_DESCRIPTOR_TYPE *fd = &(fsck.volume->block[folder].content.fileDescriptor);
+        if (!(fd->flags & SIMFS_BTREE_FLAG)) {
+            if (fd->size > 0)
+                walkIndexChain(folder, fd->block_ref, fd->size, visitFolderEntry);
+        } else if (fd->block_ref != SIMFS_INVALID_INDEX) {
+            long entries = walkBtree(folder, fd->block_ref, visitFolderEntry);
+            if (entries >= 0 && (size_t) entries != fd->size) {
+                printf("  block %d: folder size %zu, but its B+tree holds %ld entries\n", folder, fd->size, entries);
+                atomic_fetch_add(&fsck.badReferences, 1);
+            }
+        }
+
+        pthread_mutex_lock(&fsck.lock);
+        fsck.numberOfBusyWorkers--;
+    }
+    pthread_cond_broadcast(&fsck.wakeup);
+    pthread_mutex_unlock(&fsck.lock);
+    return NULL;
+}
+
+/*****
+ * Reports every block whose bit is set in the given word-wide difference.
+ */
+void reportBlocks(uint64_t difference, size_t word, char *what)
+{
+    unsigned char bytes[FSCK_WORD_BYTES];
+    memcpy(bytes, &difference, FSCK_WORD_BYTES);
+    for (size_t b = 0; b < FSCK_WORD_BYTES; ++b)
+        for (int bit = 0; bit < 8; ++bit)
+            if (bytes[b] & (0x80 >> bit))
+                printf("  block %zu: %s\n", (word * FSCK_WORD_BYTES + b) * 8 + bit, what);
+}
+
+/*****
+ * Compares the metadata and every block allocated in the on-disk bitvector with the checksums in the image, and
+ * returns the number of mismatches.
+ */
+int checkChecksums(SIMFS_VOLUME *volume)
+{
+    int bad = 0;
+
+    SIMFS_SUPERBLOCK_TYPE superblock = volume->superblock;
+    superblock.attr.metadataChecksum = 0;
+    unsigned int crc = simfsCrc32c(0, &superblock, sizeof(SIMFS_SUPERBLOCK_TYPE));
+    crc = simfsCrc32c(crc, volume->bitvector, offsetof(SIMFS_VOLUME, checksum) - offsetof(SIMFS_VOLUME, bitvector));
+    if (crc != volume->superblock.attr.metadataChecksum) {
+        printf("  metadata: checksum mismatch\n");
+        bad++;
+    }
+
+    const void *buffers[FSCK_CHECKSUM_BATCH];
+    int blocks[FSCK_CHECKSUM_BATCH];
+    unsigned int crcs[FSCK_CHECKSUM_BATCH];
+    for (int i = 0; i < SIMFS_NUMBER_OF_BLOCKS; ) {
+        int count = 0;
+        for (; i < SIMFS_NUMBER_OF_BLOCKS && count < FSCK_CHECKSUM_BATCH; ++i) {
+            if (volume->bitvector[i / 8] & (0x80 >> (i % 8))) {
+                blocks[count] = i;
+                buffers[count++] = &(volume->block[i]);
+            }
+        }
+        simfsCrc32cMany(buffers, sizeof(SIMFS_BLOCK_TYPE), count, crcs);
+        for (int k = 0; k < count; ++k) {
+            if (crcs[k] != volume->checksum[blocks[k]]) {
+                printf("  block %d: checksum mismatch\n", blocks[k]);
+                bad++;
+            }
+        }
+    }
+    return bad;
+}
+
+void usage(char *program)
+{
+    fprintf(stderr, "usage: %s [-r] [-j threads] image\n", program);
+    fprintf(stderr, "  -r          repair the bitvector and block types in place\n");
+    fprintf(stderr, "  -j threads  number of traversal threads (default: online processors)\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int repair = 0;
+    long numberOfThreads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    int opt;
+    while ((opt = getopt(argc, argv, "rj:")) != -1) {
+        switch (opt) {
+        case 'r':
+            repair = 1; break;
+        case 'j':
+            numberOfThreads = atol(optarg); break;
+        default:
+            usage(argv[0]);
+            return FSCK_OPERATIONAL_ERROR;
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return FSCK_OPERATIONAL_ERROR;
+    }
+    if (numberOfThreads < 1)
+        numberOfThreads = 1;
+    char *imageName = argv[optind];
+
+    SIMFS_VOLUME *volume = malloc(sizeof(SIMFS_VOLUME));
+    FILE *file = fopen(imageName, "rb");
+    if (volume == NULL || file == NULL) {
+        perror(imageName);
+        return FSCK_OPERATIONAL_ERROR;
+    }
+    if (fread(volume, 1, sizeof(SIMFS_VOLUME), file) != sizeof(SIMFS_VOLUME)) {
+        fprintf(stderr, "%s: short image\n", imageName);
+        return FSCK_OPERATIONAL_ERROR;
+    }
+    fclose(file);
+
+    if (volume->superblock.attr.numberOfBlocks != SIMFS_NUMBER_OF_BLOCKS ||
+        volume->superblock.attr.blockSize != SIMFS_BLOCK_SIZE) {
+        fprintf(stderr, "%s: superblock geometry %d x %d does not match this build\n", imageName,
+                volume->superblock.attr.numberOfBlocks, volume->superblock.attr.blockSize);
+        return FSCK_OPERATIONAL_ERROR;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // traverse the descriptor/index/data graph from the root, one folder per work item
+    fsck.volume = volume;
+    pthread_mutex_init(&fsck.lock, NULL);
+    pthread_cond_init(&fsck.wakeup, NULL);
+
+    printf("Checking %s with %ld thread(s)\n", imageName, numberOfThreads);
+    SIMFS_INDEX_TYPE root = volume->superblock.attr.rootNodeIndex;
+    if (markBlock(root, root, SIMFS_FOLDER_CONTENT_TYPE))
+        pushFolder(root);
+    for (int i = 0; i < SIMFS_MAX_NUMBER_OF_SNAPSHOTS; ++i) {
+        if (volume->snapshot[i].name[0] == '\0')
+            continue;
+        root = volume->snapshot[i].superblock.attr.rootNodeIndex;
+        if (markBlock(root, root, SIMFS_FOLDER_CONTENT_TYPE))
+            pushFolder(root);
+    }
+
+    // the content is compared with the checksums before anything else, as the checks below trust it
+    int badChecksums = 0;
+    if (volume->superblock.attr.flags & SIMFS_SUPERBLOCK_CHECKSUMS)
+        badChecksums = checkChecksums(volume);
+
+    pthread_t *workers = malloc(numberOfThreads * sizeof(pthread_t));
+    for (long i = 0; i < numberOfThreads; ++i)
+        pthread_create(&workers[i], NULL, fsckWorker, NULL);
+    for (long i = 0; i < numberOfThreads; ++i)
+        pthread_join(workers[i], NULL);
+    free(workers);
+
+    // every reference beyond the first must be accounted for by the shared count
+    int badSharedCounts = 0;
+    for (int i = 0; i < SIMFS_NUMBER_OF_BLOCKS; ++i) {
+        unsigned short references = atomic_load(&fsck.references[i]);
+        if (references != 0 && references != volume->sharedCount[i] + 1) {
+            printf("  block %d: %d references, shared count %d\n", i, references, volume->sharedCount[i]);
+            badSharedCounts++;
+        }
+    }
+
+    // build the reachability bitmap and compare it with the on-disk bitvector a word at a time
+    unsigned char reachable[SIMFS_NUMBER_OF_BLOCKS / 8];
+    memset(reachable, 0, sizeof(reachable));
+    for (int i = 0; i < SIMFS_NUMBER_OF_BLOCKS; ++i)
+        if (atomic_load(&fsck.references[i]) != 0)
+            simfsSetBit(reachable, i);
+
+    int leaked = 0;
+    int unmarked = 0;
+    for (size_t w = 0; w < FSCK_NUMBER_OF_WORDS; ++w) {
+        uint64_t onDisk, inUse;
+        memcpy(&onDisk, volume->bitvector + w * FSCK_WORD_BYTES, FSCK_WORD_BYTES);
+        memcpy(&inUse, reachable + w * FSCK_WORD_BYTES, FSCK_WORD_BYTES);
+        if (onDisk == inUse)
+            continue;
+
+        uint64_t leakedBits = onDisk & ~inUse;
+        uint64_t unmarkedBits = inUse & ~onDisk;
+        leaked += __builtin_popcountll(leakedBits);
+        unmarked += __builtin_popcountll(unmarkedBits);
+        reportBlocks(leakedBits, w, "allocated but unreachable (leaked)");
+        reportBlocks(unmarkedBits, w, "reachable but marked free");
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    int reachableBlocks = 0;
+    for (size_t w = 0; w < FSCK_NUMBER_OF_WORDS; ++w) {
+        uint64_t inUse;
+        memcpy(&inUse, reachable + w * FSCK_WORD_BYTES, FSCK_WORD_BYTES);
+        reachableBlocks += __builtin_popcountll(inUse);
+    }
+
+    printf("%d reachable blocks, %d leaked, %d marked free, %d bad shared counts, %d bad types, %d bad references, "
+           "%d bad checksums\n", reachableBlocks, leaked, unmarked, badSharedCounts, fsck.badTypes, fsck.badReferences,
+           badChecksums);
+    printf("Checked in %.3f s\n", elapsed);
+
+    int fixable = leaked + unmarked + badSharedCounts + fsck.badTypes;
+    int unfixable = fsck.badReferences + badChecksums;
+    if (fixable + unfixable == 0)
+        return FSCK_OK;
+    if (!repair)
+        return FSCK_UNCORRECTED;
+
+    // the reachability bitmap becomes the bitvector; reachable blocks take the type of their referrer, and
+    // blocks referenced more than once become shared blocks
+    memcpy(volume->bitvector, reachable, sizeof(reachable));
+    for (int i = 0; i < SIMFS_NUMBER_OF_BLOCKS; ++i)
+        if (atomic_load(&fsck.references[i]) != 0)
+            volume->sharedCount[i] = atomic_load(&fsck.references[i]) - 1;
+    for (int i = 0; i < SIMFS_NUMBER_OF_BLOCKS; ++i)
+        if (atomic_load(&fsck.references[i]) != 0 && fsck.expected[i] != SIMFS_INVALID_CONTENT_TYPE) {
+            volume->block[i].type = fsck.expected[i];
+            if (fsck.expected[i] == SIMFS_FOLDER_CONTENT_TYPE || fsck.expected[i] == SIMFS_FILE_CONTENT_TYPE)
+                volume->block[i].content.fileDescriptor.type = fsck.expected[i];
+        }
+
+    // the repaired image no longer matches its checksums; the next mount with checksums trusts it as it is
+    volume->superblock.attr.flags &= ~SIMFS_SUPERBLOCK_CHECKSUMS;
+
+    file = fopen(imageName, "r+b");
+    if (file == NULL || fwrite(volume, 1, sizeof(SIMFS_VOLUME), file) != sizeof(SIMFS_VOLUME)) {
+        perror(imageName);
+        return FSCK_OPERATIONAL_ERROR;
+    }
+    fclose(file);
+    free(volume);
+
+    printf("Repaired %d problem(s)", fixable);
+    if (unfixable > 0)
+        printf("; %d bad reference(s) or checksum(s) need manual attention", unfixable);
+    printf("\n");
+
+    return unfixable > 0 ? FSCK_CORRECTED | FSCK_UNCORRECTED : FSCK_CORRECTED;
+}
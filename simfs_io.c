@@ -0,0 +1,397 @@
+#define _GNU_SOURCE // O_DIRECT
+
+#include "simfs_io.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#define IO_URING 1
+#endif
+#endif
+
+//
+// a piece of a range that is read or written by a single request
+//
+typedef struct io_chunk_type {
+    char *buffer;
+    off_t offset;
+    size_t length; // bytes requested, rounded up to the alignment with O_DIRECT
+    size_t needed; // bytes of the range; the rest is padding, which may lie beyond the end of the file when reading
+    size_t done;
+    struct iovec vector; // what is left of the chunk, for io_uring
+} IO_CHUNK_TYPE;
+
+static size_t roundUp(size_t length)
+{
+    return (length + SIMFS_IO_ALIGNMENT - 1) / SIMFS_IO_ALIGNMENT * SIMFS_IO_ALIGNMENT;
+}
+
+void *simfsIoAllocate(size_t length)
+{
+    void *buffer;
+    if (posix_memalign(&buffer, SIMFS_IO_ALIGNMENT, roundUp(length)) != 0)
+        return NULL;
+    memset(buffer, 0, roundUp(length));
+    return buffer;
+}
+
+/*****
+ * Splits ranges into chunks. Returns NULL if there is no memory for them.
+ */
+static IO_CHUNK_TYPE *splitRanges(SIMFS_IO_FILE_TYPE *file, SIMFS_IO_RANGE_TYPE *ranges, int count, int *numberOfChunks)
+{
+    int chunks = 0;
+    for (int i = 0; i < count; ++i)
+        chunks += (ranges[i].length + SIMFS_IO_CHUNK_SIZE - 1) / SIMFS_IO_CHUNK_SIZE;
+
+    IO_CHUNK_TYPE *chunk = malloc((chunks > 0 ? chunks : 1) * sizeof(IO_CHUNK_TYPE));
+    if (chunk == NULL)
+        return NULL;
+
+    int k = 0;
+    for (int i = 0; i < count; ++i) {
+        for (size_t start = 0; start < ranges[i].length; start += SIMFS_IO_CHUNK_SIZE, ++k) {
+            size_t length = ranges[i].length - start;
+            chunk[k].buffer = (char *) ranges[i].buffer + start;
+            chunk[k].offset = ranges[i].offset + start;
+            chunk[k].needed = (length < SIMFS_IO_CHUNK_SIZE ? length : SIMFS_IO_CHUNK_SIZE);
+            chunk[k].length = (file->flags & SIMFS_IO_DIRECT) ? roundUp(chunk[k].needed) : chunk[k].needed;
+            chunk[k].done = 0;
+        }
+    }
+    *numberOfChunks = chunks;
+    return chunk;
+}
+
+/*****
+ * Accounts for the result of a request for the rest of a chunk: a number of bytes, or a negated error number.
+ * Returns 1 if the chunk is done, 0 if the rest of it has to be requested again, or -1 if it failed.
+ *
+ * A read that ends early has reached the end of the file, which is fine once the bytes of the range are in.
+ */
+static int completeChunk(IO_CHUNK_TYPE *chunk, int writing, ssize_t result)
+{
+    if (result < 0)
+        return (result == -EINTR || result == -EAGAIN) ? 0 : -1;
+    if (result == 0)
+        return (!writing && chunk->done >= chunk->needed) ? 1 : -1;
+
+    chunk->done += result;
+    if (chunk->done >= chunk->length || (!writing && chunk->done >= chunk->needed))
+        return 1;
+    return 0;
+}
+
+/*****
+ * Transfers the chunks one at a time with pread() or pwrite().
+ */
+static int transferChunks(SIMFS_IO_FILE_TYPE *file, int writing, IO_CHUNK_TYPE *chunks, int count)
+{
+    for (int i = 0; i < count; ++i) {
+        IO_CHUNK_TYPE *chunk = &chunks[i];
+        int state = 0;
+        while (state == 0) {
+            ssize_t result = writing ?
+                    pwrite(file->descriptor, chunk->buffer + chunk->done, chunk->length - chunk->done,
+                           chunk->offset + chunk->done) :
+                    pread(file->descriptor, chunk->buffer + chunk->done, chunk->length - chunk->done,
+                          chunk->offset + chunk->done);
+            state = completeChunk(chunk, writing, result < 0 ? -errno : result);
+        }
+        if (state < 0)
+            return -1;
+    }
+    return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// io_uring
+//
+// The kernel takes requests from the submission ring and posts their results to the completion ring; both are
+// mapped into memory shared with it. The tail of the submission ring and the head of the completion ring are ours
+// to move, and the other two are the kernel's, so each side publishes its moves with release stores and reads the
+// other side's with acquire loads.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#ifdef IO_URING
+
+static void ringTeardown(SIMFS_IO_RING_TYPE *ring)
+{
+    if (ring->entries != NULL)
+        munmap(ring->entries, ring->entriesSize);
+    if (ring->completionRingSize > 0)
+        munmap(ring->completionRing, ring->completionRingSize);
+    if (ring->submissionRing != NULL)
+        munmap(ring->submissionRing, ring->submissionRingSize);
+    close(ring->descriptor);
+    memset(ring, 0, sizeof(SIMFS_IO_RING_TYPE));
+    ring->descriptor = -1;
+}
+
+static void *mapRing(int descriptor, size_t size, off_t offset)
+{
+    void *ring = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, descriptor, offset);
+    return ring == MAP_FAILED ? NULL : ring;
+}
+
+/*****
+ * Sets up a ring with room for SIMFS_IO_QUEUE_DEPTH requests. Returns 0, or -1 if the kernel refuses it.
+ */
+static int ringSetup(SIMFS_IO_RING_TYPE *ring)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    memset(ring, 0, sizeof(SIMFS_IO_RING_TYPE));
+    ring->descriptor = (int) syscall(__NR_io_uring_setup, SIMFS_IO_QUEUE_DEPTH, &params);
+    if (ring->descriptor < 0) {
+        ring->descriptor = -1;
+        return -1;
+    }
+
+    ring->submissionRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    size_t completionRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    int single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single && completionRingSize > ring->submissionRingSize)
+        ring->submissionRingSize = completionRingSize;
+
+    ring->submissionRing = mapRing(ring->descriptor, ring->submissionRingSize, IORING_OFF_SQ_RING);
+    if (ring->submissionRing == NULL) {
+        ringTeardown(ring);
+        return -1;
+    }
+    ring->completionRing = ring->submissionRing;
+    if (!single) {
+        ring->completionRing = mapRing(ring->descriptor, completionRingSize, IORING_OFF_CQ_RING);
+        if (ring->completionRing == NULL) {
+            ringTeardown(ring);
+            return -1;
+        }
+        ring->completionRingSize = completionRingSize;
+    }
+    ring->entriesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->entries = mapRing(ring->descriptor, ring->entriesSize, IORING_OFF_SQES);
+    if (ring->entries == NULL) {
+        ringTeardown(ring);
+        return -1;
+    }
+
+    char *submission = ring->submissionRing, *completion = ring->completionRing;
+    ring->submissionHead = (unsigned int *) (submission + params.sq_off.head);
+    ring->submissionTail = (unsigned int *) (submission + params.sq_off.tail);
+    ring->submissionMask = *(unsigned int *) (submission + params.sq_off.ring_mask);
+    ring->submissionArray = (unsigned int *) (submission + params.sq_off.array);
+    ring->completionHead = (unsigned int *) (completion + params.cq_off.head);
+    ring->completionTail = (unsigned int *) (completion + params.cq_off.tail);
+    ring->completionMask = *(unsigned int *) (completion + params.cq_off.ring_mask);
+    ring->completions = completion + params.cq_off.cqes;
+    return 0;
+}
+
+/*****
+ * Transfers the chunks with up to SIMFS_IO_QUEUE_DEPTH requests in flight. A chunk that is done only in part is
+ * queued again for the rest. Every request is waited for, even after one has failed, since the kernel uses the
+ * chunks and their buffers until then.
+ *
+ * If io_uring_enter() itself fails, the requests that the kernel has not taken yet are taken back from the
+ * submission ring, the ones it has taken are waited for by polling the completion ring, and the ring is torn down,
+ * so that the file falls back to pread()/pwrite().
+ */
+static int ringTransferChunks(SIMFS_IO_FILE_TYPE *file, int writing, IO_CHUNK_TYPE *chunks, int count)
+{
+    SIMFS_IO_RING_TYPE *ring = &(file->ring);
+    struct io_uring_sqe *entries = ring->entries;
+    struct io_uring_cqe *completions = ring->completions;
+
+    // chunks waiting for a request, in a circular queue; a chunk is in it at most once
+    int *queue = malloc(count * sizeof(int));
+    if (queue == NULL)
+        return transferChunks(file, writing, chunks, count);
+    for (int i = 0; i < count; ++i)
+        queue[i] = i;
+    int first = 0, queued = count, inFlight = 0, finished = 0, failed = 0, broken = 0;
+
+    while (finished < count) {
+        unsigned int tail = *ring->submissionTail;
+        for (; !broken && queued > 0 && inFlight < SIMFS_IO_QUEUE_DEPTH; ++inFlight, --queued, ++tail) {
+            int i = queue[first];
+            first = (first + 1) % count;
+
+            IO_CHUNK_TYPE *chunk = &chunks[i];
+            chunk->vector.iov_base = chunk->buffer + chunk->done;
+            chunk->vector.iov_len = chunk->length - chunk->done;
+
+            struct io_uring_sqe *entry = &entries[tail & ring->submissionMask];
+            memset(entry, 0, sizeof(struct io_uring_sqe));
+            entry->opcode = writing ? IORING_OP_WRITEV : IORING_OP_READV;
+            entry->fd = file->descriptor;
+            entry->addr = (uintptr_t) &(chunk->vector);
+            entry->len = 1;
+            entry->off = chunk->offset + chunk->done;
+            entry->user_data = i;
+            ring->submissionArray[tail & ring->submissionMask] = tail & ring->submissionMask;
+        }
+        __atomic_store_n(ring->submissionTail, tail, __ATOMIC_RELEASE);
+
+        // requests that were not taken because of an interruption are passed again
+        unsigned int unsubmitted = tail - __atomic_load_n(ring->submissionHead, __ATOMIC_ACQUIRE);
+        if (syscall(__NR_io_uring_enter, ring->descriptor, unsubmitted, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 &&
+            errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            if (!broken) {
+                // the kernel only takes requests inside io_uring_enter(), so the rest can be taken back
+                unsigned int taken = __atomic_load_n(ring->submissionHead, __ATOMIC_ACQUIRE);
+                __atomic_store_n(ring->submissionTail, taken, __ATOMIC_RELEASE);
+                inFlight -= tail - taken;
+                finished = count - inFlight;
+                queued = 0;
+                failed = 1;
+                broken = 1;
+            } else {
+                sched_yield();
+            }
+        }
+
+        unsigned int head = *ring->completionHead;
+        unsigned int completed = __atomic_load_n(ring->completionTail, __ATOMIC_ACQUIRE);
+        for (; head != completed; ++head) {
+            struct io_uring_cqe *completion = &completions[head & ring->completionMask];
+            int i = (int) completion->user_data;
+            int state = completeChunk(&chunks[i], writing, completion->res);
+            inFlight--;
+            if (state == 0 && !broken) {
+                queue[(first + queued) % count] = i;
+                queued++;
+            } else {
+                finished++;
+                failed |= (state != 1);
+            }
+        }
+        __atomic_store_n(ring->completionHead, head, __ATOMIC_RELEASE);
+    }
+
+    free(queue);
+    if (broken) {
+        ringTeardown(ring);
+        file->flags &= ~SIMFS_IO_URING;
+    }
+    return failed ? -1 : 0;
+}
+
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+//
+// image files
+//
+//////////////////////////////////////////////////////////////////////////
+
+int simfsIoOpen(SIMFS_IO_FILE_TYPE *file, const char *fileName, int writing, unsigned int flags)
+{
+    memset(file, 0, sizeof(SIMFS_IO_FILE_TYPE));
+    file->ring.descriptor = -1;
+    file->flags = flags;
+
+    int mode = writing ? (O_WRONLY | O_CREAT | O_TRUNC) : O_RDONLY;
+    file->descriptor = -1;
+    if (flags & SIMFS_IO_DIRECT)
+        file->descriptor = open(fileName, mode | O_DIRECT, 0644);
+    if (file->descriptor < 0) {
+        // without O_DIRECT, or on a file system that does not support it
+        file->flags &= ~SIMFS_IO_DIRECT;
+        file->descriptor = open(fileName, mode, 0644);
+        if (file->descriptor < 0)
+            return -1;
+    }
+
+#ifdef IO_URING
+    if ((flags & SIMFS_IO_URING) && ringSetup(&(file->ring)) != 0)
+        file->flags &= ~SIMFS_IO_URING;
+#else
+    file->flags &= ~SIMFS_IO_URING;
+#endif
+    return 0;
+}
+
+int simfsIoSubmit(SIMFS_IO_FILE_TYPE *file, int writing, SIMFS_IO_RANGE_TYPE *ranges, int count)
+{
+    // a range that does not meet the alignment of O_DIRECT turns it off for good
+    for (int i = 0; i < count && (file->flags & SIMFS_IO_DIRECT); ++i) {
+        if ((uintptr_t) ranges[i].buffer % SIMFS_IO_ALIGNMENT != 0 || ranges[i].offset % SIMFS_IO_ALIGNMENT != 0) {
+            fcntl(file->descriptor, F_SETFL, fcntl(file->descriptor, F_GETFL) & ~O_DIRECT);
+            file->flags &= ~SIMFS_IO_DIRECT;
+        }
+    }
+
+    int numberOfChunks;
+    IO_CHUNK_TYPE *chunks = splitRanges(file, ranges, count, &numberOfChunks);
+    if (chunks == NULL)
+        return -1;
+
+    int result;
+#ifdef IO_URING
+    if (file->flags & SIMFS_IO_URING)
+        result = ringTransferChunks(file, writing, chunks, numberOfChunks);
+    else
+#endif
+    result = transferChunks(file, writing, chunks, numberOfChunks);
+    free(chunks);
+
+    for (int i = 0; writing && i < count; ++i)
+        if (ranges[i].offset + (off_t) ranges[i].length > file->end)
+            file->end = ranges[i].offset + ranges[i].length;
+    return result;
+}
+
+int simfsIoRead(SIMFS_IO_FILE_TYPE *file, void *buffer, size_t length, off_t offset)
+{
+    SIMFS_IO_RANGE_TYPE range = { buffer, length, offset };
+    return simfsIoSubmit(file, 0, &range, 1);
+}
+
+int simfsIoWrite(SIMFS_IO_FILE_TYPE *file, const void *buffer, size_t length, off_t offset)
+{
+    SIMFS_IO_RANGE_TYPE range = { (void *) buffer, length, offset };
+    return simfsIoSubmit(file, 1, &range, 1);
+}
+
+/*****
+ * Cuts the padding that O_DIRECT writes leave behind the end of the last range.
+ */
+static int cutPadding(SIMFS_IO_FILE_TYPE *file)
+{
+    if (!(file->flags & SIMFS_IO_DIRECT) || file->end == 0)
+        return 0;
+    return ftruncate(file->descriptor, file->end);
+}
+
+int simfsIoFlush(SIMFS_IO_FILE_TYPE *file)
+{
+    if (cutPadding(file) != 0)
+        return -1;
+    return fsync(file->descriptor);
+}
+
+int simfsIoClose(SIMFS_IO_FILE_TYPE *file)
+{
+    int result = cutPadding(file);
+#ifdef IO_URING
+    if (file->ring.descriptor >= 0)
+        ringTeardown(&(file->ring));
+#endif
+    if (close(file->descriptor) != 0)
+        result = -1;
+    file->descriptor = -1;
+    return result;
+}
@@ -0,0 +1,93 @@
+#ifndef __SIMFS_IO_H_
+#define __SIMFS_IO_H_
+
+#include <stddef.h>
+#include <sys/types.h>
+
+//////////////////////////////////////////////////////////////////////////
+//
+// reading and writing volume images
+//
+// An image file is read and written in batches of byte ranges. Each range is split into chunks, and a batch
+// returns when all of its chunks are done. There are two backends:
+//
+//   - pread()/pwrite(), which does one chunk at a time; it is the default,
+//   - io_uring (SIMFS_IO_URING), which keeps up to SIMFS_IO_QUEUE_DEPTH chunks in flight. The ring is set up
+//     with raw system calls. If the kernel refuses a ring (too old, or io_uring is disabled), the file falls
+//     back to pread()/pwrite(); so it does after a batch in which the ring itself failed.
+//
+// Either backend can bypass the page cache (SIMFS_IO_DIRECT) if the file system supports O_DIRECT; otherwise
+// the file falls back to buffered I/O. With O_DIRECT, buffers must come from simfsIoAllocate(), and offsets
+// must be multiples of SIMFS_IO_ALIGNMENT. Lengths are rounded up to the alignment, and simfsIoAllocate()
+// leaves room for that. A file written this way is cut back to the end of its ranges on flushing or closing.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#define SIMFS_IO_URING 0x0001 // keep many chunks in flight with io_uring
+#define SIMFS_IO_DIRECT 0x0002 // bypass the page cache with O_DIRECT
+
+#define SIMFS_IO_ALIGNMENT 4096 // of buffers, offsets and lengths with O_DIRECT
+#define SIMFS_IO_CHUNK_SIZE (64 * 1024) // ranges are split into chunks of this size
+#define SIMFS_IO_QUEUE_DEPTH 64 // chunks in flight with io_uring
+
+//
+// a range of an image file and the memory it is read into or written from
+//
+typedef struct simfs_io_range_type {
+    void *buffer;
+    size_t length;
+    off_t offset;
+} SIMFS_IO_RANGE_TYPE;
+
+//
+// the rings shared with the kernel; see io_uring_setup(2)
+//
+typedef struct simfs_io_ring_type {
+    int descriptor; // -1 without a ring
+    void *submissionRing;
+    size_t submissionRingSize;
+    void *completionRing;
+    size_t completionRingSize; // 0 if the completion ring is mapped together with the submission ring
+    void *entries; // struct io_uring_sqe
+    size_t entriesSize;
+    unsigned int *submissionHead;
+    unsigned int *submissionTail;
+    unsigned int submissionMask;
+    unsigned int *submissionArray;
+    unsigned int *completionHead;
+    unsigned int *completionTail;
+    unsigned int completionMask;
+    void *completions; // struct io_uring_cqe
+} SIMFS_IO_RING_TYPE;
+
+//
+// an open image file
+//
+typedef struct simfs_io_file_type {
+    int descriptor;
+    unsigned int flags; // the SIMFS_IO_* flags that are in effect
+    off_t end; // end of the last range written, for cutting the padding of O_DIRECT writes
+    SIMFS_IO_RING_TYPE ring;
+} SIMFS_IO_FILE_TYPE;
+
+// returns memory for a buffer of the given length that is suitable for O_DIRECT; it is zeroed and freed with free()
+void *simfsIoAllocate(size_t length);
+
+// opens an image for reading, or creates or truncates it for writing; returns 0, or -1 with errno set
+int simfsIoOpen(SIMFS_IO_FILE_TYPE *file, const char *fileName, int writing, unsigned int flags);
+
+// reads or writes a batch of ranges; returns 0 when all of them are done, or -1 if any of them failed or was cut
+// short by the end of the file
+int simfsIoSubmit(SIMFS_IO_FILE_TYPE *file, int writing, SIMFS_IO_RANGE_TYPE *ranges, int count);
+
+// reads or writes a single range
+int simfsIoRead(SIMFS_IO_FILE_TYPE *file, void *buffer, size_t length, off_t offset);
+int simfsIoWrite(SIMFS_IO_FILE_TYPE *file, const void *buffer, size_t length, off_t offset);
+
+// makes the data written so far durable; returns 0, or -1
+int simfsIoFlush(SIMFS_IO_FILE_TYPE *file);
+
+// closes the file, cutting the padding of O_DIRECT writes; returns 0, or -1 if that or closing failed
+int simfsIoClose(SIMFS_IO_FILE_TYPE *file);
+
+#endif
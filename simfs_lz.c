@@ -0,0 +1,173 @@
+#include "simfs_lz.h"
+
+#include <stdint.h>
+#include <string.h>
+
+// matches must end this far from the end of the input, which leaves room for a final run of literals
+#define LAST_LITERALS 5
+
+static unsigned int lzHash(const unsigned char *position)
+{
+    uint32_t value;
+    memcpy(&value, position, sizeof(value));
+    return (value * 2654435761u) >> (32 - SIMFS_LZ_HASH_BITS);
+}
+
+/*****
+ * Writes the extension bytes of a length whose nibble in the token is saturated.
+ */
+static unsigned char *putLength(unsigned char *out, unsigned char *outEnd, size_t length)
+{
+    for (; length >= 255; length -= 255) {
+        if (out == outEnd)
+            return NULL;
+        *out++ = 255;
+    }
+    if (out == outEnd)
+        return NULL;
+    *out++ = (unsigned char) length;
+    return out;
+}
+
+/*****
+ * Emits one sequence; a match length of zero marks the last sequence, which has literals only.
+ */
+static unsigned char *putSequence(unsigned char *out, unsigned char *outEnd, const unsigned char *literals,
+        size_t literalLength, size_t offset, size_t matchLength)
+{
+    if (out == outEnd)
+        return NULL;
+
+    size_t matchCode = matchLength > 0 ? matchLength - SIMFS_LZ_MIN_MATCH : 0;
+    unsigned char *token = out++;
+    *token = (unsigned char) (((literalLength < 15 ? literalLength : 15) << 4) | (matchCode < 15 ? matchCode : 15));
+
+    if (literalLength >= 15 && (out = putLength(out, outEnd, literalLength - 15)) == NULL)
+        return NULL;
+
+    if ((size_t) (outEnd - out) < literalLength)
+        return NULL;
+    memcpy(out, literals, literalLength);
+    out += literalLength;
+
+    if (matchLength == 0)
+        return out;
+
+    if (outEnd - out < 2)
+        return NULL;
+    *out++ = (unsigned char) (offset & 0xFF);
+    *out++ = (unsigned char) (offset >> 8);
+
+    if (matchCode >= 15 && (out = putLength(out, outEnd, matchCode - 15)) == NULL)
+        return NULL;
+    return out;
+}
+
+size_t simfsLzCompressBound(size_t length)
+{
+    return length + length / 255 + 16;
+}
+
+size_t simfsLzCompress(const char *source, size_t length, char *destination, size_t capacity)
+{
+    const unsigned char *in = (const unsigned char *) source;
+    const unsigned char *inEnd = in + length;
+    const unsigned char *matchLimit = length > LAST_LITERALS ? inEnd - LAST_LITERALS : in;
+    const unsigned char *anchor = in;
+    const unsigned char *position = in;
+    unsigned char *out = (unsigned char *) destination;
+    unsigned char *outEnd = out + capacity;
+
+    // most recent position of every hashed four-byte sequence; -1 if none
+    int32_t table[1 << SIMFS_LZ_HASH_BITS];
+    memset(table, 0xFF, sizeof(table));
+
+    while (position + SIMFS_LZ_MIN_MATCH <= matchLimit) {
+        unsigned int h = lzHash(position);
+        int32_t candidate = table[h];
+        table[h] = (int32_t) (position - in);
+
+        const unsigned char *match = in + candidate;
+        if (candidate < 0 || position - match > SIMFS_LZ_MAX_OFFSET ||
+            memcmp(match, position, SIMFS_LZ_MIN_MATCH) != 0) {
+            position++;
+            continue;
+        }
+
+        size_t matchLength = SIMFS_LZ_MIN_MATCH;
+        while (position + matchLength < matchLimit && match[matchLength] == position[matchLength])
+            matchLength++;
+
+        out = putSequence(out, outEnd, anchor, position - anchor, position - match, matchLength);
+        if (out == NULL)
+            return SIMFS_LZ_ERROR;
+
+        position += matchLength;
+        anchor = position;
+    }
+
+    out = putSequence(out, outEnd, anchor, inEnd - anchor, 0, 0);
+    if (out == NULL)
+        return SIMFS_LZ_ERROR;
+    return out - (unsigned char *) destination;
+}
+
+/*****
+ * Reads the extension bytes of a length whose nibble in the token is saturated.
+ */
+static const unsigned char *getLength(const unsigned char *in, const unsigned char *inEnd, size_t *length)
+{
+    unsigned char extension;
+    do {
+        if (in == inEnd)
+            return NULL;
+        extension = *in++;
+        *length += extension;
+    } while (extension == 255);
+    return in;
+}
+
+size_t simfsLzDecompress(const char *source, size_t length, char *destination, size_t capacity)
+{
+    const unsigned char *in = (const unsigned char *) source;
+    const unsigned char *inEnd = in + length;
+    unsigned char *out = (unsigned char *) destination;
+    unsigned char *outEnd = out + capacity;
+
+    while (in < inEnd) {
+        unsigned char token = *in++;
+
+        size_t literalLength = token >> 4;
+        if (literalLength == 15 && (in = getLength(in, inEnd, &literalLength)) == NULL)
+            return SIMFS_LZ_ERROR;
+        if ((size_t) (inEnd - in) < literalLength || (size_t) (outEnd - out) < literalLength)
+            return SIMFS_LZ_ERROR;
+        memcpy(out, in, literalLength);
+        in += literalLength;
+        out += literalLength;
+
+        if (in == inEnd)
+            break; // the last sequence has no match
+
+        if (inEnd - in < 2)
+            return SIMFS_LZ_ERROR;
+        size_t offset = in[0] | (in[1] << 8);
+        in += 2;
+
+        size_t matchLength = token & 0x0F;
+        if (matchLength == 15 && (in = getLength(in, inEnd, &matchLength)) == NULL)
+            return SIMFS_LZ_ERROR;
+        matchLength += SIMFS_LZ_MIN_MATCH;
+
+        if (offset == 0 || offset > (size_t) (out - (unsigned char *) destination) ||
+            (size_t) (outEnd - out) < matchLength)
+            return SIMFS_LZ_ERROR;
+
+        // byte by byte, since a match may overlap the output it produces
+        const unsigned char *match = out - offset;
+        for (size_t i = 0; i < matchLength; ++i)
+            *out++ = *match++;
+    }
+
+    return out - (unsigned char *) destination;
+}
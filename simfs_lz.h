@@ -0,0 +1,31 @@
+#ifndef __SIMFS_LZ_H_
+#define __SIMFS_LZ_H_
+
+#include <stddef.h>
+
+//////////////////////////////////////////////////////////////////////////
+//
+// a small self-contained LZ77 codec for file content
+//
+// The format is a sequence of (literals, match) pairs. Each sequence starts with a token byte whose high
+// nibble is the number of literals and whose low nibble is the match length minus SIMFS_LZ_MIN_MATCH;
+// a nibble of 15 is extended by bytes that are added to it until a byte is not 255. The literals follow,
+// then a two-byte little-endian offset back into the decoded output. The last sequence has literals only.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#define SIMFS_LZ_MIN_MATCH 4
+#define SIMFS_LZ_MAX_OFFSET 0xFFFF
+#define SIMFS_LZ_HASH_BITS 12
+#define SIMFS_LZ_ERROR ((size_t) -1)
+
+// the largest compressed size of the given number of bytes
+size_t simfsLzCompressBound(size_t length);
+
+// returns the compressed size, or SIMFS_LZ_ERROR if it does not fit into capacity
+size_t simfsLzCompress(const char *source, size_t length, char *destination, size_t capacity);
+
+// returns the decompressed size, or SIMFS_LZ_ERROR if the input is malformed or does not fit into capacity
+size_t simfsLzDecompress(const char *source, size_t length, char *destination, size_t capacity);
+
+#endif
@@ -0,0 +1,572 @@
+#include "simfs.h"
+#include "simfs_io.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+//The last valid position for a file descriptor in an index block
+#define LAST_POS (SIMFS_INDEX_SIZE-1)
+
+//////////////////////////////////////////////////////////////////////////
+//
+// image builder state shared by all worker threads
+//
+// The builder works in four passes: it scans the host tree into a list of entries, plans where every block of the
+// image goes, fills the blocks, and writes the image. Entries are listed breadth first, so the entries of a folder
+// are consecutive in the list. Blocks are handed out in one increasing run: a folder's index blocks or B+tree
+// nodes, then for each of its entries the descriptor and the name block of a long name, followed by the index
+// blocks and the data blocks of the file. Every file owns a disjoint range of blocks, so the files are filled by
+// several threads at once.
+//
+//////////////////////////////////////////////////////////////////////////
+
+typedef struct mkimage_entry_type {
+    SIMFS_NAME_TYPE name;
+    char *path; // on the host
+    SIMFS_CONTENT_TYPE type;
+    mode_t accessRights;
+    uid_t owner;
+    size_t size; // bytes of a file, entries of a folder
+    int firstChild; // entries of a folder are [firstChild, firstChild + size) in the list
+    SIMFS_INDEX_TYPE descriptor;
+    SIMFS_INDEX_TYPE firstIndexBlock; // first index block of the chain, or first B+tree node of a large folder
+    int numberOfIndexBlocks;
+    SIMFS_INDEX_TYPE firstDataBlock;
+} MKIMAGE_ENTRY_TYPE;
+
+typedef struct mkimage_state_type {
+    MKIMAGE_ENTRY_TYPE *entries;
+    int numberOfEntries;
+    int capacity;
+    int numberOfFolders;
+    size_t totalSize; // bytes in all files
+
+    int nextBlock; // first block that is not planned yet
+    SIMFS_VOLUME *volume;
+    time_t now;
+
+    // files with content, filled by the worker threads
+    int *files;
+    int numberOfFiles;
+    _Atomic int nextFile;
+    _Atomic int errors;
+} MKIMAGE_STATE_TYPE;
+
+static MKIMAGE_STATE_TYPE mkimage;
+
+double elapsedSeconds(struct timespec *start)
+{
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// scanning the host tree
+//
+//////////////////////////////////////////////////////////////////////////
+
+/*****
+ * Appends an entry for a host file or folder. Returns 0 if it cannot be represented in the image and is skipped.
+ */
+int addEntry(char *path, char *name)
+{
+    struct stat status;
+    if (lstat(path, &status) != 0) {
+        perror(path);
+        return 0;
+    }
+    if (!S_ISREG(status.st_mode) && !S_ISDIR(status.st_mode)) {
+        fprintf(stderr, "%s: not a regular file or folder, skipped\n", path);
+        return 0;
+    }
+    if (strlen(name) >= SIMFS_MAX_NAME_LENGTH) {
+        fprintf(stderr, "%s: name longer than %d characters, skipped\n", path, SIMFS_MAX_NAME_LENGTH - 1);
+        return 0;
+    }
+
+    if (mkimage.numberOfEntries == mkimage.capacity) {
+        mkimage.capacity = (mkimage.capacity > 0 ? 2 * mkimage.capacity : 1024);
+        mkimage.entries = realloc(mkimage.entries, mkimage.capacity * sizeof(MKIMAGE_ENTRY_TYPE));
+        if (mkimage.entries == NULL) {
+            fprintf(stderr, "out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    MKIMAGE_ENTRY_TYPE *entry = &mkimage.entries[mkimage.numberOfEntries++];
+    memset(entry, 0, sizeof(MKIMAGE_ENTRY_TYPE));
+    strcpy(entry->name, name);
+    entry->path = strdup(path);
+    entry->type = S_ISDIR(status.st_mode) ? SIMFS_FOLDER_CONTENT_TYPE : SIMFS_FILE_CONTENT_TYPE;
+    entry->accessRights = status.st_mode & 0777;
+    entry->owner = status.st_uid;
+    entry->size = S_ISDIR(status.st_mode) ? 0 : (size_t) status.st_size;
+    if (S_ISDIR(status.st_mode))
+        mkimage.numberOfFolders++;
+    else
+        mkimage.totalSize += entry->size;
+    return 1;
+}
+
+int notDotOrDotDot(const struct dirent *entry)
+{
+    return strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0;
+}
+
+/*****
+ * Lists the host tree breadth first, starting with the root folder. The entries of each folder are sorted by
+ * name, so that the same tree always gives the same image.
+ */
+int scanTree(char *root)
+{
+    if (!addEntry(root, "/") || mkimage.entries[0].type != SIMFS_FOLDER_CONTENT_TYPE) {
+        fprintf(stderr, "%s: not a folder\n", root);
+        return 0;
+    }
+
+    for (int folder = 0; folder < mkimage.numberOfEntries; ++folder) {
+        if (mkimage.entries[folder].type != SIMFS_FOLDER_CONTENT_TYPE)
+            continue;
+
+        struct dirent **names;
+        char *path = mkimage.entries[folder].path;
+        int count = scandir(path, &names, notDotOrDotDot, alphasort);
+        if (count < 0) {
+            perror(path);
+            continue; // kept as an empty folder
+        }
+
+        mkimage.entries[folder].firstChild = mkimage.numberOfEntries;
+        char *childPath = malloc(strlen(path) + 1 + sizeof(names[0]->d_name));
+        for (int i = 0; i < count; ++i) {
+            sprintf(childPath, "%s/%s", path, names[i]->d_name);
+            if (addEntry(childPath, names[i]->d_name))
+                mkimage.entries[folder].size++;
+            free(names[i]);
+        }
+        free(childPath);
+        free(names);
+    }
+    return 1;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// planning the layout
+//
+//////////////////////////////////////////////////////////////////////////
+
+/*****
+ * Number of B+tree nodes needed for a folder with the given number of entries, with full nodes on every level.
+ */
+int btreeNodesForEntries(size_t entries)
+{
+    int nodes = 0;
+    do {
+        entries = (entries + SIMFS_BTREE_ORDER - 1) / SIMFS_BTREE_ORDER;
+        nodes += entries;
+    } while (entries > 1);
+    return nodes;
+}
+
+/*****
+ * Plans the next run of blocks. Returns the first block of the run; the caller checks that the volume is large
+ * enough when planning is done.
+ */
+SIMFS_INDEX_TYPE planBlocks(int count)
+{
+    int first = mkimage.nextBlock;
+    mkimage.nextBlock += count;
+    return (SIMFS_INDEX_TYPE) first;
+}
+
+/*****
+ * Places every block of the image. A folder with more than SIMFS_BTREE_THRESHOLD entries gets a B+tree, like a
+ * folder grown through the library; any other gets a chain of index blocks sized for its entries up front.
+ *
+ * Returns 0 if the image does not fit the volume.
+ */
+int planLayout()
+{
+    mkimage.nextBlock = SIMFS_ROOT_NODE_INDEX;
+    mkimage.entries[0].descriptor = planBlocks(1);
+
+    for (int folder = 0; folder < mkimage.numberOfEntries; ++folder) {
+        MKIMAGE_ENTRY_TYPE *parent = &mkimage.entries[folder];
+        if (parent->type != SIMFS_FOLDER_CONTENT_TYPE || parent->size == 0)
+            continue;
+
+        if (parent->size > SIMFS_BTREE_THRESHOLD)
+            parent->numberOfIndexBlocks = btreeNodesForEntries(parent->size);
+        else
+            parent->numberOfIndexBlocks = (parent->size + LAST_POS - 1) / LAST_POS;
+        parent->firstIndexBlock = planBlocks(parent->numberOfIndexBlocks);
+
+        for (size_t i = 0; i < parent->size; ++i) {
+            MKIMAGE_ENTRY_TYPE *entry = &mkimage.entries[parent->firstChild + i];
+            entry->descriptor = planBlocks(strlen(entry->name) > SIMFS_NAME_PREFIX_SIZE ? 2 : 1);
+            if (entry->type != SIMFS_FILE_CONTENT_TYPE || entry->size == 0)
+                continue;
+
+            size_t dataBlocks = (entry->size + SIMFS_DATA_SIZE - 1) / SIMFS_DATA_SIZE;
+            entry->numberOfIndexBlocks = (dataBlocks + LAST_POS - 1) / LAST_POS;
+            entry->firstIndexBlock = planBlocks(entry->numberOfIndexBlocks);
+            entry->firstDataBlock = planBlocks(dataBlocks);
+        }
+    }
+
+    return mkimage.nextBlock <= SIMFS_NUMBER_OF_BLOCKS;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// filling the blocks
+//
+//////////////////////////////////////////////////////////////////////////
+
+/*****
+ * Chains index blocks that follow one another and references the given blocks from them in order. Slots that
+ * are not used stay invalid, like those of an index block allocated by the library.
+ */
+void fillIndexChain(SIMFS_INDEX_TYPE first, int numberOfIndexBlocks, SIMFS_INDEX_TYPE *references, size_t count)
+{
+    for (int k = 0; k < numberOfIndexBlocks; ++k) {
+        SIMFS_BLOCK_TYPE *block = &mkimage.volume->block[first + k];
+        block->type = SIMFS_INDEX_CONTENT_TYPE;
+        for (int i = 0; i < SIMFS_INDEX_SIZE; ++i)
+            block->content.index[i] = SIMFS_INVALID_INDEX;
+        for (int i = 0; i < LAST_POS && (size_t) k * LAST_POS + i < count; ++i)
+            block->content.index[i] = references[k * LAST_POS + i];
+        if (k + 1 < numberOfIndexBlocks)
+            block->content.index[LAST_POS] = first + k + 1;
+    }
+}
+
+typedef struct mkimage_key_type {
+    unsigned int key;
+    SIMFS_INDEX_TYPE descriptor;
+} MKIMAGE_KEY_TYPE;
+
+int compareKeys(const void *a, const void *b)
+{
+    const MKIMAGE_KEY_TYPE *x = a, *y = b;
+    if (x->key != y->key)
+        return (x->key > y->key) - (x->key < y->key);
+    return (x->descriptor > y->descriptor) - (x->descriptor < y->descriptor);
+}
+
+/*****
+ * Builds the B+tree of a large folder bottom up in its planned nodes: the leaves hold the entries sorted by key,
+ * and every level above holds the first key of each node of the level below. Returns the root.
+ */
+SIMFS_INDEX_TYPE fillBtree(MKIMAGE_ENTRY_TYPE *folder)
+{
+    MKIMAGE_KEY_TYPE *keys = malloc(folder->size * sizeof(MKIMAGE_KEY_TYPE));
+    for (size_t i = 0; i < folder->size; ++i) {
+        MKIMAGE_ENTRY_TYPE *entry = &mkimage.entries[folder->firstChild + i];
+        keys[i].key = simfsNameKey(entry->name);
+        keys[i].descriptor = entry->descriptor;
+    }
+    qsort(keys, folder->size, sizeof(MKIMAGE_KEY_TYPE), compareKeys);
+
+    SIMFS_INDEX_TYPE node = folder->firstIndexBlock;
+    SIMFS_INDEX_TYPE level = node; // first node of the level being built
+    size_t count = folder->size; // entries on the level being built
+    for (unsigned short height = 0;; ++height) {
+        for (size_t i = 0; i < count; i += SIMFS_BTREE_ORDER, ++node) {
+            SIMFS_BLOCK_TYPE *block = &mkimage.volume->block[node];
+            block->type = SIMFS_BTREE_CONTENT_TYPE;
+            SIMFS_BTREE_NODE_TYPE *n = &(block->content.btree);
+            memset(n, 0, sizeof(SIMFS_BTREE_NODE_TYPE));
+            n->level = height;
+            n->numberOfEntries = (count - i < SIMFS_BTREE_ORDER) ? count - i : SIMFS_BTREE_ORDER;
+            for (int j = 0; j < n->numberOfEntries; ++j) {
+                if (height == 0) {
+                    n->key[j] = keys[i + j].key;
+                    n->child[j] = keys[i + j].descriptor;
+                } else {
+                    SIMFS_INDEX_TYPE child = level + i + j;
+                    n->key[j] = mkimage.volume->block[child].content.btree.key[0];
+                    n->child[j] = child;
+                }
+            }
+        }
+
+        size_t nodes = (count + SIMFS_BTREE_ORDER - 1) / SIMFS_BTREE_ORDER;
+        if (nodes == 1)
+            break;
+        level = node - nodes;
+        count = nodes;
+    }
+
+    free(keys);
+    return node - 1;
+}
+
+/*****
+ * Fills the descriptor of an entry, the name block that follows it for a long name, and the index blocks or
+ * B+tree of a folder.
+ */
+void fillEntry(MKIMAGE_ENTRY_TYPE *entry, unsigned long long identifier)
+{
+    SIMFS_BLOCK_TYPE *block = &mkimage.volume->block[entry->descriptor];
+    block->type = entry->type;
+
+    SIMFS_FILE_DESCRIPTOR_TYPE *fd = &(block->content.fileDescriptor);
+    fd->identifier = SIMFS_INITIAL_VALUE_OF_THE_UNIQUE_FILE_IDENTIFIER + identifier;
+    fd->type = entry->type;
+    simfsStoreName(mkimage.volume, fd, strlen(entry->name) > SIMFS_NAME_PREFIX_SIZE ? entry->descriptor + 1 :
+                   SIMFS_INVALID_INDEX, entry->name);
+    fd->accessRights = entry->accessRights;
+    fd->owner = entry->owner;
+    fd->size = entry->size;
+    fd->storedSize = (entry->type == SIMFS_FILE_CONTENT_TYPE) ? entry->size : 0;
+    fd->flags = 0;
+    fd->block_ref = (entry->size > 0) ? entry->firstIndexBlock : SIMFS_INVALID_INDEX;
+    fd->allocatedBlocks = (entry->type == SIMFS_FILE_CONTENT_TYPE) ?
+                          (entry->size + SIMFS_DATA_SIZE - 1) / SIMFS_DATA_SIZE : 0;
+    fd->creationTime = fd->lastAccessTime = fd->lastModificationTime = mkimage.now;
+
+    if (entry->type != SIMFS_FOLDER_CONTENT_TYPE || entry->size == 0)
+        return;
+
+    if (entry->size > SIMFS_BTREE_THRESHOLD) {
+        fd->block_ref = fillBtree(entry);
+        fd->flags |= SIMFS_BTREE_FLAG;
+        return;
+    }
+
+    SIMFS_INDEX_TYPE references[SIMFS_BTREE_THRESHOLD];
+    for (size_t i = 0; i < entry->size; ++i)
+        references[i] = mkimage.entries[entry->firstChild + i].descriptor;
+    fillIndexChain(entry->firstIndexBlock, entry->numberOfIndexBlocks, references, entry->size);
+}
+
+/*****
+ * Reads the content of a host file into its planned data blocks and fills the index blocks referring to them.
+ * Content that is gone by now reads as zeros.
+ */
+int fillFile(MKIMAGE_ENTRY_TYPE *entry, char *buffer)
+{
+    int file = open(entry->path, O_RDONLY);
+    if (file < 0) {
+        perror(entry->path);
+        return 0;
+    }
+    posix_fadvise(file, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    size_t length = 0;
+    while (length < entry->size) {
+        ssize_t n = read(file, buffer + length, entry->size - length);
+        if (n < 0) {
+            perror(entry->path);
+            close(file);
+            return 0;
+        }
+        if (n == 0)
+            break;
+        length += n;
+    }
+    close(file);
+    if (length < entry->size) {
+        fprintf(stderr, "%s: shrank while the image was built\n", entry->path);
+        memset(buffer + length, 0, entry->size - length);
+    }
+
+    size_t dataBlocks = (entry->size + SIMFS_DATA_SIZE - 1) / SIMFS_DATA_SIZE;
+    SIMFS_INDEX_TYPE *references = malloc(dataBlocks * sizeof(SIMFS_INDEX_TYPE));
+    for (size_t i = 0; i < dataBlocks; ++i) {
+        SIMFS_BLOCK_TYPE *block = &mkimage.volume->block[entry->firstDataBlock + i];
+        size_t offset = i * SIMFS_DATA_SIZE;
+        size_t chunk = entry->size - offset < SIMFS_DATA_SIZE ? entry->size - offset : SIMFS_DATA_SIZE;
+        block->type = SIMFS_DATA_CONTENT_TYPE;
+        memcpy(block->content.data, buffer + offset, chunk);
+        references[i] = entry->firstDataBlock + i;
+    }
+    fillIndexChain(entry->firstIndexBlock, entry->numberOfIndexBlocks, references, dataBlocks);
+    free(references);
+    return 1;
+}
+
+void *fillWorker(void *unused)
+{
+    char *buffer = NULL;
+    size_t bufferSize = 0;
+
+    for (int i = atomic_fetch_add(&mkimage.nextFile, 1); i < mkimage.numberOfFiles;
+         i = atomic_fetch_add(&mkimage.nextFile, 1)) {
+        MKIMAGE_ENTRY_TYPE *entry = &mkimage.entries[mkimage.files[i]];
+        if (entry->size > bufferSize) {
+            free(buffer);
+            bufferSize = entry->size;
+            buffer = malloc(bufferSize);
+            if (buffer == NULL) {
+                fprintf(stderr, "out of memory\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        if (!fillFile(entry, buffer))
+            atomic_fetch_add(&mkimage.errors, 1);
+    }
+
+    free(buffer);
+    return NULL;
+}
+
+/*****
+ * Fills the superblock, the bitvector, the descriptors and the folders, and then the content of the files with
+ * the given number of threads.
+ */
+void fillVolume(long numberOfThreads)
+{
+    SIMFS_VOLUME *volume = mkimage.volume;
+    volume->superblock.attr.nextUniqueIdentifier =
+            SIMFS_INITIAL_VALUE_OF_THE_UNIQUE_FILE_IDENTIFIER + mkimage.numberOfEntries;
+    volume->superblock.attr.rootNodeIndex = SIMFS_ROOT_NODE_INDEX;
+    volume->superblock.attr.blockSize = SIMFS_BLOCK_SIZE;
+    volume->superblock.attr.numberOfBlocks = SIMFS_NUMBER_OF_BLOCKS;
+
+    // the planned blocks are the first ones of the volume
+    memset(volume->bitvector, 0xFF, mkimage.nextBlock / 8);
+    for (int i = mkimage.nextBlock / 8 * 8; i < mkimage.nextBlock; ++i)
+        simfsSetBit(volume->bitvector, i);
+
+    // the times are taken from the clock the library uses for the files it creates
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    mkimage.now = time.tv_sec;
+
+    mkimage.files = malloc(mkimage.numberOfEntries * sizeof(int));
+    for (int i = 0; i < mkimage.numberOfEntries; ++i) {
+        fillEntry(&mkimage.entries[i], i);
+        if (mkimage.entries[i].type == SIMFS_FILE_CONTENT_TYPE && mkimage.entries[i].size > 0)
+            mkimage.files[mkimage.numberOfFiles++] = i;
+    }
+
+    atomic_init(&mkimage.nextFile, 0);
+    pthread_t *workers = malloc(numberOfThreads * sizeof(pthread_t));
+    for (long i = 0; i < numberOfThreads; ++i)
+        pthread_create(&workers[i], NULL, fillWorker, NULL);
+    for (long i = 0; i < numberOfThreads; ++i)
+        pthread_join(workers[i], NULL);
+    free(workers);
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// writing the image
+//
+//////////////////////////////////////////////////////////////////////////
+
+/*****
+ * Writes the volume in one pass to a temporary file that replaces the image only when it is complete. The SIMFS_IO_*
+ * flags choose the backend.
+ */
+int writeImage(char *imageName, unsigned int ioFlags)
+{
+    char *temporaryName = malloc(strlen(imageName) + sizeof(".tmp"));
+    sprintf(temporaryName, "%s.tmp", imageName);
+
+    int written = 0;
+    SIMFS_IO_FILE_TYPE file;
+    if (simfsIoOpen(&file, temporaryName, 1, ioFlags) == 0) {
+        written = (simfsIoWrite(&file, mkimage.volume, sizeof(SIMFS_VOLUME), 0) == 0 && simfsIoFlush(&file) == 0);
+        written = (simfsIoClose(&file) == 0 && written && rename(temporaryName, imageName) == 0);
+    }
+
+    if (!written) {
+        perror(imageName);
+        remove(temporaryName);
+    }
+    free(temporaryName);
+    return written;
+}
+
+void usage(char *program)
+{
+    fprintf(stderr, "usage: %s [-j threads] [-u] [-d] folder image\n", program);
+    fprintf(stderr, "  -j threads  number of threads filling the files (default: online processors)\n");
+    fprintf(stderr, "  -u          write the image with io_uring\n");
+    fprintf(stderr, "  -d          write the image with O_DIRECT\n");
+}
+
+int main(int argc, char *argv[])
+{
+    long numberOfThreads = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned int ioFlags = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "j:ud")) != -1) {
+        switch (opt) {
+        case 'j':
+            numberOfThreads = atol(optarg); break;
+        case 'u':
+            ioFlags |= SIMFS_IO_URING; break;
+        case 'd':
+            ioFlags |= SIMFS_IO_DIRECT; break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc - 2) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (numberOfThreads < 1)
+        numberOfThreads = 1;
+    char *folderName = argv[optind];
+    char *imageName = argv[optind + 1];
+
+    struct timespec start, phase;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    phase = start;
+    if (!scanTree(folderName))
+        return EXIT_FAILURE;
+    double scanSeconds = elapsedSeconds(&phase);
+
+    if (!planLayout()) {
+        fprintf(stderr, "%s: needs %d blocks, but a volume has %d\n", folderName, mkimage.nextBlock,
+                SIMFS_NUMBER_OF_BLOCKS);
+        return EXIT_FAILURE;
+    }
+
+    mkimage.volume = simfsIoAllocate(sizeof(SIMFS_VOLUME));
+    if (mkimage.volume == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return EXIT_FAILURE;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &phase);
+    fillVolume(numberOfThreads);
+    double fillSeconds = elapsedSeconds(&phase);
+    if (atomic_load(&mkimage.errors) > 0) {
+        fprintf(stderr, "%d file(s) could not be read\n", atomic_load(&mkimage.errors));
+        return EXIT_FAILURE;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &phase);
+    if (!writeImage(imageName, ioFlags))
+        return EXIT_FAILURE;
+    double writeSeconds = elapsedSeconds(&phase);
+
+    printf("Built %s from %s: %d folder(s), %d file(s), %zu bytes in %d of %d blocks\n", imageName, folderName,
+           mkimage.numberOfFolders, mkimage.numberOfEntries - mkimage.numberOfFolders, mkimage.totalSize,
+           mkimage.nextBlock, SIMFS_NUMBER_OF_BLOCKS);
+    printf("Built in %.3f s (scan %.3f s, fill %.3f s with %ld thread(s), write %.3f s)\n", elapsedSeconds(&start),
+           scanSeconds, fillSeconds, numberOfThreads, writeSeconds);
+
+    for (int i = 0; i < mkimage.numberOfEntries; ++i)
+        free(mkimage.entries[i].path);
+    free(mkimage.entries);
+    free(mkimage.files);
+    free(mkimage.volume);
+    return EXIT_SUCCESS;
+}
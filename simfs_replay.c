@@ -0,0 +1,450 @@
+#include "simfs.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#define REPLAY_HANDLE_MAP_SIZE 65536 // recorded handles are indices into a per-process open file table
+
+//////////////////////////////////////////////////////////////////////////
+//
+// replay state shared by all worker threads
+//
+//////////////////////////////////////////////////////////////////////////
+
+typedef struct replay_operation_type {
+    SIMFS_TRACE_RECORD_TYPE record;
+    SIMFS_NAME_TYPE name;
+    unsigned long long latency; // measured by the replay in nanoseconds
+    SIMFS_ERROR result; // returned by the replay
+    int continued; // a later file of a simfsReadMany() call or name of a simfsRename() call, replayed with the first
+} REPLAY_OPERATION_TYPE;
+
+typedef struct replay_state_type {
+    SIMFS_INSTANCE instance; // the volume that the trace is replayed against
+    REPLAY_OPERATION_TYPE *operations;
+    long numberOfOperations;
+    unsigned int maxLength; // longest content written
+    char *content; // printable content of maxLength bytes used for writes
+    unsigned int maxReadLength; // longest content read by simfsReadMany()
+    int maxBatch; // most files read by one simfsReadMany()
+    long numberOfThreads;
+    double speedup; // 0 replays as fast as possible
+    struct timespec start;
+
+    // handles of the files opened by the replay for the handles recorded in the trace
+    _Atomic int handle[REPLAY_HANDLE_MAP_SIZE];
+} REPLAY_STATE_TYPE;
+
+static REPLAY_STATE_TYPE replay;
+
+static char *operationNames[SIMFS_NUMBER_OF_TRACE_OPERATIONS] = {
+    "create", "delete", "info", "open", "write", "read", "close", "compression",
+    "snapshot", "delete snapshot", "free space", "read many", "write at", "set size", "punch hole",
+    "rename", "verify"
+};
+
+/*****
+ * Reads a trace into memory. Returns 0 if the trace is not valid.
+ */
+int loadTrace(char *traceName)
+{
+    FILE *file = fopen(traceName, "rb");
+    if (file == NULL) {
+        perror(traceName);
+        return 0;
+    }
+
+    SIMFS_TRACE_HEADER_TYPE header;
+    if (fread(&header, sizeof(SIMFS_TRACE_HEADER_TYPE), 1, file) != 1 ||
+        memcmp(header.magic, SIMFS_TRACE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != SIMFS_TRACE_VERSION || header.recordSize != sizeof(SIMFS_TRACE_RECORD_TYPE)) {
+        fprintf(stderr, "%s: not a trace of this version\n", traceName);
+        fclose(file);
+        return 0;
+    }
+
+    long capacity = 1024;
+    replay.operations = malloc(capacity * sizeof(REPLAY_OPERATION_TYPE));
+    replay.numberOfOperations = 0;
+    int batchRemaining = 0;
+    SIMFS_TRACE_RECORD_TYPE record;
+    while (fread(&record, sizeof(SIMFS_TRACE_RECORD_TYPE), 1, file) == 1) {
+        if (replay.numberOfOperations == capacity) {
+            capacity *= 2;
+            replay.operations = realloc(replay.operations, capacity * sizeof(REPLAY_OPERATION_TYPE));
+        }
+        REPLAY_OPERATION_TYPE *operation = &replay.operations[replay.numberOfOperations];
+        memset(operation, 0, sizeof(REPLAY_OPERATION_TYPE));
+        operation->record = record;
+
+        if (record.operation & SIMFS_TRACE_NAME_FLAG) {
+            int c, length = 0;
+            while ((c = fgetc(file)) != EOF && c != '\0')
+                if (length < SIMFS_MAX_NAME_LENGTH - 1)
+                    operation->name[length++] = c;
+            if (c == EOF)
+                break;
+            operation->record.operation &= ~SIMFS_TRACE_NAME_FLAG;
+        }
+
+        if (operation->record.operation >= SIMFS_NUMBER_OF_TRACE_OPERATIONS) {
+            fprintf(stderr, "%s: unknown operation %d in record %ld\n", traceName, operation->record.operation,
+                    replay.numberOfOperations);
+            fclose(file);
+            return 0;
+        }
+        if ((operation->record.operation == SIMFS_TRACE_WRITE_FILE ||
+             operation->record.operation == SIMFS_TRACE_WRITE_FILE_AT) && record.length > replay.maxLength)
+            replay.maxLength = record.length;
+
+        // so are the names of a simfsRename() call
+        if (operation->record.operation == SIMFS_TRACE_RENAME_FILE && record.argument > 0)
+            operation->continued = 1;
+
+        // the files of a simfsReadMany() call are recorded one after another
+        if (operation->record.operation != SIMFS_TRACE_READ_MANY)
+            batchRemaining = 0;
+        else {
+            if (record.length > replay.maxReadLength)
+                replay.maxReadLength = record.length;
+            if (batchRemaining > 0) {
+                operation->continued = 1;
+                batchRemaining--;
+            }
+            else {
+                batchRemaining = record.argument - 1;
+                if (record.argument > replay.maxBatch)
+                    replay.maxBatch = record.argument;
+            }
+        }
+        replay.numberOfOperations++;
+    }
+    fclose(file);
+
+    return 1;
+}
+
+/*****
+ * Waits until the time at which an operation is due according to the speed-up factor.
+ */
+void waitForOperation(SIMFS_TRACE_RECORD_TYPE *record)
+{
+    if (replay.speedup <= 0)
+        return;
+
+    unsigned long long offset = (unsigned long long) (record->time / replay.speedup);
+    struct timespec due = replay.start;
+    due.tv_sec += offset / 1000000000ULL;
+    due.tv_nsec += offset % 1000000000ULL;
+    if (due.tv_nsec >= 1000000000L) {
+        due.tv_sec++;
+        due.tv_nsec -= 1000000000L;
+    }
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL) != 0)
+        ;
+}
+
+/*****
+ * Maps a recorded file handle to the handle of the same file in the replay.
+ */
+SIMFS_FILE_HANDLE_TYPE replayHandle(int recorded)
+{
+    if (recorded < 0 || recorded >= REPLAY_HANDLE_MAP_SIZE)
+        return -1;
+    return atomic_load(&replay.handle[recorded]);
+}
+
+/*****
+ * Reads the files of a recorded simfsReadMany() call, which start with the given operation, in one call. The
+ * result for each file is stored with its record.
+ */
+void replayReadMany(REPLAY_OPERATION_TYPE *operation, char *batchBuffer)
+{
+    int numberOfFiles = 1;
+    while (operation + numberOfFiles < replay.operations + replay.numberOfOperations &&
+           operation[numberOfFiles].continued && numberOfFiles < operation->record.argument)
+        numberOfFiles++;
+
+    char *fileNames[numberOfFiles];
+    struct iovec buffers[numberOfFiles];
+    SIMFS_ERROR results[numberOfFiles];
+    for (int i = 0; i < numberOfFiles; ++i) {
+        fileNames[i] = operation[i].name;
+        buffers[i].iov_base = batchBuffer + (size_t) i * replay.maxReadLength;
+        buffers[i].iov_len = replay.maxReadLength;
+    }
+
+    simfsReadMany(&replay.instance, numberOfFiles, fileNames, buffers, results);
+    for (int i = 0; i < numberOfFiles; ++i)
+        operation[i].result = results[i];
+}
+
+/*****
+ * Renames a file like a recorded simfsRename() call, whose names start with the given operation. The result is
+ * stored with every record of the call.
+ */
+SIMFS_ERROR replayRename(REPLAY_OPERATION_TYPE *operation)
+{
+    if (operation + 2 >= replay.operations + replay.numberOfOperations || !operation[1].continued ||
+        !operation[2].continued)
+        return SIMFS_SYSTEM_ERROR;
+
+    SIMFS_ERROR error = simfsRename(&replay.instance, operation[0].name, operation[1].name, operation[2].name);
+    operation[1].result = operation[2].result = error;
+    return error;
+}
+
+/*****
+ * Issues a recorded operation and returns its result.
+ */
+SIMFS_ERROR replayOperation(REPLAY_OPERATION_TYPE *operation, char *content, char *batchBuffer)
+{
+    SIMFS_TRACE_RECORD_TYPE *record = &operation->record;
+    SIMFS_FILE_DESCRIPTOR_TYPE info;
+    SIMFS_FREE_SPACE_INFO_TYPE space;
+    SIMFS_FILE_HANDLE_TYPE handle;
+    SIMFS_ERROR error = SIMFS_NO_ERROR;
+    char *readBuffer = NULL;
+
+    switch (record->operation) {
+    case SIMFS_TRACE_CREATE_FILE:
+        return simfsCreateFile(&replay.instance, operation->name, record->argument);
+    case SIMFS_TRACE_DELETE_FILE:
+        return simfsDeleteFile(&replay.instance, operation->name);
+    case SIMFS_TRACE_GET_FILE_INFO:
+        return simfsGetFileInfo(&replay.instance, operation->name, &info);
+    case SIMFS_TRACE_OPEN_FILE:
+        error = simfsOpenFile(&replay.instance, operation->name, &handle);
+        if ((error == SIMFS_NO_ERROR || error == SIMFS_DUPLICATE_ERROR) &&
+            record->argument >= 0 && record->argument < REPLAY_HANDLE_MAP_SIZE)
+            atomic_store(&replay.handle[record->argument], handle);
+        return error;
+    case SIMFS_TRACE_WRITE_FILE:
+        // the content is cut to the recorded length for the duration of the write
+        content[record->length] = '\0';
+        error = simfsWriteFile(&replay.instance, replayHandle(record->argument), content);
+        content[record->length] = replay.content[record->length];
+        return error;
+    case SIMFS_TRACE_WRITE_FILE_AT:
+        return simfsWriteFileAt(&replay.instance, replayHandle(record->argument), record->offset, content,
+                                record->length);
+    case SIMFS_TRACE_SET_FILE_SIZE:
+        return simfsSetFileSize(&replay.instance, replayHandle(record->argument), record->offset);
+    case SIMFS_TRACE_PUNCH_HOLE:
+        return simfsPunchHole(&replay.instance, replayHandle(record->argument), record->offset, record->length);
+    case SIMFS_TRACE_READ_FILE:
+        error = simfsReadFile(&replay.instance, replayHandle(record->argument), &readBuffer);
+        if (error == SIMFS_NO_ERROR)
+            free(readBuffer);
+        return error;
+    case SIMFS_TRACE_CLOSE_FILE:
+        return simfsCloseFile(&replay.instance, replayHandle(record->argument));
+    case SIMFS_TRACE_SET_FILE_COMPRESSION:
+        return simfsSetFileCompression(&replay.instance, operation->name, record->argument);
+    case SIMFS_TRACE_CREATE_SNAPSHOT:
+        return simfsCreateSnapshot(&replay.instance, operation->name);
+    case SIMFS_TRACE_DELETE_SNAPSHOT:
+        return simfsDeleteSnapshot(&replay.instance, operation->name);
+    case SIMFS_TRACE_GET_FREE_SPACE:
+        return simfsGetFreeSpace(&replay.instance, &space);
+    case SIMFS_TRACE_READ_MANY:
+        replayReadMany(operation, batchBuffer);
+        return operation->result;
+    case SIMFS_TRACE_RENAME_FILE:
+        return replayRename(operation);
+    case SIMFS_TRACE_VERIFY_VOLUME:
+        return simfsVerifyVolume(&replay.instance, NULL);
+    default:
+        return SIMFS_SYSTEM_ERROR;
+    }
+}
+
+/*****
+ * Replays the operations of the recorded threads that map to this worker, in the order of the trace.
+ */
+void *replayWorker(void *argument)
+{
+    long worker = (long) argument;
+
+    char *content = malloc(replay.maxLength + 1);
+    memcpy(content, replay.content, replay.maxLength + 1);
+    char *batchBuffer = malloc((size_t) replay.maxBatch * replay.maxReadLength + 1);
+
+    for (long i = 0; i < replay.numberOfOperations; ++i) {
+        REPLAY_OPERATION_TYPE *operation = &replay.operations[i];
+        if (operation->record.thread % replay.numberOfThreads != worker || operation->continued)
+            continue;
+
+        waitForOperation(&operation->record);
+
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        operation->result = replayOperation(operation, content, batchBuffer);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        operation->latency = (end.tv_sec - start.tv_sec) * 1000000000ULL + end.tv_nsec - start.tv_nsec;
+    }
+
+    free(content);
+    free(batchBuffer);
+    return NULL;
+}
+
+//////////////////////////////////////////////////////////////////////////
+//
+// reporting
+//
+//////////////////////////////////////////////////////////////////////////
+
+int compareLatencies(const void *a, const void *b)
+{
+    unsigned long long x = *(const unsigned long long *) a;
+    unsigned long long y = *(const unsigned long long *) b;
+    return (x > y) - (x < y);
+}
+
+/*****
+ * Returns the latency below which the given fraction of the sorted latencies fall, in microseconds.
+ */
+double percentile(unsigned long long *latencies, long count, double fraction)
+{
+    long rank = (long) (fraction * count);
+    if (rank >= count)
+        rank = count - 1;
+    return latencies[rank] / 1e3;
+}
+
+/*****
+ * Prints the latency percentiles of the replayed operations of one kind, or of all if operation is negative.
+ */
+void reportLatencies(char *label, int operation)
+{
+    unsigned long long *latencies = malloc(replay.numberOfOperations * sizeof(unsigned long long));
+    long count = 0;
+    for (long i = 0; i < replay.numberOfOperations; ++i)
+        if ((operation < 0 || replay.operations[i].record.operation == operation) && !replay.operations[i].continued)
+            latencies[count++] = replay.operations[i].latency;
+
+    if (count > 0) {
+        qsort(latencies, count, sizeof(unsigned long long), compareLatencies);
+        printf("  %-16s %9ld %10.1f %10.1f %10.1f %10.1f %10.1f\n", label, count,
+               percentile(latencies, count, 0.5), percentile(latencies, count, 0.9),
+               percentile(latencies, count, 0.99), percentile(latencies, count, 0.999),
+               latencies[count - 1] / 1e3);
+    }
+    free(latencies);
+}
+
+void usage(char *program)
+{
+    fprintf(stderr, "usage: %s [-c] [-d] [-k] [-n | -r] [-j threads] [-s speedup] trace image\n", program);
+    fprintf(stderr, "  -c          create a fresh image instead of replaying against the existing one\n");
+    fprintf(stderr, "  -d          mount the image with deduplication\n");
+    fprintf(stderr, "  -k          mount the image with checksums\n");
+    fprintf(stderr, "  -n          mount the image with noatime\n");
+    fprintf(stderr, "  -r          mount the image with relatime\n");
+    fprintf(stderr, "  -j threads  number of replay threads (default: the number of threads in the trace)\n");
+    fprintf(stderr, "  -s speedup  replay the recorded timing this many times faster; 0 replays as fast as\n");
+    fprintf(stderr, "              possible (default: 1)\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int create = 0;
+    unsigned int options = 0;
+    replay.numberOfThreads = 0;
+    replay.speedup = 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "cdknrj:s:")) != -1) {
+        switch (opt) {
+        case 'c':
+            create = 1; break;
+        case 'd':
+            options |= SIMFS_MOUNT_DEDUP; break;
+        case 'k':
+            options |= SIMFS_MOUNT_CHECKSUMS; break;
+        case 'n':
+            options |= SIMFS_MOUNT_NOATIME; break;
+        case 'r':
+            options |= SIMFS_MOUNT_RELATIME; break;
+        case 'j':
+            replay.numberOfThreads = atol(optarg); break;
+        case 's':
+            replay.speedup = atof(optarg); break;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc - 2) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    char *traceName = argv[optind];
+    char *imageName = argv[optind + 1];
+
+    if (!loadTrace(traceName))
+        return EXIT_FAILURE;
+
+    int recordedThreads = 0;
+    for (long i = 0; i < replay.numberOfOperations; ++i)
+        if (replay.operations[i].record.thread >= recordedThreads)
+            recordedThreads = replay.operations[i].record.thread + 1;
+    if (replay.numberOfThreads < 1)
+        replay.numberOfThreads = recordedThreads > 0 ? recordedThreads : 1;
+
+    replay.content = malloc(replay.maxLength + 1);
+    for (unsigned int i = 0; i <= replay.maxLength; ++i)
+        replay.content[i] = ' ' + rand() % ('~' - ' ');
+    for (int i = 0; i < REPLAY_HANDLE_MAP_SIZE; ++i)
+        atomic_init(&replay.handle[i], -1);
+
+    if (create && simfsCreateFileSystem(imageName) != SIMFS_NO_ERROR) {
+        fprintf(stderr, "%s: cannot create the image\n", imageName);
+        return EXIT_FAILURE;
+    }
+    if (simfsMountFileSystemWithOptions(&replay.instance, imageName, options) != SIMFS_NO_ERROR) {
+        fprintf(stderr, "%s: cannot mount the image\n", imageName);
+        return EXIT_FAILURE;
+    }
+
+    printf("Replaying %ld operation(s) of %d thread(s) from %s with %ld thread(s)", replay.numberOfOperations,
+           recordedThreads, traceName, replay.numberOfThreads);
+    if (replay.speedup > 0)
+        printf(" at %gx speed\n", replay.speedup);
+    else
+        printf(" as fast as possible\n");
+
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &replay.start);
+    pthread_t *workers = malloc(replay.numberOfThreads * sizeof(pthread_t));
+    for (long i = 0; i < replay.numberOfThreads; ++i)
+        pthread_create(&workers[i], NULL, replayWorker, (void *) i);
+    for (long i = 0; i < replay.numberOfThreads; ++i)
+        pthread_join(workers[i], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    free(workers);
+
+    simfsUmountFileSystem(&replay.instance, imageName);
+
+    double elapsed = (end.tv_sec - replay.start.tv_sec) + (end.tv_nsec - replay.start.tv_nsec) / 1e9;
+    long different = 0;
+    for (long i = 0; i < replay.numberOfOperations; ++i)
+        if (replay.operations[i].result != replay.operations[i].record.result)
+            different++;
+
+    printf("Replayed in %.3f s: %.0f operations/s\n", elapsed, replay.numberOfOperations / elapsed);
+    if (different > 0)
+        printf("%ld operation(s) returned a different result than recorded\n", different);
+
+    printf("  %-16s %9s %10s %10s %10s %10s %10s\n", "latency (us)", "count", "p50", "p90", "p99", "p99.9", "max");
+    for (int operation = 0; operation < SIMFS_NUMBER_OF_TRACE_OPERATIONS; ++operation)
+        reportLatencies(operationNames[operation], operation);
+    reportLatencies("all", -1);
+
+    free(replay.content);
+    free(replay.operations);
+
+    return EXIT_SUCCESS;
+}
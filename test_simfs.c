@@ -1,4 +1,6 @@
 #include "simfs.h"
+#include <unistd.h>
+#include <stdint.h>
 
 #define SIMFS_FILE_NAME "simfsFile.dta"
 
@@ -41,54 +43,527 @@ int main()
     srand(1997);
 
     SIMFS_ERROR error = SIMFS_NO_ERROR;
+    SIMFS_INSTANCE instance;
 
     error = PrintError(simfsCreateFileSystem(SIMFS_FILE_NAME));
     if (error != SIMFS_NO_ERROR)
         exit(EXIT_FAILURE);
 
-    error = PrintError(simfsMountFileSystem(SIMFS_FILE_NAME));
+    error = PrintError(simfsMountFileSystem(&instance, SIMFS_FILE_NAME));
     if (error != SIMFS_NO_ERROR)
         exit(EXIT_FAILURE);
     /*
-    error = PrintError(simfsCreateFile("batman.txt", SIMFS_FILE_CONTENT_TYPE));
+    error = PrintError(simfsCreateFile(&instance, "batman.txt", SIMFS_FILE_CONTENT_TYPE));
     if (error != SIMFS_NO_ERROR)
         exit(EXIT_FAILURE);
 
     printf("Expect Error SIMFS_DUPLICATE_ERROR\n");
-    error = PrintError(simfsCreateFile("batman.txt", SIMFS_FILE_CONTENT_TYPE));
+    error = PrintError(simfsCreateFile(&instance, "batman.txt", SIMFS_FILE_CONTENT_TYPE));
     if (error != SIMFS_DUPLICATE_ERROR){
  //       exit(EXIT_FAILURE);
     }
 
     SIMFS_FILE_DESCRIPTOR_TYPE infoBuffer;
-    error = PrintError(simfsGetFileInfo("batman.txt", &infoBuffer));
+    error = PrintError(simfsGetFileInfo(&instance, "batman.txt", &infoBuffer));
     if (error != SIMFS_NOT_FOUND_ERROR)
    //     exit(EXIT_FAILURE);
 
     printf("No expected error");
-    error = PrintError(simfsDeleteFile("batman.txt"));
+    error = PrintError(simfsDeleteFile(&instance, "batman.txt"));
 
     printf("\nSuccess!\n");*/
 
     printf("testing tasks 1 and 2\n");
-     error = simfsCreateFile("test", SIMFS_FOLDER_CONTENT_TYPE);
-    error = simfsCreateFile("test", SIMFS_FOLDER_CONTENT_TYPE);
-    simfsDeleteFile("test");
-    simfsDeleteFile("test");
+     error = simfsCreateFile(&instance, "test", SIMFS_FOLDER_CONTENT_TYPE);
+    error = simfsCreateFile(&instance, "test", SIMFS_FOLDER_CONTENT_TYPE);
+    simfsDeleteFile(&instance, "test");
+    simfsDeleteFile(&instance, "test");
     printf("testing\n");
-    simfsCreateFile("test", SIMFS_FOLDER_CONTENT_TYPE);
-    simfsCreateFile("test2", SIMFS_FILE_CONTENT_TYPE);
-    simfsCreateFile("test3", SIMFS_DATA_CONTENT_TYPE);
+    simfsCreateFile(&instance, "test", SIMFS_FOLDER_CONTENT_TYPE);
+    simfsCreateFile(&instance, "test2", SIMFS_FILE_CONTENT_TYPE);
+    simfsCreateFile(&instance, "test3", SIMFS_DATA_CONTENT_TYPE);
     printf("Remount!\n");
-    simfsUmountFileSystem("yo");
-    simfsMountFileSystem("yo");
-    simfsUmountFileSystem("yo");
-    simfsMountFileSystem("yo");
-    simfsCreateFile("test", SIMFS_FOLDER_CONTENT_TYPE);
-    simfsDeleteFile("test");
-    simfsDeleteFile("test");
-    simfsCreateFile("test", SIMFS_FOLDER_CONTENT_TYPE);
-    simfsCreateFile("test2", SIMFS_FILE_CONTENT_TYPE);
-    simfsCreateFile("test3", SIMFS_DATA_CONTENT_TYPE);
+    simfsUmountFileSystem(&instance, "yo");
+    simfsMountFileSystem(&instance, "yo");
+    simfsUmountFileSystem(&instance, "yo");
+    simfsMountFileSystem(&instance, "yo");
+    simfsCreateFile(&instance, "test", SIMFS_FOLDER_CONTENT_TYPE);
+    simfsDeleteFile(&instance, "test");
+    simfsDeleteFile(&instance, "test");
+    simfsCreateFile(&instance, "test", SIMFS_FOLDER_CONTENT_TYPE);
+    simfsCreateFile(&instance, "test2", SIMFS_FILE_CONTENT_TYPE);
+    simfsCreateFile(&instance, "test3", SIMFS_DATA_CONTENT_TYPE);
+
+    printf("testing snapshots\n");
+    SIMFS_FILE_HANDLE_TYPE handle;
+    char *content = simfsGenerateContent(100);
+    char *readBack = NULL;
+    simfsCreateFile(&instance, "snap.txt", SIMFS_FILE_CONTENT_TYPE);
+    simfsOpenFile(&instance, "snap.txt", &handle);
+    simfsWriteFile(&instance, handle, content);
+    simfsCloseFile(&instance, handle);
+    error = PrintError(simfsCreateSnapshot(&instance, "before"));
+    if (error != SIMFS_NO_ERROR)
+        exit(EXIT_FAILURE);
+    simfsOpenFile(&instance, "snap.txt", &handle);
+    simfsWriteFile(&instance, handle, "changed after the snapshot");
+    simfsCloseFile(&instance, handle);
+    simfsDeleteFile(&instance, "test2");
+    simfsUmountFileSystem(&instance, "yo");
+
+    error = PrintError(simfsMountSnapshot(&instance, "yo", "before"));
+    if (error != SIMFS_NO_ERROR)
+        exit(EXIT_FAILURE);
+    simfsOpenFile(&instance, "snap.txt", &handle);
+    simfsReadFile(&instance, handle, &readBack);
+    if (strcmp(readBack, content) != 0)
+        exit(EXIT_FAILURE);
+    free(readBack);
+    simfsCloseFile(&instance, handle);
+    printf("Expect Error SIMFS_ACCESS_ERROR\n");
+    error = PrintError(simfsCreateFile(&instance, "readonly", SIMFS_FILE_CONTENT_TYPE));
+    if (error != SIMFS_ACCESS_ERROR)
+        exit(EXIT_FAILURE);
+    simfsUmountFileSystem(&instance, "yo");
+
+    simfsMountFileSystem(&instance, "yo");
+    simfsOpenFile(&instance, "snap.txt", &handle);
+    simfsReadFile(&instance, handle, &readBack);
+    if (strcmp(readBack, "changed after the snapshot") != 0)
+        exit(EXIT_FAILURE);
+    free(readBack);
+    simfsCloseFile(&instance, handle);
+    error = PrintError(simfsDeleteSnapshot(&instance, "before"));
+    if (error != SIMFS_NO_ERROR)
+        exit(EXIT_FAILURE);
+
+    printf("testing compression\n");
+    // repetitive text, so that the chunks are compressed rather than stored as they are
+    char *logText = malloc(40 * 16 + 1);
+    for (int i = 0; i < 40; ++i)
+        sprintf(logText + 16 * i, "line %03d status ", i % 4);
+    SIMFS_FILE_DESCRIPTOR_TYPE info;
+    simfsCreateFile(&instance, "compressed.log", SIMFS_FILE_CONTENT_TYPE);
+    error = PrintError(simfsSetFileCompression(&instance, "compressed.log", 1));
+    if (error != SIMFS_NO_ERROR)
+        exit(EXIT_FAILURE);
+    simfsOpenFile(&instance, "compressed.log", &handle);
+    simfsWriteFile(&instance, handle, logText);
+    simfsGetFileInfo(&instance, "compressed.log", &info);
+    if (info.size != strlen(logText) || info.storedSize >= info.size)
+        exit(EXIT_FAILURE);
+    simfsReadFile(&instance, handle, &readBack);
+    if (strcmp(readBack, logText) != 0)
+        exit(EXIT_FAILURE);
+    free(readBack);
+    simfsCloseFile(&instance, handle);
+    simfsSetFileCompression(&instance, "compressed.log", 0);
+    simfsOpenFile(&instance, "compressed.log", &handle);
+    simfsReadFile(&instance, handle, &readBack);
+    if (strcmp(readBack, logText) != 0)
+        exit(EXIT_FAILURE);
+    free(readBack);
+    simfsCloseFile(&instance, handle);
+    free(logText);
+    simfsUmountFileSystem(&instance, "yo");
+
+    printf("testing deduplication\n");
+    simfsMountFileSystemWithOptions(&instance, "yo", SIMFS_MOUNT_DEDUP);
+    // the content of the other files on the volume is shared as well, so the copies get content of their own
+    char *copied = simfsGenerateContent(100);
+    simfsCreateFile(&instance, "copy1", SIMFS_FILE_CONTENT_TYPE);
+    simfsCreateFile(&instance, "copy2", SIMFS_FILE_CONTENT_TYPE);
+    SIMFS_FREE_SPACE_INFO_TYPE before, after, deleted;
+    simfsGetFreeSpace(&instance, &before);
+    simfsOpenFile(&instance, "copy1", &handle);
+    simfsWriteFile(&instance, handle, copied);
+    simfsCloseFile(&instance, handle);
+    simfsGetFreeSpace(&instance, &after);
+    unsigned int dataBlocks = (strlen(copied) + SIMFS_DATA_SIZE - 1) / SIMFS_DATA_SIZE;
+    unsigned int indexBlocks = before.freeBlocks - after.freeBlocks - dataBlocks;
+    before = after;
+    simfsOpenFile(&instance, "copy2", &handle);
+    simfsWriteFile(&instance, handle, copied);
+    simfsCloseFile(&instance, handle);
+    simfsGetFreeSpace(&instance, &after);
+    // the second copy shares every data block of the first one and only needs index blocks of its own
+    if (before.freeBlocks - after.freeBlocks != indexBlocks)
+        exit(EXIT_FAILURE);
+    simfsDeleteFile(&instance, "copy1");
+    simfsGetFreeSpace(&instance, &deleted);
+    // deleting the first copy frees its descriptor and index blocks, but not the data blocks
+    if (deleted.freeBlocks - after.freeBlocks != indexBlocks + 1)
+        exit(EXIT_FAILURE);
+    simfsOpenFile(&instance, "copy2", &handle);
+    simfsReadFile(&instance, handle, &readBack);
+    if (strcmp(readBack, copied) != 0)
+        exit(EXIT_FAILURE);
+    free(readBack);
+    free(copied);
+    simfsCloseFile(&instance, handle);
+    // the first index block of the file refers to a data block that is shared up to the limit of its shared
+    // count, so cloning it for the write copies that data block
+    simfsGetFreeSpace(&instance, &before);
+    char *repeated = malloc(300 * SIMFS_DATA_SIZE + 1);
+    memset(repeated, 'a', 300 * SIMFS_DATA_SIZE);
+    repeated[300 * SIMFS_DATA_SIZE] = '\0';
+    simfsCreateFile(&instance, "repeated", SIMFS_FILE_CONTENT_TYPE);
+    simfsOpenFile(&instance, "repeated", &handle);
+    simfsWriteFile(&instance, handle, repeated);
+    simfsCreateSnapshot(&instance, "repeated");
+    repeated[0] = 'b';
+    error = PrintError(simfsWriteFileAt(&instance, handle, 0, "b", 1));
+    if (error != SIMFS_NO_ERROR)
+        exit(EXIT_FAILURE);
+    simfsDeleteSnapshot(&instance, "repeated");
+    simfsReadFile(&instance, handle, &readBack);
+    if (strcmp(readBack, repeated) != 0)
+        exit(EXIT_FAILURE);
+    free(readBack);
+    free(repeated);
+    simfsCloseFile(&instance, handle);
+    simfsDeleteFile(&instance, "repeated");
+    simfsGetFreeSpace(&instance, &after);
+    if (after.freeBlocks != before.freeBlocks)
+        exit(EXIT_FAILURE);
+    simfsUmountFileSystem(&instance, "yo");
+
+    printf("testing large folders\n");
+    simfsMountFileSystem(&instance, "yo");
+    SIMFS_FREE_SPACE_INFO_TYPE space;
+    simfsGetFreeSpace(&instance, &space);
+    unsigned int freeBlocks = space.freeBlocks;
+    if (space.largestFreeRun == 0 || space.largestFreeRun > space.freeBlocks)
+        exit(EXIT_FAILURE);
+    char name[SIMFS_MAX_NAME_LENGTH];
+    for (int i = 0; i < 4 * SIMFS_BTREE_THRESHOLD; i++) {
+        sprintf(name, "entry%d", i);
+        error = PrintError(simfsCreateFile(&instance, name, SIMFS_FILE_CONTENT_TYPE));
+        if (error != SIMFS_NO_ERROR)
+            exit(EXIT_FAILURE);
+    }
+    simfsGetFreeSpace(&instance, &space);
+    if (space.freeBlocks >= freeBlocks - 4 * SIMFS_BTREE_THRESHOLD)
+        exit(EXIT_FAILURE);
+    simfsCreateSnapshot(&instance, "large");
+    for (int i = 0; i < 4 * SIMFS_BTREE_THRESHOLD; i += 2) {
+        sprintf(name, "entry%d", i);
+        simfsDeleteFile(&instance, name);
+    }
+    simfsUmountFileSystem(&instance, "yo");
+    simfsMountFileSystem(&instance, "yo");
+    for (int i = 0; i < 4 * SIMFS_BTREE_THRESHOLD; i++) {
+        sprintf(name, "entry%d", i);
+        if ((simfsGetFileInfo(&instance, name, &info) == SIMFS_NO_ERROR) != (i % 2 == 1))
+            exit(EXIT_FAILURE);
+    }
+    simfsDeleteSnapshot(&instance, "large");
+    simfsUmountFileSystem(&instance, "yo");
+
+    printf("testing writeback\n");
+    simfsMountFileSystem(&instance, "yo");
+    error = PrintError(simfsStartWriteback(&instance, "yo", 10, 4));
+    if (error != SIMFS_NO_ERROR)
+        exit(EXIT_FAILURE);
+    simfsCreateFile(&instance, "durable", SIMFS_FILE_CONTENT_TYPE);
+    simfsOpenFile(&instance, "durable", &handle);
+    simfsWriteFile(&instance, handle, content);
+    simfsCloseFile(&instance, handle);
+    error = PrintError(simfsSync(&instance));
+    if (error != SIMFS_NO_ERROR)
+        exit(EXIT_FAILURE);
+    SIMFS_WRITEBACK_STATS_TYPE stats;
+    simfsGetWritebackStats(&instance, &stats);
+    if (stats.numberOfFlushes == 0 || stats.pendingChanges != 0)
+        exit(EXIT_FAILURE);
+    simfsUmountFileSystem(&instance, "yo");
+    simfsMountFileSystem(&instance, "yo");
+    simfsOpenFile(&instance, "durable", &handle);
+    simfsReadFile(&instance, handle, &readBack);
+    if (strcmp(readBack, content) != 0)
+        exit(EXIT_FAILURE);
+    free(readBack);
+    simfsCloseFile(&instance, handle);
+    simfsUmountFileSystem(&instance, "yo");
+
+    printf("testing vectored reads\n");
+    simfsMountFileSystem(&instance, "yo");
+    simfsCreateFile(&instance, "many.log", SIMFS_FILE_CONTENT_TYPE);
+    simfsSetFileCompression(&instance, "many.log", 1);
+    simfsOpenFile(&instance, "many.log", &handle);
+    simfsWriteFile(&instance, handle, content);
+    simfsCloseFile(&instance, handle);
+    char *names[] = {"durable", "missing", "many.log", "snap.txt"};
+    char buffers[4][128];
+    struct iovec vectors[4];
+    SIMFS_ERROR results[4];
+    for (int i = 0; i < 4; i++) {
+        vectors[i].iov_base = buffers[i];
+        vectors[i].iov_len = sizeof(buffers[i]);
+    }
+    vectors[3].iov_len = 8;
+    printf("Expect Error SIMFS_NOT_FOUND_ERROR\n");
+    PrintError(simfsReadMany(&instance, 4, names, vectors, results));
+    if (results[0] != SIMFS_NO_ERROR || results[1] != SIMFS_NOT_FOUND_ERROR || results[2] != SIMFS_NO_ERROR ||
+        results[3] != SIMFS_ALLOC_ERROR || vectors[3].iov_len != strlen("changed after the snapshot"))
+        exit(EXIT_FAILURE);
+    for (int i = 0; i < 3; i += 2)
+        if (vectors[i].iov_len != strlen(content) || memcmp(buffers[i], content, strlen(content)) != 0)
+            exit(EXIT_FAILURE);
+    simfsUmountFileSystem(&instance, "yo");
+
+    printf("testing traces\n");
+    simfsMountFileSystem(&instance, "yo");
+    error = PrintError(simfsStartTrace(&instance, "yo.trace"));
+    if (error != SIMFS_NO_ERROR)
+        exit(EXIT_FAILURE);
+    simfsCreateFile(&instance, "traced", SIMFS_FILE_CONTENT_TYPE);
+    simfsOpenFile(&instance, "traced", &handle);
+    simfsWriteFile(&instance, handle, content);
+    simfsCloseFile(&instance, handle);
+    error = PrintError(simfsStopTrace(&instance));
+    if (error != SIMFS_NO_ERROR)
+        exit(EXIT_FAILURE);
+    simfsUmountFileSystem(&instance, "yo");
+    FILE *trace = fopen("yo.trace", "rb");
+    SIMFS_TRACE_HEADER_TYPE header;
+    SIMFS_TRACE_RECORD_TYPE record;
+    if (trace == NULL || fread(&header, sizeof(header), 1, trace) != 1 ||
+        memcmp(header.magic, SIMFS_TRACE_MAGIC, sizeof(header.magic)) != 0)
+        exit(EXIT_FAILURE);
+    fseek(trace, (long) (sizeof(record) + sizeof("traced")) * 2, SEEK_CUR);
+    if (fread(&record, sizeof(record), 1, trace) != 1 || record.operation != SIMFS_TRACE_WRITE_FILE ||
+        record.length != strlen(content) || record.result != SIMFS_NO_ERROR)
+        exit(EXIT_FAILURE);
+    fclose(trace);
+
+    printf("testing sparse files\n");
+    simfsMountFileSystem(&instance, "yo");
+    simfsGetFreeSpace(&instance, &before);
+    simfsCreateFile(&instance, "sparse", SIMFS_FILE_CONTENT_TYPE);
+    simfsOpenFile(&instance, "sparse", &handle);
+    error = PrintError(simfsWriteFileAt(&instance, handle, 10 * SIMFS_DATA_SIZE, "abc", 3));
+    if (error != SIMFS_NO_ERROR)
+        exit(EXIT_FAILURE);
+    simfsGetFileInfo(&instance, "sparse", &info);
+    if (info.size != 10 * SIMFS_DATA_SIZE + 3 || info.allocatedBlocks != 1)
+        exit(EXIT_FAILURE);
+    simfsReadFile(&instance, handle, &readBack);
+    for (int i = 0; i < 10 * SIMFS_DATA_SIZE; i++)
+        if (readBack[i] != '\0')
+            exit(EXIT_FAILURE);
+    if (strcmp(readBack + 10 * SIMFS_DATA_SIZE, "abc") != 0)
+        exit(EXIT_FAILURE);
+    free(readBack);
+    simfsWriteFileAt(&instance, handle, 1, "x", 1);
+    simfsPunchHole(&instance, handle, 10 * SIMFS_DATA_SIZE, SIMFS_DATA_SIZE);
+    simfsGetFileInfo(&instance, "sparse", &info);
+    simfsGetFreeSpace(&instance, &after);
+    if (info.size != 10 * SIMFS_DATA_SIZE + 3 || info.allocatedBlocks != 1 ||
+        after.freeBlocks != before.freeBlocks - 1 - 1 - (10 + SIMFS_INDEX_SIZE - 1) / (SIMFS_INDEX_SIZE - 1))
+        exit(EXIT_FAILURE);
+    simfsSetFileSize(&instance, handle, 0);
+    simfsSetFileSize(&instance, handle, 5);
+    simfsGetFileInfo(&instance, "sparse", &info);
+    simfsGetFreeSpace(&instance, &after);
+    if (info.size != 5 || info.allocatedBlocks != 0 || after.freeBlocks != before.freeBlocks - 1)
+        exit(EXIT_FAILURE);
+    printf("Expect Error SIMFS_ALLOC_ERROR\n");
+    if (PrintError(simfsSetFileSize(&instance, handle, SIZE_MAX)) != SIMFS_ALLOC_ERROR ||
+        simfsSetFileSize(&instance, handle, SIMFS_MAX_FILE_SIZE + 1) != SIMFS_ALLOC_ERROR ||
+        simfsWriteFileAt(&instance, handle, SIZE_MAX, "x", 1) != SIMFS_ALLOC_ERROR ||
+        simfsWriteFileAt(&instance, handle, SIMFS_MAX_FILE_SIZE, "x", 1) != SIMFS_ALLOC_ERROR ||
+        simfsGetFileInfo(&instance, "sparse", &info) != SIMFS_NO_ERROR || info.size != 5)
+        exit(EXIT_FAILURE);
+    simfsReadFile(&instance, handle, &readBack);
+    if (memcmp(readBack, "\0\0\0\0\0", 6) != 0)
+        exit(EXIT_FAILURE);
+    free(readBack);
+    simfsCloseFile(&instance, handle);
+    simfsUmountFileSystem(&instance, "yo");
+
+    printf("testing access times\n");
+    simfsMountFileSystem(&instance, "yo");
+    simfsCreateFile(&instance, "atime", SIMFS_FILE_CONTENT_TYPE);
+    simfsOpenFile(&instance, "atime", &handle);
+    simfsWriteFile(&instance, handle, content);
+    simfsCloseFile(&instance, handle);
+    simfsCreateSnapshot(&instance, "atime.snap");
+    simfsUmountFileSystem(&instance, "yo");
+    sleep(1);
+    // reads never touch the descriptor shared with the snapshot
+    simfsMountFileSystemWithOptions(&instance, "yo", SIMFS_MOUNT_NOATIME);
+    simfsGetFreeSpace(&instance, &before);
+    simfsOpenFile(&instance, "atime", &handle);
+    simfsReadFile(&instance, handle, &readBack);
+    free(readBack);
+    simfsCloseFile(&instance, handle);
+    simfsGetFreeSpace(&instance, &after);
+    if (after.freeBlocks != before.freeBlocks)
+        exit(EXIT_FAILURE);
+    simfsUmountFileSystem(&instance, "yo");
+    // the access time is cached while the file is open and written back on closing
+    simfsMountFileSystemWithOptions(&instance, "yo", SIMFS_MOUNT_RELATIME);
+    simfsGetFreeSpace(&instance, &before);
+    simfsOpenFile(&instance, "atime", &handle);
+    simfsReadFile(&instance, handle, &readBack);
+    free(readBack);
+    simfsGetFreeSpace(&instance, &after);
+    simfsGetFileInfo(&instance, "atime", &info);
+    if (after.freeBlocks != before.freeBlocks || info.lastAccessTime <= info.lastModificationTime)
+        exit(EXIT_FAILURE);
+    simfsCloseFile(&instance, handle);
+    simfsGetFreeSpace(&instance, &after);
+    if (after.freeBlocks >= before.freeBlocks)
+        exit(EXIT_FAILURE);
+    simfsDeleteSnapshot(&instance, "atime.snap");
+    simfsUmountFileSystem(&instance, "yo");
+
+    printf("testing renames\n");
+    simfsMountFileSystem(&instance, "yo");
+    simfsCreateFile(&instance, "archive", SIMFS_FOLDER_CONTENT_TYPE);
+    simfsGetFreeSpace(&instance, &before);
+    simfsOpenFile(&instance, "atime", &handle);
+    error = PrintError(simfsRename(&instance, "atime", NULL, "renamed"));
+    if (error != SIMFS_NO_ERROR)
+        exit(EXIT_FAILURE);
+    simfsGetFreeSpace(&instance, &after);
+    if (after.freeBlocks != before.freeBlocks || simfsGetFileInfo(&instance, "atime", &info) != SIMFS_NOT_FOUND_ERROR ||
+        simfsGetFileInfo(&instance, "renamed", &info) != SIMFS_NO_ERROR || info.size != strlen(content))
+        exit(EXIT_FAILURE);
+    simfsReadFile(&instance, handle, &readBack);
+    if (strcmp(readBack, content) != 0)
+        exit(EXIT_FAILURE);
+    free(readBack);
+    simfsCloseFile(&instance, handle);
+    printf("Expect Error SIMFS_DUPLICATE_ERROR\n");
+    if (PrintError(simfsRename(&instance, "renamed", "", "durable")) != SIMFS_DUPLICATE_ERROR)
+        exit(EXIT_FAILURE);
+    simfsOpenFile(&instance, "renamed", &handle);
+    simfsRename(&instance, "renamed", "archive", "moved");
+    simfsGetFileInfo(&instance, "archive", &info);
+    if (info.size != 1 || simfsGetFileInfo(&instance, "renamed", &info) != SIMFS_NOT_FOUND_ERROR)
+        exit(EXIT_FAILURE);
+    // the handle still works in the other folder, also when the path to it has to be cloned
+    simfsCreateSnapshot(&instance, "moved.snap");
+    error = PrintError(simfsWriteFile(&instance, handle, "written after the move"));
+    if (error != SIMFS_NO_ERROR)
+        exit(EXIT_FAILURE);
+    simfsReadFile(&instance, handle, &readBack);
+    if (strcmp(readBack, "written after the move") != 0)
+        exit(EXIT_FAILURE);
+    free(readBack);
+    simfsCloseFile(&instance, handle);
+    simfsDeleteSnapshot(&instance, "moved.snap");
+    simfsUmountFileSystem(&instance, "yo");
+    simfsMountFileSystem(&instance, "yo");
+    if (simfsGetFileInfo(&instance, "moved", &info) != SIMFS_NOT_FOUND_ERROR ||
+        simfsGetFileInfo(&instance, "archive", &info) != SIMFS_NO_ERROR || info.size != 1)
+        exit(EXIT_FAILURE);
+
+    printf("testing independent instances\n");
+    SIMFS_INSTANCE other;
+    simfsCreateFileSystem("yo2");
+    simfsMountFileSystem(&other, "yo2");
+    simfsCreateFile(&other, "elsewhere", SIMFS_FILE_CONTENT_TYPE);
+    simfsOpenFile(&other, "elsewhere", &handle);
+    simfsWriteFile(&other, handle, content);
+    if (simfsGetFileInfo(&instance, "elsewhere", &info) != SIMFS_NOT_FOUND_ERROR ||
+        simfsGetFileInfo(&other, "archive", &info) != SIMFS_NOT_FOUND_ERROR)
+        exit(EXIT_FAILURE);
+    simfsCloseFile(&other, handle);
+    simfsUmountFileSystem(&other, "yo2");
+    simfsUmountFileSystem(&instance, "yo");
+    simfsMountFileSystem(&other, "yo2");
+    if (simfsGetFileInfo(&other, "elsewhere", &info) != SIMFS_NO_ERROR || info.size != strlen(content))
+        exit(EXIT_FAILURE);
+    simfsUmountFileSystem(&other, "yo2");
+
+    printf("testing checksums\n");
+    simfsMountFileSystemWithOptions(&instance, "yo", SIMFS_MOUNT_CHECKSUMS);
+    simfsCreateFile(&instance, "guarded", SIMFS_FILE_CONTENT_TYPE);
+    simfsOpenFile(&instance, "guarded", &handle);
+    simfsWriteFile(&instance, handle, content);
+    simfsCloseFile(&instance, handle);
+    simfsGetFileInfo(&instance, "guarded", &info);
+    simfsUmountFileSystem(&instance, "yo");
+    // flip a bit of the first data block of the file in the image
+    SIMFS_VOLUME *image = malloc(sizeof(SIMFS_VOLUME));
+    FILE *imageFile = fopen("yo", "r+b");
+    if (image == NULL || imageFile == NULL || fread(image, sizeof(SIMFS_VOLUME), 1, imageFile) != 1)
+        exit(EXIT_FAILURE);
+    image->block[image->block[info.block_ref].content.index[0]].content.data[0] ^= 1;
+    rewind(imageFile);
+    fwrite(image, sizeof(SIMFS_VOLUME), 1, imageFile);
+    fclose(imageFile);
+    free(image);
+    error = PrintError(simfsMountFileSystemWithOptions(&instance, "yo", SIMFS_MOUNT_CHECKSUMS));
+    if (error != SIMFS_NO_ERROR)
+        exit(EXIT_FAILURE);
+    simfsOpenFile(&instance, "guarded", &handle);
+    printf("Expect Error SIMFS_READ_ERROR\n");
+    if (PrintError(simfsReadFile(&instance, handle, &readBack)) != SIMFS_READ_ERROR)
+        exit(EXIT_FAILURE);
+    simfsCloseFile(&instance, handle);
+    int badBlocks = 0;
+    if (simfsVerifyVolume(&instance, &badBlocks) != SIMFS_READ_ERROR || badBlocks != 1)
+        exit(EXIT_FAILURE);
+    simfsUmountFileSystem(&instance, "yo");
+    // without checksums, the content is read as it is
+    simfsMountFileSystem(&instance, "yo");
+    simfsOpenFile(&instance, "guarded", &handle);
+    if (simfsReadFile(&instance, handle, &readBack) != SIMFS_NO_ERROR || readBack[0] != (content[0] ^ 1))
+        exit(EXIT_FAILURE);
+    free(readBack);
+    simfsCloseFile(&instance, handle);
+    simfsUmountFileSystem(&instance, "yo");
+
+    printf("testing long names\n");
+    // the two names differ only after the part held in the descriptor
+    char *longName = "a name that is long enough to need a name block, 1";
+    char *otherLongName = "a name that is long enough to need a name block, 2";
+    simfsMountFileSystem(&instance, "yo");
+    simfsGetFreeSpace(&instance, &before);
+    simfsCreateFile(&instance, longName, SIMFS_FILE_CONTENT_TYPE);
+    simfsCreateFile(&instance, otherLongName, SIMFS_FOLDER_CONTENT_TYPE);
+    simfsGetFreeSpace(&instance, &after);
+    simfsGetFileInfo(&instance, otherLongName, &info);
+    if (after.freeBlocks != before.freeBlocks - 4 || info.type != SIMFS_FOLDER_CONTENT_TYPE ||
+        info.nameLength != strlen(otherLongName) || info.nameBlock == SIMFS_INVALID_INDEX)
+        exit(EXIT_FAILURE);
+    simfsRename(&instance, longName, NULL, "short");
+    simfsGetFreeSpace(&instance, &after);
+    if (after.freeBlocks != before.freeBlocks - 3 ||
+        simfsGetFileInfo(&instance, longName, &info) != SIMFS_NOT_FOUND_ERROR ||
+        simfsGetFileInfo(&instance, "short", &info) != SIMFS_NO_ERROR || info.nameBlock != SIMFS_INVALID_INDEX)
+        exit(EXIT_FAILURE);
+    simfsDeleteFile(&instance, "short");
+    simfsDeleteFile(&instance, otherLongName);
+    simfsGetFreeSpace(&instance, &after);
+    if (after.freeBlocks != before.freeBlocks)
+        exit(EXIT_FAILURE);
+    simfsUmountFileSystem(&instance, "yo");
+
+    printf("testing image I/O\n");
+    // either backend falls back quietly if the kernel or the file system does not support it
+    simfsMountFileSystemWithOptions(&instance, "yo", SIMFS_MOUNT_IO_URING | SIMFS_MOUNT_DIRECT_IO);
+    simfsCreateFile(&instance, "direct", SIMFS_FILE_CONTENT_TYPE);
+    simfsOpenFile(&instance, "direct", &handle);
+    simfsWriteFile(&instance, handle, content);
+    simfsCloseFile(&instance, handle);
+    simfsUmountFileSystem(&instance, "yo");
+    simfsMountFileSystemWithOptions(&instance, "yo", SIMFS_MOUNT_IO_URING);
+    simfsOpenFile(&instance, "direct", &handle);
+    if (simfsReadFile(&instance, handle, &readBack) != SIMFS_NO_ERROR || strcmp(readBack, content) != 0)
+        exit(EXIT_FAILURE);
+    free(readBack);
+    simfsCloseFile(&instance, handle);
+    simfsUmountFileSystem(&instance, "yo");
+    printf("Expect Error SIMFS_ALLOC_ERROR\n");
+    if (PrintError(simfsMountFileSystem(&instance, "no such image")) != SIMFS_ALLOC_ERROR)
+        exit(EXIT_FAILURE);
+    free(content);
+
+    printf("\nSuccess!\n");
     return EXIT_SUCCESS;
 }